@@ -0,0 +1,69 @@
+#include "AlbedoSource.hh"
+#include "RockAlbedo.hh"
+#include "DetectorLayout.hh"
+#include "EventRandom.hh"
+
+#include "G4ParticleGun.hh"
+#include "G4Neutron.hh"
+#include "G4Event.hh"
+#include "G4PhysicalConstants.hh"
+#include "G4SystemOfUnits.hh"
+#include "Randomize.hh"
+
+#include <algorithm>
+#include <cmath>
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+AlbedoSource::AlbedoSource()
+ : G4VUserPrimaryGeneratorAction(),
+   fParticleGun(nullptr)
+{
+  fParticleGun = new G4ParticleGun(1);
+  fParticleGun->SetParticleDefinition(G4Neutron::Definition());
+}
+
+AlbedoSource::~AlbedoSource()
+{
+  delete fParticleGun;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void AlbedoSource::GeneratePrimaries(G4Event* event)
+{
+  EventRandom::Reseed(event);
+
+  const RockAlbedo::Source& source = RockAlbedo::GetSource();
+  const G4ThreeVector& half = DetectorLayout::Instance()->GetRoomHalf();
+
+  // Wall with probability proportional to its area
+  G4double area[3] = { half.y()*half.z(), half.z()*half.x(), half.x()*half.y() };
+  G4double pick = (area[0] + area[1] + area[2])*G4UniformRand();
+  G4int axis = (pick < area[0]) ? 0 : (pick < area[0] + area[1]) ? 1 : 2;
+  G4double sign = (G4UniformRand() < 0.5) ? -1. : 1.;
+
+  // Just inside the room, heading into the rock
+  G4ThreeVector position;
+  for (G4int i = 0; i < 3; ++i) position[i] = half[i]*(2.*G4UniformRand() - 1.);
+  position[axis] = sign*(half[axis] - 1.*um);
+  G4ThreeVector normal;
+  normal[axis] = sign;
+
+  G4double cosTheta = source.cosMin + (source.cosMax - source.cosMin)*G4UniformRand();
+  G4double sinTheta = std::sqrt(std::max(0., 1. - cosTheta*cosTheta));
+  G4double phi = twopi*G4UniformRand();
+  G4ThreeVector u = normal.orthogonal().unit();
+  G4ThreeVector v = normal.cross(u);
+  G4ThreeVector direction = cosTheta*normal
+                          + sinTheta*(std::cos(phi)*u + std::sin(phi)*v);
+
+  G4double energy = source.emin*std::pow(source.emax/source.emin, G4UniformRand());
+
+  fParticleGun->SetParticleEnergy(energy);
+  fParticleGun->SetParticleMomentumDirection(direction);
+  fParticleGun->SetParticlePosition(position);
+  fParticleGun->GeneratePrimaryVertex(event);
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
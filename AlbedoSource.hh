@@ -0,0 +1,32 @@
+#ifndef AlbedoSource_h
+#define AlbedoSource_h 1
+
+#include "G4VUserPrimaryGeneratorAction.hh"
+
+class G4ParticleGun;
+class G4Event;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+/// Primary generator of RockAlbedo::Build(): one neutron per event, from
+/// a point uniform over the walls of the room, into the rock, with an
+/// energy uniform in lethargy inside the current energy group and a
+/// cosine to the wall normal uniform inside the current cosine bin.
+/// Register it on the workers in place of the application generator for
+/// albedo runs.
+
+class AlbedoSource : public G4VUserPrimaryGeneratorAction
+{
+  public:
+    AlbedoSource();
+    virtual ~AlbedoSource();
+
+    virtual void GeneratePrimaries(G4Event* event);
+
+  private:
+    G4ParticleGun* fParticleGun;
+};
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+#endif
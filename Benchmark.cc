@@ -0,0 +1,260 @@
+#include "Benchmark.hh"
+#include "DetectorLayout.hh"
+#include "StackingAction.hh"
+#include "VolumeProfiler.hh"
+
+#include "G4RunManager.hh"
+#include "G4AutoLock.hh"
+#include "G4GenericMessenger.hh"
+#include "G4Version.hh"
+#include "Randomize.hh"
+#include "G4ios.hh"
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+namespace
+{
+  G4Mutex benchmarkMutex = G4MUTEX_INITIALIZER;
+  std::vector<G4long*>* stepCounters = nullptr;
+  G4ThreadLocal G4long* steps = nullptr;
+
+  const long kSeeds[Benchmark::kNumberOfWorkloads] = { 1001, 2002, 3003 };
+
+  // JSON string body of text
+  std::string Escape(const std::string& text)
+  {
+    std::ostringstream os;
+    for (unsigned char c : text) {
+      if (c == '"' || c == '\\') os << '\\' << c;
+      else if (c < 0x20) {
+        static const char* hex = "0123456789abcdef";
+        os << "\\u00" << hex[c >> 4] << hex[c & 0xf];
+      }
+      else os << c;
+    }
+    return os.str();
+  }
+
+  // Value following "key": in a JSON line written by Run(), strings
+  // left escaped
+  std::string Field(const std::string& line, const std::string& key)
+  {
+    std::string pattern = "\"" + key + "\":";
+    std::size_t start = line.find(pattern);
+    if (start == std::string::npos) return "";
+    start += pattern.size();
+    if (start < line.size() && line[start] == '"') {
+      std::size_t end = ++start;
+      while (end < line.size() && line[end] != '"') {
+        end += (line[end] == '\\') ? 2 : 1;
+      }
+      return line.substr(start, end - start);
+    }
+    std::size_t end = line.find_first_of(",}", start);
+    return line.substr(start, end - start);
+  }
+
+  // Sampling of VolumeProfiler, 0 when off
+  G4int ProfilerSampling()
+  {
+    return VolumeProfiler::IsEnabled() ? VolumeProfiler::GetSampling() : 0;
+  }
+
+  // Current resident memory of the process [MB], 0 if unknown
+  G4double ResidentMB()
+  {
+    std::ifstream in("/proc/self/statm");
+    long size = 0, resident = 0;
+    if (!(in >> size >> resident)) return 0.;
+    return resident*(G4double)sysconf(_SC_PAGESIZE)/(1024.*1024.);
+  }
+}
+
+Benchmark::Workload Benchmark::fWorkload = Benchmark::kThermal;
+G4bool              Benchmark::fRunning  = false;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+Benchmark* Benchmark::Instance()
+{
+  static Benchmark instance;
+  return &instance;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+Benchmark::Benchmark()
+ : fMessenger(nullptr),
+   fTag("default"),
+   fOutput("benchmark.jsonl"),
+   fWarmup(100)
+{
+  DefineCommands();
+}
+
+Benchmark::~Benchmark()
+{
+  delete fMessenger;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+const char* Benchmark::GetWorkloadName(Workload workload)
+{
+  static const char* names[kNumberOfWorkloads] = {
+    "thermal", "rock", "spallation" };
+  return names[workload];
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void Benchmark::CountStep()
+{
+  if (!steps) {
+    steps = new G4long(0);
+    G4AutoLock lock(&benchmarkMutex);
+    if (!stepCounters) stepCounters = new std::vector<G4long*>;
+    stepCounters->push_back(steps);
+  }
+  ++*steps;
+}
+
+G4long Benchmark::CollectSteps()
+{
+  // Workers are idle between runs
+  G4AutoLock lock(&benchmarkMutex);
+  G4long total = 0;
+  if (!stepCounters) return total;
+  for (auto counter : *stepCounters) {
+    total += *counter;
+    *counter = 0;
+  }
+  return total;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4double Benchmark::ReferenceRate(Workload workload) const
+{
+  std::ifstream in(fOutput);
+  std::string line;
+  G4double rate = 0.;
+  while (std::getline(in, line)) {
+    if (Field(line, "tag") == Escape(fTag) &&
+        Field(line, "profiler") == std::to_string(ProfilerSampling()) &&
+        Field(line, "workload") == GetWorkloadName(workload) &&
+        Field(line, "threads") == "1" &&
+        Field(line, "stacking") == (StackingAction::IsGrouped() ? "grouped"
+                                                                : "lifo")) {
+      rate = std::atof(Field(line, "events_per_s").c_str());
+    }
+  }
+  return rate;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void Benchmark::Run(const G4String& workloadAndEvents)
+{
+  std::istringstream is(workloadAndEvents);
+  std::string name;
+  G4int nofEvents = 0;
+  is >> name >> nofEvents;
+
+  G4int workload = 0;
+  while (workload < kNumberOfWorkloads &&
+         name != GetWorkloadName(Workload(workload))) ++workload;
+  if (workload == kNumberOfWorkloads || nofEvents <= 0) {
+    G4ExceptionDescription msg;
+    msg << "Usage: /nmds/benchmark/run thermal|rock|spallation <events>";
+    G4Exception("Benchmark::Run()", "NMDS018", JustWarning, msg);
+    return;
+  }
+  fWorkload = Workload(workload);
+
+  auto runManager = G4RunManager::GetRunManager();
+  G4Random::setTheSeed(kSeeds[workload]);
+  fRunning = true;
+  if (fWarmup > 0) runManager->BeamOn(fWarmup);
+  CollectSteps();
+  G4double beforeMB = ResidentMB();
+
+  auto start = std::chrono::steady_clock::now();
+  runManager->BeamOn(nofEvents);
+  std::chrono::duration<G4double> elapsed =
+    std::chrono::steady_clock::now() - start;
+  G4long nofSteps = CollectSteps();
+  fRunning = false;
+
+  // The peak is that of the job so far, the current memory that of this run
+  G4double afterMB = ResidentMB();
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  G4double peakMB = usage.ru_maxrss/1024.;   // kB on Linux
+
+  G4int threads = runManager->GetNumberOfThreads();
+  G4double seconds = elapsed.count();
+  G4double eventRate = (seconds > 0.) ? nofEvents/seconds : 0.;
+  G4double stepRate  = (seconds > 0.) ? nofSteps/seconds : 0.;
+  G4double reference = (threads == 1) ? eventRate : ReferenceRate(fWorkload);
+
+  std::ostringstream record;
+  record << "{\"tag\":\"" << Escape(fTag) << "\""
+         << ",\"workload\":\"" << GetWorkloadName(fWorkload) << "\""
+         << ",\"threads\":" << threads
+         << ",\"stacking\":\"" << (StackingAction::IsGrouped() ? "grouped" : "lifo")
+         << "\""
+         << ",\"profiler\":" << ProfilerSampling()
+         << ",\"events\":" << nofEvents
+         << ",\"steps\":" << nofSteps
+         << ",\"seconds\":" << seconds
+         << ",\"events_per_s\":" << eventRate
+         << ",\"steps_per_s\":" << stepRate
+         << ",\"rss_before_mb\":" << beforeMB
+         << ",\"rss_after_mb\":" << afterMB
+         << ",\"peak_rss_mb\":" << peakMB;
+  if (reference > 0.) {
+    record << ",\"efficiency\":" << eventRate/(threads*reference);
+  }
+  record << ",\"geant4\":" << G4VERSION_NUMBER
+         << ",\"geometry\":\"" << std::hex
+         << DetectorLayout::Instance()->GetFingerprint() << std::dec << "\"}";
+
+  std::ofstream out(fOutput, std::ios::app);
+  if (!out) {
+    G4ExceptionDescription msg;
+    msg << "Cannot append to " << fOutput;
+    G4Exception("Benchmark::Run()", "NMDS018", JustWarning, msg);
+  }
+  out << record.str() << '\n';
+  G4cout << "### Benchmark " << record.str() << G4endl;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void Benchmark::DefineCommands()
+{
+  fMessenger = new G4GenericMessenger(this, "/nmds/benchmark/",
+                                      "Reference workloads");
+
+  fMessenger->DeclareProperty("tag", fTag, "Name of the build in the records.");
+  fMessenger->DeclareProperty("output", fOutput,
+                              "JSON-lines file the records are appended to.");
+
+  auto& warmupCmd = fMessenger->DeclareProperty("warmup", fWarmup,
+                    "Untimed events before each benchmark.");
+  warmupCmd.SetParameterName("events", false);
+  warmupCmd.SetRange("events>=0");
+
+  fMessenger->DeclareMethod("run", &Benchmark::Run,
+                            "Workload (thermal, rock, spallation) and events.");
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
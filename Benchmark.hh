@@ -0,0 +1,74 @@
+#ifndef Benchmark_h
+#define Benchmark_h 1
+
+#include "globals.hh"
+
+class G4GenericMessenger;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+/// Fixed, seeded reference workloads on the NMDS-II geometry, timed and
+/// written as one JSON line per run, to compare builds and thread counts.
+///
+/// Workloads, generated by BenchmarkSource (to register on the workers as
+/// the primary generator for benchmark jobs):
+///   thermal     Maxwellian neutrons at 293 K uniform in the moderator
+///   rock        Watt-spectrum neutrons uniform in the rock
+///   spallation  800 MeV protons on the lead target along z
+///
+/// A run seeds the master engine with a fixed seed per workload, runs a
+/// few untimed warm-up events (physics tables, first-event costs), then
+/// times the events and counts the steps on every thread. The record
+/// holds the build tag, workload, threads, stacking mode, VolumeProfiler
+/// sampling (0 when off), events, wall time, events/s, steps/s, resident
+/// memory of the process before and after the timed events, its peak over
+/// the whole job so far (so only the first run of a job has a peak of its
+/// own) and the geometry fingerprint. When the output file already holds
+/// a one-thread record of the same tag, workload, stacking mode and
+/// profiler setting, the scaling efficiency rate(N) / (N rate(1)) is
+/// added; a scan is then one job per thread count appending to the same
+/// file (see ReadMe).
+///
+///   /nmds/benchmark/tag my-build
+///   /nmds/benchmark/output benchmark.jsonl
+///   /nmds/benchmark/warmup 100
+///   /nmds/benchmark/run thermal 100000
+
+class Benchmark
+{
+  public:
+    enum Workload { kThermal = 0, kRock, kSpallation, kNumberOfWorkloads };
+
+    static Benchmark* Instance();
+    ~Benchmark();
+
+    static Workload GetWorkload() { return fWorkload; }
+    static const char* GetWorkloadName(Workload workload);
+
+    // From ScoringSteppingAction while a benchmark runs
+    static G4bool IsRunning() { return fRunning; }
+    static void CountStep();
+
+    void Run(const G4String& workloadAndEvents);
+
+  private:
+    Benchmark();
+
+    static G4long CollectSteps();
+    G4double ReferenceRate(Workload workload) const;
+
+    void DefineCommands();
+
+    G4GenericMessenger* fMessenger;
+
+    G4String fTag;
+    G4String fOutput;
+    G4int    fWarmup;
+
+    static Workload fWorkload;
+    static G4bool   fRunning;
+};
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+#endif
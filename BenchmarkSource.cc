@@ -0,0 +1,143 @@
+#include "BenchmarkSource.hh"
+#include "Benchmark.hh"
+#include "DetectorLayout.hh"
+#include "EventRandom.hh"
+
+#include "G4ParticleGun.hh"
+#include "G4Neutron.hh"
+#include "G4Proton.hh"
+#include "G4Event.hh"
+#include "G4Navigator.hh"
+#include "G4TransportationManager.hh"
+#include "G4VPhysicalVolume.hh"
+#include "G4PhysicalConstants.hh"
+#include "G4SystemOfUnits.hh"
+#include "Randomize.hh"
+
+#include <cmath>
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+BenchmarkSource::BenchmarkSource()
+ : G4VUserPrimaryGeneratorAction(),
+   fParticleGun(nullptr),
+   fNavigator(nullptr)
+{
+  fParticleGun = new G4ParticleGun(1);
+}
+
+BenchmarkSource::~BenchmarkSource()
+{
+  delete fParticleGun;
+  delete fNavigator;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+// Uniform in the moderator: points of the box outside it are rejected
+G4ThreeVector BenchmarkSource::InModerator()
+{
+  if (!fNavigator) {
+    fNavigator = new G4Navigator();
+    fNavigator->SetWorldVolume(G4TransportationManager::GetTransportationManager()
+                                 ->GetNavigatorForTracking()->GetWorldVolume());
+  }
+
+  auto layout = DetectorLayout::Instance();
+  G4double half = layout->GetBoxHalf();
+  G4ThreeVector position;
+  for (G4int i = 0; i < 100000; ++i) {
+    position.set(half*(2.*G4UniformRand() - 1.),
+                 half*(2.*G4UniformRand() - 1.),
+                 half*(2.*G4UniformRand() - 1.));
+    position += layout->GetBoxCenter();
+    G4VPhysicalVolume* pv =
+      fNavigator->LocateGlobalPointAndSetup(position, nullptr, false, true);
+    if (pv && layout->GetRole(pv->GetLogicalVolume()) == DetectorLayout::kModerator) {
+      return position;
+    }
+  }
+  G4Exception("BenchmarkSource::InModerator()", "NMDS018", FatalException,
+              "No moderator volume found in the moderator box.");
+  return position;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4ThreeVector BenchmarkSource::Isotropic() const
+{
+  G4double cosTheta = 2.*G4UniformRand() - 1.;
+  G4double sinTheta = std::sqrt(1. - cosTheta*cosTheta);
+  G4double phi = twopi*G4UniformRand();
+  return G4ThreeVector(sinTheta*std::cos(phi), sinTheta*std::sin(phi), cosTheta);
+}
+
+// Energy of a Maxwellian flux at temperature kT
+G4double BenchmarkSource::Maxwellian(G4double kT) const
+{
+  return -kT*std::log(G4UniformRand()*G4UniformRand());
+}
+
+// Watt spectrum exp(-E/a) sinh(sqrt(bE)), rejection of MCNP
+G4double BenchmarkSource::Watt(G4double a, G4double b) const
+{
+  G4double k = 1. + a*b/8.;
+  G4double l = a*(k + std::sqrt(k*k - 1.));
+  G4double m = l/a - 1.;
+  while (true) {
+    G4double x = -std::log(G4UniformRand());
+    G4double y = -std::log(G4UniformRand());
+    if ((y - m*(x + 1.))*(y - m*(x + 1.)) <= b*l*x) return l*x;
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void BenchmarkSource::GeneratePrimaries(G4Event* event)
+{
+  EventRandom::Reseed(event);
+
+  auto layout = DetectorLayout::Instance();
+  const G4ThreeVector& center = layout->GetBoxCenter();
+
+  switch (Benchmark::GetWorkload()) {
+    case Benchmark::kThermal: {
+      fParticleGun->SetParticleDefinition(G4Neutron::Definition());
+      fParticleGun->SetParticleEnergy(Maxwellian(k_Boltzmann*293.*kelvin));
+      fParticleGun->SetParticleMomentumDirection(Isotropic());
+      fParticleGun->SetParticlePosition(InModerator());
+      break;
+    }
+    case Benchmark::kRock: {
+      // Uniform in the rock block outside the room
+      const G4ThreeVector& rock = layout->GetRockHalf();
+      const G4ThreeVector& room = layout->GetRoomHalf();
+      G4ThreeVector position;
+      do {
+        position.set(rock.x()*(2.*G4UniformRand() - 1.),
+                     rock.y()*(2.*G4UniformRand() - 1.),
+                     rock.z()*(2.*G4UniformRand() - 1.));
+      } while (std::fabs(position.x()) < room.x() &&
+               std::fabs(position.y()) < room.y() &&
+               std::fabs(position.z()) < room.z());
+      fParticleGun->SetParticleDefinition(G4Neutron::Definition());
+      fParticleGun->SetParticleEnergy(Watt(0.988*MeV, 2.249/MeV));
+      fParticleGun->SetParticleMomentumDirection(Isotropic());
+      fParticleGun->SetParticlePosition(position);
+      break;
+    }
+    default: {
+      // Pencil beam from the upstream wall of the room
+      G4ThreeVector position(center.x(), center.y(),
+                             -layout->GetRoomHalf().z() + 1.*cm);
+      fParticleGun->SetParticleDefinition(G4Proton::Definition());
+      fParticleGun->SetParticleEnergy(800.*MeV);
+      fParticleGun->SetParticleMomentumDirection(G4ThreeVector(0., 0., 1.));
+      fParticleGun->SetParticlePosition(position);
+      break;
+    }
+  }
+  fParticleGun->GeneratePrimaryVertex(event);
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
@@ -0,0 +1,41 @@
+#ifndef BenchmarkSource_h
+#define BenchmarkSource_h 1
+
+#include "G4VUserPrimaryGeneratorAction.hh"
+#include "G4ThreeVector.hh"
+#include "globals.hh"
+
+class G4ParticleGun;
+class G4Navigator;
+class G4Event;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+/// Primary generator of the Benchmark workloads, one particle per event:
+/// thermal neutrons (Maxwellian at 293 K, isotropic, uniform in the
+/// volumes with the moderator role, found by rejection in the box), rock neutrons (Watt fission spectrum, isotropic,
+/// uniform in the rock) or 800 MeV protons along z onto the lead target.
+/// Register it on the workers in place of the application generator for
+/// benchmark jobs.
+
+class BenchmarkSource : public G4VUserPrimaryGeneratorAction
+{
+  public:
+    BenchmarkSource();
+    virtual ~BenchmarkSource();
+
+    virtual void GeneratePrimaries(G4Event* event);
+
+  private:
+    G4ThreeVector InModerator();
+    G4ThreeVector Isotropic() const;
+    G4double Maxwellian(G4double kT) const;
+    G4double Watt(G4double a, G4double b) const;
+
+    G4ParticleGun* fParticleGun;
+    G4Navigator*   fNavigator;      // own one, not the tracking navigator
+};
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+#endif
@@ -0,0 +1,364 @@
+#include "CounterElectronics.hh"
+#include "ParallelRun.hh"
+
+#include "G4AutoLock.hh"
+#include "G4GenericMessenger.hh"
+#include "G4SystemOfUnits.hh"
+#include "Randomize.hh"
+#include "G4ios.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+
+namespace
+{
+  G4Mutex electronicsMutex = G4MUTEX_INITIALIZER;
+  std::vector<CounterElectronics*>* workers = nullptr;
+
+  // He-3(n,p)T: Q value, proton and triton energies, proton share of
+  // the wall losses (ratio of the ranges)
+  const G4double kQ           = 764.*keV;
+  const G4double kProton      = 573.*keV;
+  const G4double kTriton      = 191.*keV;
+  const G4double kProtonShare = 0.75;
+
+  const G4double kHeightWidth = 10.*keV;
+
+  void WriteVector(std::ostream& os, const char* key,
+                   const std::vector<G4double>& v)
+  {
+    os << key << ' ' << v.size() << '\n' << std::hexfloat;
+    for (std::size_t i = 0; i < v.size(); ++i) {
+      os << v[i] << ((i % 8 == 7) ? '\n' : ' ');
+    }
+    os << std::defaultfloat << '\n';
+  }
+
+  G4bool ReadVector(std::istream& is, const char* key,
+                    std::vector<G4double>& v)
+  {
+    std::string name, value;
+    std::size_t size = 0;
+    is >> name >> size;
+    if (!is || name != key || size != v.size()) return false;
+    for (std::size_t i = 0; i < size; ++i) {
+      is >> value;
+      v[i] = std::strtod(value.c_str(), nullptr);
+    }
+    return (bool)is;
+  }
+}
+
+G4bool   CounterElectronics::fEnabled         = false;
+G4double CounterElectronics::fThreshold       = 150.*keV;
+G4double CounterElectronics::fWallProbability = 0.15;
+G4double CounterElectronics::fResolution      = 0.05;
+G4double CounterElectronics::fDeadTime        = 2.*microsecond;
+G4double CounterElectronics::fPredelay        = 4.5*microsecond;
+G4double CounterElectronics::fGate            = 64.*microsecond;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+CounterElectronics* CounterElectronics::Instance()
+{
+  static G4ThreadLocal CounterElectronics* instance = nullptr;
+  if (!instance) {
+    instance = new CounterElectronics(false);
+    G4AutoLock lock(&electronicsMutex);
+    if (!workers) workers = new std::vector<CounterElectronics*>;
+    workers->push_back(instance);
+  }
+  return instance;
+}
+
+CounterElectronics* CounterElectronics::Master()
+{
+  static CounterElectronics master(true);
+  return &master;
+}
+
+void CounterElectronics::CollectWorkers()
+{
+  G4AutoLock lock(&electronicsMutex);
+  if (!workers) return;
+  CounterElectronics* master = Master();
+  for (auto worker : *workers) {
+    master->Merge(*worker);
+    worker->Reset();
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+CounterElectronics::CounterElectronics(G4bool master)
+ : fLastPulse(kNofCounters, 0.),
+   fEvent(kNumberOfBins, 0.),
+   fSum(kNumberOfBins, 0.),
+   fSum2(kNumberOfBins, 0.),
+   fHeight(kHeightBins, 0.),
+   fEventMultiplicity(kMaxMultiplicity + 1, 0.),
+   fGateMultiplicity(kMaxMultiplicity + 1, 0.),
+   fLost(3, 0.),
+   fNofEvents(0),
+   fMessenger(nullptr)
+{
+  if (master) DefineCommands();
+}
+
+CounterElectronics::~CounterElectronics()
+{
+  delete fMessenger;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void CounterElectronics::Fill(G4int counter, G4double time, G4double weight)
+{
+  fCaptures.push_back({ time, counter, weight });
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4double CounterElectronics::PulseHeight() const
+{
+  G4double energy = kQ;
+  if (G4UniformRand() < fWallProbability) {
+    G4double low = (G4UniformRand() < kProtonShare) ? kTriton : kProton;
+    energy = low + (kQ - low)*G4UniformRand();
+  }
+  if (fResolution > 0.) {
+    energy = G4RandGauss::shoot(energy, fResolution*energy/2.355);
+  }
+  return energy;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void CounterElectronics::EndOfEvent()
+{
+  ++fNofEvents;
+  G4int n = (G4int)fCaptures.size();
+  if (n == 0) {
+    fEventMultiplicity[0] += 1.;
+    return;
+  }
+
+  std::sort(fCaptures.begin(), fCaptures.end());
+  std::fill(fLastPulse.begin(), fLastPulse.end(), -DBL_MAX);
+  fAccepted.clear();
+  fAcceptedWeight.clear();
+
+  for (const auto& capture : fCaptures) {
+    fLost[0] += capture.weight;
+    G4double height = PulseHeight();
+    G4int bin = (G4int)(height/kHeightWidth);
+    if (bin >= 0 && bin < kHeightBins) fHeight[bin] += capture.weight;
+
+    if (height < fThreshold) {
+      fLost[1] += capture.weight;
+      continue;
+    }
+    // Non-paralyzable: a lost pulse does not extend the dead time
+    G4double& last = fLastPulse[capture.counter];
+    if (capture.time < last + fDeadTime) {
+      fLost[2] += capture.weight;
+      continue;
+    }
+    last = capture.time;
+    fEvent[capture.counter] += capture.weight;
+    fEvent[kTotalBin] += capture.weight;
+    fAccepted.push_back(capture.time);
+    fAcceptedWeight.push_back(capture.weight);
+  }
+
+  // Shift register on the accepted pulses, as in DieAwayHistogram
+  G4int accepted = (G4int)fAccepted.size();
+  fEventMultiplicity[std::min(accepted, kMaxMultiplicity)] += 1.;
+  G4int open = 0, close = 0;
+  for (G4int i = 0; i < accepted; ++i) {
+    G4double gateOpen  = fAccepted[i] + fPredelay;
+    G4double gateClose = gateOpen + fGate;
+    while (open  < accepted && fAccepted[open]  <= gateOpen)  ++open;
+    while (close < accepted && fAccepted[close] <= gateClose) ++close;
+    G4int inGate = std::max(close - open, 0);
+    fGateMultiplicity[std::min(inGate, kMaxMultiplicity)] += 1.;
+    fEvent[kDoublesBin] += inGate*fAcceptedWeight[i];
+  }
+
+  for (G4int i = 0; i < kNumberOfBins; ++i) {
+    fSum[i]  += fEvent[i];
+    fSum2[i] += fEvent[i]*fEvent[i];
+    fEvent[i] = 0.;
+  }
+  fCaptures.clear();
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void CounterElectronics::Reset()
+{
+  std::fill(fEvent.begin(), fEvent.end(), 0.);
+  std::fill(fSum.begin(), fSum.end(), 0.);
+  std::fill(fSum2.begin(), fSum2.end(), 0.);
+  std::fill(fHeight.begin(), fHeight.end(), 0.);
+  std::fill(fEventMultiplicity.begin(), fEventMultiplicity.end(), 0.);
+  std::fill(fGateMultiplicity.begin(), fGateMultiplicity.end(), 0.);
+  std::fill(fLost.begin(), fLost.end(), 0.);
+  fCaptures.clear();
+  fNofEvents = 0;
+}
+
+void CounterElectronics::Merge(const CounterElectronics& other)
+{
+  for (G4int i = 0; i < kNumberOfBins; ++i) {
+    fSum[i]  += other.fSum[i];
+    fSum2[i] += other.fSum2[i];
+  }
+  for (G4int i = 0; i < kHeightBins; ++i) fHeight[i] += other.fHeight[i];
+  for (G4int i = 0; i <= kMaxMultiplicity; ++i) {
+    fEventMultiplicity[i] += other.fEventMultiplicity[i];
+    fGateMultiplicity[i]  += other.fGateMultiplicity[i];
+  }
+  for (std::size_t i = 0; i < fLost.size(); ++i) fLost[i] += other.fLost[i];
+  fNofEvents += other.fNofEvents;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void CounterElectronics::Write(std::ostream& os) const
+{
+  os << "electronics " << fNofEvents << '\n';
+  WriteVector(os, "sum", fSum);
+  WriteVector(os, "sum2", fSum2);
+  WriteVector(os, "height", fHeight);
+  WriteVector(os, "eventMultiplicity", fEventMultiplicity);
+  WriteVector(os, "gateMultiplicity", fGateMultiplicity);
+  WriteVector(os, "lost", fLost);
+}
+
+G4bool CounterElectronics::Read(std::istream& is)
+{
+  std::string key;
+  G4long nevents = 0;
+  is >> key >> nevents;
+  if (!is || key != "electronics") return false;
+  fNofEvents = nevents;
+  return ReadVector(is, "sum", fSum) && ReadVector(is, "sum2", fSum2) &&
+         ReadVector(is, "height", fHeight) &&
+         ReadVector(is, "eventMultiplicity", fEventMultiplicity) &&
+         ReadVector(is, "gateMultiplicity", fGateMultiplicity) &&
+         ReadVector(is, "lost", fLost);
+}
+
+void CounterElectronics::Pack(std::vector<G4double>& buffer) const
+{
+  buffer.push_back(fNofEvents);
+  ParallelRun::PackVector(buffer, fSum);
+  ParallelRun::PackVector(buffer, fSum2);
+  ParallelRun::PackVector(buffer, fHeight);
+  ParallelRun::PackVector(buffer, fEventMultiplicity);
+  ParallelRun::PackVector(buffer, fGateMultiplicity);
+  ParallelRun::PackVector(buffer, fLost);
+}
+
+G4bool CounterElectronics::Unpack(const std::vector<G4double>& buffer,
+                                  std::size_t& offset)
+{
+  if (offset >= buffer.size()) return false;
+  fNofEvents = (G4long)buffer[offset++];
+  return ParallelRun::UnpackVector(buffer, offset, fSum) &&
+         ParallelRun::UnpackVector(buffer, offset, fSum2) &&
+         ParallelRun::UnpackVector(buffer, offset, fHeight) &&
+         ParallelRun::UnpackVector(buffer, offset, fEventMultiplicity) &&
+         ParallelRun::UnpackVector(buffer, offset, fGateMultiplicity) &&
+         ParallelRun::UnpackVector(buffer, offset, fLost);
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void CounterElectronics::Print() const
+{
+  G4double n = std::max<G4double>(fNofEvents, 1.);
+  auto error = [&](G4int bin) {
+    if (fSum[bin] <= 0. || fNofEvents < 2) return 0.;
+    G4double mean = fSum[bin]/n;
+    G4double var = (fSum2[bin]/n - mean*mean)/(n - 1.);
+    return var > 0. ? std::sqrt(var)/mean : 0.;
+  };
+
+  G4cout << G4endl
+         << "-------------------- Digitized counts per history -----------------"
+         << G4endl
+         << " events: " << fNofEvents << ", captures " << fLost[0]/n
+         << ", lost to threshold " << fLost[1]/n
+         << ", to dead time " << fLost[2]/n << G4endl;
+  for (G4int i = 0; i < kNumberOfBins; ++i) {
+    if (fSum[i] == 0.) continue;
+    G4String name = (i == kTotalBin) ? G4String("counts")
+                  : (i == kDoublesBin) ? G4String("doubles")
+                  : "counter " + std::to_string(i);
+    G4cout << "  " << std::setw(14) << name
+           << "  " << std::setw(12) << fSum[i]/n
+           << "  +- " << std::setw(6) << std::setprecision(3)
+           << 100.*error(i) << " %" << std::setprecision(6) << G4endl;
+  }
+  G4cout << "  counts/event";
+  for (G4int i = 0; i <= kMaxMultiplicity; ++i) {
+    if (fEventMultiplicity[i] > 0.) {
+      G4cout << ' ' << i << ':' << fEventMultiplicity[i];
+    }
+  }
+  G4cout << G4endl << "  counts/gate ";
+  for (G4int i = 0; i <= kMaxMultiplicity; ++i) {
+    if (fGateMultiplicity[i] > 0.) {
+      G4cout << ' ' << i << ':' << fGateMultiplicity[i];
+    }
+  }
+  G4cout << G4endl
+         << "------------------------------------------------------------------"
+         << G4endl;
+}
+
+void CounterElectronics::CollectAndPrint()
+{
+  CollectWorkers();
+  Print();
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void CounterElectronics::DefineCommands()
+{
+  fMessenger = new G4GenericMessenger(this, "/nmds/electronics/",
+                                      "Counter read-out chain");
+
+  fMessenger->DeclareProperty("enable", fEnabled,
+                              "Digitize the counter captures.");
+  fMessenger->DeclarePropertyWithUnit("threshold", "keV", fThreshold,
+                                      "Pulse-height threshold.");
+
+  auto& wallCmd = fMessenger->DeclareProperty("wallProbability",
+                  fWallProbability,
+                  "Probability that a reaction product hits the wall.");
+  wallCmd.SetParameterName("probability", false);
+  wallCmd.SetRange("probability>=0. && probability<=1.");
+
+  auto& resolutionCmd = fMessenger->DeclareProperty("resolution", fResolution,
+                        "Relative FWHM of the pulse height.");
+  resolutionCmd.SetParameterName("resolution", false);
+  resolutionCmd.SetRange("resolution>=0.");
+
+  fMessenger->DeclarePropertyWithUnit("deadTime", "us", fDeadTime,
+                                      "Non-paralyzable dead time per counter.");
+  fMessenger->DeclarePropertyWithUnit("predelay", "us", fPredelay,
+                                      "Predelay of the coincidence gate.");
+  fMessenger->DeclarePropertyWithUnit("gate", "us", fGate,
+                                      "Width of the coincidence gate.");
+
+  fMessenger->DeclareMethod("print", &CounterElectronics::CollectAndPrint,
+                            "Merge the thread counts and print them.");
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
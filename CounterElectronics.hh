@@ -0,0 +1,116 @@
+#ifndef CounterElectronics_h
+#define CounterElectronics_h 1
+
+#include "globals.hh"
+#include "DetectorLayout.hh"
+
+#include <iosfwd>
+#include <vector>
+
+class G4GenericMessenger;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+/// Read-out chain of the He-3 counters applied to the captures of each
+/// event, so that only digitized counts leave the thread.
+///
+/// Every capture becomes a pulse: the full 764 keV, or with the wall
+/// probability a pulse flat between 191 and 764 keV (proton partly in the
+/// wall) or between 573 and 764 keV (triton partly in the wall), in the
+/// ratio of their ranges, smeared with a Gaussian resolution. Pulses under
+/// the threshold are dropped; the others, sorted in time, go through a
+/// non-paralyzable dead time per counter. The accepted pulses of all
+/// counters feed a shift register with the predelay and gate of the
+/// coincidence window.
+///
+/// Per history, with errors: counts per counter, total counts and doubles
+/// (pulses in the gate of each trigger, with the trigger weight). Also the
+/// pulse-height spectrum, the pulses lost to threshold and dead time, and
+/// the multiplicities of counts per event and per gate. Threads are merged
+/// like RunTally and the sums are kept in production checkpoints.
+///
+///   /nmds/electronics/enable true
+///   /nmds/electronics/threshold 150 keV
+///   /nmds/electronics/wallProbability 0.15
+///   /nmds/electronics/resolution 0.05
+///   /nmds/electronics/deadTime 2 us
+///   /nmds/electronics/predelay 4.5 us
+///   /nmds/electronics/gate 64 us
+///   /nmds/electronics/print
+
+class CounterElectronics
+{
+  public:
+    static const G4int kNofCounters     = DetectorLayout::kNumberOfCounters;
+    static const G4int kTotalBin        = kNofCounters;
+    static const G4int kDoublesBin      = kNofCounters + 1;
+    static const G4int kNumberOfBins    = kNofCounters + 2;
+    static const G4int kHeightBins      = 100;   // 10 keV up to 1 MeV
+    static const G4int kMaxMultiplicity = 64;
+
+    static CounterElectronics* Instance();
+    static CounterElectronics* Master();
+    static void CollectWorkers();
+
+    static G4bool IsEnabled() { return fEnabled; }
+
+    // Capture in a counter, from the sensitive detector
+    void Fill(G4int counter, G4double time, G4double weight);
+    void EndOfEvent();
+
+    void Reset();
+    void Merge(const CounterElectronics& other);
+
+    void Write(std::ostream& os) const;
+    G4bool Read(std::istream& is);
+
+    // Sums as a flat buffer, for the reduction over processes (ParallelRun)
+    void Pack(std::vector<G4double>& buffer) const;
+    G4bool Unpack(const std::vector<G4double>& buffer, std::size_t& offset);
+
+    void Print() const;
+
+  private:
+    CounterElectronics(G4bool master);
+    ~CounterElectronics();
+
+    struct Capture {
+      G4double time;
+      G4int    counter;
+      G4double weight;
+      G4bool operator<(const Capture& other) const { return time < other.time; }
+    };
+
+    G4double PulseHeight() const;
+
+    void DefineCommands();
+    void CollectAndPrint();
+
+    std::vector<Capture>  fCaptures;      // current event
+    std::vector<G4double> fAccepted;      // times of accepted pulses
+    std::vector<G4double> fAcceptedWeight;
+    std::vector<G4double> fLastPulse;     // per counter, current event
+
+    std::vector<G4double> fEvent;
+    std::vector<G4double> fSum;
+    std::vector<G4double> fSum2;
+    std::vector<G4double> fHeight;
+    std::vector<G4double> fEventMultiplicity;
+    std::vector<G4double> fGateMultiplicity;
+    std::vector<G4double> fLost;          // captures, threshold, dead time
+    G4long                fNofEvents;
+
+    G4GenericMessenger* fMessenger;
+
+    static G4bool   fEnabled;
+    static G4double fThreshold;
+    static G4double fWallProbability;
+    static G4double fResolution;
+    static G4double fDeadTime;
+    static G4double fPredelay;
+    static G4double fGate;
+};
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+#endif
@@ -0,0 +1,179 @@
+#include "CounterGas.hh"
+#include "DetectorLayout.hh"
+
+#include "G4LogicalVolume.hh"
+#include "G4VPhysicalVolume.hh"
+#include "G4Material.hh"
+#include "G4GenericMessenger.hh"
+#include "G4ios.hh"
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+CounterGas* CounterGas::Instance()
+{
+  static CounterGas instance;
+  return &instance;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+CounterGas::CounterGas()
+ : fMessenger(nullptr),
+   fScales(DetectorLayout::kNumberOfCounters, 1.)
+{
+  DefineCommands();
+}
+
+CounterGas::~CounterGas()
+{
+  delete fMessenger;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+std::vector<G4LogicalVolume*>
+CounterGas::Apply(G4VPhysicalVolume* const* counters, G4LogicalVolume* nominal)
+{
+  // Volumes of a previous construction are gone with the geometry stores
+  fVolumes.clear();
+
+  for (G4int i = 0; i < DetectorLayout::kNumberOfCounters; ++i) {
+    if (fScales[i] != 1.) {
+      counters[i]->SetLogicalVolume(GetVolume(fScales[i], nominal));
+    }
+  }
+
+  std::vector<G4LogicalVolume*> volumes;
+  for (auto& entry : fVolumes) volumes.push_back(entry.second);
+  return volumes;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4LogicalVolume* CounterGas::GetVolume(G4double scale, G4LogicalVolume* nominal)
+{
+  auto found = fVolumes.find(scale);
+  if (found != fVolumes.end()) return found->second;
+
+  char suffix[32];
+  std::snprintf(suffix, sizeof(suffix), "_x%.4f", scale);
+
+  // Materials outlive the geometry: reuse one of an earlier construction
+  const G4Material* base = nominal->GetMaterial();
+  G4String name = base->GetName() + suffix;
+  G4Material* material = G4Material::GetMaterial(name, false);
+  if (!material) {
+    material = new G4Material(name, scale*base->GetDensity(), base,
+                              base->GetState(), base->GetTemperature(),
+                              scale*base->GetPressure());
+  }
+
+  auto lv = new G4LogicalVolume(nominal->GetSolid(), material,
+                                nominal->GetName() + suffix);
+  fVolumes[scale] = lv;
+  return lv;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void CounterGas::SetScale(const G4String& counterAndScale)
+{
+  std::istringstream is(counterAndScale);
+  G4int counter = -1;
+  G4double scale = 0.;
+  is >> counter >> scale;
+
+  // Materials and volumes are named after the scale to 4 decimals: keep
+  // no more, so that one name is always one density
+  G4double rounded = std::round(scale*1.e4)/1.e4;
+  if (!is || counter < 0 || counter >= DetectorLayout::kNumberOfCounters ||
+      rounded <= 0.) {
+    G4ExceptionDescription msg;
+    msg << "Expected a counter 0.." << DetectorLayout::kNumberOfCounters - 1
+        << " and a scale of at least 0.0001, got \"" << counterAndScale
+        << "\"";
+    G4Exception("CounterGas::SetScale()", "NMDS019", JustWarning, msg);
+    return;
+  }
+  if (DetectorLayout::Instance()->IsClosed()) {
+    G4Exception("CounterGas::SetScale()", "NMDS019", JustWarning,
+                "The geometry is built: the fill changes at the next "
+                "construction (/run/reinitializeGeometry).");
+  }
+  if (rounded != scale) {
+    G4ExceptionDescription msg;
+    msg << "Scale " << scale << " of counter " << counter
+        << " rounded to " << rounded << " (4 decimals)";
+    G4Exception("CounterGas::SetScale()", "NMDS019", JustWarning, msg);
+  }
+  fScales[counter] = rounded;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void CounterGas::ReadFile(const G4String& fileName)
+{
+  std::ifstream in(fileName);
+  if (!in) {
+    G4ExceptionDescription msg;
+    msg << "Cannot open counter fill file " << fileName;
+    G4Exception("CounterGas::ReadFile()", "NMDS019", JustWarning, msg);
+    return;
+  }
+  std::string line;
+  while (std::getline(in, line)) {
+    std::size_t hash = line.find('#');
+    if (hash != std::string::npos) line.erase(hash);
+    if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+    SetScale(line);
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void CounterGas::Reset()
+{
+  fScales.assign(DetectorLayout::kNumberOfCounters, 1.);
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void CounterGas::Print() const
+{
+  G4cout << "### Counter fill relative to nominal:" << G4endl;
+  G4int nominal = 0;
+  for (G4int i = 0; i < DetectorLayout::kNumberOfCounters; ++i) {
+    if (fScales[i] == 1.) {
+      ++nominal;
+      continue;
+    }
+    G4cout << "  counter " << i << "  x" << fScales[i] << G4endl;
+  }
+  G4cout << "  " << nominal << " counters at the nominal fill, "
+         << fVolumes.size() << " derived gas volumes" << G4endl;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void CounterGas::DefineCommands()
+{
+  fMessenger = new G4GenericMessenger(this, "/nmds/counterGas/",
+                                      "Fill of the He-3 counters");
+
+  fMessenger->DeclareMethod("scale", &CounterGas::SetScale,
+                            "Counter and its gas density relative to nominal.");
+  fMessenger->DeclareMethod("file", &CounterGas::ReadFile,
+                            "Read \"counter scale\" lines from a file.")
+    .SetParameterName("file", false);
+  fMessenger->DeclareMethod("reset", &CounterGas::Reset,
+                            "All counters at the nominal fill.");
+  fMessenger->DeclareMethod("print", &CounterGas::Print,
+                            "Print the counters off the nominal fill.");
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
@@ -0,0 +1,69 @@
+#ifndef CounterGas_h
+#define CounterGas_h 1
+
+#include "globals.hh"
+
+#include <map>
+#include <vector>
+
+class G4LogicalVolume;
+class G4VPhysicalVolume;
+class G4GenericMessenger;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+/// Fill of each He-3 counter relative to the nominal MixGas (4 atm).
+///
+/// A counter with a scale other than 1 is given a logical volume on the
+/// same solid, filled with a derived material of MixGas at the scaled
+/// density and pressure. Derived materials name MixGas as their base
+/// material: the energy-loss and range tables are built once for MixGas
+/// and scaled by density, and the neutron cross sections are per element,
+/// so 60 different fills cost 60 material-cuts couples, not 60 table sets.
+/// Counters with the same scale share their material and volume. Scales
+/// are rounded to 4 decimals, the precision of the material names
+/// (MixGas_x0.9700), so that equal names always mean equal densities.
+///
+/// Scales are set before /run/initialize, per counter or from a file of
+/// "counter scale" lines (# starts a comment):
+///
+///   /nmds/counterGas/scale 12 0.97
+///   /nmds/counterGas/file fills.txt
+///   /nmds/counterGas/reset
+///   /nmds/counterGas/print
+
+class CounterGas
+{
+  public:
+    static CounterGas* Instance();
+    ~CounterGas();
+
+    G4double GetScale(G4int counter) const { return fScales[counter]; }
+
+    // Called by DetectorConstruction after the counters are placed; moves
+    // the counters off the nominal fill to their derived volumes and
+    // returns these volumes
+    std::vector<G4LogicalVolume*> Apply(G4VPhysicalVolume* const* counters,
+                                        G4LogicalVolume* nominal);
+
+    void SetScale(const G4String& counterAndScale);
+    void ReadFile(const G4String& fileName);
+    void Reset();
+    void Print() const;
+
+  private:
+    CounterGas();
+
+    G4LogicalVolume* GetVolume(G4double scale, G4LogicalVolume* nominal);
+
+    void DefineCommands();
+
+    G4GenericMessenger* fMessenger;
+
+    std::vector<G4double>                 fScales;
+    std::map<G4double, G4LogicalVolume*>  fVolumes;
+};
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+#endif
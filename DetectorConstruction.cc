@@ -1,5 +1,31 @@
 #include "../include/DetectorConstruction.hh"
 #include "../../../common/include/CalorimeterSD.hh"
+#include "DetectorLayout.hh"
+#include "TallySD.hh"
+#include "ProductionRun.hh"
+#include "DieAwayHistogram.hh"
+#include "VolumeProfiler.hh"
+#include "DetectorSymmetry.hh"
+#include "FluenceMesh.hh"
+#include "NavigationStats.hh"
+#include "FieldMap.hh"
+#include "StartupProfiler.hh"
+#include "NeutronXSCache.hh"
+#include "ResponseMatrix.hh"
+#include "EventRandom.hh"
+#include "PrimaryFilter.hh"
+#include "RockSource.hh"
+#include "ImportanceMap.hh"
+#include "CounterElectronics.hh"
+#include "RunTermination.hh"
+#include "Benchmark.hh"
+#include "CounterGas.hh"
+#include "RockAlbedo.hh"
+#include "StackingAction.hh"
+#include "ThermalDiffusion.hh"
+#include "EventFileSource.hh"
+#include "PerturbationTally.hh"
+#include "GeometryMemory.hh"
 #include "G4Material.hh"
 #include "G4NistManager.hh"
 
@@ -14,12 +40,16 @@
 #include "G4EllipticalTube.hh"
 
 #include "G4LogicalVolume.hh"
+#include "G4LogicalVolumeStore.hh"
 #include "G4PVPlacement.hh"
 #include "G4PVReplica.hh"
 #include "G4GlobalMagFieldMessenger.hh"
+#include "G4TransportationManager.hh"
+#include "G4FieldManager.hh"
 #include "G4AutoDelete.hh"
 
 #include "G4SDManager.hh"
+#include "G4RunManager.hh"
 
 #include "G4VisAttributes.hh"
 #include "G4Colour.hh"
@@ -39,6 +69,31 @@ G4GlobalMagFieldMessenger* DetectorConstruction::fMagFieldMessenger = 0;
 DetectorConstruction::DetectorConstruction()
  : G4VUserDetectorConstruction()
 {
+  // Production run and scoring commands
+  ProductionRun::Instance();
+  DieAwayHistogram::Master();
+  VolumeProfiler::Master();
+  DetectorSymmetry::Instance();
+  FluenceMesh::Master();
+  NavigationStats::Master();
+  FieldMap::DefineCommands();
+  StartupProfiler::Instance();
+  NeutronXSCache::Instance();
+  ResponseMatrix::Instance();
+  EventRandom::Instance();
+  PrimaryFilter::Master();
+  RockSource::Master();
+  ImportanceMap::Master();
+  CounterElectronics::Master();
+  RunTermination::Instance();
+  Benchmark::Instance();
+  CounterGas::Instance();
+  RockAlbedo::Master();
+  StackingAction::DefineCommands();
+  ThermalDiffusion::Master();
+  EventFileSource::Master();
+  PerturbationTally::Master();
+  GeometryMemory::Instance();
 }
 
 //....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
@@ -53,6 +108,7 @@ G4VPhysicalVolume* DetectorConstruction::Construct()
 {
 
   // Define materials 
+  StartupProfiler::Instance()->Start("materials");
   DefineMaterials();
   
   // Define volumes
@@ -106,8 +162,7 @@ void DetectorConstruction::DefineMaterials()
 
   /////////////////////////////////////////////////////////////////////////
 
-  // Print materials
-  G4cout << *(G4Material::GetMaterialTable()) << G4endl;
+  // The material table is printed on request (/nmds/startup/printMaterials)
 }
 
 //....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
@@ -126,8 +181,11 @@ G4VPhysicalVolume* DetectorConstruction::DefineVolumes()
   //     
   // World
   //
+  auto profiler = StartupProfiler::Instance();
+  profiler->Start("volumes: world and rock");
+  GeometryMemory::Instance()->Reset();
 
-  G4Box* worldS = new G4Box("World", worldSizeX/2, worldSizeY/2, worldSizeZ/2);
+  G4Box* worldS = GeometryMemory::Solid(new G4Box("World", worldSizeX/2, worldSizeY/2, worldSizeZ/2));
   G4LogicalVolume* worldLV = new G4LogicalVolume(worldS, WorldMaterial, "World");
  
   G4PVPlacement* worldPV
@@ -147,9 +205,9 @@ G4VPhysicalVolume* DetectorConstruction::DefineVolumes()
   // Rock
   //
 
-  G4Box* RockBlock = new G4Box("RockBlock", rockSizeX/2, rockSizeY/2, rockSizeZ/2);
-  G4Box* Room = new G4Box("Room", roomSizeX/2, roomSizeY/2, roomSizeZ/2);
-  G4SubtractionSolid* Rock = new G4SubtractionSolid("Rock", RockBlock, Room, 0, G4ThreeVector(0,0,0));
+  G4Box* RockBlock = GeometryMemory::Solid(new G4Box("RockBlock", rockSizeX/2, rockSizeY/2, rockSizeZ/2));
+  G4Box* Room = GeometryMemory::Solid(new G4Box("Room", roomSizeX/2, roomSizeY/2, roomSizeZ/2));
+  G4SubtractionSolid* Rock = GeometryMemory::Solid(new G4SubtractionSolid("Rock", RockBlock, Room, 0, G4ThreeVector(0,0,0)));
 
 
   G4LogicalVolume* rockLV = new G4LogicalVolume(Rock, RockMaterial, "RockLV");
@@ -167,9 +225,11 @@ G4VPhysicalVolume* DetectorConstruction::DefineVolumes()
 
 ////////////////////////////////////////////////////////////////////////
 
+ profiler->Start("volumes: counter and moderator solids");
+
  G4double He_R=1.55*cm/2;
  G4double He_L=30*cm;
- G4EllipticalTube* HeS = new G4EllipticalTube("HeS", He_R, He_R, He_L/2);
+ G4EllipticalTube* HeS = GeometryMemory::Solid(new G4EllipticalTube("HeS", He_R, He_R, He_L/2));
 
  G4LogicalVolume* HeCounter_LV = new G4LogicalVolume(HeS, MixMaterial, "HeCounter_LV");
 
@@ -179,35 +239,35 @@ G4VPhysicalVolume* DetectorConstruction::DefineVolumes()
   G4double PolyA = 60*cm;
   G4double PolyT = 15*cm;
 
-  G4Box* PolySide_Box = new G4Box("PolySide_Box", PolyT/2, LeadL/2, LeadL/2);
-  G4SubtractionSolid* PolySide_Box1 = new G4SubtractionSolid("PolySide_Box1", PolySide_Box, HeS, 0, G4ThreeVector(-5*cm, 12.5*cm,0));
-  G4SubtractionSolid* PolySide_Box2 = new G4SubtractionSolid("PolySide_Box2", PolySide_Box1, HeS, 0, G4ThreeVector(0, 12.5*cm,0));
-  G4SubtractionSolid* PolySide_Box3 = new G4SubtractionSolid("PolySide_Box3", PolySide_Box2, HeS, 0, G4ThreeVector(0, 7.5*cm,0));
-  G4SubtractionSolid* PolySide_Box4 = new G4SubtractionSolid("PolySide_Box4", PolySide_Box3, HeS, 0, G4ThreeVector(0, 2.5*cm,0));
-  G4SubtractionSolid* PolySide_Box5 = new G4SubtractionSolid("PolySide_Box5", PolySide_Box4, HeS, 0, G4ThreeVector(0, -2.5*cm,0));
-  G4SubtractionSolid* PolySide_Box6 = new G4SubtractionSolid("PolySide_Box6", PolySide_Box5, HeS, 0, G4ThreeVector(0, -7.5*cm,0));
-  G4SubtractionSolid* PolySide_Box7 = new G4SubtractionSolid("PolySide_Box7", PolySide_Box6, HeS, 0, G4ThreeVector(0, -12.5*cm,0));
-  G4SubtractionSolid* PolyLR_S = new G4SubtractionSolid("PolyLR_S", PolySide_Box7, HeS, 0, G4ThreeVector(-5*cm, -12.5*cm,0));
+  G4Box* PolySide_Box = GeometryMemory::Solid(new G4Box("PolySide_Box", PolyT/2, LeadL/2, LeadL/2));
+  G4SubtractionSolid* PolySide_Box1 = GeometryMemory::Solid(new G4SubtractionSolid("PolySide_Box1", PolySide_Box, HeS, 0, G4ThreeVector(-5*cm, 12.5*cm,0)));
+  G4SubtractionSolid* PolySide_Box2 = GeometryMemory::Solid(new G4SubtractionSolid("PolySide_Box2", PolySide_Box1, HeS, 0, G4ThreeVector(0, 12.5*cm,0)));
+  G4SubtractionSolid* PolySide_Box3 = GeometryMemory::Solid(new G4SubtractionSolid("PolySide_Box3", PolySide_Box2, HeS, 0, G4ThreeVector(0, 7.5*cm,0)));
+  G4SubtractionSolid* PolySide_Box4 = GeometryMemory::Solid(new G4SubtractionSolid("PolySide_Box4", PolySide_Box3, HeS, 0, G4ThreeVector(0, 2.5*cm,0)));
+  G4SubtractionSolid* PolySide_Box5 = GeometryMemory::Solid(new G4SubtractionSolid("PolySide_Box5", PolySide_Box4, HeS, 0, G4ThreeVector(0, -2.5*cm,0)));
+  G4SubtractionSolid* PolySide_Box6 = GeometryMemory::Solid(new G4SubtractionSolid("PolySide_Box6", PolySide_Box5, HeS, 0, G4ThreeVector(0, -7.5*cm,0)));
+  G4SubtractionSolid* PolySide_Box7 = GeometryMemory::Solid(new G4SubtractionSolid("PolySide_Box7", PolySide_Box6, HeS, 0, G4ThreeVector(0, -12.5*cm,0)));
+  G4SubtractionSolid* PolyLR_S = GeometryMemory::Solid(new G4SubtractionSolid("PolyLR_S", PolySide_Box7, HeS, 0, G4ThreeVector(-5*cm, -12.5*cm,0)));
 
   G4LogicalVolume* PolySide_LV = new G4LogicalVolume(PolyLR_S, PolyMaterial, "PolySide_LV");
 
-  G4Box* PolyUD_Box = new G4Box("PolyUD_Box", PolyA/2, PolyT/2, PolyA/2);
-  G4SubtractionSolid* PolyUD_Box1 = new G4SubtractionSolid("PolyUD_Box1", PolyUD_Box, HeS, 0, G4ThreeVector(-22.5*cm, -5*cm, 0));
-  G4SubtractionSolid* PolyUD_Box2 = new G4SubtractionSolid("PolyUD_Box2", PolyUD_Box1, HeS, 0, G4ThreeVector(-17.5*cm, -5*cm, 0));
-  G4SubtractionSolid* PolyUD_Box3 = new G4SubtractionSolid("PolyUD_Box3", PolyUD_Box2, HeS, 0, G4ThreeVector(-17.5*cm, 0, 0));
-  G4SubtractionSolid* PolyUD_Box4 = new G4SubtractionSolid("PolyUD_Box4", PolyUD_Box3, HeS, 0, G4ThreeVector(-12.5*cm, -5*cm, 0));
-  G4SubtractionSolid* PolyUD_Box5 = new G4SubtractionSolid("PolyUD_Box5", PolyUD_Box4, HeS, 0, G4ThreeVector(-12.5*cm, 0, 0));
-  G4SubtractionSolid* PolyUD_Box6 = new G4SubtractionSolid("PolyUD_Box6", PolyUD_Box5, HeS, 0, G4ThreeVector(-7.5*cm, 0, 0));
-  G4SubtractionSolid* PolyUD_Box7 = new G4SubtractionSolid("PolyUD_Box7", PolyUD_Box6, HeS, 0, G4ThreeVector(-2.5*cm, 0, 0));
-  G4SubtractionSolid* PolyUD_Box8 = new G4SubtractionSolid("PolyUD_Box8", PolyUD_Box7, HeS, 0, G4ThreeVector(2.5*cm, 0, 0));
-  G4SubtractionSolid* PolyUD_Box9 = new G4SubtractionSolid("PolyUD_Box9", PolyUD_Box8, HeS, 0, G4ThreeVector(7.5*cm, 0, 0));
-  G4SubtractionSolid* PolyUD_Box10 = new G4SubtractionSolid("PolyUD_Box10", PolyUD_Box9, HeS, 0, G4ThreeVector(12.5*cm, -5*cm, 0));
-  G4SubtractionSolid* PolyUD_Box11 = new G4SubtractionSolid("PolyUD_Box11", PolyUD_Box10, HeS, 0, G4ThreeVector(12.5*cm, 0, 0));
-  G4SubtractionSolid* PolyUD_Box12 = new G4SubtractionSolid("PolyUD_Box12", PolyUD_Box11, HeS, 0, G4ThreeVector(17.5*cm, -5*cm, 0));
-  G4SubtractionSolid* PolyUD_Box13 = new G4SubtractionSolid("PolyUD_Box13", PolyUD_Box12, HeS, 0, G4ThreeVector(17.5*cm, 0, 0));
-  G4SubtractionSolid* PolyUD_S = new G4SubtractionSolid("PolyUD_S", PolyUD_Box13, HeS, 0, G4ThreeVector(22.5*cm, -5*cm, 0));
-
-  G4LogicalVolume* PolyUD_LV = new G4LogicalVolume(PolyUD_S, PolyMaterial, "PolySide_LV");
+  G4Box* PolyUD_Box = GeometryMemory::Solid(new G4Box("PolyUD_Box", PolyA/2, PolyT/2, PolyA/2));
+  G4SubtractionSolid* PolyUD_Box1 = GeometryMemory::Solid(new G4SubtractionSolid("PolyUD_Box1", PolyUD_Box, HeS, 0, G4ThreeVector(-22.5*cm, -5*cm, 0)));
+  G4SubtractionSolid* PolyUD_Box2 = GeometryMemory::Solid(new G4SubtractionSolid("PolyUD_Box2", PolyUD_Box1, HeS, 0, G4ThreeVector(-17.5*cm, -5*cm, 0)));
+  G4SubtractionSolid* PolyUD_Box3 = GeometryMemory::Solid(new G4SubtractionSolid("PolyUD_Box3", PolyUD_Box2, HeS, 0, G4ThreeVector(-17.5*cm, 0, 0)));
+  G4SubtractionSolid* PolyUD_Box4 = GeometryMemory::Solid(new G4SubtractionSolid("PolyUD_Box4", PolyUD_Box3, HeS, 0, G4ThreeVector(-12.5*cm, -5*cm, 0)));
+  G4SubtractionSolid* PolyUD_Box5 = GeometryMemory::Solid(new G4SubtractionSolid("PolyUD_Box5", PolyUD_Box4, HeS, 0, G4ThreeVector(-12.5*cm, 0, 0)));
+  G4SubtractionSolid* PolyUD_Box6 = GeometryMemory::Solid(new G4SubtractionSolid("PolyUD_Box6", PolyUD_Box5, HeS, 0, G4ThreeVector(-7.5*cm, 0, 0)));
+  G4SubtractionSolid* PolyUD_Box7 = GeometryMemory::Solid(new G4SubtractionSolid("PolyUD_Box7", PolyUD_Box6, HeS, 0, G4ThreeVector(-2.5*cm, 0, 0)));
+  G4SubtractionSolid* PolyUD_Box8 = GeometryMemory::Solid(new G4SubtractionSolid("PolyUD_Box8", PolyUD_Box7, HeS, 0, G4ThreeVector(2.5*cm, 0, 0)));
+  G4SubtractionSolid* PolyUD_Box9 = GeometryMemory::Solid(new G4SubtractionSolid("PolyUD_Box9", PolyUD_Box8, HeS, 0, G4ThreeVector(7.5*cm, 0, 0)));
+  G4SubtractionSolid* PolyUD_Box10 = GeometryMemory::Solid(new G4SubtractionSolid("PolyUD_Box10", PolyUD_Box9, HeS, 0, G4ThreeVector(12.5*cm, -5*cm, 0)));
+  G4SubtractionSolid* PolyUD_Box11 = GeometryMemory::Solid(new G4SubtractionSolid("PolyUD_Box11", PolyUD_Box10, HeS, 0, G4ThreeVector(12.5*cm, 0, 0)));
+  G4SubtractionSolid* PolyUD_Box12 = GeometryMemory::Solid(new G4SubtractionSolid("PolyUD_Box12", PolyUD_Box11, HeS, 0, G4ThreeVector(17.5*cm, -5*cm, 0)));
+  G4SubtractionSolid* PolyUD_Box13 = GeometryMemory::Solid(new G4SubtractionSolid("PolyUD_Box13", PolyUD_Box12, HeS, 0, G4ThreeVector(17.5*cm, 0, 0)));
+  G4SubtractionSolid* PolyUD_S = GeometryMemory::Solid(new G4SubtractionSolid("PolyUD_S", PolyUD_Box13, HeS, 0, G4ThreeVector(22.5*cm, -5*cm, 0)));
+
+  G4LogicalVolume* PolyUD_LV = new G4LogicalVolume(PolyUD_S, PolyMaterial, "PolyUD_LV");
 
 
 ////////////////////////////////////////////////////////////////////////
@@ -215,8 +275,9 @@ G4VPhysicalVolume* DetectorConstruction::DefineVolumes()
   //     
   // Target
   //
+  profiler->Start("volumes: target, moderator and counters");
 
-  G4Box* Target = new G4Box("Target", LeadL/2, LeadL/2, LeadL/2);
+  G4Box* Target = GeometryMemory::Solid(new G4Box("Target", LeadL/2, LeadL/2, LeadL/2));
   G4LogicalVolume* TargetLV = new G4LogicalVolume(Target, LeadMaterial, "TargetLV");
 
   VD[21] =
@@ -233,8 +294,8 @@ G4VPhysicalVolume* DetectorConstruction::DefineVolumes()
 
 
 /////////////////////////////////////////////////////////////////
-  G4RotationMatrix* rot1 = new G4RotationMatrix();
-  rot1->rotateY(0*deg);
+  G4RotationMatrix* rot1 =
+    GeometryMemory::Rotation(G4RotationMatrix().rotateY(0*deg));
 
   PolyR_PV = new G4PVPlacement
                 (rot1,
@@ -248,8 +309,8 @@ G4VPhysicalVolume* DetectorConstruction::DefineVolumes()
 
 
 /////////////////////////////////////////////////////////////////
-  G4RotationMatrix* rot2 = new G4RotationMatrix();
-  rot2->rotateY(90*deg);
+  G4RotationMatrix* rot2 =
+    GeometryMemory::Rotation(G4RotationMatrix().rotateY(90*deg));
 
   PolyB_PV = new G4PVPlacement
                 (rot2,
@@ -263,8 +324,8 @@ G4VPhysicalVolume* DetectorConstruction::DefineVolumes()
 
 /////////////////////////////////////////////////////////////////
 
-  G4RotationMatrix* rot3 = new G4RotationMatrix();
-  rot3->rotateY(180*deg);
+  G4RotationMatrix* rot3 =
+    GeometryMemory::Rotation(G4RotationMatrix().rotateY(180*deg));
 
   PolyL_PV = new G4PVPlacement
                 (rot3,
@@ -278,8 +339,8 @@ G4VPhysicalVolume* DetectorConstruction::DefineVolumes()
 
 /////////////////////////////////////////////////////////////////
 
-  G4RotationMatrix* rot4 = new G4RotationMatrix();
-  rot4->rotateY(270*deg);
+  G4RotationMatrix* rot4 =
+    GeometryMemory::Rotation(G4RotationMatrix().rotateY(270*deg));
 
   PolyF_PV = new G4PVPlacement
                 (rot4,
@@ -293,8 +354,8 @@ G4VPhysicalVolume* DetectorConstruction::DefineVolumes()
 
 /////////////////////////////////////////////////////////////////
 
-  G4RotationMatrix* rot5 = new G4RotationMatrix();
-  rot5->rotateX(0*deg);
+  G4RotationMatrix* rot5 =
+    GeometryMemory::Rotation(G4RotationMatrix().rotateX(0*deg));
   PolyU_PV = new G4PVPlacement
                 (rot5,
                  G4ThreeVector(0, (LeadL+PolyT+2*VDt)/2, Lead_TargetZ),
@@ -307,8 +368,8 @@ G4VPhysicalVolume* DetectorConstruction::DefineVolumes()
 
 /////////////////////////////////////////////////////////////////
 
-  G4RotationMatrix* rot6 = new G4RotationMatrix();
-  rot6->rotateX(180*deg);
+  G4RotationMatrix* rot6 =
+    GeometryMemory::Rotation(G4RotationMatrix().rotateX(180*deg));
   PolyD_PV = new G4PVPlacement
                  (rot6,
                  G4ThreeVector(0, -(LeadL+PolyT+2*VDt)/2, Lead_TargetZ),
@@ -322,7 +383,7 @@ G4VPhysicalVolume* DetectorConstruction::DefineVolumes()
 
 /////////////////////////////////////////////////////////////////
 
-  G4Box* PolyCornerS = new G4Box("PolyCornerS", PolyT/2, LeadL/2, PolyT/2);
+  G4Box* PolyCornerS = GeometryMemory::Solid(new G4Box("PolyCornerS", PolyT/2, LeadL/2, PolyT/2));
   G4LogicalVolume* PolyCornerLV = new G4LogicalVolume(PolyCornerS, PolyMaterial, "PolyCornerLV");
 
   PolyCornerPV1 = new G4PVPlacement
@@ -973,9 +1034,10 @@ G4VPhysicalVolume* DetectorConstruction::DefineVolumes()
   //     
   // VD0
   //
+  profiler->Start("volumes: virtual detectors");
 
 
-  G4Box* VD0 = new G4Box("VD0", worldSizeX/2, worldSizeY/2, VDt/2);
+  G4Box* VD0 = GeometryMemory::Solid(new G4Box("VD0", worldSizeX/2, worldSizeY/2, VDt/2));
   G4LogicalVolume* VD0LV = new G4LogicalVolume(VD0, WorldMaterial, "VD0LV");
 
    VD[1] = new G4PVPlacement
@@ -995,7 +1057,7 @@ G4VPhysicalVolume* DetectorConstruction::DefineVolumes()
   // VD1
   //
 
-  G4Box* VD1 = new G4Box("VD1", roomSizeX/4, roomSizeY/4, VDt/2);
+  G4Box* VD1 = GeometryMemory::Solid(new G4Box("VD1", roomSizeX/4, roomSizeY/4, VDt/2));
   G4LogicalVolume* VD1LV = new G4LogicalVolume(VD1, WorldMaterial, "VD1LV");
 
    VD[2] = new G4PVPlacement
@@ -1011,7 +1073,7 @@ G4VPhysicalVolume* DetectorConstruction::DefineVolumes()
 
 
 //////////////////////////////////////////
-  G4Box* VD_Z = new G4Box("VD_Z", roomSizeX/2, roomSizeY/2, VDt/2);
+  G4Box* VD_Z = GeometryMemory::Solid(new G4Box("VD_Z", roomSizeX/2, roomSizeY/2, VDt/2));
   G4LogicalVolume* VD_ZLV = new G4LogicalVolume(VD_Z, WorldMaterial, "VD_ZLV");
 
    VD[3] = new G4PVPlacement
@@ -1036,7 +1098,7 @@ G4VPhysicalVolume* DetectorConstruction::DefineVolumes()
                  false);
 
 //////////////////////////////////////////
-  G4Box* VD_Y = new G4Box("VD_Y", roomSizeX/2, VDt/2, roomSizeZ/2);
+  G4Box* VD_Y = GeometryMemory::Solid(new G4Box("VD_Y", roomSizeX/2, VDt/2, roomSizeZ/2));
   G4LogicalVolume* VD_YLV = new G4LogicalVolume(VD_Y, WorldMaterial, "VD_YLV");
 
   VD[5] = new G4PVPlacement
@@ -1061,7 +1123,7 @@ G4VPhysicalVolume* DetectorConstruction::DefineVolumes()
                  false);
 
 //////////////////////////////////////////
-  G4Box* VD_X = new G4Box("VD_X",  VDt/2, roomSizeY/2, roomSizeZ/2);
+  G4Box* VD_X = GeometryMemory::Solid(new G4Box("VD_X",  VDt/2, roomSizeY/2, roomSizeZ/2));
   G4LogicalVolume* VD_XLV = new G4LogicalVolume(VD_X, WorldMaterial, "VD_XLV");
 
   VD[7] = new G4PVPlacement
@@ -1087,7 +1149,7 @@ G4VPhysicalVolume* DetectorConstruction::DefineVolumes()
 
 
 //////////////////////////////////////////
-  G4Box* VDtarget_Z = new G4Box("VDtarget_Z", LeadL/2, LeadL/2, VDt/2);
+  G4Box* VDtarget_Z = GeometryMemory::Solid(new G4Box("VDtarget_Z", LeadL/2, LeadL/2, VDt/2));
   G4LogicalVolume* VDtarget_ZLV = new G4LogicalVolume(VDtarget_Z, WorldMaterial, "VDtarget_ZLV");
 
    VD[9] = new G4PVPlacement
@@ -1111,7 +1173,7 @@ G4VPhysicalVolume* DetectorConstruction::DefineVolumes()
                  false);
 
 //////////////////////////////////////////
-  G4Box* VDtarget_Y = new G4Box("VDtarget_Y", LeadL/2, VDt/2, LeadL/2);
+  G4Box* VDtarget_Y = GeometryMemory::Solid(new G4Box("VDtarget_Y", LeadL/2, VDt/2, LeadL/2));
   G4LogicalVolume* VDtarget_YLV = new G4LogicalVolume(VDtarget_Y, WorldMaterial, "VDtarget_YLV");
 
    VD[11] = new G4PVPlacement
@@ -1135,7 +1197,7 @@ G4VPhysicalVolume* DetectorConstruction::DefineVolumes()
                  false);
 
 //////////////////////////////////////////
-  G4Box* VDtarget_X = new G4Box("VDtarget_X", VDt/2, LeadL/2, LeadL/2);
+  G4Box* VDtarget_X = GeometryMemory::Solid(new G4Box("VDtarget_X", VDt/2, LeadL/2, LeadL/2));
   G4LogicalVolume* VDtarget_XLV = new G4LogicalVolume(VDtarget_X, WorldMaterial, "VDtarget_XLV");
 
    VD[13] = new G4PVPlacement
@@ -1159,7 +1221,7 @@ G4VPhysicalVolume* DetectorConstruction::DefineVolumes()
                  false);
 
 //////////////////////////////////////////
-  G4Box* VDbox_Z = new G4Box("VDbox_Z", PolyA/2, PolyA/2, VDt/2);
+  G4Box* VDbox_Z = GeometryMemory::Solid(new G4Box("VDbox_Z", PolyA/2, PolyA/2, VDt/2));
   G4LogicalVolume* VDbox_ZLV = new G4LogicalVolume(VDbox_Z, WorldMaterial, "VDbox_ZLV");
 
    VD[15] = new G4PVPlacement
@@ -1183,7 +1245,7 @@ G4VPhysicalVolume* DetectorConstruction::DefineVolumes()
                  false);
 
 //////////////////////////////////////////
-  G4Box* VDbox_Y = new G4Box("VDbox_Y", PolyA/2, VDt/2, PolyA/2);
+  G4Box* VDbox_Y = GeometryMemory::Solid(new G4Box("VDbox_Y", PolyA/2, VDt/2, PolyA/2));
   G4LogicalVolume* VDbox_YLV = new G4LogicalVolume(VDbox_Y, WorldMaterial, "VDbox_YLV");
 
    VD[17] = new G4PVPlacement
@@ -1207,7 +1269,7 @@ G4VPhysicalVolume* DetectorConstruction::DefineVolumes()
                  false);
 
 //////////////////////////////////////////
-  G4Box* VDbox_X = new G4Box("VDbox_X", VDt/2, PolyA/2, PolyA/2);
+  G4Box* VDbox_X = GeometryMemory::Solid(new G4Box("VDbox_X", VDt/2, PolyA/2, PolyA/2));
   G4LogicalVolume* VDbox_XLV = new G4LogicalVolume(VDbox_X, WorldMaterial, "VDbox_XLV");
 
    VD[19] = new G4PVPlacement
@@ -1233,6 +1295,48 @@ G4VPhysicalVolume* DetectorConstruction::DefineVolumes()
 
 /**/
 
+////////////////////////////////////////////////////////////////////////
+
+  //
+  // Layout used by scoring and run control
+  //
+  profiler->Start("layout and symmetry");
+  auto layout = DetectorLayout::Instance();
+  layout->Clear();
+  layout->SetRole(worldLV, DetectorLayout::kWorld);
+  layout->SetRole(rockLV, DetectorLayout::kRock);
+  layout->SetRole(TargetLV, DetectorLayout::kTarget);
+  layout->SetRole(PolySide_LV, DetectorLayout::kModerator);
+  layout->SetRole(PolyUD_LV, DetectorLayout::kModerator);
+  layout->SetRole(PolyCornerLV, DetectorLayout::kModerator);
+  layout->SetRole(HeCounter_LV, DetectorLayout::kCounter);
+  // Counters off the nominal fill (/nmds/counterGas/...)
+  for (auto gasLV : CounterGas::Instance()->Apply(HeCounter_PV, HeCounter_LV)) {
+    layout->SetRole(gasLV, DetectorLayout::kCounter);
+  }
+  for (auto vdLV : { VD0LV, VD1LV, VD_ZLV, VD_YLV, VD_XLV,
+                     VDtarget_ZLV, VDtarget_YLV, VDtarget_XLV,
+                     VDbox_ZLV, VDbox_YLV, VDbox_XLV }) {
+    layout->SetRole(vdLV, DetectorLayout::kVirtualDetector);
+  }
+  for (G4int i = 0; i < DetectorLayout::kNumberOfCounters; ++i) {
+    layout->SetCounter(i, HeCounter_PV[i]);
+  }
+  for (G4int i = 1; i < DetectorLayout::kNumberOfVD; ++i) {
+    layout->SetVD(i, VD[i]);
+  }
+  layout->SetDimensions(G4ThreeVector(worldSizeX/2, worldSizeY/2, worldSizeZ/2),
+                        G4ThreeVector(rockSizeX/2, rockSizeY/2, rockSizeZ/2),
+                        G4ThreeVector(roomSizeX/2, roomSizeY/2, roomSizeZ/2),
+                        G4ThreeVector(0., 0., Lead_TargetZ),
+                        LeadL/2 + VDt + PolyT, LeadL/2,
+                        He_R, He_L/2);
+  layout->Close(worldPV);
+  DetectorSymmetry::Instance()->Build(worldPV);
+
+  // Voxel settings per logical volume (/nmds/navigation/smartless)
+  NavigationStats::Master()->ApplyVoxelSettings();
+
 ////////////////////////////////////////////////////////////////////////
 
   //                                        
@@ -1243,6 +1347,8 @@ G4VPhysicalVolume* DetectorConstruction::DefineVolumes()
   auto simpleBoxVisAtt= new G4VisAttributes(G4Colour(1.0,1.0,1.0));
   simpleBoxVisAtt->SetVisibility(true);
 
+  profiler->Stop();
+
   //
   // Always return the physical World
   //
@@ -1254,20 +1360,60 @@ G4VPhysicalVolume* DetectorConstruction::DefineVolumes()
 void DetectorConstruction::ConstructSDandField()
 {
   // G4SDManager::GetSDMpointer()->SetVerboseLevel(1);
+  auto profiler = StartupProfiler::Instance();
+  profiler->Start("sensitive detectors and field");
 
+  //
+  // Counter, VD and target tallies
+  //
+  auto tallySD = new TallySD("TallySD");
+  G4SDManager::GetSDMpointer()->AddNewDetector(tallySD);
+
+  auto layout = DetectorLayout::Instance();
+  for (auto lv : *G4LogicalVolumeStore::GetInstance()) {
+    DetectorLayout::VolumeRole role = layout->GetRole(lv);
+    if (role == DetectorLayout::kCounter ||
+        role == DetectorLayout::kVirtualDetector ||
+        role == DetectorLayout::kTarget) {
+      SetSensitiveDetector(lv, tallySD);
+    }
+  }
 
   // 
   // Magnetic field
   //
-  // Create global magnetic field messenger.
-  // Uniform magnetic field is then created automatically if
-  // the field value is not zero.
-  G4ThreeVector fieldValue;
-  fMagFieldMessenger = new G4GlobalMagFieldMessenger(fieldValue);
-  fMagFieldMessenger->SetVerboseLevel(1);
+  // With a field map, interpolate it over the whole world; the grid itself
+  // is shared by all threads.
+  if (!FieldMap::GetFileName().empty()) {
+    auto fieldMap = new FieldMap();
+    auto fieldManager =
+      G4TransportationManager::GetTransportationManager()->GetFieldManager();
+    fieldManager->SetDetectorField(fieldMap);
+    fieldManager->CreateChordFinder(fieldMap);
+    G4AutoDelete::Register(fieldMap);
+  }
+  else {
+    // Create global magnetic field messenger.
+    // Uniform magnetic field is then created automatically if
+    // the field value is not zero; with a zero field no field manager,
+    // chord finder or propagator is set up and transport stays linear.
+    G4ThreeVector fieldValue;
+    fMagFieldMessenger = new G4GlobalMagFieldMessenger(fieldValue);
+    fMagFieldMessenger->SetVerboseLevel(1);
   
-  // Register the field messenger for deleting
-  G4AutoDelete::Register(fMagFieldMessenger);
+    // Register the field messenger for deleting
+    G4AutoDelete::Register(fMagFieldMessenger);
+  }
+
+  // Up to the first event of this thread (ScoringEventAction): physics
+  // tables, geometry closing and voxels. The MT master has no events.
+  if (G4RunManager::GetRunManager()->GetRunManagerType() ==
+      G4RunManager::masterRM) {
+    profiler->Stop();
+  }
+  else {
+    profiler->Start("run initialisation");
+  }
 }
 
 //....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
@@ -0,0 +1,177 @@
+#include "DetectorLayout.hh"
+
+#include "G4LogicalVolume.hh"
+#include "G4VPhysicalVolume.hh"
+#include "G4VSolid.hh"
+#include "G4Material.hh"
+#include "G4RotationMatrix.hh"
+
+#include <iomanip>
+#include <sstream>
+
+namespace
+{
+  // 64 bit FNV-1a
+  void HashString(unsigned long long& hash, const std::string& text)
+  {
+    for (std::size_t i = 0; i < text.size(); ++i) {
+      hash ^= static_cast<unsigned char>(text[i]);
+      hash *= 1099511628211ULL;
+    }
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+DetectorLayout* DetectorLayout::Instance()
+{
+  static DetectorLayout instance;
+  return &instance;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+DetectorLayout::DetectorLayout()
+ : fCounters(kNumberOfCounters, nullptr),
+   fVDs(kNumberOfVD, nullptr),
+   fBoxHalf(0.), fTargetHalf(0.),
+   fCounterRadius(0.), fCounterHalfLength(0.),
+   fFingerprint(0), fClosed(false)
+{
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void DetectorLayout::Clear()
+{
+  fRoles.clear();
+  fCounterIndex.clear();
+  fVDIndex.clear();
+  fCounters.assign(kNumberOfCounters, nullptr);
+  fVDs.assign(kNumberOfVD, nullptr);
+  fFingerprint = 0;
+  fClosed = false;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void DetectorLayout::SetRole(const G4LogicalVolume* lv, VolumeRole role)
+{
+  fRoles[lv] = role;
+}
+
+void DetectorLayout::SetCounter(G4int index, const G4VPhysicalVolume* pv)
+{
+  if (index < 0 || index >= kNumberOfCounters) return;
+  fCounters[index] = pv;
+  fCounterIndex[pv] = index;
+}
+
+void DetectorLayout::SetVD(G4int index, const G4VPhysicalVolume* pv)
+{
+  if (index < 0 || index >= kNumberOfVD) return;
+  fVDs[index] = pv;
+  fVDIndex[pv] = index;
+}
+
+void DetectorLayout::SetDimensions(const G4ThreeVector& worldHalf,
+                                   const G4ThreeVector& rockHalf,
+                                   const G4ThreeVector& roomHalf,
+                                   const G4ThreeVector& boxCenter,
+                                   G4double boxHalf, G4double targetHalf,
+                                   G4double counterRadius,
+                                   G4double counterHalfLength)
+{
+  fWorldHalf  = worldHalf;
+  fRockHalf   = rockHalf;
+  fRoomHalf   = roomHalf;
+  fBoxCenter  = boxCenter;
+  fBoxHalf    = boxHalf;
+  fTargetHalf = targetHalf;
+  fCounterRadius     = counterRadius;
+  fCounterHalfLength = counterHalfLength;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void DetectorLayout::Close(const G4VPhysicalVolume* world)
+{
+  unsigned long long hash = 14695981039346656037ULL;
+
+  std::ostringstream os;
+  os << std::setprecision(17);
+  os << fWorldHalf << fRockHalf << fRoomHalf << fBoxCenter
+     << fBoxHalf << fTargetHalf << fCounterRadius << fCounterHalfLength;
+  HashString(hash, os.str());
+
+  const G4LogicalVolume* worldLV = world->GetLogicalVolume();
+  for (G4int i = 0; i < (G4int)worldLV->GetNoDaughters(); ++i) {
+    const G4VPhysicalVolume* pv = worldLV->GetDaughter(i);
+    const G4LogicalVolume* lv = pv->GetLogicalVolume();
+    std::ostringstream ds;
+    ds << std::setprecision(17)
+       << pv->GetName() << ' ' << pv->GetTranslation() << ' ';
+    const G4RotationMatrix* rot = pv->GetRotation();
+    if (rot && !rot->isIdentity()) {
+      ds << rot->xx() << rot->xy() << rot->xz()
+         << rot->yx() << rot->yy() << rot->yz()
+         << rot->zx() << rot->zy() << rot->zz();
+    }
+    ds << ' ' << lv->GetName() << ' ' << lv->GetMaterial()->GetName() << ' ';
+    lv->GetSolid()->StreamInfo(ds);
+    HashString(hash, ds.str());
+  }
+
+  fFingerprint = hash;
+  fClosed = true;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+DetectorLayout::VolumeRole
+DetectorLayout::GetRole(const G4LogicalVolume* lv) const
+{
+  auto it = fRoles.find(lv);
+  return (it == fRoles.end()) ? kOther : it->second;
+}
+
+G4int DetectorLayout::GetCounterIndex(const G4VPhysicalVolume* pv) const
+{
+  auto it = fCounterIndex.find(pv);
+  return (it == fCounterIndex.end()) ? -1 : it->second;
+}
+
+G4int DetectorLayout::GetVDIndex(const G4VPhysicalVolume* pv) const
+{
+  auto it = fVDIndex.find(pv);
+  return (it == fVDIndex.end()) ? -1 : it->second;
+}
+
+const G4VPhysicalVolume* DetectorLayout::GetCounter(G4int index) const
+{
+  if (index < 0 || index >= kNumberOfCounters) return nullptr;
+  return fCounters[index];
+}
+
+const G4VPhysicalVolume* DetectorLayout::GetVD(G4int index) const
+{
+  if (index < 0 || index >= kNumberOfVD) return nullptr;
+  return fVDs[index];
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+const char* DetectorLayout::GetRoleName(VolumeRole role)
+{
+  switch (role) {
+    case kWorld:           return "World";
+    case kRock:            return "Rock";
+    case kTarget:          return "Target";
+    case kModerator:       return "Moderator";
+    case kCounter:         return "Counter";
+    case kVirtualDetector: return "VD";
+    default:               return "Other";
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
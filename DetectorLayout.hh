@@ -0,0 +1,102 @@
+#ifndef DetectorLayout_h
+#define DetectorLayout_h 1
+
+#include "globals.hh"
+#include "G4ThreeVector.hh"
+
+#include <map>
+#include <vector>
+
+class G4LogicalVolume;
+class G4VPhysicalVolume;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+/// Read-only description of the NMDS-II geometry, filled once by
+/// DetectorConstruction::DefineVolumes() and shared by all threads.
+///
+/// It maps the logical volumes onto their role in the set-up, numbers the
+/// 60 He-3 counters and the VD planes by physical volume, keeps the main
+/// dimensions and provides a fingerprint of the built geometry.
+
+class DetectorLayout
+{
+  public:
+    enum VolumeRole {
+      kOther = 0,
+      kWorld,
+      kRock,
+      kTarget,
+      kModerator,
+      kCounter,
+      kVirtualDetector,
+      kNumberOfRoles
+    };
+
+    static const G4int kNumberOfCounters = 60;
+    static const G4int kNumberOfVD       = 22;   // VD[1..20] planes, VD[21] target
+
+    static DetectorLayout* Instance();
+
+    void Clear();
+
+    // Filled by DetectorConstruction
+    void SetRole(const G4LogicalVolume* lv, VolumeRole role);
+    void SetCounter(G4int index, const G4VPhysicalVolume* pv);
+    void SetVD(G4int index, const G4VPhysicalVolume* pv);
+    void SetDimensions(const G4ThreeVector& worldHalf,
+                       const G4ThreeVector& rockHalf,
+                       const G4ThreeVector& roomHalf,
+                       const G4ThreeVector& boxCenter,
+                       G4double boxHalf, G4double targetHalf,
+                       G4double counterRadius, G4double counterHalfLength);
+    void Close(const G4VPhysicalVolume* world);
+
+    // Queries
+    VolumeRole GetRole(const G4LogicalVolume* lv) const;
+    G4int GetCounterIndex(const G4VPhysicalVolume* pv) const;
+    G4int GetVDIndex(const G4VPhysicalVolume* pv) const;
+    const G4VPhysicalVolume* GetCounter(G4int index) const;
+    const G4VPhysicalVolume* GetVD(G4int index) const;
+
+    const G4ThreeVector& GetWorldHalf() const { return fWorldHalf; }
+    const G4ThreeVector& GetRockHalf()  const { return fRockHalf; }
+    const G4ThreeVector& GetRoomHalf()  const { return fRoomHalf; }
+    const G4ThreeVector& GetBoxCenter() const { return fBoxCenter; }
+    G4double GetBoxHalf()    const { return fBoxHalf; }
+    G4double GetTargetHalf() const { return fTargetHalf; }
+    G4double GetCounterRadius()     const { return fCounterRadius; }
+    G4double GetCounterHalfLength() const { return fCounterHalfLength; }
+
+    // Hash of names, placements, materials and solid parameters
+    // of the world daughters; set by Close()
+    unsigned long long GetFingerprint() const { return fFingerprint; }
+    G4bool IsClosed() const { return fClosed; }
+
+    static const char* GetRoleName(VolumeRole role);
+
+  private:
+    DetectorLayout();
+
+    std::map<const G4LogicalVolume*, VolumeRole>  fRoles;
+    std::map<const G4VPhysicalVolume*, G4int>     fCounterIndex;
+    std::map<const G4VPhysicalVolume*, G4int>     fVDIndex;
+    std::vector<const G4VPhysicalVolume*>         fCounters;
+    std::vector<const G4VPhysicalVolume*>         fVDs;
+
+    G4ThreeVector fWorldHalf;
+    G4ThreeVector fRockHalf;
+    G4ThreeVector fRoomHalf;
+    G4ThreeVector fBoxCenter;
+    G4double      fBoxHalf;
+    G4double      fTargetHalf;
+    G4double      fCounterRadius;
+    G4double      fCounterHalfLength;
+
+    unsigned long long fFingerprint;
+    G4bool             fClosed;
+};
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+#endif
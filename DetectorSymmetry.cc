@@ -0,0 +1,291 @@
+#include "DetectorSymmetry.hh"
+#include "DetectorLayout.hh"
+#include "RunTally.hh"
+
+#include "G4LogicalVolume.hh"
+#include "G4VPhysicalVolume.hh"
+#include "G4Box.hh"
+#include "G4RotationMatrix.hh"
+#include "G4GenericMessenger.hh"
+#include "G4SystemOfUnits.hh"
+#include "G4ios.hh"
+
+#include <cmath>
+#include <map>
+
+namespace
+{
+  const G4double kTolerance = 1.*micrometer;
+
+  G4int Find(std::vector<G4int>& parent, G4int i)
+  {
+    while (parent[i] != i) i = parent[i] = parent[parent[i]];
+    return i;
+  }
+
+  void Unite(std::vector<G4int>& parent, G4int i, G4int j)
+  {
+    i = Find(parent, i);
+    j = Find(parent, j);
+    if (i != j) parent[std::max(i, j)] = std::min(i, j);
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+DetectorSymmetry* DetectorSymmetry::Instance()
+{
+  static DetectorSymmetry instance;
+  return &instance;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+DetectorSymmetry::DetectorSymmetry()
+ : fFolding("none"),
+   fBuilt(false),
+   fMessenger(nullptr)
+{
+  fMessenger = new G4GenericMessenger(this, "/nmds/symmetry/",
+                                      "Detector symmetry and tally folding");
+  fMessenger->DeclareMethod("print", &DetectorSymmetry::Print,
+                            "Print the detector symmetry group.");
+  fMessenger->DeclareMethod("fold", &DetectorSymmetry::SetFolding,
+                            "Fold equivalent counter and VD tallies.")
+    .SetCandidates("none exact detector");
+}
+
+DetectorSymmetry::~DetectorSymmetry()
+{
+  delete fMessenger;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4ThreeVector DetectorSymmetry::Apply(const G4int matrix[3][3],
+                                      const G4ThreeVector& v) const
+{
+  G4ThreeVector result;
+  for (G4int i = 0; i < 3; ++i) {
+    result[i] = matrix[i][0]*v[0] + matrix[i][1]*v[1] + matrix[i][2]*v[2];
+  }
+  return result;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void DetectorSymmetry::Build(const G4VPhysicalVolume* world)
+{
+  fElements.clear();
+  fCenter = DetectorLayout::Instance()->GetBoxCenter();
+
+  static const G4int perms[6][3] =
+    { {0,1,2}, {0,2,1}, {1,0,2}, {1,2,0}, {2,0,1}, {2,1,0} };
+  static const char* axes = "xyz";
+
+  for (G4int p = 0; p < 6; ++p) {
+    for (G4int s = 0; s < 8; ++s) {
+      Element element;
+      element.name = "(";
+      for (G4int i = 0; i < 3; ++i) {
+        G4int sign = (s & (1 << i)) ? -1 : 1;
+        for (G4int j = 0; j < 3; ++j) element.matrix[i][j] = 0;
+        element.matrix[i][perms[p][i]] = sign;
+        if (i > 0) element.name += ",";
+        if (sign < 0) element.name += "-";
+        element.name += axes[perms[p][i]];
+      }
+      element.name += ")";
+      if (TestElement(world, element)) fElements.push_back(element);
+    }
+  }
+  // Orbits of the new group for a folding set before
+  fBuilt = true;
+  if (fFolding != "none") ApplyFolding();
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4bool DetectorSymmetry::TestElement(const G4VPhysicalVolume* world,
+                                     Element& element) const
+{
+  auto layout = DetectorLayout::Instance();
+  element.exact = true;
+  element.counterMap.assign(DetectorLayout::kNumberOfCounters, -1);
+  element.vdMap.assign(DetectorLayout::kNumberOfVD, -1);
+
+  // Is a box with these half lengths invariant under the element ?
+  auto boxInvariant = [&](const G4ThreeVector& half) {
+    G4ThreeVector image = Apply(element.matrix, half);
+    for (G4int i = 0; i < 3; ++i) {
+      if (std::fabs(std::fabs(image[i]) - half[i]) > kTolerance) return false;
+    }
+    return true;
+  };
+
+  const G4LogicalVolume* worldLV = world->GetLogicalVolume();
+  G4int ndaughters = (G4int)worldLV->GetNoDaughters();
+
+  for (G4int i = 0; i < ndaughters; ++i) {
+    const G4VPhysicalVolume* pv = worldLV->GetDaughter(i);
+    const G4LogicalVolume* lv = pv->GetLogicalVolume();
+    DetectorLayout::VolumeRole role = layout->GetRole(lv);
+
+    if (role == DetectorLayout::kRock || role == DetectorLayout::kWorld) {
+      // The rock cavity must map onto itself
+      G4ThreeVector image = Apply(element.matrix, pv->GetTranslation() - fCenter)
+                          + fCenter;
+      if ((image - pv->GetTranslation()).mag() > kTolerance ||
+          !boxInvariant(layout->GetRockHalf()) ||
+          !boxInvariant(layout->GetRoomHalf())) element.exact = false;
+      continue;
+    }
+
+    G4ThreeVector image = Apply(element.matrix, pv->GetTranslation() - fCenter)
+                        + fCenter;
+
+    // Thin boxes must keep their orientation
+    const G4Box* box = dynamic_cast<const G4Box*>(lv->GetSolid());
+    G4bool shapeOK = !box ||
+      boxInvariant(G4ThreeVector(box->GetXHalfLength(), box->GetYHalfLength(),
+                                 box->GetZHalfLength()));
+
+    const G4VPhysicalVolume* match = nullptr;
+    for (G4int j = 0; j < ndaughters && shapeOK; ++j) {
+      const G4VPhysicalVolume* other = worldLV->GetDaughter(j);
+      if (other->GetLogicalVolume() != lv) continue;
+      if ((other->GetTranslation() - image).mag() > kTolerance) continue;
+      if (role == DetectorLayout::kCounter) {
+        G4ThreeVector axis = pv->GetObjectRotationValue()*G4ThreeVector(0,0,1);
+        G4ThreeVector otherAxis =
+          other->GetObjectRotationValue()*G4ThreeVector(0,0,1);
+        if (Apply(element.matrix, axis).cross(otherAxis).mag() > 1.e-9) {
+          continue;
+        }
+      }
+      match = other;
+      break;
+    }
+
+    G4int vd = layout->GetVDIndex(pv);
+    if (vd >= 0) {
+      if (match) element.vdMap[vd] = layout->GetVDIndex(match);
+      else element.exact = false;
+    }
+
+    if (role == DetectorLayout::kTarget || role == DetectorLayout::kModerator ||
+        role == DetectorLayout::kCounter) {
+      if (!match) return false;
+      if (role == DetectorLayout::kCounter) {
+        element.counterMap[layout->GetCounterIndex(pv)] =
+          layout->GetCounterIndex(match);
+      }
+    }
+  }
+  return true;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+std::vector<std::vector<G4int> >
+DetectorSymmetry::GetOrbits(G4bool exactOnly) const
+{
+  std::vector<G4int> parent(RunTally::kNumberOfBins);
+  for (G4int i = 0; i < RunTally::kNumberOfBins; ++i) parent[i] = i;
+
+  for (const auto& element : fElements) {
+    if (exactOnly && !element.exact) continue;
+    for (G4int i = 0; i < DetectorLayout::kNumberOfCounters; ++i) {
+      if (element.counterMap[i] < 0) continue;
+      Unite(parent, RunTally::kCounterOffset + i,
+                    RunTally::kCounterOffset + element.counterMap[i]);
+    }
+    for (G4int i = 0; i < DetectorLayout::kNumberOfVD; ++i) {
+      if (element.vdMap[i] < 0) continue;
+      Unite(parent, RunTally::kVDOffset + i,
+                    RunTally::kVDOffset + element.vdMap[i]);
+    }
+  }
+
+  std::map<G4int, std::vector<G4int> > classes;
+  for (G4int i = 0; i < RunTally::kNumberOfBins; ++i) {
+    classes[Find(parent, i)].push_back(i);
+  }
+  std::vector<std::vector<G4int> > orbits(RunTally::kNumberOfBins);
+  for (G4int i = 0; i < RunTally::kNumberOfBins; ++i) {
+    orbits[i] = classes[Find(parent, i)];
+  }
+  return orbits;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void DetectorSymmetry::SetFolding(const G4String& mode)
+{
+  if (mode != "none" && mode != "exact" && mode != "detector") {
+    G4ExceptionDescription msg;
+    msg << "Unknown folding " << mode << " (none, exact or detector); "
+        << "folding stays " << fFolding << ".";
+    G4Exception("DetectorSymmetry::SetFolding()", "NMDS025", JustWarning, msg);
+    return;
+  }
+  fFolding = mode;
+  if (fBuilt) {
+    ApplyFolding();
+  }
+  else if (mode != "none") {
+    G4cout << "### Tally folding " << mode
+           << " applied once the geometry is built." << G4endl;
+  }
+}
+
+void DetectorSymmetry::ApplyFolding()
+{
+  if (fFolding == "none") {
+    RunTally::SetOrbits(std::vector<std::vector<G4int> >());
+  }
+  else {
+    RunTally::SetOrbits(GetOrbits(fFolding == "exact"));
+  }
+  G4cout << "### Tally folding: " << fFolding << G4endl;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void DetectorSymmetry::Print() const
+{
+  G4cout << G4endl
+         << "--------------------- Detector symmetry group --------------------"
+         << G4endl
+         << " " << fElements.size() << " elements about " << fCenter/cm
+         << " cm" << G4endl;
+
+  for (const auto& element : fElements) {
+    G4cout << "  " << element.name << (element.exact ? "  exact" : "")
+           << G4endl << "    counters:";
+    for (auto i : element.counterMap) G4cout << ' ' << i;
+    G4cout << G4endl << "    VD:";
+    for (G4int i = 1; i < DetectorLayout::kNumberOfVD; ++i) {
+      G4cout << ' ' << element.vdMap[i];
+    }
+    G4cout << G4endl;
+  }
+
+  for (G4int exact = 1; exact >= 0; --exact) {
+    auto orbits = GetOrbits(exact);
+    G4cout << (exact ? " exact" : " detector") << " orbits:";
+    for (G4int i = 0; i < RunTally::kNumberOfBins; ++i) {
+      if (orbits[i].size() < 2 || orbits[i][0] != i) continue;
+      G4cout << " {";
+      for (std::size_t k = 0; k < orbits[i].size(); ++k) {
+        G4cout << (k ? "," : "") << RunTally::GetBinName(orbits[i][k]);
+      }
+      G4cout << "}";
+    }
+    G4cout << G4endl;
+  }
+  G4cout << "-----------------------------------------------------------------"
+         << G4endl;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
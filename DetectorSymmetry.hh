@@ -0,0 +1,76 @@
+#ifndef DetectorSymmetry_h
+#define DetectorSymmetry_h 1
+
+#include "globals.hh"
+#include "G4ThreeVector.hh"
+
+#include <vector>
+
+class G4VPhysicalVolume;
+class G4GenericMessenger;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+/// Symmetry group of the NMDS-II detector, derived from the built geometry.
+///
+/// The candidates are the 48 axis permutations and reflections about the
+/// centre of the moderator box. An element belongs to the detector group
+/// when it maps the target, every moderator piece and every He-3 counter
+/// (position and tube axis) onto a placement of the same logical volume.
+/// For each element the counter and VD permutations are kept; VD planes
+/// without an image are mapped to -1. An element is "exact" when it also
+/// leaves the rock, the room and all VD planes invariant.
+///
+/// Folding replaces, event by event, every counter or VD score by its
+/// average over the orbit of equivalent bins (RunTally::SetOrbits()):
+///
+///   /nmds/symmetry/print
+///   /nmds/symmetry/fold none|exact|detector
+///
+/// "detector" assumes that the source and the surroundings share the
+/// symmetry of the detector. A mode set before the geometry is built
+/// takes effect when Build() runs, and again after every rebuild.
+
+class DetectorSymmetry
+{
+  public:
+    struct Element {
+      G4int              matrix[3][3];
+      G4String           name;
+      G4bool             exact;
+      std::vector<G4int> counterMap;
+      std::vector<G4int> vdMap;
+    };
+
+    static DetectorSymmetry* Instance();
+    ~DetectorSymmetry();
+
+    // Called by DetectorConstruction once DetectorLayout is closed
+    void Build(const G4VPhysicalVolume* world);
+
+    const std::vector<Element>& GetElements() const { return fElements; }
+
+    // Orbits of the RunTally bins under the exact or all elements
+    std::vector<std::vector<G4int> > GetOrbits(G4bool exactOnly) const;
+
+    void SetFolding(const G4String& mode);
+    void Print() const;
+
+  private:
+    DetectorSymmetry();
+
+    G4ThreeVector Apply(const G4int matrix[3][3], const G4ThreeVector& v) const;
+    G4bool TestElement(const G4VPhysicalVolume* world, Element& element) const;
+
+    void ApplyFolding();
+
+    std::vector<Element> fElements;
+    G4ThreeVector        fCenter;
+    G4String             fFolding;
+    G4bool               fBuilt;
+    G4GenericMessenger*  fMessenger;
+};
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+#endif
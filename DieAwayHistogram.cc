@@ -0,0 +1,311 @@
+#include "DieAwayHistogram.hh"
+#include "ParallelRun.hh"
+
+#include "G4AutoLock.hh"
+#include "G4GenericMessenger.hh"
+#include "G4SystemOfUnits.hh"
+#include "G4ios.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+
+namespace
+{
+  G4Mutex histoMutex = G4MUTEX_INITIALIZER;
+  std::vector<DieAwayHistogram*>* workers = nullptr;
+
+  const G4double kLogTimeMin   = 0.;   // log10(t/ns)
+  const G4double kLogEnergyMin = -5.;  // log10(E/eV)
+  const G4double kBinsPerDecade = 10.;
+
+  void WriteVector(std::ostream& os, const char* key,
+                   const std::vector<G4double>& v)
+  {
+    os << key << ' ' << v.size() << '\n' << std::hexfloat;
+    for (std::size_t i = 0; i < v.size(); ++i) {
+      os << v[i] << ((i % 8 == 7) ? '\n' : ' ');
+    }
+    os << std::defaultfloat << '\n';
+  }
+
+  G4bool ReadVector(std::istream& is, const char* key,
+                    std::vector<G4double>& v)
+  {
+    std::string name, value;
+    std::size_t size = 0;
+    is >> name >> size;
+    if (!is || name != key || size != v.size()) return false;
+    for (std::size_t i = 0; i < size; ++i) {
+      is >> value;
+      v[i] = std::strtod(value.c_str(), nullptr);
+    }
+    return (bool)is;
+  }
+}
+
+G4double DieAwayHistogram::fPredelay = 4.5*microsecond;
+G4double DieAwayHistogram::fGate     = 64.*microsecond;
+G4String DieAwayHistogram::fFileName = "dieaway.txt";
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+DieAwayHistogram* DieAwayHistogram::Instance()
+{
+  static G4ThreadLocal DieAwayHistogram* instance = nullptr;
+  if (!instance) {
+    instance = new DieAwayHistogram(false);
+    G4AutoLock lock(&histoMutex);
+    if (!workers) workers = new std::vector<DieAwayHistogram*>;
+    workers->push_back(instance);
+  }
+  return instance;
+}
+
+DieAwayHistogram* DieAwayHistogram::Master()
+{
+  static DieAwayHistogram master(true);
+  return &master;
+}
+
+void DieAwayHistogram::CollectWorkers()
+{
+  G4AutoLock lock(&histoMutex);
+  if (!workers) return;
+  for (auto worker : *workers) {
+    Master()->Merge(*worker);
+    worker->Reset();
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+DieAwayHistogram::DieAwayHistogram(G4bool master)
+ : fTime(kNofCounters*kTimeBins, 0.),
+   fEnergy(kNofCounters*kEnergyBins, 0.),
+   fTimeEnergy(kTimeBins*kEnergyBins, 0.),
+   fEventMultiplicity(kMaxMultiplicity + 1, 0.),
+   fGateMultiplicity(kMaxMultiplicity + 1, 0.),
+   fMessenger(nullptr)
+{
+  fCaptureTimes.reserve(kMaxMultiplicity);
+  if (master) DefineCommands();
+}
+
+DieAwayHistogram::~DieAwayHistogram()
+{
+  delete fMessenger;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4int DieAwayHistogram::TimeBin(G4double time)
+{
+  if (time <= 0.) return 0;
+  G4int bin = (G4int)((std::log10(time/ns) - kLogTimeMin)*kBinsPerDecade);
+  return std::min(std::max(bin, 0), kTimeBins - 1);
+}
+
+G4int DieAwayHistogram::EnergyBin(G4double energy)
+{
+  if (energy <= 0.) return 0;
+  G4int bin = (G4int)((std::log10(energy/eV) - kLogEnergyMin)*kBinsPerDecade);
+  return std::min(std::max(bin, 0), kEnergyBins - 1);
+}
+
+G4double DieAwayHistogram::GetTimeEdge(G4int bin)
+{
+  return std::pow(10., kLogTimeMin + bin/kBinsPerDecade)*ns;
+}
+
+G4double DieAwayHistogram::GetEnergyEdge(G4int bin)
+{
+  return std::pow(10., kLogEnergyMin + bin/kBinsPerDecade)*eV;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void DieAwayHistogram::Fill(G4int counter, G4double time, G4double energy,
+                            G4double weight)
+{
+  G4int it = TimeBin(time);
+  G4int ie = EnergyBin(energy);
+  fTime[counter*kTimeBins + it]     += weight;
+  fEnergy[counter*kEnergyBins + ie] += weight;
+  fTimeEnergy[it*kEnergyBins + ie]  += weight;
+  fCaptureTimes.push_back(time);
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void DieAwayHistogram::EndOfEvent()
+{
+  // Multiplicities count captures, not weights
+  G4int n = (G4int)fCaptureTimes.size();
+  fEventMultiplicity[std::min(n, kMaxMultiplicity)] += 1.;
+  if (n == 0) return;
+
+  std::sort(fCaptureTimes.begin(), fCaptureTimes.end());
+
+  // Shift-register logic: captures in (t+predelay, t+predelay+gate]
+  // for each trigger t, with two moving gate edges
+  G4int open = 0, close = 0;
+  for (G4int i = 0; i < n; ++i) {
+    G4double gateOpen  = fCaptureTimes[i] + fPredelay;
+    G4double gateClose = gateOpen + fGate;
+    while (open  < n && fCaptureTimes[open]  <= gateOpen)  ++open;
+    while (close < n && fCaptureTimes[close] <= gateClose) ++close;
+    G4int inGate = std::max(close - open, 0);
+    fGateMultiplicity[std::min(inGate, kMaxMultiplicity)] += 1.;
+  }
+  fCaptureTimes.clear();
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void DieAwayHistogram::Reset()
+{
+  std::fill(fTime.begin(), fTime.end(), 0.);
+  std::fill(fEnergy.begin(), fEnergy.end(), 0.);
+  std::fill(fTimeEnergy.begin(), fTimeEnergy.end(), 0.);
+  std::fill(fEventMultiplicity.begin(), fEventMultiplicity.end(), 0.);
+  std::fill(fGateMultiplicity.begin(), fGateMultiplicity.end(), 0.);
+  fCaptureTimes.clear();
+}
+
+void DieAwayHistogram::Merge(const DieAwayHistogram& other)
+{
+  for (std::size_t i = 0; i < fTime.size(); ++i) fTime[i] += other.fTime[i];
+  for (std::size_t i = 0; i < fEnergy.size(); ++i) fEnergy[i] += other.fEnergy[i];
+  for (std::size_t i = 0; i < fTimeEnergy.size(); ++i) {
+    fTimeEnergy[i] += other.fTimeEnergy[i];
+  }
+  for (G4int i = 0; i <= kMaxMultiplicity; ++i) {
+    fEventMultiplicity[i] += other.fEventMultiplicity[i];
+    fGateMultiplicity[i]  += other.fGateMultiplicity[i];
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void DieAwayHistogram::Write(std::ostream& os) const
+{
+  WriteVector(os, "time", fTime);
+  WriteVector(os, "energy", fEnergy);
+  WriteVector(os, "timeEnergy", fTimeEnergy);
+  WriteVector(os, "eventMultiplicity", fEventMultiplicity);
+  WriteVector(os, "gateMultiplicity", fGateMultiplicity);
+}
+
+G4bool DieAwayHistogram::Read(std::istream& is)
+{
+  return ReadVector(is, "time", fTime)
+      && ReadVector(is, "energy", fEnergy)
+      && ReadVector(is, "timeEnergy", fTimeEnergy)
+      && ReadVector(is, "eventMultiplicity", fEventMultiplicity)
+      && ReadVector(is, "gateMultiplicity", fGateMultiplicity);
+}
+
+void DieAwayHistogram::Pack(std::vector<G4double>& buffer) const
+{
+  ParallelRun::PackVector(buffer, fTime);
+  ParallelRun::PackVector(buffer, fEnergy);
+  ParallelRun::PackVector(buffer, fTimeEnergy);
+  ParallelRun::PackVector(buffer, fEventMultiplicity);
+  ParallelRun::PackVector(buffer, fGateMultiplicity);
+}
+
+G4bool DieAwayHistogram::Unpack(const std::vector<G4double>& buffer,
+                                std::size_t& offset)
+{
+  return ParallelRun::UnpackVector(buffer, offset, fTime)
+      && ParallelRun::UnpackVector(buffer, offset, fEnergy)
+      && ParallelRun::UnpackVector(buffer, offset, fTimeEnergy)
+      && ParallelRun::UnpackVector(buffer, offset, fEventMultiplicity)
+      && ParallelRun::UnpackVector(buffer, offset, fGateMultiplicity);
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void DieAwayHistogram::WriteFile() const
+{
+  std::ofstream out(fFileName);
+  if (!out) {
+    G4ExceptionDescription msg;
+    msg << "Cannot open " << fFileName;
+    G4Exception("DieAwayHistogram::WriteFile()", "NMDS006", JustWarning, msg);
+    return;
+  }
+
+  out << "# NMDS-II counter die-away histograms\n"
+      << "# predelay_ns " << fPredelay/ns << " gate_ns " << fGate/ns << '\n'
+      << "# time bin edges [ns]\n";
+  for (G4int i = 0; i <= kTimeBins; ++i) out << GetTimeEdge(i)/ns << ' ';
+  out << "\n# energy bin edges [eV]\n";
+  for (G4int i = 0; i <= kEnergyBins; ++i) out << GetEnergyEdge(i)/eV << ' ';
+  out << '\n';
+
+  out << "# time: counter followed by " << kTimeBins << " bins\n";
+  for (G4int c = 0; c < kNofCounters; ++c) {
+    out << c;
+    for (G4int i = 0; i < kTimeBins; ++i) out << ' ' << fTime[c*kTimeBins + i];
+    out << '\n';
+  }
+  out << "# energy: counter followed by " << kEnergyBins << " bins\n";
+  for (G4int c = 0; c < kNofCounters; ++c) {
+    out << c;
+    for (G4int i = 0; i < kEnergyBins; ++i) {
+      out << ' ' << fEnergy[c*kEnergyBins + i];
+    }
+    out << '\n';
+  }
+  out << "# timeEnergy: time bin followed by " << kEnergyBins << " bins\n";
+  for (G4int t = 0; t < kTimeBins; ++t) {
+    out << t;
+    for (G4int i = 0; i < kEnergyBins; ++i) {
+      out << ' ' << fTimeEnergy[t*kEnergyBins + i];
+    }
+    out << '\n';
+  }
+  out << "# multiplicity: n events triggers\n";
+  for (G4int i = 0; i <= kMaxMultiplicity; ++i) {
+    out << i << ' ' << fEventMultiplicity[i] << ' '
+        << fGateMultiplicity[i] << '\n';
+  }
+
+  G4cout << "### Die-away histograms written to " << fFileName << G4endl;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void DieAwayHistogram::CollectAndWrite()
+{
+  CollectWorkers();
+  WriteFile();
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void DieAwayHistogram::DefineCommands()
+{
+  fMessenger = new G4GenericMessenger(this, "/nmds/dieaway/",
+                                      "Counter die-away histograms");
+
+  auto& predelayCmd = fMessenger->DeclarePropertyWithUnit("predelay", "us",
+                                  fPredelay, "Coincidence gate predelay.");
+  predelayCmd.SetParameterName("predelay", false);
+  predelayCmd.SetRange("predelay>=0.");
+
+  auto& gateCmd = fMessenger->DeclarePropertyWithUnit("gate", "us",
+                              fGate, "Coincidence gate width.");
+  gateCmd.SetParameterName("gate", false);
+  gateCmd.SetRange("gate>0.");
+
+  fMessenger->DeclareProperty("file", fFileName, "Output file name.");
+
+  fMessenger->DeclareMethod("write", &DieAwayHistogram::CollectAndWrite,
+                            "Merge the thread histograms and write them.");
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
@@ -0,0 +1,84 @@
+#ifndef DieAwayHistogram_h
+#define DieAwayHistogram_h 1
+
+#include "globals.hh"
+#include "DetectorLayout.hh"
+
+#include <iosfwd>
+#include <vector>
+
+class G4GenericMessenger;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+/// Streaming die-away and multiplicity histograms of the He-3 counters.
+///
+/// Captures are binned on the fly in log-spaced time (1 ns - 100 ms) and
+/// neutron energy (1e-5 eV - 10 MeV), per counter and for all counters in
+/// time x energy; values outside the range go to the first or last bin.
+/// At the end of each event the sorted capture times give the number of
+/// captures per event and, for every capture taken as trigger, the number
+/// of captures in the coincidence gate [predelay, predelay+gate] after it.
+///
+/// Memory is fixed (about 0.2 MB per thread) whatever the number of events;
+/// thread copies are merged like RunTally.
+
+class DieAwayHistogram
+{
+  public:
+    static const G4int kNofCounters     = DetectorLayout::kNumberOfCounters;
+    static const G4int kTimeBins        = 80;   // 10 per decade
+    static const G4int kEnergyBins      = 120;  // 10 per decade
+    static const G4int kMaxMultiplicity = 64;
+
+    static DieAwayHistogram* Instance();
+    static DieAwayHistogram* Master();
+    static void CollectWorkers();
+
+    void Fill(G4int counter, G4double time, G4double energy, G4double weight);
+    void EndOfEvent();
+
+    void Reset();
+    void Merge(const DieAwayHistogram& other);
+
+    void Write(std::ostream& os) const;
+    G4bool Read(std::istream& is);
+
+    // Sums as a flat buffer, for the reduction over processes (ParallelRun)
+    void Pack(std::vector<G4double>& buffer) const;
+    G4bool Unpack(const std::vector<G4double>& buffer, std::size_t& offset);
+    void WriteFile() const;
+
+    G4double GetTimeCount(G4int counter, G4int bin) const
+      { return fTime[counter*kTimeBins + bin]; }
+
+    static G4double GetTimeEdge(G4int bin);
+    static G4double GetEnergyEdge(G4int bin);
+
+  private:
+    DieAwayHistogram(G4bool master);
+    ~DieAwayHistogram();
+
+    static G4int TimeBin(G4double time);
+    static G4int EnergyBin(G4double energy);
+
+    void DefineCommands();
+    void CollectAndWrite();
+
+    std::vector<G4double> fTime;         // [counter][time]
+    std::vector<G4double> fEnergy;       // [counter][energy]
+    std::vector<G4double> fTimeEnergy;   // [time][energy]
+    std::vector<G4double> fEventMultiplicity;
+    std::vector<G4double> fGateMultiplicity;
+    std::vector<G4double> fCaptureTimes; // current event
+
+    G4GenericMessenger* fMessenger;
+
+    static G4double fPredelay;
+    static G4double fGate;
+    static G4String fFileName;
+};
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+#endif
@@ -0,0 +1,592 @@
+#include "EventFileSource.hh"
+#include "EventRandom.hh"
+#include "ParallelRun.hh"
+
+#include "G4AutoLock.hh"
+#include "G4GenericMessenger.hh"
+#include "G4Event.hh"
+#include "G4PrimaryVertex.hh"
+#include "G4PrimaryParticle.hh"
+#include "G4ParticleTable.hh"
+#include "G4IonTable.hh"
+#include "G4SystemOfUnits.hh"
+#include "G4ios.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+  G4Mutex eventFileMutex = G4MUTEX_INITIALIZER;
+
+  const char kMagic[8] = { 'N', 'M', 'D', 'S', 'E', 'V', 'T', '1' };
+  const std::size_t kEventBytes    = 8;
+  const std::size_t kParticleBytes = 8 + 9*sizeof(double);
+  const std::uint32_t kMaxParticles = 10000000;
+
+  // Bounded multi-producer multi-consumer queue (D. Vyukov): one
+  // compare-and-swap per operation, no lock. Records are swapped in and
+  // out so that their storage is reused.
+  class RecordQueue
+  {
+    public:
+      explicit RecordQueue(std::size_t capacity)
+       : fCells(new Cell[capacity]), fMask(capacity - 1), fHead(0), fTail(0)
+      {
+        for (std::size_t i = 0; i < capacity; ++i) {
+          fCells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+      }
+
+      G4bool TryPush(EventFileSource::Record& record)
+      {
+        std::size_t pos = fTail.load(std::memory_order_relaxed);
+        Cell* cell;
+        for (;;) {
+          cell = &fCells[pos & fMask];
+          std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+          std::ptrdiff_t diff = (std::ptrdiff_t)sequence - (std::ptrdiff_t)pos;
+          if (diff == 0) {
+            if (fTail.compare_exchange_weak(pos, pos + 1,
+                                            std::memory_order_relaxed)) break;
+          }
+          else if (diff < 0) return false;
+          else pos = fTail.load(std::memory_order_relaxed);
+        }
+        cell->record.swap(record);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+      }
+
+      G4bool TryPop(EventFileSource::Record& record)
+      {
+        std::size_t pos = fHead.load(std::memory_order_relaxed);
+        Cell* cell;
+        for (;;) {
+          cell = &fCells[pos & fMask];
+          std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+          std::ptrdiff_t diff = (std::ptrdiff_t)sequence - (std::ptrdiff_t)(pos + 1);
+          if (diff == 0) {
+            if (fHead.compare_exchange_weak(pos, pos + 1,
+                                            std::memory_order_relaxed)) break;
+          }
+          else if (diff < 0) return false;
+          else pos = fHead.load(std::memory_order_relaxed);
+        }
+        record.swap(cell->record);
+        cell->sequence.store(pos + fMask + 1, std::memory_order_release);
+        return true;
+      }
+
+      std::size_t Capacity() const { return fMask + 1; }
+
+    private:
+      struct Cell {
+        std::atomic<std::size_t> sequence;
+        EventFileSource::Record  record;
+      };
+
+      std::unique_ptr<Cell[]> fCells;
+      std::size_t fMask;
+      // Ends of the queue on their own cache lines
+      char fPad0[64];
+      std::atomic<std::size_t> fHead;
+      char fPad1[64];
+      std::atomic<std::size_t> fTail;
+      char fPad2[64];
+  };
+
+  void Decode(const char* data, std::uint32_t count,
+              EventFileSource::Record& record)
+  {
+    record.resize(count);
+    for (std::uint32_t i = 0; i < count; ++i) {
+      const char* p = data + i*kParticleBytes;
+      std::int32_t pdg;
+      double v[9];
+      std::memcpy(&pdg, p, sizeof(pdg));
+      std::memcpy(v, p + 8, sizeof(v));
+      EventFileSource::Particle& particle = record[i];
+      particle.pdg = pdg;
+      particle.position.set(v[0]*mm, v[1]*mm, v[2]*mm);
+      particle.time = v[3]*ns;
+      particle.energy = v[4]*MeV;
+      particle.direction.set(v[5], v[6], v[7]);
+      particle.weight = v[8];
+    }
+  }
+}
+
+std::vector<G4String> EventFileSource::fFiles;
+G4int  EventFileSource::fReaders  = 1;
+G4int  EventFileSource::fCapacity = 1024;
+G4bool EventFileSource::fLoop     = false;
+G4int  EventFileSource::fVersion  = 0;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+/// Reader threads of one pass setting, and the queue they fill.
+class EventFileSource::Reader
+{
+  public:
+    Reader(const std::vector<G4String>& files, G4int readers,
+           G4int capacity, G4bool loop);
+    ~Reader();
+
+    // Next event; false once the files are read and the queue is empty
+    G4bool Pop(Record& record);
+
+    // Messages of the readers since the last call
+    G4bool TakeErrors(std::vector<G4String>& errors);
+
+    void Print() const;
+
+  private:
+    void Run(std::vector<G4String> files);
+    void ReadFile(const G4String& fileName, G4long& events);
+    void ReadMapped(const G4String& fileName, const char* data,
+                    std::size_t size, G4long& events);
+    void ReadStream(const G4String& fileName, G4long& events);
+    G4bool Push(Record& record);
+    void Error(const G4String& message);
+
+    RecordQueue fQueue;
+    std::vector<G4String> fFiles;
+    G4bool fLoop;
+    std::vector<std::thread> fThreads;
+
+    std::atomic<G4bool> fStop;
+    std::atomic<G4int>  fRunning;
+
+    std::atomic<G4long> fEvents;
+    std::atomic<G4long> fBytes;
+    std::atomic<G4int>  fMapped;
+    std::atomic<G4long> fPopped;
+    std::atomic<G4long> fWaits;
+    std::atomic<G4long> fWaitTime;     // ns
+    std::atomic<G4long> fFull;
+
+    std::mutex fErrorMutex;
+    std::vector<G4String> fErrors;
+    std::set<G4String> fReported;
+    std::atomic<G4bool> fHasErrors;
+};
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+EventFileSource::Reader::Reader(const std::vector<G4String>& files,
+                                G4int readers, G4int capacity, G4bool loop)
+ : fQueue(capacity),
+   fLoop(loop),
+   fStop(false),
+   fRunning(0),
+   fEvents(0), fBytes(0), fMapped(0), fPopped(0),
+   fWaits(0), fWaitTime(0), fFull(0),
+   fHasErrors(false)
+{
+  // Files of this process, then of each reader
+  G4int rank = ParallelRun::GetRank();
+  G4int size = ParallelRun::GetSize();
+  for (std::size_t i = 0; i < files.size(); ++i) {
+    if ((G4int)(i%size) == rank) fFiles.push_back(files[i]);
+  }
+  G4int nofThreads = std::min(readers, (G4int)fFiles.size());
+  std::vector<std::vector<G4String>> shards(nofThreads);
+  for (std::size_t i = 0; i < fFiles.size(); ++i) {
+    shards[i%nofThreads].push_back(fFiles[i]);
+  }
+
+  fRunning = nofThreads;
+  for (G4int i = 0; i < nofThreads; ++i) {
+    fThreads.emplace_back(&Reader::Run, this, shards[i]);
+  }
+}
+
+EventFileSource::Reader::~Reader()
+{
+  fStop = true;
+  for (auto& thread : fThreads) thread.join();
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void EventFileSource::Reader::Run(std::vector<G4String> files)
+{
+  G4long pass;
+  do {
+    pass = 0;
+    for (const auto& fileName : files) {
+      if (fStop) break;
+      ReadFile(fileName, pass);
+    }
+  } while (fLoop && pass > 0 && !fStop);
+
+  fRunning.fetch_sub(1, std::memory_order_release);
+}
+
+void EventFileSource::Reader::ReadFile(const G4String& fileName, G4long& events)
+{
+  int fd = open(fileName.c_str(), O_RDONLY);
+  if (fd < 0) {
+    Error("cannot open " + fileName);
+    return;
+  }
+
+  struct stat status;
+  std::size_t size = (fstat(fd, &status) == 0) ? status.st_size : 0;
+  void* data = (size > 0)
+             ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+  close(fd);
+
+  if (data != MAP_FAILED) {
+    madvise(data, size, MADV_SEQUENTIAL);
+    ++fMapped;
+    ReadMapped(fileName, static_cast<const char*>(data), size, events);
+    munmap(data, size);
+  }
+  else {
+    ReadStream(fileName, events);
+  }
+}
+
+void EventFileSource::Reader::ReadMapped(const G4String& fileName,
+                                         const char* data, std::size_t size,
+                                         G4long& events)
+{
+  if (size < sizeof(kMagic) || std::memcmp(data, kMagic, sizeof(kMagic))) {
+    Error(fileName + " is not an event file");
+    return;
+  }
+
+  Record record;
+  std::size_t offset = sizeof(kMagic);
+  while (offset < size) {
+    std::uint32_t count;
+    if (size - offset < kEventBytes) break;
+    std::memcpy(&count, data + offset, sizeof(count));
+    if (count > kMaxParticles
+        || size - offset - kEventBytes < count*kParticleBytes) break;
+    Decode(data + offset + kEventBytes, count, record);
+    offset += kEventBytes + count*kParticleBytes;
+    fBytes += kEventBytes + count*kParticleBytes;
+    if (!Push(record)) return;
+    ++events;
+  }
+  if (offset < size) {
+    std::ostringstream message;
+    message << fileName << ": bad record at byte " << offset;
+    Error(message.str());
+  }
+}
+
+void EventFileSource::Reader::ReadStream(const G4String& fileName, G4long& events)
+{
+  std::ifstream in(fileName, std::ios::binary);
+  char magic[sizeof(kMagic)];
+  if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, kMagic, sizeof(kMagic))) {
+    Error(fileName + " is not an event file");
+    return;
+  }
+
+  Record record;
+  std::vector<char> buffer;
+  char header[kEventBytes];
+  while (in.read(header, kEventBytes)) {
+    std::uint32_t count;
+    std::memcpy(&count, header, sizeof(count));
+    if (count > kMaxParticles) break;
+    buffer.resize(count*kParticleBytes);
+    if (!in.read(buffer.data(), buffer.size())) break;
+    Decode(buffer.data(), count, record);
+    fBytes += kEventBytes + buffer.size();
+    if (!Push(record)) return;
+    ++events;
+  }
+  if (!in.eof() || in.gcount() > 0) {
+    Error(fileName + ": bad or truncated record");
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4bool EventFileSource::Reader::Push(Record& record)
+{
+  while (!fQueue.TryPush(record)) {
+    if (fStop) return false;
+    ++fFull;
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+  }
+  ++fEvents;
+  return true;
+}
+
+G4bool EventFileSource::Reader::Pop(Record& record)
+{
+  if (fQueue.TryPop(record)) {
+    ++fPopped;
+    return true;
+  }
+
+  // Readers behind: count the wait, never touch the files
+  auto start = std::chrono::steady_clock::now();
+  ++fWaits;
+  G4bool popped = false;
+  for (;;) {
+    if (fQueue.TryPop(record)) {
+      popped = true;
+      break;
+    }
+    if (fRunning.load(std::memory_order_acquire) == 0) {
+      popped = fQueue.TryPop(record);
+      break;
+    }
+    std::this_thread::yield();
+  }
+  fWaitTime += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                 std::chrono::steady_clock::now() - start).count();
+  if (popped) ++fPopped;
+  return popped;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void EventFileSource::Reader::Error(const G4String& message)
+{
+  // Once, not on every pass of a loop
+  std::lock_guard<std::mutex> lock(fErrorMutex);
+  if (!fReported.insert(message).second) return;
+  fErrors.push_back(message);
+  fHasErrors = true;
+}
+
+G4bool EventFileSource::Reader::TakeErrors(std::vector<G4String>& errors)
+{
+  if (!fHasErrors.load(std::memory_order_relaxed)) return false;
+  std::lock_guard<std::mutex> lock(fErrorMutex);
+  errors.swap(fErrors);
+  fErrors.clear();
+  fHasErrors = false;
+  return !errors.empty();
+}
+
+void EventFileSource::Reader::Print() const
+{
+  G4cout << "  files          " << fFiles.size() << " on this process, "
+         << fThreads.size() << " reader threads, " << fMapped
+         << " mapped" << G4endl
+         << "  decoded        " << fEvents << " events, "
+         << fBytes/(1024.*1024.) << " MB" << G4endl
+         << "  popped         " << fPopped << " events, queue of "
+         << fQueue.Capacity() << G4endl
+         << "  worker waits   " << fWaits << " (" << fWaitTime*1.e-9
+         << " s)" << G4endl
+         << "  reader waits   " << fFull << " on a full queue" << G4endl
+         << "  reading        " << (fRunning ? "in progress" : "done") << G4endl;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+EventFileSource::EventFileSource()
+ : G4VUserPrimaryGeneratorAction(),
+   fReaderVersion(-1),
+   fMessenger(nullptr)
+{
+}
+
+EventFileSource::~EventFileSource()
+{
+  delete fMessenger;
+}
+
+EventFileSource* EventFileSource::Master()
+{
+  static EventFileSource* master = nullptr;
+  if (!master) {
+    master = new EventFileSource();
+    master->DefineCommands();
+  }
+  return master;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+std::shared_ptr<EventFileSource::Reader> EventFileSource::GetReader(G4bool start)
+{
+  // One reader per settings, started by whichever thread asks first
+  static std::shared_ptr<Reader> cache;
+  static G4int cacheVersion = -1;
+
+  G4AutoLock lock(&eventFileMutex);
+  if (cache && cacheVersion != fVersion) cache.reset();
+  if (!cache && start) {
+    G4int capacity = 1;
+    while (capacity < fCapacity) capacity *= 2;
+    cache = std::make_shared<Reader>(fFiles, fReaders, capacity, fLoop);
+    cacheVersion = fVersion;
+  }
+  return cache;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void EventFileSource::GeneratePrimaries(G4Event* event)
+{
+  EventRandom::Reseed(event);
+
+  G4int version = fVersion;
+  if (!fReader || fReaderVersion != version) {
+    fReader = GetReader(true);
+    fReaderVersion = version;
+  }
+
+  std::vector<G4String> errors;
+  if (fReader->TakeErrors(errors)) {
+    for (const auto& error : errors) {
+      G4Exception("EventFileSource::GeneratePrimaries()", "NMDS022",
+                  JustWarning, error.c_str());
+    }
+  }
+
+  if (!fReader->Pop(fRecord)) {
+    G4ExceptionDescription msg;
+    msg << "No more events in the event files of this process ("
+        << fFiles.size() << " files in all); use /nmds/eventFile/loop true"
+        << " to read them again.";
+    G4Exception("EventFileSource::GeneratePrimaries()", "NMDS022",
+                RunMustBeAborted, msg);
+    event->SetEventAborted();
+    return;
+  }
+
+  for (const auto& p : fRecord) {
+    const G4ParticleDefinition* definition = FindDefinition(p.pdg);
+    if (!definition) continue;
+    auto particle = new G4PrimaryParticle(definition);
+    particle->SetKineticEnergy(p.energy);
+    particle->SetMomentumDirection(p.direction.unit());
+    particle->SetWeight(p.weight);
+    auto vertex = new G4PrimaryVertex(p.position, p.time);
+    vertex->SetPrimary(particle);
+    event->AddPrimaryVertex(vertex);
+  }
+}
+
+const G4ParticleDefinition* EventFileSource::FindDefinition(G4int pdg)
+{
+  auto it = fDefinitions.find(pdg);
+  if (it != fDefinitions.end()) return it->second;
+
+  const G4ParticleDefinition* definition
+    = G4ParticleTable::GetParticleTable()->FindParticle(pdg);
+  if (!definition && pdg > 1000000000) {
+    definition = G4IonTable::GetIonTable()->GetIon(pdg);
+  }
+  if (!definition) {
+    G4ExceptionDescription msg;
+    msg << "Unknown PDG code " << pdg << "; these particles are skipped.";
+    G4Exception("EventFileSource::FindDefinition()", "NMDS022",
+                JustWarning, msg);
+  }
+  fDefinitions[pdg] = definition;
+  return definition;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void EventFileSource::Print()
+{
+  G4cout << G4endl
+         << "---------------------------- Event files ----------------------------"
+         << G4endl
+         << "  files          " << fFiles.size() << ", " << fReaders
+         << " readers per process, queue " << fCapacity << " events, "
+         << (fLoop ? "looping" : "single pass") << G4endl;
+  auto reader = GetReader(false);
+  if (reader) reader->Print();
+  else G4cout << "  reading        not started" << G4endl;
+  G4cout << "---------------------------------------------------------------------"
+         << G4endl;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void EventFileSource::AddFile(const G4String& fileName)
+{
+  fFiles.push_back(fileName);
+  ++fVersion;
+}
+
+void EventFileSource::Clear()
+{
+  fFiles.clear();
+  ++fVersion;
+}
+
+void EventFileSource::SetReaders(G4int readers)
+{
+  fReaders = readers;
+  ++fVersion;
+}
+
+void EventFileSource::SetQueue(G4int capacity)
+{
+  fCapacity = capacity;
+  ++fVersion;
+}
+
+void EventFileSource::SetLoop(G4bool loop)
+{
+  fLoop = loop;
+  ++fVersion;
+}
+
+void EventFileSource::Rewind()
+{
+  ++fVersion;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void EventFileSource::DefineCommands()
+{
+  fMessenger = new G4GenericMessenger(this, "/nmds/eventFile/",
+                                      "Primaries read from event files");
+
+  fMessenger->DeclareMethod("add", &EventFileSource::AddFile,
+                            "Append an event file.");
+  fMessenger->DeclareMethod("clear", &EventFileSource::Clear,
+                            "Forget the event files.");
+
+  auto& readersCmd = fMessenger->DeclareMethod("readers",
+                     &EventFileSource::SetReaders,
+                     "Reader threads per process, each with its share of the files.");
+  readersCmd.SetParameterName("readers", false);
+  readersCmd.SetRange("readers>0");
+
+  auto& queueCmd = fMessenger->DeclareMethod("queue", &EventFileSource::SetQueue,
+                   "Events decoded ahead of the workers (rounded up to a power of 2).");
+  queueCmd.SetParameterName("events", false);
+  queueCmd.SetRange("events>0");
+
+  fMessenger->DeclareMethod("loop", &EventFileSource::SetLoop,
+                            "Read the files again once they are all read.");
+  fMessenger->DeclareMethod("rewind", &EventFileSource::Rewind,
+                            "Start again from the first event of the files.");
+  fMessenger->DeclareMethod("print", &EventFileSource::Print,
+                            "Print the files and the reading statistics.");
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
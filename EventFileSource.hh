@@ -0,0 +1,109 @@
+#ifndef EventFileSource_h
+#define EventFileSource_h 1
+
+#include "G4VUserPrimaryGeneratorAction.hh"
+#include "globals.hh"
+#include "G4ThreeVector.hh"
+
+#include <map>
+#include <memory>
+#include <vector>
+
+class G4Event;
+class G4ParticleDefinition;
+class G4GenericMessenger;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+/// Primaries read from precomputed event files (cosmic showers at the
+/// rock surface, spallation products in the target, ...), decoded ahead
+/// of the workers by dedicated reader threads.
+///
+/// The files are dealt over the processes of a parallel run (file i to
+/// rank i mod size), then over the reader threads of the process. Each
+/// reader maps its files in memory (plain reads when mapping fails),
+/// decodes the records and pushes the events into a bounded lock-free
+/// queue shared by the workers; a full queue makes the readers wait, the
+/// workers only pop. A worker finding the queue empty before the readers
+/// are done counts a wait and retries; /nmds/eventFile/print shows the
+/// waits, which stay at zero when reading keeps up. Each record is used
+/// once per pass over the files; which event gets which record depends on
+/// the timing of the threads. The event number plays no part: per-event
+/// seeding, EventRandom replay and a resumed ProductionRun do not give the
+/// same events again, and results with these files only agree within
+/// their statistical errors between runs, thread counts and processes.
+/// With loop, readers start over at the end of
+/// their files, otherwise the run is aborted when all are read.
+///
+/// File layout, native byte order: the 8 characters "NMDSEVT1", then per
+/// event a uint32 particle count and a uint32 set to 0, then per particle
+/// an int32 PDG code, a uint32 set to 0 and 9 doubles: x, y, z [mm],
+/// t [ns], kinetic energy [MeV], direction x, y, z and weight. Positions
+/// are global. Register EventFileSource on the workers as the primary
+/// generator.
+///
+///   /nmds/eventFile/add showers_000.bin
+///   /nmds/eventFile/clear
+///   /nmds/eventFile/readers 2
+///   /nmds/eventFile/queue 1024
+///   /nmds/eventFile/loop true
+///   /nmds/eventFile/rewind
+///   /nmds/eventFile/print
+
+class EventFileSource : public G4VUserPrimaryGeneratorAction
+{
+  public:
+    // Decoded particle of a record
+    struct Particle {
+      G4int         pdg;
+      G4ThreeVector position;
+      G4double      time;
+      G4double      energy;
+      G4ThreeVector direction;
+      G4double      weight;
+    };
+
+    typedef std::vector<Particle> Record;
+
+    class Reader;
+
+    EventFileSource();
+    virtual ~EventFileSource();
+
+    // Holds the commands
+    static EventFileSource* Master();
+
+    virtual void GeneratePrimaries(G4Event* event);
+
+    void Print();
+
+  private:
+    static std::shared_ptr<Reader> GetReader(G4bool start);
+
+    const G4ParticleDefinition* FindDefinition(G4int pdg);
+
+    void DefineCommands();
+    void AddFile(const G4String& fileName);
+    void Clear();
+    void SetReaders(G4int readers);
+    void SetQueue(G4int capacity);
+    void SetLoop(G4bool loop);
+    void Rewind();
+
+    std::shared_ptr<Reader> fReader;
+    G4int fReaderVersion;
+    Record fRecord;
+    std::map<G4int, const G4ParticleDefinition*> fDefinitions;
+
+    G4GenericMessenger* fMessenger;
+
+    static std::vector<G4String> fFiles;
+    static G4int  fReaders;
+    static G4int  fCapacity;
+    static G4bool fLoop;
+    static G4int  fVersion;
+};
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+#endif
@@ -0,0 +1,154 @@
+#include "EventRandom.hh"
+
+#include "G4Event.hh"
+#include "G4RunManager.hh"
+#include "G4GenericMessenger.hh"
+#include "G4SystemOfUnits.hh"
+#include "Randomize.hh"
+#include "G4ios.hh"
+
+#include <chrono>
+
+namespace
+{
+  // SplitMix64 finalizer: every bit of the input reaches every output bit
+  unsigned long long Mix(unsigned long long x)
+  {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30))*0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27))*0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+  }
+
+  G4ThreadLocal std::chrono::steady_clock::time_point* eventStart = nullptr;
+}
+
+G4bool   EventRandom::fPerEvent    = false;
+G4long   EventRandom::fRunSeed     = 12345;
+G4long   EventRandom::fEventOffset = 0;
+G4double EventRandom::fSlowEvent   = 0.;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+EventRandom* EventRandom::Instance()
+{
+  static EventRandom instance;
+  return &instance;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+EventRandom::EventRandom()
+ : fMessenger(nullptr)
+{
+  DefineCommands();
+}
+
+EventRandom::~EventRandom()
+{
+  delete fMessenger;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4long EventRandom::GetEventNumber(const G4Event* event)
+{
+  return fEventOffset + event->GetEventID();
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void EventRandom::Reseed(const G4Event* event)
+{
+  if (!fPerEvent) return;
+
+  unsigned long long key = Mix(Mix((unsigned long long)fRunSeed)
+                               ^ (unsigned long long)GetEventNumber(event));
+
+  // Two non-zero 31-bit seeds, zero terminated as the engines expect
+  long seeds[3];
+  seeds[0] = long((key & 0x7fffffffULL) | 1ULL);
+  seeds[1] = long(((key >> 32) & 0x7fffffffULL) | 1ULL);
+  seeds[2] = 0;
+  G4Random::setTheSeeds(seeds);
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void EventRandom::SeedStream(G4long stream)
+{
+  unsigned long long key = Mix(Mix(Mix((unsigned long long)fRunSeed)
+                                   ^ (unsigned long long)stream));
+  long seeds[3];
+  seeds[0] = long((key & 0x7fffffffULL) | 1ULL);
+  seeds[1] = long(((key >> 32) & 0x7fffffffULL) | 1ULL);
+  seeds[2] = 0;
+  G4Random::setTheSeeds(seeds);
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void EventRandom::BeginOfEvent()
+{
+  if (fSlowEvent <= 0.) return;
+  if (!eventStart) eventStart = new std::chrono::steady_clock::time_point;
+  *eventStart = std::chrono::steady_clock::now();
+}
+
+void EventRandom::EndOfEvent()
+{
+  if (fSlowEvent <= 0. || !eventStart) return;
+  std::chrono::duration<G4double> elapsed =
+    std::chrono::steady_clock::now() - *eventStart;
+  if (elapsed.count()*s < fSlowEvent) return;
+
+  const G4Event* event = G4RunManager::GetRunManager()->GetCurrentEvent();
+  if (!event) return;
+  G4cout << "### Slow event " << GetEventNumber(event) << ": "
+         << elapsed.count() << " s";
+  if (fPerEvent) {
+    G4cout << ", replay with /nmds/random/replay " << GetEventNumber(event);
+  }
+  G4cout << G4endl;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void EventRandom::Replay(G4long eventNumber)
+{
+  if (!fPerEvent) {
+    G4Exception("EventRandom::Replay()", "NMDS013", JustWarning,
+                "Replay needs per-event seeding (/nmds/random/perEvent).");
+    return;
+  }
+
+  // A one-event run whose event 0 has this number
+  G4long offset = fEventOffset;
+  fEventOffset = eventNumber;
+  G4RunManager::GetRunManager()->BeamOn(1);
+  fEventOffset = offset;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void EventRandom::DefineCommands()
+{
+  fMessenger = new G4GenericMessenger(this, "/nmds/random/",
+                                      "Per-event random streams");
+
+  fMessenger->DeclareProperty("perEvent", fPerEvent,
+                              "Seed every event from run seed and event number.");
+  fMessenger->DeclareProperty("runSeed", fRunSeed,
+                              "Seed of the whole run.");
+  fMessenger->DeclareProperty("eventOffset", fEventOffset,
+                              "Number of the first event of the next run.");
+  fMessenger->DeclarePropertyWithUnit("slowEvent", "s", fSlowEvent,
+                              "Report events slower than this; 0 for none.");
+
+  auto& replayCmd = fMessenger->DeclareMethod("replay", &EventRandom::Replay,
+                                              "Run one event again, alone.");
+  replayCmd.SetParameterName("event", false);
+  replayCmd.SetRange("event>=0");
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
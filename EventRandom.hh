@@ -0,0 +1,71 @@
+#ifndef EventRandom_h
+#define EventRandom_h 1
+
+#include "globals.hh"
+
+class G4Event;
+class G4GenericMessenger;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+/// Random stream of each event seeded from (run seed, event number) only.
+///
+/// The event number is the event ID plus an offset that ProductionRun
+/// sets to the events already done before each chunk, so that it counts
+/// events across a whole production. With per-event seeding on, an
+/// event's random numbers do not depend on the thread that runs it or on
+/// the events before it: results do not depend on the number of threads,
+/// and any event can be run again alone, bit for bit, with replay.
+/// This holds for generators whose primaries come from the random
+/// numbers only; EventFileSource hands out records in the order the
+/// threads ask for them, so its events are not reproduced.
+/// Events slower than a threshold are reported with their number.
+///
+/// The primary generator calls Reseed() first thing in
+/// GeneratePrimaries() (ResponseSource does); the per-event seeds
+/// Geant4 draws from the master engine are then overridden.
+///
+///   /nmds/random/perEvent true
+///   /nmds/random/runSeed 12345
+///   /nmds/random/slowEvent 10 s
+///   /nmds/random/replay 123456
+
+class EventRandom
+{
+  public:
+    static EventRandom* Instance();
+
+    static G4bool IsPerEvent() { return fPerEvent; }
+
+    // Seed the thread engine for this event
+    static void Reseed(const G4Event* event);
+
+    // Seed the master engine for stream (process) number stream
+    static void SeedStream(G4long stream);
+
+    static void SetEventOffset(G4long offset) { fEventOffset = offset; }
+    static G4long GetEventNumber(const G4Event* event);
+
+    // Wall time of the events of this thread, from ScoringEventAction
+    static void BeginOfEvent();
+    static void EndOfEvent();
+
+    void Replay(G4long eventNumber);
+
+  private:
+    EventRandom();
+    ~EventRandom();
+
+    void DefineCommands();
+
+    G4GenericMessenger* fMessenger;
+
+    static G4bool   fPerEvent;
+    static G4long   fRunSeed;
+    static G4long   fEventOffset;
+    static G4double fSlowEvent;
+};
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+#endif
@@ -0,0 +1,252 @@
+#include "FieldMap.hh"
+
+#include "G4AutoLock.hh"
+#include "G4GenericMessenger.hh"
+#include "G4SystemOfUnits.hh"
+#include "G4ios.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+namespace
+{
+  G4Mutex fieldMapMutex = G4MUTEX_INITIALIZER;
+}
+
+G4String FieldMap::fFileName = "";
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+/// Commands of the field map, defined once for the application.
+class FieldMap::Messenger
+{
+  public:
+    Messenger();
+    ~Messenger() { delete fMessenger; }
+
+  private:
+    void Check();
+
+    G4GenericMessenger* fMessenger;
+};
+
+FieldMap::Messenger::Messenger()
+ : fMessenger(nullptr)
+{
+  fMessenger = new G4GenericMessenger(this, "/nmds/field/",
+                                      "Magnetic field map");
+  fMessenger->DeclareProperty("map", FieldMap::fFileName,
+                              "Field map file, read at /run/initialize.");
+  fMessenger->DeclareMethod("check", &Messenger::Check,
+                            "Check the interpolation on a linear field.");
+}
+
+void FieldMap::Messenger::Check()
+{
+  G4double deviation = FieldMap::CheckLinear();
+  G4cout << "### Field map check: linear field reproduced within "
+         << deviation << " of its largest value" << G4endl;
+  if (deviation > 1.e-5) {
+    G4ExceptionDescription msg;
+    msg << "Interpolation of a linear field off by " << deviation
+        << " of its largest value";
+    G4Exception("FieldMap::CheckLinear()", "NMDS010", JustWarning, msg);
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+FieldMap::FieldMap()
+ : G4MagneticField()
+{
+  if (!fFileName.empty()) fGrid = Load(fFileName);
+}
+
+FieldMap::FieldMap(const std::shared_ptr<const Grid>& grid)
+ : G4MagneticField(),
+   fGrid(grid)
+{
+}
+
+FieldMap::~FieldMap()
+{
+}
+
+void FieldMap::DefineCommands()
+{
+  static Messenger messenger;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+std::shared_ptr<const FieldMap::Grid> FieldMap::Load(const G4String& fileName)
+{
+  // One copy per file name, whichever thread asks first
+  static std::shared_ptr<const Grid> cache;
+  static G4String cacheName;
+
+  G4AutoLock lock(&fieldMapMutex);
+  if (cache && cacheName == fileName) return cache;
+
+  std::ifstream in(fileName);
+  auto grid = std::make_shared<Grid>();
+  G4double low[3], high[3];
+  G4bool ok = in && (in >> grid->n[0] >> grid->n[1] >> grid->n[2]);
+  ok = ok && grid->n[0] > 1 && grid->n[1] > 1 && grid->n[2] > 1;
+  ok = ok && (in >> low[0] >> low[1] >> low[2] >> high[0] >> high[1] >> high[2]);
+
+  if (ok) {
+    G4long size = (G4long)grid->n[0]*grid->n[1]*grid->n[2];
+    grid->nodes.resize(size);
+    for (G4long i = 0; i < size && ok; ++i) {
+      G4double bx, by, bz;
+      ok = (G4bool)(in >> bx >> by >> bz);
+      Node& node = grid->nodes[i];
+      node.b[0] = bx*tesla;
+      node.b[1] = by*tesla;
+      node.b[2] = bz*tesla;
+      node.b[3] = 0.f;
+    }
+  }
+  if (!ok) {
+    G4ExceptionDescription msg;
+    msg << "Cannot read the field map " << fileName;
+    G4Exception("FieldMap::Load()", "NMDS010", FatalException, msg);
+    return nullptr;
+  }
+
+  for (G4int i = 0; i < 3; ++i) {
+    low[i] *= cm;
+    high[i] *= cm;
+  }
+  SetBounds(*grid, low, high);
+
+  G4cout << "### Field map " << fileName << ": " << grid->n[0] << " x "
+         << grid->n[1] << " x " << grid->n[2] << " nodes" << G4endl;
+
+  cache = grid;
+  cacheName = fileName;
+  return cache;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void FieldMap::SetBounds(Grid& grid, const G4double low[3],
+                         const G4double high[3])
+{
+  for (G4int i = 0; i < 3; ++i) {
+    grid.low[i] = low[i];
+    grid.inverseWidth[i] = (grid.n[i] - 1)/(high[i] - low[i]);
+  }
+
+  // Corners of a cell relative to its lowest node
+  G4long nx = grid.n[0];
+  G4long nxy = nx*grid.n[1];
+  for (G4int c = 0; c < 8; ++c) {
+    grid.offsets[c] = (c & 1) + ((c >> 1) & 1)*nx + ((c >> 2) & 1)*nxy;
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4double FieldMap::CheckLinear()
+{
+  // B = b0 + g x on an uneven grid, sampled off the nodes
+  const G4double b0[3] = { 0.1*tesla, -0.2*tesla, 0.3*tesla };
+  const G4double g[3][3] = { {  0.01,  0.02, -0.01 },
+                             { -0.03,  0.01,  0.02 },
+                             {  0.02, -0.01,  0.03 } };   // tesla/cm
+  auto linear = [&](const G4double x[3], G4int m) {
+    return b0[m] + (g[m][0]*x[0] + g[m][1]*x[1] + g[m][2]*x[2])*tesla/cm;
+  };
+
+  auto grid = std::make_shared<Grid>();
+  grid->n[0] = 4;
+  grid->n[1] = 5;
+  grid->n[2] = 7;
+  const G4double low[3]  = { -10.*cm, -20.*cm, -30.*cm };
+  const G4double high[3] = {  10.*cm,  25.*cm,  30.*cm };
+  SetBounds(*grid, low, high);
+
+  grid->nodes.resize(grid->n[0]*grid->n[1]*grid->n[2]);
+  G4double scale = 0.;
+  G4long i = 0;
+  for (G4int k = 0; k < grid->n[2]; ++k) {
+    for (G4int j = 0; j < grid->n[1]; ++j) {
+      for (G4int l = 0; l < grid->n[0]; ++l, ++i) {
+        G4int index[3] = { l, j, k };
+        G4double x[3];
+        for (G4int a = 0; a < 3; ++a) {
+          x[a] = low[a] + index[a]/grid->inverseWidth[a];
+        }
+        for (G4int m = 0; m < 3; ++m) {
+          grid->nodes[i].b[m] = float(linear(x, m));
+          scale = std::max(scale, std::fabs(linear(x, m)));
+        }
+        grid->nodes[i].b[3] = 0.f;
+      }
+    }
+  }
+
+  FieldMap field(grid);
+  G4double worst = 0.;
+  const G4int nofPoints = 11;
+  for (G4int k = 0; k < nofPoints; ++k) {
+    for (G4int j = 0; j < nofPoints; ++j) {
+      for (G4int l = 0; l < nofPoints; ++l) {
+        G4int step[3] = { l, j, k };
+        G4double point[4] = { 0., 0., 0., 0. };
+        for (G4int a = 0; a < 3; ++a) {
+          point[a] = low[a] + (high[a] - low[a])*(step[a] + 0.37)/nofPoints;
+        }
+        G4double b[3];
+        field.GetFieldValue(point, b);
+        for (G4int m = 0; m < 3; ++m) {
+          worst = std::max(worst, std::fabs(b[m] - linear(point, m))/scale);
+        }
+      }
+    }
+  }
+  return worst;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void FieldMap::GetFieldValue(const G4double point[4], G4double* field) const
+{
+  field[0] = field[1] = field[2] = 0.;
+  if (!fGrid) return;
+  const Grid& grid = *fGrid;
+
+  G4long index[3];
+  G4double f[3];
+  for (G4int i = 0; i < 3; ++i) {
+    G4double u = (point[i] - grid.low[i])*grid.inverseWidth[i];
+    if (!(u >= 0. && u <= grid.n[i] - 1)) return;
+    G4long cell = std::min((G4long)u, (G4long)grid.n[i] - 2);
+    index[i] = cell;
+    f[i] = u - cell;
+  }
+
+  G4double fx[2] = { 1. - f[0], f[0] };
+  G4double fy[2] = { 1. - f[1], f[1] };
+  G4double fz[2] = { 1. - f[2], f[2] };
+  float weights[8];
+  for (G4int c = 0; c < 8; ++c) {
+    weights[c] = float(fx[c & 1]*fy[(c >> 1) & 1]*fz[(c >> 2) & 1]);
+  }
+
+  const Node* base = &grid.nodes[index[0] +
+                                 grid.n[0]*(index[1] + grid.n[1]*index[2])];
+  alignas(16) float b[4] = { 0.f, 0.f, 0.f, 0.f };
+  for (G4int c = 0; c < 8; ++c) {
+    const float* node = base[grid.offsets[c]].b;
+    for (G4int m = 0; m < 4; ++m) b[m] += weights[c]*node[m];
+  }
+  field[0] = b[0];
+  field[1] = b[1];
+  field[2] = b[2];
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
@@ -0,0 +1,75 @@
+#ifndef FieldMap_h
+#define FieldMap_h 1
+
+#include "globals.hh"
+#include "G4MagneticField.hh"
+
+#include <memory>
+#include <vector>
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+/// Magnetic field interpolated trilinearly on a regular grid.
+///
+/// The grid is read once, by the first thread that needs it, and shared
+/// read-only by the field objects of all threads. Nodes are stored as
+/// 16-byte aligned float quadruplets, x fastest, so that a cell is eight
+/// short strided loads and the interpolation a fixed 8 x 4 loop. The field
+/// is zero outside the grid. The map is only used when a file is given
+/// before /run/initialize; otherwise no field is built at all.
+///
+/// File format (text): "nx ny nz", then "xmin ymin zmin xmax ymax zmax"
+/// in cm, then nx*ny*nz lines "bx by bz" in tesla, x fastest, then y, z.
+///
+/// The commands are held apart from any field. check interpolates a
+/// linear field tabulated on a small grid, which trilinear interpolation
+/// must reproduce, and prints the largest deviation.
+///
+///   /nmds/field/map field.txt
+///   /nmds/field/check
+
+class FieldMap : public G4MagneticField
+{
+  public:
+    FieldMap();
+    virtual ~FieldMap();
+
+    // Commands, held without building a field
+    static void DefineCommands();
+
+    static const G4String& GetFileName() { return fFileName; }
+
+    virtual void GetFieldValue(const G4double point[4], G4double* field) const;
+
+  private:
+    struct alignas(16) Node {
+      float b[4];
+    };
+
+    struct Grid {
+      G4int n[3];
+      G4double low[3];
+      G4double inverseWidth[3];
+      G4long offsets[8];
+      std::vector<Node> nodes;
+    };
+
+    class Messenger;
+
+    explicit FieldMap(const std::shared_ptr<const Grid>& grid);
+
+    static std::shared_ptr<const Grid> Load(const G4String& fileName);
+    static void SetBounds(Grid& grid, const G4double low[3],
+                          const G4double high[3]);
+
+    // Largest deviation from a linear field, over its largest value
+    static G4double CheckLinear();
+
+    std::shared_ptr<const Grid> fGrid;
+
+    static G4String fFileName;
+};
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+#endif
@@ -0,0 +1,437 @@
+#include "FluenceMesh.hh"
+#include "DetectorLayout.hh"
+#include "ParallelRun.hh"
+
+#include "G4Step.hh"
+#include "G4Track.hh"
+#include "G4Neutron.hh"
+#include "G4AutoLock.hh"
+#include "G4GenericMessenger.hh"
+#include "G4SystemOfUnits.hh"
+#include "G4ios.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+
+namespace
+{
+  G4Mutex meshMutex = G4MUTEX_INITIALIZER;
+  std::vector<FluenceMesh*>* workers = nullptr;
+
+  template <class T>
+  void WriteRaw(std::ostream& os, const T& value)
+  {
+    os.write(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+}
+
+G4bool        FluenceMesh::fEnabled      = false;
+G4int         FluenceMesh::fExtent       = 0;
+G4ThreeVector FluenceMesh::fBins         = G4ThreeVector(100, 60, 100);
+G4int         FluenceMesh::fEnergyGroups = 1;
+G4double      FluenceMesh::fEmin         = 1.e-5*eV;
+G4double      FluenceMesh::fEmax         = 20.*MeV;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+FluenceMesh* FluenceMesh::Instance()
+{
+  static G4ThreadLocal FluenceMesh* instance = nullptr;
+  if (!instance) {
+    instance = new FluenceMesh(false);
+    G4AutoLock lock(&meshMutex);
+    if (!workers) workers = new std::vector<FluenceMesh*>;
+    workers->push_back(instance);
+  }
+  return instance;
+}
+
+FluenceMesh* FluenceMesh::Master()
+{
+  static FluenceMesh master(true);
+  return &master;
+}
+
+void FluenceMesh::CollectWorkers()
+{
+  G4AutoLock lock(&meshMutex);
+  if (!workers) return;
+  FluenceMesh* master = Master();
+  for (auto worker : *workers) {
+    master->Merge(*worker);
+    worker->Reset();
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+FluenceMesh::FluenceMesh(G4bool master)
+ : fConfigExtent(-1),
+   fConfigEmin(0.),
+   fConfigEmax(0.),
+   fGroups(0),
+   fNofEvents(0),
+   fMessenger(nullptr)
+{
+  fN[0] = fN[1] = fN[2] = 0;
+  if (master) DefineCommands();
+}
+
+FluenceMesh::~FluenceMesh()
+{
+  delete fMessenger;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void FluenceMesh::Configure()
+{
+  auto layout = DetectorLayout::Instance();
+  G4ThreeVector center, half;
+  if (fExtent == 1) {
+    center = layout->GetBoxCenter();
+    G4double boxHalf = layout->GetBoxHalf();
+    half = G4ThreeVector(boxHalf, boxHalf, boxHalf);
+  }
+  else {
+    half = layout->GetRoomHalf();
+  }
+
+  fConfigBins   = fBins;
+  fConfigExtent = fExtent;
+  fConfigEmin   = fEmin;
+  fConfigEmax   = fEmax;
+  fGroups       = fEnergyGroups;
+
+  for (G4int i = 0; i < 3; ++i) {
+    fN[i] = std::max((G4int)fBins[i], 1);
+    fWidth[i] = 2.*half[i]/fN[i];
+    fCross[i].reserve(fN[i] + 1);
+  }
+  fLow = center - half;
+  fMerged.reserve(fN[0] + fN[1] + fN[2] + 2);
+  fBuffer.reserve(fN[0] + fN[1] + fN[2] + 2);
+  fIndex.reserve(fN[0] + fN[1] + fN[2] + 2);
+
+  G4int nbins = fN[0]*fN[1]*fN[2]*fGroups;
+  fEvent.assign(nbins, 0.);
+  fSum.assign(nbins, 0.);
+  fSum2.assign(nbins, 0.);
+  fTouched.clear();
+  fNofEvents = 0;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4int FluenceMesh::EnergyGroup(G4double energy) const
+{
+  if (fGroups == 1) return 0;
+  if (energy < fConfigEmin || energy >= fConfigEmax) return -1;
+  return (G4int)(fGroups*std::log(energy/fConfigEmin)
+                        /std::log(fConfigEmax/fConfigEmin));
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void FluenceMesh::BeginOfRun()
+{
+  // Rebuild the grid when the configuration changed between runs
+  if (fConfigBins != fBins || fConfigExtent != fExtent ||
+      fGroups != fEnergyGroups || fConfigEmin != fEmin || fConfigEmax != fEmax) {
+    Configure();
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void FluenceMesh::Step(const G4Step* step)
+{
+  const G4Track* track = step->GetTrack();
+  if (track->GetDefinition() != G4Neutron::Definition()) return;
+
+  const G4StepPoint* prePoint = step->GetPreStepPoint();
+  G4int group = EnergyGroup(prePoint->GetKineticEnergy());
+  if (group < 0) return;
+
+  Score(prePoint->GetPosition(), step->GetPostStepPoint()->GetPosition(),
+        track->GetWeight(), group);
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void FluenceMesh::Score(const G4ThreeVector& p0, const G4ThreeVector& p1,
+                        G4double weight, G4int group)
+{
+  G4ThreeVector delta = p1 - p0;
+  G4double length = delta.mag();
+  if (length <= 0.) return;
+
+  // Segment in voxel units, u(t) = u0 + t*du, clipped to the mesh
+  G4double u0[3], du[3];
+  G4double t0 = 0., t1 = 1.;
+  for (G4int i = 0; i < 3; ++i) {
+    u0[i] = (p0[i] - fLow[i])/fWidth[i];
+    du[i] = delta[i]/fWidth[i];
+    if (du[i] == 0.) {
+      if (u0[i] < 0. || u0[i] >= fN[i]) return;
+      continue;
+    }
+    G4double ta = -u0[i]/du[i];
+    G4double tb = (fN[i] - u0[i])/du[i];
+    if (ta > tb) std::swap(ta, tb);
+    t0 = std::max(t0, ta);
+    t1 = std::min(t1, tb);
+  }
+  if (t0 >= t1) return;
+
+  G4int first[3], last[3];
+  G4bool single = true;
+  for (G4int i = 0; i < 3; ++i) {
+    first[i] = std::min(std::max((G4int)(u0[i] + t0*du[i]), 0), fN[i] - 1);
+    last[i]  = std::min(std::max((G4int)(u0[i] + t1*du[i]), 0), fN[i] - 1);
+    if (first[i] != last[i]) single = false;
+  }
+
+  G4int offset = group*fN[0]*fN[1]*fN[2];
+  G4double scale = weight*length;
+
+  // Short path: the step stays in one voxel
+  if (single) {
+    G4int bin = offset + (first[0]*fN[1] + first[1])*fN[2] + first[2];
+    if (fEvent[bin] == 0.) fTouched.push_back(bin);
+    fEvent[bin] += scale*(t1 - t0);
+    return;
+  }
+
+  // Grid planes crossed along each axis, in increasing t
+  for (G4int i = 0; i < 3; ++i) {
+    std::vector<G4double>& cross = fCross[i];
+    if (first[i] == last[i]) {
+      cross.clear();
+      continue;
+    }
+    G4int count = std::abs(last[i] - first[i]);
+    cross.resize(count);
+    G4double inv = 1./du[i];
+    G4double start = (du[i] > 0.) ? first[i] + 1 : first[i];
+    G4double sign  = (du[i] > 0.) ? 1. : -1.;
+    G4double base  = u0[i];
+    G4double* t = cross.data();
+    for (G4int k = 0; k < count; ++k) t[k] = (start + sign*k - base)*inv;
+  }
+
+  fBuffer.resize(fCross[0].size() + fCross[1].size());
+  std::merge(fCross[0].begin(), fCross[0].end(),
+             fCross[1].begin(), fCross[1].end(), fBuffer.begin());
+  fMerged.resize(fBuffer.size() + fCross[2].size() + 2);
+  fMerged.front() = t0;
+  std::merge(fBuffer.begin(), fBuffer.end(),
+             fCross[2].begin(), fCross[2].end(), fMerged.begin() + 1);
+  fMerged.back() = t1;
+
+  // Voxel and length of each interval, from its midpoint
+  G4int nintervals = (G4int)fMerged.size() - 1;
+  fIndex.resize(nintervals);
+  fBuffer.resize(nintervals);
+  const G4double* t = fMerged.data();
+  G4int* index = fIndex.data();
+  G4double* value = fBuffer.data();
+  for (G4int k = 0; k < nintervals; ++k) {
+    G4double tm = 0.5*(t[k] + t[k+1]);
+    G4int ix = std::min(std::max((G4int)(u0[0] + tm*du[0]), 0), fN[0] - 1);
+    G4int iy = std::min(std::max((G4int)(u0[1] + tm*du[1]), 0), fN[1] - 1);
+    G4int iz = std::min(std::max((G4int)(u0[2] + tm*du[2]), 0), fN[2] - 1);
+    index[k] = offset + (ix*fN[1] + iy)*fN[2] + iz;
+    value[k] = (t[k+1] - t[k])*scale;
+  }
+
+  for (G4int k = 0; k < nintervals; ++k) {
+    if (value[k] <= 0.) continue;
+    if (fEvent[index[k]] == 0.) fTouched.push_back(index[k]);
+    fEvent[index[k]] += value[k];
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void FluenceMesh::EndOfEvent()
+{
+  // Every history counts, with or without a neutron in the mesh
+  for (auto bin : fTouched) {
+    G4double x = fEvent[bin];
+    fSum[bin]  += x;
+    fSum2[bin] += x*x;
+    fEvent[bin] = 0.;
+  }
+  fTouched.clear();
+  ++fNofEvents;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void FluenceMesh::Reset()
+{
+  std::fill(fEvent.begin(), fEvent.end(), 0.);
+  std::fill(fSum.begin(), fSum.end(), 0.);
+  std::fill(fSum2.begin(), fSum2.end(), 0.);
+  fTouched.clear();
+  fNofEvents = 0;
+}
+
+void FluenceMesh::Merge(const FluenceMesh& other)
+{
+  if (!other.fSum.empty()) {
+    if (fSum.size() != other.fSum.size()) Configure();
+    for (std::size_t i = 0; i < fSum.size(); ++i) {
+      fSum[i]  += other.fSum[i];
+      fSum2[i] += other.fSum2[i];
+    }
+  }
+  fNofEvents += other.fNofEvents;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void FluenceMesh::Write(std::ostream& os) const
+{
+  // Sparse, exact: only the voxels that were scored
+  G4int nonzero = 0;
+  for (auto x : fSum) if (x != 0.) ++nonzero;
+
+  os << "mesh " << fSum.size() << ' ' << fNofEvents << ' ' << nonzero << '\n'
+     << std::hexfloat;
+  for (std::size_t i = 0; i < fSum.size(); ++i) {
+    if (fSum[i] == 0.) continue;
+    os << i << ' ' << fSum[i] << ' ' << fSum2[i] << '\n';
+  }
+  os << std::defaultfloat;
+}
+
+G4bool FluenceMesh::Read(std::istream& is)
+{
+  std::string key, s1, s2;
+  std::size_t nbins = 0, index = 0;
+  G4long nevents = 0;
+  G4int nonzero = 0;
+  is >> key >> nbins >> nevents >> nonzero;
+  if (!is || key != "mesh") return false;
+
+  if (nbins > 0 && fSum.size() != nbins) Configure();
+  if (fSum.size() != nbins) return false;
+  Reset();
+  for (G4int i = 0; i < nonzero; ++i) {
+    is >> index >> s1 >> s2;
+    if (!is || index >= nbins) return false;
+    fSum[index]  = std::strtod(s1.c_str(), nullptr);
+    fSum2[index] = std::strtod(s2.c_str(), nullptr);
+  }
+  fNofEvents = nevents;
+  return true;
+}
+
+void FluenceMesh::Pack(std::vector<G4double>& buffer) const
+{
+  buffer.push_back(fNofEvents);
+  ParallelRun::PackVector(buffer, fSum);
+  ParallelRun::PackVector(buffer, fSum2);
+}
+
+G4bool FluenceMesh::Unpack(const std::vector<G4double>& buffer,
+                           std::size_t& offset)
+{
+  if (offset >= buffer.size()) return false;
+  G4long nevents = (G4long)buffer[offset++];
+  if (!ParallelRun::UnpackVector(buffer, offset, fSum) ||
+      !ParallelRun::UnpackVector(buffer, offset, fSum2)) return false;
+  fNofEvents = nevents;
+  return true;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void FluenceMesh::WriteFile(const G4String& fileName) const
+{
+  std::ofstream out(fileName, std::ios::binary);
+  if (!out || fSum.empty()) {
+    G4ExceptionDescription msg;
+    msg << "Cannot write the fluence mesh to " << fileName;
+    G4Exception("FluenceMesh::WriteFile()", "NMDS008", JustWarning, msg);
+    return;
+  }
+
+  // Header, then fluence [1/cm2 per event] and relative error,
+  // x slowest, energy group slowest of all
+  out.write("NMDSMESH", 8);
+  WriteRaw(out, (G4int)1);
+  for (G4int i = 0; i < 3; ++i) WriteRaw(out, fN[i]);
+  WriteRaw(out, fGroups);
+  for (G4int i = 0; i < 3; ++i) WriteRaw(out, fLow[i]/cm);
+  for (G4int i = 0; i < 3; ++i) WriteRaw(out, (fLow[i] + fN[i]*fWidth[i])/cm);
+  WriteRaw(out, fConfigEmin/MeV);
+  WriteRaw(out, fConfigEmax/MeV);
+  WriteRaw(out, (long long)fNofEvents);
+
+  G4double volume = fWidth[0]*fWidth[1]*fWidth[2]/cm3;
+  G4double n = std::max<G4double>(fNofEvents, 1.);
+  for (auto sum : fSum) WriteRaw(out, sum/cm/volume/n);
+  for (std::size_t i = 0; i < fSum.size(); ++i) {
+    G4double error = 1.;
+    if (fSum[i] > 0. && fNofEvents > 1) {
+      G4double mean = fSum[i]/n;
+      G4double var = (fSum2[i]/n - mean*mean)/(n - 1.);
+      error = (var > 0.) ? std::sqrt(var)/mean : 0.;
+    }
+    WriteRaw(out, error);
+  }
+
+  G4cout << "### Fluence mesh " << fN[0] << "x" << fN[1] << "x" << fN[2]
+         << "x" << fGroups << " (" << fNofEvents << " events) written to "
+         << fileName << G4endl;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void FluenceMesh::CollectAndWrite(const G4String& fileName)
+{
+  CollectWorkers();
+  WriteFile(fileName);
+}
+
+void FluenceMesh::SetExtent(const G4String& extent)
+{
+  fExtent = (extent == "box") ? 1 : 0;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void FluenceMesh::DefineCommands()
+{
+  fMessenger = new G4GenericMessenger(this, "/nmds/mesh/",
+                                      "Track-length fluence mesh");
+
+  fMessenger->DeclareProperty("enable", fEnabled,
+                              "Score neutron fluence on the mesh.");
+
+  fMessenger->DeclareMethod("extent", &FluenceMesh::SetExtent,
+                            "Mesh over the room or the moderator box.")
+    .SetCandidates("room box");
+
+  fMessenger->DeclareProperty("bins", fBins, "Number of bins in x, y, z.");
+
+  auto& groupsCmd = fMessenger->DeclareProperty("energyGroups", fEnergyGroups,
+                    "Number of log-spaced energy groups.");
+  groupsCmd.SetParameterName("groups", false);
+  groupsCmd.SetRange("groups>0");
+
+  fMessenger->DeclarePropertyWithUnit("emin", "eV", fEmin,
+                                      "Lower edge of the energy groups.");
+  fMessenger->DeclarePropertyWithUnit("emax", "MeV", fEmax,
+                                      "Upper edge of the energy groups.");
+
+  fMessenger->DeclareMethod("write", &FluenceMesh::CollectAndWrite,
+                            "Merge the thread meshes and write them.");
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
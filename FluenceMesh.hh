@@ -0,0 +1,115 @@
+#ifndef FluenceMesh_h
+#define FluenceMesh_h 1
+
+#include "globals.hh"
+#include "G4ThreeVector.hh"
+
+#include <iosfwd>
+#include <vector>
+
+class G4Step;
+class G4GenericMessenger;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+/// Neutron fluence on a regular mesh over the room or the moderator box,
+/// by track-length estimation; no volume is added to the geometry.
+///
+/// Each neutron step is clipped to the mesh and split at the grid planes
+/// it crosses: the crossings along each axis form arithmetic sequences
+/// that are generated in straight loops, merged, and turned into voxel
+/// indices and lengths in a second straight loop before the scatter-add.
+/// A step that stays in one voxel takes a short path. Scores are kept per
+/// history, so that every voxel has a relative error; threads are merged
+/// like RunTally. ThermalDiffusion is kept off while the mesh is on, since
+/// its jumps would leave the moderator fluence under-counted.
+///
+///   /nmds/mesh/enable true
+///   /nmds/mesh/extent room|box
+///   /nmds/mesh/bins 100 60 100
+///   /nmds/mesh/energyGroups 1
+///   /nmds/mesh/write fluence.bin
+
+class FluenceMesh
+{
+  public:
+    static FluenceMesh* Instance();
+    static FluenceMesh* Master();
+    static void CollectWorkers();
+
+    static G4bool IsEnabled() { return fEnabled; }
+
+    // Grid from the master settings, at the start of each run
+    // (ScoringRunAction), so that every event of the run is counted
+    void BeginOfRun();
+    // Called for every step by ScoringSteppingAction
+    void Step(const G4Step* step);
+    void EndOfEvent();
+
+    // Track length of the segment p0-p1, with weight, in an energy group
+    void Score(const G4ThreeVector& p0, const G4ThreeVector& p1,
+               G4double weight, G4int group);
+
+    void Reset();
+    void Merge(const FluenceMesh& other);
+
+    void Write(std::ostream& os) const;
+    G4bool Read(std::istream& is);
+
+    // Sums as a flat buffer, for the reduction over processes (ParallelRun)
+    void Pack(std::vector<G4double>& buffer) const;
+    G4bool Unpack(const std::vector<G4double>& buffer, std::size_t& offset);
+    void WriteFile(const G4String& fileName) const;
+
+    G4int GetNumberOfBins() const { return (G4int)fSum.size(); }
+    G4double GetSum(G4int bin)  const { return fSum[bin]; }
+    G4double GetSum2(G4int bin) const { return fSum2[bin]; }
+    G4long GetNumberOfEvents()  const { return fNofEvents; }
+
+  private:
+    FluenceMesh(G4bool master);
+    ~FluenceMesh();
+
+    void Configure();
+    G4int EnergyGroup(G4double energy) const;
+
+    void DefineCommands();
+    void SetExtent(const G4String& extent);
+    void CollectAndWrite(const G4String& fileName);
+
+    // Grid of this instance, and the configuration it was built from
+    G4ThreeVector fConfigBins;
+    G4int         fConfigExtent;
+    G4double      fConfigEmin;
+    G4double      fConfigEmax;
+    G4int         fN[3];
+    G4int         fGroups;
+    G4ThreeVector fLow;
+    G4ThreeVector fWidth;
+
+    std::vector<G4double> fEvent;
+    std::vector<G4int>    fTouched;
+    std::vector<G4double> fSum;
+    std::vector<G4double> fSum2;
+    G4long                fNofEvents;
+
+    // Work arrays of the traversal
+    std::vector<G4double> fCross[3];
+    std::vector<G4double> fMerged;
+    std::vector<G4double> fBuffer;
+    std::vector<G4int>    fIndex;
+
+    G4GenericMessenger* fMessenger;
+
+    // Configuration, set on the master
+    static G4bool        fEnabled;
+    static G4int         fExtent;   // 0 room, 1 moderator box
+    static G4ThreeVector fBins;
+    static G4int         fEnergyGroups;
+    static G4double      fEmin;
+    static G4double      fEmax;
+};
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+#endif
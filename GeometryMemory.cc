@@ -0,0 +1,341 @@
+#include "GeometryMemory.hh"
+
+#include "G4VSolid.hh"
+#include "G4Box.hh"
+#include "G4EllipticalTube.hh"
+#include "G4UnionSolid.hh"
+#include "G4SubtractionSolid.hh"
+#include "G4IntersectionSolid.hh"
+#include "G4DisplacedSolid.hh"
+#include "G4AffineTransform.hh"
+#include "G4SolidStore.hh"
+#include "G4LogicalVolume.hh"
+#include "G4LogicalVolumeStore.hh"
+#include "G4VPhysicalVolume.hh"
+#include "G4PVPlacement.hh"
+#include "G4PVReplica.hh"
+#include "G4PhysicalVolumeStore.hh"
+#include "G4SmartVoxelHeader.hh"
+#include "G4SmartVoxelProxy.hh"
+#include "G4SmartVoxelNode.hh"
+#include "G4Material.hh"
+#include "G4Element.hh"
+#include "G4RunManager.hh"
+#include "G4GenericMessenger.hh"
+#include "G4ios.hh"
+
+#include <iomanip>
+#include <sstream>
+#include <sys/resource.h>
+
+namespace
+{
+  // Size of the solid if it is a T
+  template <class T>
+  G4bool SizeIf(const G4VSolid* solid, size_t& bytes)
+  {
+    if (!dynamic_cast<const T*>(solid)) return false;
+    bytes = sizeof(T);
+    return true;
+  }
+
+  void PrintLine(const G4String& label, G4long objects, G4long bytes)
+  {
+    G4cout << "  " << std::left << std::setw(34) << label << std::right
+           << std::setw(9) << objects
+           << std::setw(12) << std::fixed << std::setprecision(1)
+           << bytes/1024. << G4endl;
+    G4cout.unsetf(std::ios::floatfield);
+    G4cout << std::setprecision(6);
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+GeometryMemory* GeometryMemory::Instance()
+{
+  static GeometryMemory instance;
+  return &instance;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+GeometryMemory::GeometryMemory()
+ : fMergedSolids(0),
+   fMergedBytes(0),
+   fMergedRotations(0),
+   fDeduplicate(true),
+   fMessenger(nullptr)
+{
+  DefineCommands();
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+GeometryMemory::~GeometryMemory()
+{
+  delete fMessenger;
+  for (auto rotation : fRotations) delete rotation;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4RotationMatrix* GeometryMemory::Rotation(const G4RotationMatrix& rotation)
+{
+  GeometryMemory* self = Instance();
+  if (self->fDeduplicate) {
+    if (rotation.isIdentity()) {
+      ++self->fMergedRotations;
+      return nullptr;
+    }
+    for (auto shared : self->fRotations) {
+      if (*shared == rotation) {
+        ++self->fMergedRotations;
+        return shared;
+      }
+    }
+  }
+
+  // Kept for the whole job: placements of a later construction may use it
+  self->fRotations.push_back(new G4RotationMatrix(rotation));
+  return self->fRotations.back();
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4VSolid* GeometryMemory::Share(G4VSolid* solid)
+{
+  GeometryMemory* self = Instance();
+  if (!self->fDeduplicate || !solid) return solid;
+
+  G4String key = SolidKey(solid);
+  auto it = self->fSolids.find(key);
+  if (it == self->fSolids.end()) {
+    self->fSolids[key] = solid;
+    return solid;
+  }
+
+  // A boolean solid placed with a transformation wraps its second solid in
+  // a G4DisplacedSolid ("placedB") of its own, which its destructor only
+  // empties: delete it too, or it stays in the solid store
+  G4VSolid* displaced = solid->GetConstituentSolid(1);
+  if (!dynamic_cast<G4DisplacedSolid*>(displaced) ||
+      displaced->GetName() != "placedB") displaced = nullptr;
+
+  G4String type;
+  ++self->fMergedSolids;
+  self->fMergedBytes += SolidBytes(solid, type);
+  if (displaced) self->fMergedBytes += SolidBytes(displaced, type);
+  delete solid;
+  delete displaced;
+  return it->second;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void GeometryMemory::Reset()
+{
+  fSolids.clear();
+  fMergedSolids = 0;
+  fMergedBytes = 0;
+  fMergedRotations = 0;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4String GeometryMemory::SolidKey(const G4VSolid* solid)
+{
+  // The dump of the parameters, without the name of the solid; those of
+  // boolean solids include their constituents, shared beforehand
+  std::ostringstream os;
+  os << std::setprecision(17);
+  solid->StreamInfo(os);
+  std::string dump = os.str();
+
+  const G4String name = solid->GetName();
+  if (!name.empty()) {
+    for (size_t pos = dump.find(name); pos != std::string::npos;
+         pos = dump.find(name, pos)) {
+      dump.erase(pos, name.size());
+    }
+  }
+  return solid->GetEntityType() + '\n' + dump;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+size_t GeometryMemory::SolidBytes(const G4VSolid* solid, G4String& type)
+{
+  type = solid->GetEntityType();
+
+  // Types of DefineVolumes(), others count as G4VSolid
+  size_t bytes = sizeof(G4VSolid);
+  if (SizeIf<G4Box>(solid, bytes)               ||
+      SizeIf<G4EllipticalTube>(solid, bytes)    ||
+      SizeIf<G4UnionSolid>(solid, bytes)        ||
+      SizeIf<G4SubtractionSolid>(solid, bytes)  ||
+      SizeIf<G4IntersectionSolid>(solid, bytes)) {
+    return bytes;
+  }
+  if (SizeIf<G4DisplacedSolid>(solid, bytes)) {
+    // Direct and inverse transformations
+    return bytes + 2*sizeof(G4AffineTransform);
+  }
+  return bytes;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void GeometryMemory::WalkHeader(const G4SmartVoxelHeader* header,
+                                std::set<const void*>& visited, Usage& usage)
+{
+  size_t nslices = header->GetNoSlices();
+  usage.Add(sizeof(G4SmartVoxelHeader) + nslices*sizeof(G4SmartVoxelProxy*));
+  for (size_t i = 0; i < nslices; ++i) {
+    const G4SmartVoxelProxy* proxy = header->GetSlice(i);
+
+    // Equivalent slices share their proxy
+    if (!visited.insert(proxy).second) continue;
+    usage.bytes += sizeof(G4SmartVoxelProxy);
+    if (proxy->IsNode()) {
+      usage.Add(sizeof(G4SmartVoxelNode)
+                + proxy->GetNode()->GetNoContained()*sizeof(G4int));
+    }
+    else {
+      WalkHeader(proxy->GetHeader(), visited, usage);
+    }
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void GeometryMemory::Print() const
+{
+  // Shared by the threads
+  std::map<G4String, Usage> solids;
+  Usage solidTotal;
+  for (auto solid : *G4SolidStore::GetInstance()) {
+    G4String type;
+    size_t bytes = SolidBytes(solid, type);
+    solids[type].Add(bytes);
+    solidTotal.Add(bytes);
+  }
+
+  Usage logical, voxels;
+  std::set<const void*> visited;
+  std::map<std::pair<const G4VSolid*, const G4Material*>,
+           std::vector<G4String> > sameVolumes;
+  for (auto lv : *G4LogicalVolumeStore::GetInstance()) {
+    logical.Add(sizeof(G4LogicalVolume)
+                + lv->GetNoDaughters()*sizeof(G4VPhysicalVolume*));
+    if (lv->GetVoxelHeader()) WalkHeader(lv->GetVoxelHeader(), visited, voxels);
+    sameVolumes[std::make_pair(lv->GetSolid(), lv->GetMaterial())]
+      .push_back(lv->GetName());
+  }
+
+  Usage physical, rotations;
+  std::set<const G4RotationMatrix*> distinct;
+  for (auto pv : *G4PhysicalVolumeStore::GetInstance()) {
+    size_t bytes = sizeof(G4VPhysicalVolume);
+    if (dynamic_cast<const G4PVPlacement*>(pv)) bytes = sizeof(G4PVPlacement);
+    else if (dynamic_cast<const G4PVReplica*>(pv)) bytes = sizeof(G4PVReplica);
+    physical.Add(bytes);
+    const G4RotationMatrix* rotation = pv->GetRotation();
+    if (rotation && distinct.insert(rotation).second) {
+      rotations.Add(sizeof(G4RotationMatrix));
+    }
+  }
+
+  Usage materials, elements;
+  for (auto material : *G4Material::GetMaterialTable()) {
+    materials.Add(sizeof(G4Material) + material->GetNumberOfElements()
+                  *(sizeof(G4Element*) + 2*sizeof(G4double)));
+  }
+  for (auto element : *G4Element::GetElementTable()) {
+    elements.Add(sizeof(G4Element) + element->GetNumberOfIsotopes()
+                 *(sizeof(G4Isotope*) + sizeof(G4double)));
+  }
+
+  G4long shared = solidTotal.bytes + logical.bytes + physical.bytes
+                + rotations.bytes + voxels.bytes + materials.bytes
+                + elements.bytes;
+
+  // Copy held by each thread
+  Usage logicalData, physicalData;
+  logicalData.objects  = logical.objects;
+  logicalData.bytes    = logical.objects*sizeof(G4LVData);
+  physicalData.objects = physical.objects;
+  physicalData.bytes   = physical.objects*sizeof(G4PVData);
+  G4long perThread = logicalData.bytes + physicalData.bytes;
+
+  G4int threads = 1;
+  G4int copies = 1;
+  auto runManager = G4RunManager::GetRunManager();
+  if (runManager) {
+    threads = runManager->GetNumberOfThreads();
+    copies = threads;
+    if (runManager->GetRunManagerType() == G4RunManager::masterRM) ++copies;
+  }
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  G4double peakMB = usage.ru_maxrss/1024.;   // kB on Linux
+
+  G4cout << G4endl
+         << "------------------------- Geometry memory -------------------------"
+         << G4endl
+         << "                                      objects          kB" << G4endl
+         << "  shared by the threads" << G4endl;
+  for (const auto& entry : solids) {
+    PrintLine("  solids " + entry.first, entry.second.objects,
+              entry.second.bytes);
+  }
+  PrintLine("  logical volumes", logical.objects, logical.bytes);
+  PrintLine("  physical volumes", physical.objects, physical.bytes);
+  PrintLine("  rotation matrices", rotations.objects, rotations.bytes);
+  PrintLine("  voxel headers and nodes", voxels.objects, voxels.bytes);
+  PrintLine("  materials", materials.objects, materials.bytes);
+  PrintLine("  elements", elements.objects, elements.bytes);
+  PrintLine("  total", 0, shared);
+  G4cout << "  per thread" << G4endl;
+  PrintLine("  logical volume data", logicalData.objects, logicalData.bytes);
+  PrintLine("  physical volume data", physicalData.objects, physicalData.bytes);
+  PrintLine("  total", 0, perThread);
+
+  std::ostringstream label;
+  label << "process, " << threads << " thread" << (threads > 1 ? "s" : "")
+        << (copies > threads ? " + master" : "");
+  PrintLine(label.str(), 0, shared + copies*perThread);
+  G4cout << "  peak resident memory of the process  "
+         << std::fixed << std::setprecision(1) << peakMB << " MB" << G4endl;
+  G4cout.unsetf(std::ios::floatfield);
+  G4cout << std::setprecision(6);
+
+  G4cout << "  shared at construction: " << fMergedSolids << " solids ("
+         << fMergedBytes << " bytes), " << fMergedRotations << " rotations"
+         << (fDeduplicate ? "" : " (sharing off)") << G4endl;
+  for (const auto& entry : sameVolumes) {
+    if (entry.second.size() < 2) continue;
+    G4cout << "  same solid and material:";
+    for (const auto& name : entry.second) G4cout << ' ' << name;
+    G4cout << G4endl;
+  }
+  G4cout << "-------------------------------------------------------------------"
+         << G4endl;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void GeometryMemory::DefineCommands()
+{
+  fMessenger = new G4GenericMessenger(this, "/nmds/geometry/",
+                                      "Geometry memory and sharing");
+
+  fMessenger->DeclareProperty("deduplicate", fDeduplicate,
+                              "Share identical solids and rotations"
+                              " (before /run/initialize).");
+  fMessenger->DeclareMethod("memory", &GeometryMemory::Print,
+                            "Print the memory taken by the geometry.");
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
@@ -0,0 +1,89 @@
+#ifndef GeometryMemory_h
+#define GeometryMemory_h 1
+
+#include "globals.hh"
+#include "G4RotationMatrix.hh"
+
+#include <map>
+#include <set>
+#include <vector>
+
+class G4VSolid;
+class G4SmartVoxelHeader;
+class G4GenericMessenger;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+/// Memory taken by the geometry, and sharing of identical solids and
+/// rotations while it is built.
+///
+/// DefineVolumes() passes its rotations through Rotation() and its solids
+/// through Solid(). An identity rotation becomes no rotation; equal
+/// matrices share one copy, kept for the whole job. A solid equal to one
+/// already built in the same construction (same type, parameters and
+/// constituents, whatever the name) is deleted and the first one is used
+/// instead. Logical volumes are not merged, since their names select the
+/// scoring roles and settings; the report lists those with the same solid
+/// and material. Sharing is on by default and must be set before
+/// /run/initialize.
+///
+/// The report estimates, from the object sizes, the memory shared by the
+/// threads (solids by type, logical and physical volumes, rotations,
+/// smart voxels, materials and elements) and the copy each thread holds
+/// of the logical and physical volume data, then the total of the process
+/// for its number of threads, next to its peak resident memory. Physics
+/// tables and navigator state are not included. Voxels exist once the
+/// geometry has been closed, i.e. after the first run.
+///
+///   /nmds/geometry/deduplicate true
+///   /nmds/geometry/memory
+
+class GeometryMemory
+{
+  public:
+    static GeometryMemory* Instance();
+
+    // Shared copy of a rotation, nullptr for the identity
+    static G4RotationMatrix* Rotation(const G4RotationMatrix& rotation);
+
+    // Solid to use in place of a newly built one, which may be deleted
+    static G4VSolid* Share(G4VSolid* solid);
+    template <class T> static T* Solid(T* solid)
+    { return static_cast<T*>(Share(solid)); }
+
+    // Forget the solids of a previous construction
+    void Reset();
+
+    void Print() const;
+
+  private:
+    struct Usage {
+      Usage() : objects(0), bytes(0) {}
+      void Add(size_t size) { ++objects; bytes += size; }
+      G4long objects;
+      G4long bytes;
+    };
+
+    GeometryMemory();
+    ~GeometryMemory();
+
+    static size_t SolidBytes(const G4VSolid* solid, G4String& type);
+    static G4String SolidKey(const G4VSolid* solid);
+    static void WalkHeader(const G4SmartVoxelHeader* header,
+                           std::set<const void*>& visited, Usage& usage);
+
+    void DefineCommands();
+
+    std::map<G4String, G4VSolid*>   fSolids;
+    std::vector<G4RotationMatrix*>  fRotations;
+    G4int  fMergedSolids;
+    G4long fMergedBytes;
+    G4int  fMergedRotations;
+    G4bool fDeduplicate;
+
+    G4GenericMessenger* fMessenger;
+};
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+#endif
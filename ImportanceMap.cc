@@ -0,0 +1,413 @@
+#include "ImportanceMap.hh"
+#include "DetectorLayout.hh"
+
+#include "G4Step.hh"
+#include "G4Track.hh"
+#include "G4Neutron.hh"
+#include "G4AutoLock.hh"
+#include "G4GenericMessenger.hh"
+#include "G4SystemOfUnits.hh"
+#include "G4ios.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <limits>
+
+namespace
+{
+  G4Mutex importanceMutex = G4MUTEX_INITIALIZER;
+  std::vector<ImportanceMap*>* workers = nullptr;
+
+  template <class T>
+  void WriteRaw(std::ostream& os, const T& value)
+  {
+    os.write(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+}
+
+G4bool        ImportanceMap::fEnabled      = false;
+G4ThreeVector ImportanceMap::fBins         = G4ThreeVector(30, 30, 40);
+G4int         ImportanceMap::fEnergyGroups = 1;
+G4double      ImportanceMap::fEmin         = 1.e-5*eV;
+G4double      ImportanceMap::fEmax         = 20.*MeV;
+G4int         ImportanceMap::fCounter      = -1;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+ImportanceMap* ImportanceMap::Instance()
+{
+  static G4ThreadLocal ImportanceMap* instance = nullptr;
+  if (!instance) {
+    instance = new ImportanceMap(false);
+    G4AutoLock lock(&importanceMutex);
+    if (!workers) workers = new std::vector<ImportanceMap*>;
+    workers->push_back(instance);
+  }
+  return instance;
+}
+
+ImportanceMap* ImportanceMap::Master()
+{
+  static ImportanceMap master(true);
+  return &master;
+}
+
+void ImportanceMap::CollectWorkers()
+{
+  G4AutoLock lock(&importanceMutex);
+  if (!workers) return;
+  ImportanceMap* master = Master();
+  for (auto worker : *workers) {
+    master->Merge(*worker);
+    worker->Reset();
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+ImportanceMap::ImportanceMap(G4bool master)
+ : fConfigEmin(0.),
+   fConfigEmax(0.),
+   fGroups(0),
+   fCurrent(nullptr),
+   fCurrentID(-1),
+   fLastCell(-1),
+   fNofEvents(0),
+   fMessenger(nullptr)
+{
+  fN[0] = fN[1] = fN[2] = 0;
+  if (master) DefineCommands();
+}
+
+ImportanceMap::~ImportanceMap()
+{
+  delete fMessenger;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ImportanceMap::Configure()
+{
+  G4ThreeVector half = DetectorLayout::Instance()->GetRockHalf();
+
+  fConfigBins = fBins;
+  fConfigEmin = fEmin;
+  fConfigEmax = fEmax;
+  fGroups     = fEnergyGroups;
+
+  for (G4int i = 0; i < 3; ++i) {
+    fN[i] = std::max((G4int)fBins[i], 1);
+    fWidth[i] = 2.*half[i]/fN[i];
+  }
+  fLow = -half;
+
+  G4int nbins = fN[0]*fN[1]*fN[2]*fGroups;
+  fEvent.assign(nbins, 0.);
+  fSum.assign(nbins, 0.);
+  fSum2.assign(nbins, 0.);
+  fWeight.assign(nbins, 0.);
+  fTouched.clear();
+  fNofEvents = 0;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4int ImportanceMap::EnergyGroup(G4double energy) const
+{
+  if (fGroups == 1) return 0;
+  if (energy < fConfigEmin || energy >= fConfigEmax) return -1;
+  return (G4int)(fGroups*std::log(energy/fConfigEmin)
+                        /std::log(fConfigEmax/fConfigEmin));
+}
+
+G4int ImportanceMap::Voxel(const G4ThreeVector& point) const
+{
+  G4int index[3];
+  for (G4int i = 0; i < 3; ++i) {
+    G4double u = (point[i] - fLow[i])/fWidth[i];
+    if (!(u >= 0. && u <= fN[i])) return -1;
+    index[i] = std::min((G4int)u, fN[i] - 1);
+  }
+  return (index[0]*fN[1] + index[1])*fN[2] + index[2];
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ImportanceMap::Enter(G4int cell, G4double weight)
+{
+  if (cell == fLastCell) return;
+  fLastCell = cell;
+  fCurrent->cells.push_back(cell);
+  fWeight[cell] += weight;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ImportanceMap::Traverse(const G4ThreeVector& p0, const G4ThreeVector& p1,
+                             G4int group, G4double weight)
+{
+  // Segment in voxel units, u(t) = u0 + t*du, clipped to the mesh
+  G4double u0[3], du[3];
+  G4double tEnter = 0., tExit = 1.;
+  for (G4int i = 0; i < 3; ++i) {
+    u0[i] = (p0[i] - fLow[i])/fWidth[i];
+    du[i] = (p1[i] - p0[i])/fWidth[i];
+    if (du[i] == 0.) {
+      if (u0[i] < 0. || u0[i] > fN[i]) return;
+      continue;
+    }
+    G4double ta = -u0[i]/du[i];
+    G4double tb = (fN[i] - u0[i])/du[i];
+    if (ta > tb) std::swap(ta, tb);
+    tEnter = std::max(tEnter, ta);
+    tExit  = std::min(tExit, tb);
+  }
+  if (tEnter >= tExit) return;
+
+  // Voxel walk: step along the axis whose next plane is nearest
+  G4int index[3], step[3];
+  G4double tNext[3], tDelta[3];
+  for (G4int i = 0; i < 3; ++i) {
+    G4double u = u0[i] + tEnter*du[i];
+    index[i] = std::min(std::max((G4int)std::floor(u), 0), fN[i] - 1);
+    if (du[i] > 0.) {
+      step[i] = 1;
+      tNext[i] = (index[i] + 1 - u0[i])/du[i];
+      tDelta[i] = 1./du[i];
+    }
+    else if (du[i] < 0.) {
+      step[i] = -1;
+      tNext[i] = (index[i] - u0[i])/du[i];
+      tDelta[i] = -1./du[i];
+    }
+    else {
+      step[i] = 0;
+      tNext[i] = tDelta[i] = DBL_MAX;
+    }
+  }
+
+  G4int voxelsInGroups = fN[0]*fN[1]*fN[2];
+  while (true) {
+    Enter(group*voxelsInGroups + (index[0]*fN[1] + index[1])*fN[2] + index[2],
+          weight);
+    G4int axis = (tNext[0] < tNext[1]) ? (tNext[0] < tNext[2] ? 0 : 2)
+                                       : (tNext[1] < tNext[2] ? 1 : 2);
+    if (tNext[axis] >= tExit) break;
+    index[axis] += step[axis];
+    if (index[axis] < 0 || index[axis] >= fN[axis]) break;
+    tNext[axis] += tDelta[axis];
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ImportanceMap::BeginOfRun()
+{
+  // Rebuild the grid when the configuration changed between runs
+  if (fConfigBins != fBins || fGroups != fEnergyGroups ||
+      fConfigEmin != fEmin || fConfigEmax != fEmax) {
+    Configure();
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ImportanceMap::Step(const G4Step* step)
+{
+  const G4Track* track = step->GetTrack();
+  if (track->GetDefinition() != G4Neutron::Definition()) return;
+
+  G4int id = track->GetTrackID();
+  if (id != fCurrentID) {
+    // A primary has no entry yet; a secondary was linked by NewTrack()
+    fCurrent = &fTracks[id];
+    fCurrentID = id;
+    fLastCell = -1;
+  }
+
+  // Flight at the energy of the pre-step point
+  const G4StepPoint* prePoint = step->GetPreStepPoint();
+  const G4StepPoint* postPoint = step->GetPostStepPoint();
+  G4double weight = track->GetWeight();
+  G4int group = EnergyGroup(prePoint->GetKineticEnergy());
+  if (group >= 0) {
+    Traverse(prePoint->GetPosition(), postPoint->GetPosition(), group, weight);
+  }
+
+  // A collision may move the neutron to another group
+  if (track->GetTrackStatus() != fAlive) return;
+  group = EnergyGroup(postPoint->GetKineticEnergy());
+  G4int voxel = Voxel(postPoint->GetPosition());
+  if (group >= 0 && voxel >= 0) {
+    Enter(group*fN[0]*fN[1]*fN[2] + voxel, weight);
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ImportanceMap::NewTrack(const G4Track* track)
+{
+  auto parent = fTracks.find(track->GetParentID());
+  if (parent == fTracks.end()) return;
+
+  TrackEntries& entries = fTracks[track->GetTrackID()];
+  entries.parent = track->GetParentID();
+  entries.parentCount = parent->second.cells.size();
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ImportanceMap::Score(G4int counter, G4int trackID, G4double weight)
+{
+  if (fCounter >= 0 && counter != fCounter) return;
+
+  // Credit the cells of the track, then those of its ancestors
+  std::size_t limit = std::numeric_limits<std::size_t>::max();
+  G4int id = trackID;
+  while (true) {
+    auto entry = fTracks.find(id);
+    if (entry == fTracks.end()) break;
+    const TrackEntries& entries = entry->second;
+    std::size_t n = std::min(limit, entries.cells.size());
+    for (std::size_t i = 0; i < n; ++i) {
+      G4int cell = entries.cells[i];
+      if (fEvent[cell] == 0.) fTouched.push_back(cell);
+      fEvent[cell] += weight;
+    }
+    if (entries.parent == 0) break;
+    limit = entries.parentCount;
+    id = entries.parent;
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ImportanceMap::EndOfEvent()
+{
+  fTracks.clear();
+  fCurrent = nullptr;
+  fCurrentID = -1;
+  fLastCell = -1;
+
+  // Every history counts, with or without a neutron in the rock
+  for (auto bin : fTouched) {
+    G4double x = fEvent[bin];
+    fSum[bin]  += x;
+    fSum2[bin] += x*x;
+    fEvent[bin] = 0.;
+  }
+  fTouched.clear();
+  ++fNofEvents;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ImportanceMap::Reset()
+{
+  std::fill(fEvent.begin(), fEvent.end(), 0.);
+  std::fill(fSum.begin(), fSum.end(), 0.);
+  std::fill(fSum2.begin(), fSum2.end(), 0.);
+  std::fill(fWeight.begin(), fWeight.end(), 0.);
+  fTouched.clear();
+  fNofEvents = 0;
+}
+
+void ImportanceMap::Merge(const ImportanceMap& other)
+{
+  if (!other.fSum.empty()) {
+    if (fSum.size() != other.fSum.size()) Configure();
+    for (std::size_t i = 0; i < fSum.size(); ++i) {
+      fSum[i]    += other.fSum[i];
+      fSum2[i]   += other.fSum2[i];
+      fWeight[i] += other.fWeight[i];
+    }
+  }
+  fNofEvents += other.fNofEvents;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ImportanceMap::WriteFile(const G4String& fileName) const
+{
+  std::ofstream out(fileName, std::ios::binary);
+  if (!out || fSum.empty()) {
+    G4ExceptionDescription msg;
+    msg << "Cannot write the importance map to " << fileName;
+    G4Exception("ImportanceMap::WriteFile()", "NMDS015", JustWarning, msg);
+    return;
+  }
+
+  out.write("NMDSIMPM", 8);
+  WriteRaw(out, (G4int)1);
+  for (G4int i = 0; i < 3; ++i) WriteRaw(out, fN[i]);
+  WriteRaw(out, fGroups);
+  for (G4int i = 0; i < 3; ++i) WriteRaw(out, fLow[i]/cm);
+  for (G4int i = 0; i < 3; ++i) WriteRaw(out, (fLow[i] + fN[i]*fWidth[i])/cm);
+  WriteRaw(out, fConfigEmin/MeV);
+  WriteRaw(out, fConfigEmax/MeV);
+  WriteRaw(out, (long long)fNofEvents);
+
+  // Captures per unit weight entering, then relative error of the credits
+  G4int entered = 0, scored = 0;
+  for (std::size_t i = 0; i < fSum.size(); ++i) {
+    G4double importance = (fWeight[i] > 0.) ? fSum[i]/fWeight[i] : 0.;
+    if (fWeight[i] > 0.) ++entered;
+    if (fSum[i] > 0.) ++scored;
+    WriteRaw(out, importance);
+  }
+  G4double n = std::max<G4double>(fNofEvents, 1.);
+  for (std::size_t i = 0; i < fSum.size(); ++i) {
+    G4double error = 1.;
+    if (fSum[i] > 0. && fNofEvents > 1) {
+      G4double mean = fSum[i]/n;
+      G4double var = (fSum2[i]/n - mean*mean)/(n - 1.);
+      error = (var > 0.) ? std::sqrt(var)/mean : 0.;
+    }
+    WriteRaw(out, error);
+  }
+
+  G4cout << "### Importance map " << fN[0] << "x" << fN[1] << "x" << fN[2]
+         << "x" << fGroups << " (" << fNofEvents << " events, " << entered
+         << " cells entered, " << scored << " with captures) written to "
+         << fileName << G4endl;
+}
+
+void ImportanceMap::CollectAndWrite(const G4String& fileName)
+{
+  CollectWorkers();
+  WriteFile(fileName);
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ImportanceMap::DefineCommands()
+{
+  fMessenger = new G4GenericMessenger(this, "/nmds/importance/",
+                                      "Importance of the rock to the counters");
+
+  fMessenger->DeclareProperty("enable", fEnabled,
+                              "Estimate the importance map.");
+
+  fMessenger->DeclareProperty("bins", fBins, "Number of bins in x, y, z.");
+
+  auto& groupsCmd = fMessenger->DeclareProperty("energyGroups", fEnergyGroups,
+                    "Number of log-spaced energy groups.");
+  groupsCmd.SetParameterName("groups", false);
+  groupsCmd.SetRange("groups>0");
+
+  fMessenger->DeclarePropertyWithUnit("emin", "eV", fEmin,
+                                      "Lower edge of the energy groups.");
+  fMessenger->DeclarePropertyWithUnit("emax", "MeV", fEmax,
+                                      "Upper edge of the energy groups.");
+
+  auto& counterCmd = fMessenger->DeclareProperty("counter", fCounter,
+                     "Counter scored, -1 for all.");
+  counterCmd.SetParameterName("counter", false);
+  counterCmd.SetRange("counter>=-1 && counter<60");
+
+  fMessenger->DeclareMethod("write", &ImportanceMap::CollectAndWrite,
+                            "Merge the thread maps and write them.");
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
@@ -0,0 +1,124 @@
+#ifndef ImportanceMap_h
+#define ImportanceMap_h 1
+
+#include "globals.hh"
+#include "G4ThreeVector.hh"
+
+#include <unordered_map>
+#include <vector>
+
+class G4Step;
+class G4Track;
+class G4GenericMessenger;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+/// Importance of every voxel and energy group of a mesh over the rock
+/// block (rock and room) to the counter captures: the expected captures
+/// caused by a neutron of unit weight entering the cell, i.e. the adjoint
+/// flux of the counter response, estimated in forward runs as a
+/// weight-window generator does.
+///
+/// Every neutron records the cells it enters along its steps (a step is
+/// walked voxel by voxel) with its weight. When a neutron is captured in a
+/// counter, its capture weight is credited to all cells it entered and to
+/// the cells its ancestors entered before they created it, through the
+/// parent links registered by StackingAction (the high-precision models
+/// create all outgoing neutrons of a reaction as secondaries, so the
+/// parent entries are exactly those before the reaction). The importance
+/// is the credited score over the entering weight; per-history sums give
+/// its relative error. Threads are merged like RunTally. ThermalDiffusion
+/// is kept off while the map is on: the cells crossed by its jumps would
+/// not be entered.
+///
+/// The file is binary: "NMDSIMPM", version, nx ny nz groups, low and high
+/// corners [cm], emin emax [MeV], events, then importance and relative
+/// error per cell, group slowest, then x, y, z. It serves to set weight
+/// windows (inverse importance) or to fold a source given per cell.
+///
+///   /nmds/importance/enable true
+///   /nmds/importance/bins 30 30 40
+///   /nmds/importance/energyGroups 4
+///   /nmds/importance/counter -1
+///   /nmds/importance/write importance.bin
+
+class ImportanceMap
+{
+  public:
+    static ImportanceMap* Instance();
+    static ImportanceMap* Master();
+    static void CollectWorkers();
+
+    static G4bool IsEnabled() { return fEnabled; }
+
+    // Grid from the master settings, at the start of each run
+    // (ScoringRunAction), so that every event of the run is counted
+    void BeginOfRun();
+    // Called for every step by ScoringSteppingAction
+    void Step(const G4Step* step);
+    // Parent link of a new track, from StackingAction
+    void NewTrack(const G4Track* track);
+    // Capture in a counter, from the sensitive detector
+    void Score(G4int counter, G4int trackID, G4double weight);
+    void EndOfEvent();
+
+    void Reset();
+    void Merge(const ImportanceMap& other);
+    void WriteFile(const G4String& fileName) const;
+
+  private:
+    ImportanceMap(G4bool master);
+    ~ImportanceMap();
+
+    struct TrackEntries {
+      G4int parent;
+      std::size_t parentCount;   // entries of the parent before this track
+      std::vector<G4int> cells;
+    };
+
+    void Configure();
+    G4int EnergyGroup(G4double energy) const;
+    G4int Voxel(const G4ThreeVector& point) const;
+    void Enter(G4int cell, G4double weight);
+    void Traverse(const G4ThreeVector& p0, const G4ThreeVector& p1,
+                  G4int group, G4double weight);
+
+    void DefineCommands();
+    void CollectAndWrite(const G4String& fileName);
+
+    // Grid of this instance, and the configuration it was built from
+    G4ThreeVector fConfigBins;
+    G4double      fConfigEmin;
+    G4double      fConfigEmax;
+    G4int         fN[3];
+    G4int         fGroups;
+    G4ThreeVector fLow;
+    G4ThreeVector fWidth;
+
+    // Entries of the tracks of the current event
+    std::unordered_map<G4int, TrackEntries> fTracks;
+    TrackEntries* fCurrent;
+    G4int         fCurrentID;
+    G4int         fLastCell;
+
+    std::vector<G4double> fEvent;
+    std::vector<G4int>    fTouched;
+    std::vector<G4double> fSum;
+    std::vector<G4double> fSum2;
+    std::vector<G4double> fWeight;
+    G4long                fNofEvents;
+
+    G4GenericMessenger* fMessenger;
+
+    // Configuration, set on the master
+    static G4bool        fEnabled;
+    static G4ThreeVector fBins;
+    static G4int         fEnergyGroups;
+    static G4double      fEmin;
+    static G4double      fEmax;
+    static G4int         fCounter;   // -1 for all counters
+};
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+#endif
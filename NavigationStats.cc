@@ -0,0 +1,318 @@
+#include "NavigationStats.hh"
+
+#include "G4Step.hh"
+#include "G4VTouchable.hh"
+#include "G4NavigationHistory.hh"
+#include "G4LogicalVolume.hh"
+#include "G4LogicalVolumeStore.hh"
+#include "G4VPhysicalVolume.hh"
+#include "G4SmartVoxelHeader.hh"
+#include "G4SmartVoxelProxy.hh"
+#include "G4SmartVoxelNode.hh"
+#include "G4RunManager.hh"
+#include "G4AutoLock.hh"
+#include "G4GenericMessenger.hh"
+#include "G4ios.hh"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+namespace
+{
+  G4Mutex navigationMutex = G4MUTEX_INITIALIZER;
+  std::vector<NavigationStats*>* workers = nullptr;
+}
+
+G4bool NavigationStats::fEnabled = false;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+NavigationStats* NavigationStats::Instance()
+{
+  static G4ThreadLocal NavigationStats* instance = nullptr;
+  if (!instance) {
+    instance = new NavigationStats(false);
+    G4AutoLock lock(&navigationMutex);
+    if (!workers) workers = new std::vector<NavigationStats*>;
+    workers->push_back(instance);
+  }
+  return instance;
+}
+
+NavigationStats* NavigationStats::Master()
+{
+  static NavigationStats master(true);
+  return &master;
+}
+
+void NavigationStats::CollectWorkers()
+{
+  G4AutoLock lock(&navigationMutex);
+  if (!workers) return;
+  NavigationStats* master = Master();
+  for (auto worker : *workers) {
+    for (const auto& entry : worker->fCounters) {
+      Counters& merged = master->fMerged[entry.first->GetName()];
+      merged.steps       += entry.second.steps;
+      merged.candidates  += entry.second.candidates;
+      merged.relocations += entry.second.relocations;
+      merged.maxCandidates = std::max(merged.maxCandidates,
+                                      entry.second.maxCandidates);
+    }
+    worker->Reset();
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+NavigationStats::NavigationStats(G4bool master)
+ : fLastVolume(nullptr),
+   fLastCounters(nullptr),
+   fMessenger(nullptr)
+{
+  if (master) DefineCommands();
+}
+
+NavigationStats::~NavigationStats()
+{
+  delete fMessenger;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void NavigationStats::SetSmartless(const G4String& lvName, G4double smartless)
+{
+  fSmartless[lvName] = smartless;
+}
+
+void NavigationStats::SetOptimisation(const G4String& lvName, G4bool optimise)
+{
+  fOptimise[lvName] = optimise;
+}
+
+void NavigationStats::ApplyVoxelSettings() const
+{
+  for (auto lv : *G4LogicalVolumeStore::GetInstance()) {
+    auto smartless = fSmartless.find(lv->GetName());
+    if (smartless != fSmartless.end()) lv->SetSmartless(smartless->second);
+    auto optimise = fOptimise.find(lv->GetName());
+    if (optimise != fOptimise.end()) lv->SetOptimisation(optimise->second);
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4int NavigationStats::CountCandidates(const G4LogicalVolume* lv,
+                                       const G4ThreeVector& localPoint)
+{
+  // Same descent as G4VoxelNavigation: slice by slice down to a node
+  const G4SmartVoxelHeader* header = lv->GetVoxelHeader();
+  if (!header) return (G4int)lv->GetNoDaughters();
+
+  while (true) {
+    G4double coordinate = localPoint(header->GetAxis());
+    G4int nslices = (G4int)header->GetNoSlices();
+    G4double width = (header->GetMaxExtent() - header->GetMinExtent())/nslices;
+    G4int slice = G4int((coordinate - header->GetMinExtent())/width);
+    slice = std::max(0, std::min(nslices - 1, slice));
+    const G4SmartVoxelProxy* proxy = header->GetSlice(slice);
+    if (proxy->IsNode()) return (G4int)proxy->GetNode()->GetNoContained();
+    header = proxy->GetHeader();
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void NavigationStats::Step(const G4Step* step)
+{
+  const G4StepPoint* prePoint = step->GetPreStepPoint();
+  const G4LogicalVolume* lv = prePoint->GetPhysicalVolume()->GetLogicalVolume();
+
+  // The same volume usually repeats from step to step
+  if (lv != fLastVolume) {
+    fLastVolume   = lv;
+    fLastCounters = &fCounters[lv];
+  }
+  Counters& counters = *fLastCounters;
+  ++counters.steps;
+  if (step->GetPostStepPoint()->GetStepStatus() == fGeomBoundary) {
+    ++counters.relocations;
+  }
+
+  if (lv->GetNoDaughters() == 0) return;
+  G4ThreeVector local = prePoint->GetTouchable()->GetHistory()->GetTopTransform()
+                          .TransformPoint(prePoint->GetPosition());
+  G4long candidates = CountCandidates(lv, local);
+  counters.candidates += candidates;
+  counters.maxCandidates = std::max(counters.maxCandidates, candidates);
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void NavigationStats::Reset()
+{
+  fCounters.clear();
+  fMerged.clear();
+  fLastVolume   = nullptr;
+  fLastCounters = nullptr;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void NavigationStats::WalkHeader(const G4SmartVoxelHeader* header, G4int depth,
+                                 std::vector<const void*>& visited,
+                                 G4int& slices, G4int& nodes, G4int& maxDepth,
+                                 G4int& maxContained, G4long& contained) const
+{
+  maxDepth = std::max(maxDepth, depth);
+  G4int nslices = (G4int)header->GetNoSlices();
+  slices += nslices;
+  for (G4int i = 0; i < nslices; ++i) {
+    const G4SmartVoxelProxy* proxy = header->GetSlice(i);
+
+    // Equivalent slices share their proxy
+    if (std::find(visited.begin(), visited.end(), proxy) != visited.end()) {
+      continue;
+    }
+    visited.push_back(proxy);
+    if (proxy->IsNode()) {
+      G4int n = (G4int)proxy->GetNode()->GetNoContained();
+      ++nodes;
+      contained += n;
+      maxContained = std::max(maxContained, n);
+    }
+    else {
+      WalkHeader(proxy->GetHeader(), depth + 1, visited,
+                 slices, nodes, maxDepth, maxContained, contained);
+    }
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void NavigationStats::PrintVoxels() const
+{
+  static const char* axes = "xyz";
+
+  G4cout << G4endl
+         << "------------------------- Smart voxels ---------------------------"
+         << G4endl
+         << "  volume          daughters smartless axis depth slices  nodes"
+         << "  avg/node max/node" << G4endl;
+  for (auto lv : *G4LogicalVolumeStore::GetInstance()) {
+    if (lv->GetNoDaughters() == 0) continue;
+    G4cout << "  " << std::left << std::setw(14) << lv->GetName() << std::right
+           << std::setw(11) << lv->GetNoDaughters()
+           << std::setw(10) << lv->GetSmartless();
+
+    const G4SmartVoxelHeader* header = lv->GetVoxelHeader();
+    if (!header) {
+      G4cout << "   not voxelised" << G4endl;
+      continue;
+    }
+    std::vector<const void*> visited;
+    G4int slices = 0, nodes = 0, maxDepth = 0, maxContained = 0;
+    G4long contained = 0;
+    WalkHeader(header, 1, visited, slices, nodes, maxDepth, maxContained,
+               contained);
+    G4cout << std::setw(5) << axes[header->GetAxis()]
+           << std::setw(6) << maxDepth
+           << std::setw(7) << slices
+           << std::setw(7) << nodes
+           << std::setw(10) << std::setprecision(3)
+           << (nodes ? G4double(contained)/nodes : 0.)
+           << std::setw(10) << maxContained
+           << std::setprecision(6) << G4endl;
+  }
+  G4cout << "-----------------------------------------------------------------"
+         << G4endl;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void NavigationStats::Print() const
+{
+  G4cout << G4endl
+         << "----------------------- Navigation per volume --------------------"
+         << G4endl
+         << "  volume              steps  relocations  avg cand.  max cand."
+         << G4endl;
+  for (const auto& entry : fMerged) {
+    const Counters& counters = entry.second;
+    G4cout << "  " << std::left << std::setw(14) << entry.first << std::right
+           << std::setw(11) << counters.steps
+           << std::setw(13) << counters.relocations
+           << std::setw(11) << std::setprecision(3)
+           << (counters.steps ? G4double(counters.candidates)/counters.steps
+                              : 0.)
+           << std::setw(11) << counters.maxCandidates
+           << std::setprecision(6) << G4endl;
+  }
+  G4cout << "-----------------------------------------------------------------"
+         << G4endl;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void NavigationStats::SmartlessCommand(const G4String& args)
+{
+  std::istringstream is(args);
+  G4String lvName;
+  G4double smartless = 0.;
+  if (!(is >> lvName >> smartless) || smartless <= 0.) {
+    G4ExceptionDescription msg;
+    msg << "Expected a logical volume name and a positive smartless value,"
+        << " got \"" << args << "\"";
+    G4Exception("NavigationStats::SmartlessCommand()", "NMDS009",
+                JustWarning, msg);
+    return;
+  }
+  SetSmartless(lvName, smartless);
+  ApplyVoxelSettings();
+  G4RunManager::GetRunManager()->GeometryHasBeenModified();
+}
+
+void NavigationStats::OptimiseCommand(const G4String& args)
+{
+  std::istringstream is(args);
+  G4String lvName, value;
+  if (!(is >> lvName >> value)) {
+    G4ExceptionDescription msg;
+    msg << "Expected a logical volume name and true or false, got \""
+        << args << "\"";
+    G4Exception("NavigationStats::OptimiseCommand()", "NMDS009",
+                JustWarning, msg);
+    return;
+  }
+  SetOptimisation(lvName, value == "true" || value == "1");
+  ApplyVoxelSettings();
+  G4RunManager::GetRunManager()->GeometryHasBeenModified();
+}
+
+void NavigationStats::CollectAndPrint()
+{
+  CollectWorkers();
+  Print();
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void NavigationStats::DefineCommands()
+{
+  fMessenger = new G4GenericMessenger(this, "/nmds/navigation/",
+                                      "Smart voxels and navigation statistics");
+
+  fMessenger->DeclareMethod("smartless", &NavigationStats::SmartlessCommand,
+                            "Voxel quality of a logical volume: name value.");
+  fMessenger->DeclareMethod("optimise", &NavigationStats::OptimiseCommand,
+                            "Voxelise a logical volume or not: name bool.");
+  fMessenger->DeclareMethod("voxels", &NavigationStats::PrintVoxels,
+                            "Print the smart-voxel structure of each volume.");
+  fMessenger->DeclareProperty("enable", fEnabled,
+                              "Record navigation statistics for every step.");
+  fMessenger->DeclareMethod("print", &NavigationStats::CollectAndPrint,
+                            "Merge the thread statistics and print them.");
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
@@ -0,0 +1,95 @@
+#ifndef NavigationStats_h
+#define NavigationStats_h 1
+
+#include "globals.hh"
+#include "G4ThreeVector.hh"
+
+#include <map>
+#include <vector>
+
+class G4Step;
+class G4LogicalVolume;
+class G4SmartVoxelHeader;
+class G4GenericMessenger;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+/// Smart-voxel settings per logical volume and navigation statistics.
+///
+/// Voxel quality (smartless) and optimisation are kept per logical volume
+/// name and applied by DetectorConstruction when the volumes are built, or
+/// immediately from the UI, in which case the voxels are rebuilt at the
+/// next run. The voxel dump walks the headers of every optimised volume
+/// (slices, distinct nodes, depth, daughters per node). With statistics
+/// enabled, each step records the number of daughter candidates of the
+/// voxel node holding the pre-step point, which is what the voxel
+/// navigation scans, and each geometry-limited step counts a relocation.
+///
+///   /nmds/navigation/smartless World 4
+///   /nmds/navigation/optimise World true
+///   /nmds/navigation/voxels
+///   /nmds/navigation/enable true
+///   /nmds/navigation/print
+
+class NavigationStats
+{
+  public:
+    static NavigationStats* Instance();
+    static NavigationStats* Master();
+    static void CollectWorkers();
+
+    static G4bool IsEnabled() { return fEnabled; }
+
+    // Voxel settings, by logical volume name
+    void SetSmartless(const G4String& lvName, G4double smartless);
+    void SetOptimisation(const G4String& lvName, G4bool optimise);
+    void ApplyVoxelSettings() const;
+
+    // Called for every step by ScoringSteppingAction
+    void Step(const G4Step* step);
+
+    void Reset();
+    void PrintVoxels() const;
+    void Print() const;
+
+  private:
+    struct Counters {
+      Counters() : steps(0), candidates(0), maxCandidates(0),
+                   relocations(0) {}
+      G4long steps;
+      G4long candidates;
+      G4long maxCandidates;
+      G4long relocations;
+    };
+
+    NavigationStats(G4bool master);
+    ~NavigationStats();
+
+    static G4int CountCandidates(const G4LogicalVolume* lv,
+                                 const G4ThreeVector& localPoint);
+    void WalkHeader(const G4SmartVoxelHeader* header, G4int depth,
+                    std::vector<const void*>& visited,
+                    G4int& slices, G4int& nodes, G4int& maxDepth,
+                    G4int& maxContained, G4long& contained) const;
+
+    void DefineCommands();
+    void SmartlessCommand(const G4String& args);
+    void OptimiseCommand(const G4String& args);
+    void CollectAndPrint();
+
+    std::map<const G4LogicalVolume*, Counters> fCounters;
+    std::map<G4String, Counters>               fMerged;
+    const G4LogicalVolume* fLastVolume;
+    Counters*              fLastCounters;
+
+    std::map<G4String, G4double> fSmartless;
+    std::map<G4String, G4bool>   fOptimise;
+
+    G4GenericMessenger* fMessenger;
+
+    static G4bool fEnabled;
+};
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+#endif
@@ -0,0 +1,548 @@
+#include "NeutronXSCache.hh"
+#include "NeutronXSCacheData.hh"
+
+#include "G4Material.hh"
+#include "G4Element.hh"
+#include "G4LogicalVolume.hh"
+#include "G4LogicalVolumeStore.hh"
+#include "G4Neutron.hh"
+#include "G4DynamicParticle.hh"
+#include "G4HadronicProcess.hh"
+#include "G4HadronicProcessStore.hh"
+#include "G4CrossSectionDataStore.hh"
+#include "G4AutoLock.hh"
+#include "G4GenericMessenger.hh"
+#include "G4Version.hh"
+#include "G4SystemOfUnits.hh"
+#include "Randomize.hh"
+#include "G4ios.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <sstream>
+
+namespace
+{
+  G4Mutex xsMutex = G4MUTEX_INITIALIZER;
+
+  const G4double kEmin = 1.e-5*eV;
+  const G4double kEmax = 20.*MeV;
+  const G4int    kPointsPerDecade  = 50;
+  const G4int    kBucketsPerDecade = 64;
+  const G4int    kMaxDepth = 8;
+  const G4int    kMaxZ = 120;
+  const G4int    kFileVersion = 1;
+  const G4long   kTabulationSeed = 20110307;
+
+  // The data store asks for each element in turn at the same energy
+  struct LastLookup {
+    const void* table;
+    G4double energy;
+    G4int index;
+    G4double fraction;
+  };
+  G4ThreadLocal LastLookup lastLookup = { nullptr, -1., -1, 0. };
+
+  template <typename T>
+  void WriteRaw(std::ostream& os, const T& value)
+  {
+    os.write(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+
+  template <typename T>
+  G4bool ReadRaw(std::istream& is, T& value)
+  {
+    return (G4bool)is.read(reinterpret_cast<char*>(&value), sizeof(T));
+  }
+}
+
+G4bool   NeutronXSCache::fEnabled   = false;
+G4String NeutronXSCache::fFileName  = "nmds_xs.cache";
+G4double NeutronXSCache::fTolerance = 0.01;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+NeutronXSCache* NeutronXSCache::Instance()
+{
+  static NeutronXSCache instance;
+  return &instance;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+NeutronXSCache::NeutronXSCache()
+ : fBuilt(false),
+   fMessenger(nullptr)
+{
+  for (G4int c = 0; c < kNumberOfChannels; ++c) fChannels[c] = false;
+
+  fMessenger = new G4GenericMessenger(this, "/nmds/xs/",
+                                      "Unionized neutron cross sections");
+  fMessenger->DeclareProperty("enable", fEnabled,
+                              "Use the tabulated neutron cross sections.");
+  fMessenger->DeclareProperty("file", fFileName,
+                              "File the tables are saved to and read from.");
+  auto& toleranceCmd = fMessenger->DeclareProperty("tolerance", fTolerance,
+                              "Relative interpolation tolerance of the grid.");
+  toleranceCmd.SetParameterName("tolerance", false);
+  toleranceCmd.SetRange("tolerance>0.");
+  fMessenger->DeclareMethod("print", &NeutronXSCache::Print,
+                            "Print the tables.");
+}
+
+NeutronXSCache::~NeutronXSCache()
+{
+  delete fMessenger;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void NeutronXSCache::Attach()
+{
+  static G4ThreadLocal G4bool attached = false;
+  if (attached) return;
+  attached = true;
+
+  // Normally built on the master already (Prepare(), at the start of the
+  // run); otherwise the first thread builds the tables from its own data
+  // sets, before the cached ones are put in front of them
+  G4HadronicProcess* processes[kNumberOfChannels];
+  FindProcesses(processes);
+  {
+    G4AutoLock lock(&xsMutex);
+    if (!fBuilt) Build(processes);
+  }
+
+  for (G4int c = 0; c < kNumberOfChannels; ++c) {
+    if (processes[c] && fChannels[c]) {
+      processes[c]->AddDataSet(new NeutronXSCacheData((Channel)c));
+    }
+  }
+}
+
+void NeutronXSCache::Prepare()
+{
+  static G4ThreadLocal G4bool prepared = false;
+  if (prepared) return;
+  prepared = true;
+
+  G4HadronicProcess* processes[kNumberOfChannels];
+  FindProcesses(processes);
+  G4AutoLock lock(&xsMutex);
+  if (!fBuilt) Build(processes);
+}
+
+void NeutronXSCache::FindProcesses(G4HadronicProcess* processes[kNumberOfChannels])
+{
+  static const G4HadronicProcessType types[kNumberOfChannels] =
+    { fHadronElastic, fHadronInelastic, fCapture, fFission };
+  auto store = G4HadronicProcessStore::Instance();
+  for (G4int c = 0; c < kNumberOfChannels; ++c) {
+    processes[c] = store->FindProcess(G4Neutron::Definition(), types[c]);
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void NeutronXSCache::Build(G4HadronicProcess* processes[kNumberOfChannels])
+{
+  fBuilt = true;
+  for (G4int c = 0; c < kNumberOfChannels; ++c) {
+    fChannels[c] = (processes[c] != nullptr);
+  }
+
+  // Materials of the geometry, in order of first use
+  std::vector<const G4Material*> materials;
+  for (auto lv : *G4LogicalVolumeStore::GetInstance()) {
+    const G4Material* material = lv->GetMaterial();
+    if (std::find(materials.begin(), materials.end(), material) ==
+        materials.end()) materials.push_back(material);
+  }
+
+  fTables.clear();
+  for (auto material : materials) {
+    Table table;
+    table.material = material;
+    table.key = MakeKey(material);
+    table.column.assign(kMaxZ, -1);
+    G4bool unique = true;
+    for (std::size_t i = 0; i < material->GetNumberOfElements(); ++i) {
+      const G4Element* element = material->GetElement(i);
+      G4int Z = G4int(element->GetZ() + 0.5);
+      if (Z >= kMaxZ || table.column[Z] >= 0) unique = false;
+      else table.column[Z] = (G4int)i;
+      table.elements.push_back(element);
+    }
+    // Data sets are asked by Z only
+    if (!unique) {
+      G4cout << "### Cross-section cache: " << material->GetName()
+             << " has two elements of the same Z, not tabulated" << G4endl;
+      continue;
+    }
+    fTables.push_back(table);
+  }
+
+  if (Load(fFileName)) return;
+
+  // The engine of the calling thread is put back afterwards
+  std::ostringstream state;
+  G4Random::getTheEngine()->put(state);
+
+  for (auto& table : fTables) {
+    BuildTable(table, processes);
+    Finish(table);
+    G4cout << "### Cross-section cache: " << table.material->GetName() << ", "
+           << table.energy.size() << " points" << G4endl;
+  }
+
+  std::istringstream restore(state.str());
+  G4Random::getTheEngine()->get(restore);
+  Save(fFileName);
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void NeutronXSCache::Evaluate(const Table& table,
+                              G4HadronicProcess* processes[kNumberOfChannels],
+                              G4double energy,
+                              std::vector<G4double>& values) const
+{
+  // Data sets that Doppler-broaden sample the target motion: the same
+  // numbers at every energy make the tabulated function smooth, so that
+  // the refinement follows the data and not the sampling noise
+  G4Random::setTheSeed(kTabulationSeed);
+
+  G4DynamicParticle neutron(G4Neutron::Definition(), G4ThreeVector(0., 0., 1.),
+                            energy);
+  std::size_t nel = table.elements.size();
+  values.assign(kNumberOfChannels*nel, 0.);
+  for (G4int c = 0; c < kNumberOfChannels; ++c) {
+    if (!processes[c]) continue;
+    G4CrossSectionDataStore* store = processes[c]->GetCrossSectionDataStore();
+    for (std::size_t i = 0; i < nel; ++i) {
+      values[c*nel + i] = store->GetCrossSection(&neutron, table.elements[i],
+                                                 table.material);
+    }
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void NeutronXSCache::BuildTable(Table& table,
+                                G4HadronicProcess* processes[kNumberOfChannels])
+                                const
+{
+  // Points are kept as rows of all channels and elements, and split into
+  // the per-channel arrays at the end
+  std::vector<G4double> energies;
+  std::vector<std::vector<G4double> > rows;
+
+  std::function<void(G4double, const std::vector<G4double>&,
+                     G4double, const std::vector<G4double>&, G4int)> refine =
+    [&](G4double e0, const std::vector<G4double>& v0,
+        G4double e1, const std::vector<G4double>& v1, G4int depth) {
+      if (depth >= kMaxDepth) return;
+      G4double em = std::sqrt(e0*e1);
+      std::vector<G4double> vm;
+      Evaluate(table, processes, em, vm);
+      G4double f = (em - e0)/(e1 - e0);
+      G4bool converged = true;
+      for (std::size_t j = 0; j < vm.size() && converged; ++j) {
+        G4double interpolated = v0[j] + f*(v1[j] - v0[j]);
+        G4double scale = std::max(std::fabs(vm[j]), 1.e-6*barn);
+        if (std::fabs(vm[j] - interpolated) > fTolerance*scale) converged = false;
+      }
+      if (converged) return;
+      refine(e0, v0, em, vm, depth + 1);
+      energies.push_back(em);
+      rows.push_back(vm);
+      refine(em, vm, e1, v1, depth + 1);
+    };
+
+  G4int nbase = G4int(std::ceil(std::log10(kEmax/kEmin)*kPointsPerDecade));
+  std::vector<G4double> previous, current;
+  G4double ePrevious = kEmin;
+  Evaluate(table, processes, kEmin, previous);
+  energies.push_back(kEmin);
+  rows.push_back(previous);
+  for (G4int k = 1; k <= nbase; ++k) {
+    G4double e = (k == nbase) ? kEmax
+                              : kEmin*std::pow(10., G4double(k)/kPointsPerDecade);
+    Evaluate(table, processes, e, current);
+    refine(ePrevious, previous, e, current, 0);
+    energies.push_back(e);
+    rows.push_back(current);
+    ePrevious = e;
+    previous.swap(current);
+  }
+
+  std::size_t nel = table.elements.size();
+  std::size_t npoints = energies.size();
+  table.energy = energies;
+  for (G4int c = 0; c < kNumberOfChannels; ++c) {
+    table.xs[c].resize(npoints*nel);
+    for (std::size_t p = 0; p < npoints; ++p) {
+      for (std::size_t i = 0; i < nel; ++i) {
+        table.xs[c][p*nel + i] = rows[p][c*nel + i];
+      }
+    }
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void NeutronXSCache::Finish(Table& table) const
+{
+  // Macroscopic cross sections and their total
+  std::size_t nel = table.elements.size();
+  std::size_t npoints = table.energy.size();
+  const G4double* density = table.material->GetVecNbOfAtomsPerVolume();
+  table.total.assign(npoints, 0.);
+  for (G4int c = 0; c < kNumberOfChannels; ++c) {
+    table.macro[c].assign(npoints, 0.);
+    for (std::size_t p = 0; p < npoints; ++p) {
+      G4double sum = 0.;
+      for (std::size_t i = 0; i < nel; ++i) {
+        sum += density[i]*table.xs[c][p*nel + i];
+      }
+      table.macro[c][p] = sum;
+      table.total[p] += sum;
+    }
+  }
+
+  // Grid point at or below the low edge of each logarithmic bucket
+  G4int nbuckets = G4int(std::ceil(std::log10(kEmax/kEmin)*kBucketsPerDecade));
+  table.bucket.resize(nbuckets + 1);
+  std::size_t p = 0;
+  for (G4int b = 0; b <= nbuckets; ++b) {
+    G4double edge = kEmin*std::pow(10., G4double(b)/kBucketsPerDecade);
+    while (p + 2 < npoints && table.energy[p + 1] <= edge) ++p;
+    table.bucket[b] = (G4int)p;
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+const NeutronXSCache::Table*
+NeutronXSCache::FindTable(const G4Material* material) const
+{
+  for (const auto& table : fTables) {
+    if (table.material == material) return &table;
+  }
+  return nullptr;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4int NeutronXSCache::Locate(const Table& table, G4double energy,
+                             G4double& fraction) const
+{
+  if (lastLookup.table == &table && lastLookup.energy == energy) {
+    fraction = lastLookup.fraction;
+    return lastLookup.index;
+  }
+
+  static const G4double bucketsPerLog = kBucketsPerDecade/std::log(10.);
+  G4int b = G4int(std::log(energy/kEmin)*bucketsPerLog);
+  b = std::max(0, std::min((G4int)table.bucket.size() - 1, b));
+  G4int p = table.bucket[b];
+  G4int last = (G4int)table.energy.size() - 2;
+  while (p < last && table.energy[p + 1] < energy) ++p;
+  fraction = (energy - table.energy[p])/(table.energy[p + 1] - table.energy[p]);
+
+  lastLookup.table = &table;
+  lastLookup.energy = energy;
+  lastLookup.index = p;
+  lastLookup.fraction = fraction;
+  return p;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4bool NeutronXSCache::IsApplicable(const G4Material* material,
+                                    G4double energy) const
+{
+  return material && energy >= kEmin && energy <= kEmax &&
+         FindTable(material) != nullptr;
+}
+
+G4double NeutronXSCache::GetElementCrossSection(Channel channel,
+                                                const G4Material* material,
+                                                G4int Z, G4double energy) const
+{
+  const Table* table = FindTable(material);
+  if (!table || Z < 0 || Z >= kMaxZ || table->column[Z] < 0) return 0.;
+  G4double f;
+  G4int p = Locate(*table, energy, f);
+  std::size_t nel = table->elements.size();
+  const G4double* xs = &table->xs[channel][p*nel + table->column[Z]];
+  return xs[0] + f*(xs[nel] - xs[0]);
+}
+
+G4double NeutronXSCache::GetMacroscopic(Channel channel,
+                                        const G4Material* material,
+                                        G4double energy) const
+{
+  if (!IsApplicable(material, energy)) return 0.;
+  const Table* table = FindTable(material);
+  G4double f;
+  G4int p = Locate(*table, energy, f);
+  const G4double* macro = &table->macro[channel][p];
+  return macro[0] + f*(macro[1] - macro[0]);
+}
+
+G4double NeutronXSCache::GetTotalMacroscopic(const G4Material* material,
+                                             G4double energy) const
+{
+  if (!IsApplicable(material, energy)) return 0.;
+  const Table* table = FindTable(material);
+  G4double f;
+  G4int p = Locate(*table, energy, f);
+  const G4double* total = &table->total[p];
+  return total[0] + f*(total[1] - total[0]);
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4String NeutronXSCache::MakeKey(const G4Material* material) const
+{
+  // Everything the tables depend on
+  const char* data = std::getenv("G4NEUTRONHPDATA");
+  std::ostringstream key;
+  key << std::hexfloat << "g4 " << G4VERSION_NUMBER
+      << " data " << (data ? data : "-")
+      << " tolerance " << fTolerance
+      << " channels";
+  for (G4int c = 0; c < kNumberOfChannels; ++c) key << ' ' << fChannels[c];
+  key << " material " << material->GetName()
+      << ' ' << material->GetDensity()
+      << ' ' << material->GetTemperature();
+  for (std::size_t i = 0; i < material->GetNumberOfElements(); ++i) {
+    const G4Element* element = material->GetElement(i);
+    key << " element " << element->GetName() << ' ' << element->GetZ()
+        << ' ' << element->GetN() << ' '
+        << material->GetVecNbOfAtomsPerVolume()[i];
+  }
+  return key.str();
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4bool NeutronXSCache::Load(const G4String& fileName)
+{
+  std::ifstream in(fileName, std::ios::binary);
+  if (!in) return false;
+
+  char magic[8];
+  G4int version = 0, ntables = 0;
+  if (!in.read(magic, 8) || std::string(magic, 8) != "NMDSXS01" ||
+      !ReadRaw(in, version) || version != kFileVersion ||
+      !ReadRaw(in, ntables)) return false;
+
+  std::vector<Table> loaded(fTables);
+  std::vector<G4bool> found(loaded.size(), false);
+  for (G4int t = 0; t < ntables; ++t) {
+    G4int length = 0, npoints = 0, nel = 0;
+    if (!ReadRaw(in, length) || length <= 0) return false;
+    std::string key(length, ' ');
+    if (!in.read(&key[0], length) ||
+        !ReadRaw(in, npoints) || !ReadRaw(in, nel) || npoints < 2) {
+      return false;
+    }
+    std::vector<G4double> energy(npoints);
+    std::vector<G4double> xs[kNumberOfChannels];
+    in.read(reinterpret_cast<char*>(energy.data()), npoints*sizeof(G4double));
+    for (G4int c = 0; c < kNumberOfChannels; ++c) {
+      xs[c].resize((std::size_t)npoints*nel);
+      in.read(reinterpret_cast<char*>(xs[c].data()),
+              xs[c].size()*sizeof(G4double));
+    }
+    if (!in) return false;
+
+    for (std::size_t i = 0; i < loaded.size(); ++i) {
+      if (loaded[i].key != key || (G4int)loaded[i].elements.size() != nel) {
+        continue;
+      }
+      loaded[i].energy = energy;
+      for (G4int c = 0; c < kNumberOfChannels; ++c) loaded[i].xs[c] = xs[c];
+      found[i] = true;
+    }
+  }
+
+  // All materials or none, so that the file always matches the geometry
+  if (std::find(found.begin(), found.end(), false) != found.end()) return false;
+  for (auto& table : loaded) Finish(table);
+  fTables.swap(loaded);
+  G4cout << "### Cross-section cache: " << fTables.size()
+         << " materials read from " << fileName << G4endl;
+  return true;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void NeutronXSCache::Save(const G4String& fileName) const
+{
+  // Write aside and rename, as for checkpoints
+  G4String tmpName = fileName + ".tmp";
+  {
+    std::ofstream out(tmpName, std::ios::binary);
+    if (!out) {
+      G4ExceptionDescription msg;
+      msg << "Cannot write the cross-section cache to " << fileName;
+      G4Exception("NeutronXSCache::Save()", "NMDS011", JustWarning, msg);
+      return;
+    }
+    out.write("NMDSXS01", 8);
+    WriteRaw(out, kFileVersion);
+    WriteRaw(out, (G4int)fTables.size());
+    for (const auto& table : fTables) {
+      WriteRaw(out, (G4int)table.key.size());
+      out.write(table.key.data(), table.key.size());
+      WriteRaw(out, (G4int)table.energy.size());
+      WriteRaw(out, (G4int)table.elements.size());
+      out.write(reinterpret_cast<const char*>(table.energy.data()),
+                table.energy.size()*sizeof(G4double));
+      for (G4int c = 0; c < kNumberOfChannels; ++c) {
+        out.write(reinterpret_cast<const char*>(table.xs[c].data()),
+                  table.xs[c].size()*sizeof(G4double));
+      }
+    }
+  }
+  if (std::rename(tmpName.c_str(), fileName.c_str()) != 0) {
+    G4ExceptionDescription msg;
+    msg << "Cannot rename " << tmpName << " to " << fileName;
+    G4Exception("NeutronXSCache::Save()", "NMDS011", JustWarning, msg);
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void NeutronXSCache::Print() const
+{
+  static const G4double energies[] = { 0.0253*eV, 1.*eV, 1.*keV, 1.*MeV };
+
+  G4cout << G4endl
+         << "------------------- Neutron cross-section cache ------------------"
+         << G4endl
+         << "  material        points   Sigma_t [1/cm] at 0.0253 eV, 1 eV, "
+         << "1 keV, 1 MeV" << G4endl;
+  for (const auto& table : fTables) {
+    G4cout << "  " << std::left << std::setw(16) << table.material->GetName()
+           << std::right << std::setw(6) << table.energy.size();
+    for (auto energy : energies) {
+      G4cout << std::setw(12) << std::setprecision(4)
+             << GetTotalMacroscopic(table.material, energy)*cm;
+    }
+    G4cout << std::setprecision(6) << G4endl;
+  }
+  if (fTables.empty()) G4cout << "  not built yet" << G4endl;
+  G4cout << "-----------------------------------------------------------------"
+         << G4endl;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
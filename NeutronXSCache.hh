@@ -0,0 +1,116 @@
+#ifndef NeutronXSCache_h
+#define NeutronXSCache_h 1
+
+#include "globals.hh"
+
+#include <iosfwd>
+#include <vector>
+
+class G4Material;
+class G4Element;
+class G4HadronicProcess;
+class G4GenericMessenger;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+/// Neutron cross sections of the materials in the geometry, tabulated on
+/// one unionized energy grid per material.
+///
+/// The grid starts from a fixed number of points per decade and is refined
+/// by bisection wherever linear interpolation misses the underlying data
+/// (the data sets already registered with the neutron elastic, inelastic,
+/// capture and fission processes) by more than the tolerance, for any
+/// element and channel. Per channel, the element cross sections are stored
+/// point by point (elements contiguous), next to the macroscopic cross
+/// sections and their total, so that one grid search and one interpolation
+/// loop serve every element of the material. The tables are built once,
+/// on the master at the start of the first run (ScoringRunAction), outside
+/// any event, and shared read-only; they are saved to a file and reused
+/// while the material, Geant4 version and data path are unchanged. Data
+/// sets that sample the thermal motion of the target draw the same fixed
+/// random numbers at every energy, and the engine is restored afterwards,
+/// so building the tables leaves the random sequence of the run as it was.
+///
+/// Each thread then puts a NeutronXSCacheData set in front of the data
+/// sets of its neutron processes (Attach(), from ScoringRunAction at the
+/// start of the run).
+///
+///   /nmds/xs/enable true
+///   /nmds/xs/file nmds_xs.cache
+///   /nmds/xs/tolerance 0.01
+///   /nmds/xs/print
+
+class NeutronXSCache
+{
+  public:
+    enum Channel { kElastic, kInelastic, kCapture, kFission, kNumberOfChannels };
+
+    static NeutronXSCache* Instance();
+
+    static G4bool IsEnabled() { return fEnabled; }
+
+    // Build or load the tables if needed, and attach the cached data sets
+    // to the neutron processes of the calling thread
+    void Attach();
+    // Only build or load the tables: on the master at the start of the run,
+    // and for lookups (PerturbationTally)
+    void Prepare();
+
+    G4bool IsApplicable(const G4Material* material, G4double energy) const;
+
+    // Microscopic cross section of element Z, macroscopic cross section
+    G4double GetElementCrossSection(Channel channel, const G4Material* material,
+                                    G4int Z, G4double energy) const;
+    G4double GetMacroscopic(Channel channel, const G4Material* material,
+                            G4double energy) const;
+    G4double GetTotalMacroscopic(const G4Material* material,
+                                 G4double energy) const;
+
+    void Print() const;
+
+  private:
+    struct Table {
+      const G4Material* material;
+      G4String key;
+      std::vector<const G4Element*> elements;
+      std::vector<G4int> column;           // by Z, -1 when absent
+      std::vector<G4double> energy;        // unionized grid
+      std::vector<G4double> xs[kNumberOfChannels];     // [point][element]
+      std::vector<G4double> macro[kNumberOfChannels];  // [point]
+      std::vector<G4double> total;                     // [point]
+      std::vector<G4int> bucket;           // first point of each log bucket
+    };
+
+    NeutronXSCache();
+    ~NeutronXSCache();
+
+    static void FindProcesses(G4HadronicProcess* processes[kNumberOfChannels]);
+    void Build(G4HadronicProcess* processes[kNumberOfChannels]);
+    void BuildTable(Table& table,
+                    G4HadronicProcess* processes[kNumberOfChannels]) const;
+    void Evaluate(const Table& table,
+                  G4HadronicProcess* processes[kNumberOfChannels],
+                  G4double energy, std::vector<G4double>& values) const;
+    void Finish(Table& table) const;
+
+    const Table* FindTable(const G4Material* material) const;
+    G4int Locate(const Table& table, G4double energy, G4double& fraction) const;
+
+    G4String MakeKey(const G4Material* material) const;
+    G4bool Load(const G4String& fileName);
+    void Save(const G4String& fileName) const;
+
+    std::vector<Table> fTables;
+    G4bool fBuilt;
+    G4bool fChannels[kNumberOfChannels];
+
+    G4GenericMessenger* fMessenger;
+
+    static G4bool   fEnabled;
+    static G4String fFileName;
+    static G4double fTolerance;
+};
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+#endif
@@ -0,0 +1,34 @@
+#include "NeutronXSCacheData.hh"
+
+#include "G4DynamicParticle.hh"
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+NeutronXSCacheData::NeutronXSCacheData(NeutronXSCache::Channel channel)
+ : G4VCrossSectionDataSet("NMDSCachedXS"),
+   fChannel(channel),
+   fCache(NeutronXSCache::Instance())
+{
+}
+
+NeutronXSCacheData::~NeutronXSCacheData()
+{
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4bool NeutronXSCacheData::IsElementApplicable(const G4DynamicParticle* particle,
+                                               G4int, const G4Material* material)
+{
+  return fCache->IsApplicable(material, particle->GetKineticEnergy());
+}
+
+G4double
+NeutronXSCacheData::GetElementCrossSection(const G4DynamicParticle* particle,
+                                           G4int Z, const G4Material* material)
+{
+  return fCache->GetElementCrossSection(fChannel, material, Z,
+                                        particle->GetKineticEnergy());
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
@@ -0,0 +1,32 @@
+#ifndef NeutronXSCacheData_h
+#define NeutronXSCacheData_h 1
+
+#include "G4VCrossSectionDataSet.hh"
+#include "NeutronXSCache.hh"
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+/// Cross-section data set reading one channel of NeutronXSCache; it
+/// applies to the tabulated materials in the tabulated energy range and
+/// leaves everything else to the data sets behind it.
+
+class NeutronXSCacheData : public G4VCrossSectionDataSet
+{
+  public:
+    NeutronXSCacheData(NeutronXSCache::Channel channel);
+    virtual ~NeutronXSCacheData();
+
+    virtual G4bool IsElementApplicable(const G4DynamicParticle* particle,
+                                       G4int Z, const G4Material* material);
+    virtual G4double GetElementCrossSection(const G4DynamicParticle* particle,
+                                            G4int Z,
+                                            const G4Material* material);
+
+  private:
+    NeutronXSCache::Channel fChannel;
+    const NeutronXSCache*   fCache;
+};
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+#endif
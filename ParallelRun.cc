@@ -0,0 +1,167 @@
+#include "ParallelRun.hh"
+#include "RunTally.hh"
+#include "DieAwayHistogram.hh"
+#include "FluenceMesh.hh"
+#include "CounterElectronics.hh"
+
+#include "G4ios.hh"
+
+#include <algorithm>
+
+#ifdef NMDS_USE_MPI
+#include <mpi.h>
+#endif
+
+G4int ParallelRun::fRank = 0;
+G4int ParallelRun::fSize = 1;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ParallelRun::Initialize(int* argc, char*** argv)
+{
+#ifdef NMDS_USE_MPI
+  MPI_Init(argc, argv);
+  MPI_Comm_rank(MPI_COMM_WORLD, &fRank);
+  MPI_Comm_size(MPI_COMM_WORLD, &fSize);
+  if (fRank == 0) {
+    G4cout << "### Production over " << fSize << " processes" << G4endl;
+  }
+#else
+  (void)argc;
+  (void)argv;
+#endif
+}
+
+void ParallelRun::Finalize()
+{
+#ifdef NMDS_USE_MPI
+  MPI_Finalize();
+#endif
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4long ParallelRun::GetFirstEvent(G4long nofEvents)
+{
+  return nofEvents*fRank/fSize;
+}
+
+G4long ParallelRun::GetNumberOfEvents(G4long nofEvents)
+{
+  return nofEvents*(fRank + 1)/fSize - nofEvents*fRank/fSize;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ParallelRun::Sum(std::vector<G4double>& buffer)
+{
+#ifdef NMDS_USE_MPI
+  if (fSize > 1) {
+    MPI_Allreduce(MPI_IN_PLACE, buffer.data(), (int)buffer.size(),
+                  MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+  }
+#else
+  (void)buffer;
+#endif
+}
+
+G4long ParallelRun::Sum(G4long value)
+{
+#ifdef NMDS_USE_MPI
+  if (fSize > 1) {
+    long long local = value, total = 0;
+    MPI_Allreduce(&local, &total, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+    return (G4long)total;
+  }
+#endif
+  return value;
+}
+
+G4long ParallelRun::Broadcast(G4long value)
+{
+#ifdef NMDS_USE_MPI
+  if (fSize > 1) {
+    long long shared = value;
+    MPI_Bcast(&shared, 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+    return (G4long)shared;
+  }
+#endif
+  return value;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ParallelRun::PackVector(std::vector<G4double>& buffer,
+                             const std::vector<G4double>& v)
+{
+  buffer.insert(buffer.end(), v.begin(), v.end());
+}
+
+G4bool ParallelRun::UnpackVector(const std::vector<G4double>& buffer,
+                                 std::size_t& offset, std::vector<G4double>& v)
+{
+  if (offset + v.size() > buffer.size()) return false;
+  std::copy(buffer.begin() + offset, buffer.begin() + offset + v.size(),
+            v.begin());
+  offset += v.size();
+  return true;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ParallelRun::PackTallies(std::vector<G4double>& buffer)
+{
+  RunTally::Master()->Pack(buffer);
+  DieAwayHistogram::Master()->Pack(buffer);
+  FluenceMesh::Master()->Pack(buffer);
+  CounterElectronics::Master()->Pack(buffer);
+}
+
+G4bool ParallelRun::UnpackTallies(const std::vector<G4double>& buffer)
+{
+  std::size_t offset = 0;
+  return RunTally::Master()->Unpack(buffer, offset) &&
+         DieAwayHistogram::Master()->Unpack(buffer, offset) &&
+         FluenceMesh::Master()->Unpack(buffer, offset) &&
+         CounterElectronics::Master()->Unpack(buffer, offset) &&
+         offset == buffer.size();
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+std::vector<G4double> ParallelRun::ReduceTallies()
+{
+  std::vector<G4double> local;
+  if (fSize == 1) return local;
+
+  PackTallies(local);
+
+  // Every rank must bring the same layout, e.g. the same mesh
+  G4long size = local.size();
+  G4long mismatch = (Broadcast(size) != size) ? 1 : 0;
+  if (Sum(mismatch) > 0) {
+    G4Exception("ParallelRun::ReduceTallies()", "NMDS017", FatalException,
+                "The ranks have different tally settings.");
+    return std::vector<G4double>();
+  }
+
+  std::vector<G4double> total(local);
+  Sum(total);
+  UnpackTallies(total);
+  return local;
+}
+
+void ParallelRun::RestoreTallies(const std::vector<G4double>& local)
+{
+  if (!local.empty()) UnpackTallies(local);
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4String ParallelRun::GetFileName(const G4String& fileName)
+{
+  if (fSize == 1) return fileName;
+  return fileName + ".rank" + std::to_string(fRank);
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
@@ -0,0 +1,73 @@
+#ifndef ParallelRun_h
+#define ParallelRun_h 1
+
+#include "globals.hh"
+
+#include <vector>
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+/// Production runs spread over several processes (MPI ranks), each with
+/// its own geometry, threads and tallies, built with NMDS_USE_MPI.
+///
+/// ProductionRun gives rank r the events [N r/size, N (r+1)/size) of a
+/// run of N events and numbers them globally, so that with per-event
+/// seeding (/nmds/random/perEvent) every event has the random stream it
+/// has in a single process, and the summed tallies are those of the
+/// single-process run up to rounding. Without it the master engine of
+/// each rank is seeded from the run seed and the rank.
+///
+/// After every chunk the sums of RunTally, DieAwayHistogram, FluenceMesh
+/// and CounterElectronics are added over the ranks with one all-reduce;
+/// rank 0 decides on that total how the run goes on (RunTermination) and
+/// tells the others. Each rank checkpoints its own sums to
+/// <file>.rank<r>. At the end all ranks hold the reduced tallies and rank
+/// 0 prints and writes them. Without NMDS_USE_MPI, or with a single rank,
+/// all of this reduces to the serial run.
+///
+///   mpirun -np 4 nmds production.mac
+
+class ParallelRun
+{
+  public:
+    // From main(), around everything else
+    static void Initialize(int* argc, char*** argv);
+    static void Finalize();
+
+    static G4int GetRank() { return fRank; }
+    static G4int GetSize() { return fSize; }
+
+    // Share of this rank in a run of nofEvents events
+    static G4long GetFirstEvent(G4long nofEvents);
+    static G4long GetNumberOfEvents(G4long nofEvents);
+
+    // Collective operations, the identity on a single rank
+    static void Sum(std::vector<G4double>& buffer);
+    static G4long Sum(G4long value);
+    static G4long Broadcast(G4long value);
+
+    // Replace the master tallies by their sums over the ranks; the local
+    // sums are returned for RestoreTallies()
+    static std::vector<G4double> ReduceTallies();
+    static void RestoreTallies(const std::vector<G4double>& local);
+
+    // File name of this rank
+    static G4String GetFileName(const G4String& fileName);
+
+    // Flat buffers of the tallies
+    static void PackVector(std::vector<G4double>& buffer,
+                           const std::vector<G4double>& v);
+    static G4bool UnpackVector(const std::vector<G4double>& buffer,
+                               std::size_t& offset, std::vector<G4double>& v);
+
+  private:
+    static void PackTallies(std::vector<G4double>& buffer);
+    static G4bool UnpackTallies(const std::vector<G4double>& buffer);
+
+    static G4int fRank;
+    static G4int fSize;
+};
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+#endif
@@ -0,0 +1,528 @@
+#include "PerturbationTally.hh"
+#include "NeutronXSCache.hh"
+
+#include "G4Step.hh"
+#include "G4Track.hh"
+#include "G4Neutron.hh"
+#include "G4Material.hh"
+#include "G4Element.hh"
+#include "G4LogicalVolume.hh"
+#include "G4LogicalVolumeStore.hh"
+#include "G4VPhysicalVolume.hh"
+#include "G4HadronicProcess.hh"
+#include "G4HadronicProcessStore.hh"
+#include "G4AutoLock.hh"
+#include "G4GenericMessenger.hh"
+#include "G4ios.hh"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+namespace
+{
+  G4Mutex perturbationMutex = G4MUTEX_INITIALIZER;
+  std::vector<PerturbationTally*>* workers = nullptr;
+
+  // Name of a region, or of one of its counter-fill variants
+  G4bool Matches(const G4String& name, const G4String& region)
+  {
+    if (name == region) return true;
+    G4String prefix = region + "_x";
+    return name.compare(0, prefix.size(), prefix) == 0;
+  }
+
+  G4bool IsCollision(const G4VProcess* process)
+  {
+    if (!process || process->GetProcessType() != fHadronic) return false;
+    G4int type = process->GetProcessSubType();
+    return type == fHadronElastic || type == fHadronInelastic ||
+           type == fCapture || type == fFission;
+  }
+}
+
+G4bool PerturbationTally::fEnabled = false;
+std::vector<PerturbationTally::Definition> PerturbationTally::fDefinitions;
+G4int  PerturbationTally::fVersion = 0;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+PerturbationTally* PerturbationTally::Instance()
+{
+  static G4ThreadLocal PerturbationTally* instance = nullptr;
+  if (!instance) {
+    instance = new PerturbationTally(false);
+    G4AutoLock lock(&perturbationMutex);
+    if (!workers) workers = new std::vector<PerturbationTally*>;
+    workers->push_back(instance);
+  }
+  return instance;
+}
+
+PerturbationTally* PerturbationTally::Master()
+{
+  static PerturbationTally master(true);
+  return &master;
+}
+
+void PerturbationTally::CollectWorkers()
+{
+  G4AutoLock lock(&perturbationMutex);
+  if (!workers) return;
+  PerturbationTally* master = Master();
+  for (auto worker : *workers) {
+    master->Merge(*worker);
+    worker->Reset();
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+PerturbationTally::PerturbationTally(G4bool master)
+ : fConfigVersion(-1),
+   fPerturbations(0),
+   fCurrent(nullptr),
+   fCurrentID(-1),
+   fScoredID(-1),
+   fScoredStep(-1),
+   fScored(false),
+   fNofEvents(0),
+   fMessenger(nullptr)
+{
+  if (master) DefineCommands();
+}
+
+PerturbationTally::~PerturbationTally()
+{
+  delete fMessenger;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void PerturbationTally::Configure()
+{
+  fConfigVersion = fVersion;
+  fPerturbations = fDefinitions.size();
+
+  // Volumes of each perturbation, with the element in their material
+  fRegions.clear();
+  for (auto lv : *G4LogicalVolumeStore::GetInstance()) {
+    const G4Material* material = lv->GetMaterial();
+    for (G4int p = 0; p < fPerturbations; ++p) {
+      const Definition& definition = fDefinitions[p];
+      if (!Matches(lv->GetName(), definition.region) &&
+          !Matches(material->GetName(), definition.region)) continue;
+
+      Entry entry = { p, -1, 0 };
+      if (!definition.element.empty()) {
+        for (std::size_t i = 0; i < material->GetNumberOfElements(); ++i) {
+          const G4Element* element = material->GetElement(i);
+          if (element->GetName() == definition.element ||
+              element->GetSymbol() == definition.element) {
+            entry.element = i;
+            entry.Z = G4int(element->GetZ() + 0.5);
+            break;
+          }
+        }
+        if (entry.element < 0) continue;
+      }
+      fRegions[lv].push_back(entry);
+    }
+  }
+
+  fEventRate.assign(kNumberOfBins, 0.);
+  fRateSum.assign(kNumberOfBins, 0.);
+  fRateSum2.assign(kNumberOfBins, 0.);
+  G4int nbins = fPerturbations*kNumberOfBins;
+  fEventDerivative.assign(nbins, 0.);
+  fSum.assign(nbins, 0.);
+  fSum2.assign(nbins, 0.);
+  fCross.assign(nbins, 0.);
+  fScored = false;
+  fNofEvents = 0;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+std::vector<G4double>* PerturbationTally::Current(G4int trackID, G4bool create)
+{
+  if (trackID != fCurrentID) {
+    auto entry = fTracks.find(trackID);
+    fCurrent = (entry != fTracks.end()) ? &entry->second : nullptr;
+    fCurrentID = trackID;
+  }
+  if (!fCurrent && create) {
+    fCurrent = &fTracks[trackID];
+    fCurrent->assign(fPerturbations, 0.);
+  }
+  return fCurrent;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4double PerturbationTally::CrossSection(const G4Material* material,
+                                         const Entry& entry,
+                                         G4double energy) const
+{
+  auto cache = NeutronXSCache::Instance();
+  if (cache->IsApplicable(material, energy)) {
+    if (entry.element < 0) return cache->GetTotalMacroscopic(material, energy);
+    G4double sigma = 0.;
+    for (G4int c = 0; c < NeutronXSCache::kNumberOfChannels; ++c) {
+      sigma += cache->GetElementCrossSection((NeutronXSCache::Channel)c,
+                                             material, entry.Z, energy);
+    }
+    return sigma*material->GetVecNbOfAtomsPerVolume()[entry.element];
+  }
+
+  // Outside the tables, from the processes
+  auto store = G4HadronicProcessStore::Instance();
+  auto neutron = G4Neutron::Definition();
+  if (entry.element < 0) {
+    return store->GetElasticCrossSectionPerVolume(neutron, energy, material)
+         + store->GetInelasticCrossSectionPerVolume(neutron, energy, material)
+         + store->GetCaptureCrossSectionPerVolume(neutron, energy, material)
+         + store->GetFissionCrossSectionPerVolume(neutron, energy, material);
+  }
+  const G4Element* element = material->GetElement(entry.element);
+  G4double sigma
+    = store->GetElasticCrossSectionPerAtom(neutron, energy, element, material)
+    + store->GetInelasticCrossSectionPerAtom(neutron, energy, element, material)
+    + store->GetCaptureCrossSectionPerAtom(neutron, energy, element, material)
+    + store->GetFissionCrossSectionPerAtom(neutron, energy, element, material);
+  return sigma*material->GetVecNbOfAtomsPerVolume()[entry.element];
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void PerturbationTally::Accumulate(const G4Step* step,
+                                   const std::vector<Entry>& entries,
+                                   std::vector<G4double>& derivatives) const
+{
+  const G4StepPoint* prePoint = step->GetPreStepPoint();
+  const G4Material* material = prePoint->GetMaterial();
+  G4double energy = prePoint->GetKineticEnergy();
+  G4double length = step->GetStepLength();
+
+  // Collision ending the step, and the element hit when it matters
+  const G4VProcess* process = step->GetPostStepPoint()->GetProcessDefinedStep();
+  G4bool collision = IsCollision(process);
+  G4int targetZ = -1;
+  G4bool byElement = std::any_of(entries.begin(), entries.end(),
+                                 [](const Entry& e) { return e.element >= 0; });
+  if (collision && byElement) {
+    auto hadronic
+      = dynamic_cast<G4HadronicProcess*>(const_cast<G4VProcess*>(process));
+    const G4Isotope* isotope = hadronic ? hadronic->GetTargetIsotope() : nullptr;
+    if (isotope) targetZ = isotope->GetZ();
+  }
+
+  for (const auto& entry : entries) {
+    G4double& d = derivatives[entry.index];
+    d -= CrossSection(material, entry, energy)*length;
+    if (collision && (entry.element < 0 || targetZ == entry.Z)) d += 1.;
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void PerturbationTally::BeginOfRun()
+{
+  if (fConfigVersion != fVersion) Configure();
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void PerturbationTally::Step(const G4Step* step)
+{
+  const G4Track* track = step->GetTrack();
+  if (track->GetDefinition() != G4Neutron::Definition()) return;
+
+  // The capture step was taken by Score() already
+  G4int id = track->GetTrackID();
+  if (id == fScoredID && track->GetCurrentStepNumber() == fScoredStep) return;
+
+  const G4LogicalVolume* lv
+    = step->GetPreStepPoint()->GetPhysicalVolume()->GetLogicalVolume();
+  auto region = fRegions.find(lv);
+  if (region == fRegions.end()) return;
+
+  Accumulate(step, region->second, *Current(id, true));
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void PerturbationTally::NewTrack(const G4Track* track)
+{
+  // Neutrons come out of the reaction ending their parent, so the parent
+  // derivatives are final when the secondaries are stacked
+  auto parent = fTracks.find(track->GetParentID());
+  if (parent == fTracks.end()) return;
+  std::vector<G4double> derivatives = parent->second;
+  fTracks[track->GetTrackID()].swap(derivatives);
+  fCurrentID = -1;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void PerturbationTally::Score(G4int counter, const G4Step* step)
+{
+  // Up to date with this step, which is its last
+  const G4Track* track = step->GetTrack();
+  G4int id = track->GetTrackID();
+  const G4LogicalVolume* lv
+    = step->GetPreStepPoint()->GetPhysicalVolume()->GetLogicalVolume();
+  auto region = fRegions.find(lv);
+  if (region != fRegions.end()) {
+    Accumulate(step, region->second, *Current(id, true));
+    fScoredID = id;
+    fScoredStep = track->GetCurrentStepNumber();
+  }
+
+  G4double weight = track->GetWeight();
+  fEventRate[counter] += weight;
+  fEventRate[kTotalBin] += weight;
+  fScored = true;
+
+  const std::vector<G4double>* derivatives = Current(id, false);
+  if (!derivatives) return;
+  for (G4int p = 0; p < fPerturbations; ++p) {
+    G4double x = weight*(*derivatives)[p];
+    fEventDerivative[p*kNumberOfBins + counter] += x;
+    fEventDerivative[p*kNumberOfBins + kTotalBin] += x;
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void PerturbationTally::EndOfEvent()
+{
+  fTracks.clear();
+  fCurrent = nullptr;
+  fCurrentID = -1;
+  fScoredID = -1;
+
+  // Every history counts, captured or not
+  if (fScored) {
+    for (G4int bin = 0; bin < kNumberOfBins; ++bin) {
+      G4double r = fEventRate[bin];
+      fRateSum[bin]  += r;
+      fRateSum2[bin] += r*r;
+      fEventRate[bin] = 0.;
+      for (G4int p = 0; p < fPerturbations; ++p) {
+        G4int i = p*kNumberOfBins + bin;
+        G4double x = fEventDerivative[i];
+        fSum[i]   += x;
+        fSum2[i]  += x*x;
+        fCross[i] += r*x;
+        fEventDerivative[i] = 0.;
+      }
+    }
+    fScored = false;
+  }
+  ++fNofEvents;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void PerturbationTally::Reset()
+{
+  std::fill(fEventRate.begin(), fEventRate.end(), 0.);
+  std::fill(fRateSum.begin(), fRateSum.end(), 0.);
+  std::fill(fRateSum2.begin(), fRateSum2.end(), 0.);
+  std::fill(fEventDerivative.begin(), fEventDerivative.end(), 0.);
+  std::fill(fSum.begin(), fSum.end(), 0.);
+  std::fill(fSum2.begin(), fSum2.end(), 0.);
+  std::fill(fCross.begin(), fCross.end(), 0.);
+  fScored = false;
+  fNofEvents = 0;
+}
+
+void PerturbationTally::Merge(const PerturbationTally& other)
+{
+  // Sums of an earlier set of perturbations are dropped
+  if (fConfigVersion != fVersion) Configure();
+  if (other.fConfigVersion != fVersion) return;
+
+  for (G4int bin = 0; bin < kNumberOfBins; ++bin) {
+    fRateSum[bin]  += other.fRateSum[bin];
+    fRateSum2[bin] += other.fRateSum2[bin];
+  }
+  for (std::size_t i = 0; i < fSum.size(); ++i) {
+    fSum[i]   += other.fSum[i];
+    fSum2[i]  += other.fSum2[i];
+    fCross[i] += other.fCross[i];
+  }
+  fNofEvents += other.fNofEvents;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4double PerturbationTally::GetSensitivity(G4int p, G4int bin,
+                                           G4double& error) const
+{
+  error = 0.;
+  G4double n = fNofEvents;
+  if (n < 2. || fRateSum[bin] <= 0.) return 0.;
+
+  // Ratio of means; variance of the means from the per-history sums
+  G4int i = p*kNumberOfBins + bin;
+  G4double rate = fRateSum[bin]/n;
+  G4double derivative = fSum[i]/n;
+  G4double varRate = (fRateSum2[bin]/n - rate*rate)/(n - 1.);
+  G4double varDerivative = (fSum2[i]/n - derivative*derivative)/(n - 1.);
+  G4double covariance = (fCross[i]/n - rate*derivative)/(n - 1.);
+
+  G4double s = derivative/rate;
+  G4double var = (varDerivative - 2.*s*covariance + s*s*varRate)/(rate*rate);
+  error = std::sqrt(std::max(0., var));
+  return s;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void PerturbationTally::Print()
+{
+  CollectWorkers();
+  if (fConfigVersion != fVersion) Configure();
+
+  G4cout << G4endl
+         << "------------------------- Perturbations -------------------------"
+         << G4endl
+         << "  " << fNofEvents << " histories; S = relative change of the"
+         << " counter total per relative change of density" << G4endl;
+
+  for (G4int p = 0; p < fPerturbations; ++p) {
+    const Definition& definition = fDefinitions[p];
+    G4int volumes = 0;
+    for (const auto& region : fRegions) {
+      for (const auto& entry : region.second) {
+        if (entry.index == p) ++volumes;
+      }
+    }
+
+    G4double error;
+    G4double s = GetSensitivity(p, kTotalBin, error);
+    G4double low = DBL_MAX, high = -DBL_MAX;
+    for (G4int c = 0; c < kTotalBin; ++c) {
+      G4double e;
+      G4double sc = GetSensitivity(p, c, e);
+      if (fRateSum[c] <= 0.) continue;
+      low = std::min(low, sc);
+      high = std::max(high, sc);
+    }
+
+    G4cout << "  " << std::setw(12) << std::left << definition.name << std::right
+           << " " << definition.region
+           << (definition.element.empty() ? G4String("") : " " + definition.element)
+           << " (" << volumes << " volumes)" << G4endl
+           << "      S = " << std::setprecision(4) << s << " +- " << error;
+    if (low <= high) {
+      G4cout << ", counters " << low << " to " << high;
+    }
+    G4cout << std::setprecision(6) << G4endl;
+    if (volumes == 0) {
+      G4cout << "      no volume matches this region" << G4endl;
+    }
+  }
+  G4cout << "-----------------------------------------------------------------"
+         << G4endl;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void PerturbationTally::WriteFile(const G4String& fileName)
+{
+  if (fConfigVersion != fVersion) Configure();
+
+  std::ofstream out(fileName);
+  if (!out) {
+    G4ExceptionDescription msg;
+    msg << "Cannot write the perturbation tallies to " << fileName;
+    G4Exception("PerturbationTally::WriteFile()", "NMDS023", JustWarning, msg);
+    return;
+  }
+
+  G4double n = std::max((G4double)fNofEvents, 1.);
+  out << "# " << fNofEvents << " histories" << G4endl
+      << "# perturbation counter rate derivative S S_error"
+      << " (rate and derivative per history)" << G4endl;
+  out << std::setprecision(8);
+  for (G4int p = 0; p < fPerturbations; ++p) {
+    for (G4int bin = 0; bin < kNumberOfBins; ++bin) {
+      G4double error;
+      G4double s = GetSensitivity(p, bin, error);
+      out << fDefinitions[p].name << " ";
+      if (bin == kTotalBin) out << "total";
+      else                  out << bin;
+      out << " " << fRateSum[bin]/n
+          << " " << fSum[p*kNumberOfBins + bin]/n
+          << " " << s << " " << error << "\n";
+    }
+  }
+}
+
+void PerturbationTally::CollectAndWrite(const G4String& fileName)
+{
+  CollectWorkers();
+  WriteFile(fileName);
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void PerturbationTally::Add(const G4String& arguments)
+{
+  std::istringstream is(arguments);
+  Definition definition;
+  is >> definition.name >> definition.region >> definition.element;
+  if (definition.region.empty()) {
+    G4ExceptionDescription msg;
+    msg << "Expected \"name region [element]\", got \"" << arguments << "\"";
+    G4Exception("PerturbationTally::Add()", "NMDS023", JustWarning, msg);
+    return;
+  }
+  for (const auto& other : fDefinitions) {
+    if (other.name == definition.name) {
+      G4ExceptionDescription msg;
+      msg << "Perturbation " << definition.name << " exists already";
+      G4Exception("PerturbationTally::Add()", "NMDS023", JustWarning, msg);
+      return;
+    }
+  }
+  fDefinitions.push_back(definition);
+  ++fVersion;
+}
+
+void PerturbationTally::Clear()
+{
+  fDefinitions.clear();
+  ++fVersion;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void PerturbationTally::DefineCommands()
+{
+  fMessenger = new G4GenericMessenger(this, "/nmds/perturbation/",
+                                      "Sensitivities to densities");
+
+  fMessenger->DeclareProperty("enable", fEnabled,
+                              "Score the perturbations during the runs.");
+
+  auto& addCmd = fMessenger->DeclareMethod("add", &PerturbationTally::Add,
+                 "Add a perturbation: name, region (logical volume or material)"
+                 " and optionally an element of its material.");
+  addCmd.SetParameterName("arguments", false);
+
+  fMessenger->DeclareMethod("clear", &PerturbationTally::Clear,
+                            "Remove all perturbations.");
+  fMessenger->DeclareMethod("print", &PerturbationTally::Print,
+                            "Merge the threads and print the sensitivities.");
+  fMessenger->DeclareMethod("write", &PerturbationTally::CollectAndWrite,
+                            "Merge the threads and write the sensitivities.");
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
@@ -0,0 +1,148 @@
+#ifndef PerturbationTally_h
+#define PerturbationTally_h 1
+
+#include "globals.hh"
+#include "DetectorLayout.hh"
+
+#include <unordered_map>
+#include <vector>
+
+class G4Step;
+class G4Track;
+class G4Material;
+class G4LogicalVolume;
+class G4GenericMessenger;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+/// First-order sensitivities of the counter captures to the density of a
+/// material, or of one element in it, inside a region of the geometry,
+/// estimated in the unperturbed run (differential operator sampling).
+///
+/// Scaling the density in the region by (1+d) scales the macroscopic
+/// cross sections there, so the probability of a neutron history changes
+/// by the factor exp(-d Sigma l) (1+d)^k, with l the flights and k the
+/// collisions in the region; for an element, Sigma is its own cross
+/// section and k counts the collisions with it. The derivative of the log
+/// weight, D = k - Sigma l, is accumulated along the neutron steps and
+/// passed on to secondaries through the parent links (StackingAction), so
+/// that a capture of weight w scores w D: the mean of w D per history is
+/// dR/dd, and S = (dR/dd)/R is the relative change of the rate R per
+/// relative change of density. A variant with density changed by d has
+/// rate R (1 + S d) to first order. Cross sections come from the
+/// NeutronXSCache tables (built for the purpose when the cache is off),
+/// or from the processes outside their range.
+///
+/// Only neutron transport is perturbed: the production of neutrons by the
+/// primary beam and the steps replaced by RockAlbedo or ThermalDiffusion
+/// carry no derivative. Thicknesses are not parameters of this tally; a
+/// density change is the nearest equivalent.
+///
+/// A region is a logical volume or a material, by name; a material also
+/// covers its counter fills (MixGas_x0.9700, see CounterGas), and so does
+/// a logical volume its variants (HeCounter_LV_x0.9700). Threads are
+/// merged like RunTally; errors are from the per-history sums.
+///
+///   /nmds/perturbation/enable true
+///   /nmds/perturbation/add poly G4_POLYETHYLENE
+///   /nmds/perturbation/add he3 MixGas Helium3
+///   /nmds/perturbation/add sides PolySide_LV
+///   /nmds/perturbation/clear
+///   /nmds/perturbation/print
+///   /nmds/perturbation/write sensitivities.txt
+
+class PerturbationTally
+{
+  public:
+    // Bins per perturbation: counters 0..59, then their total
+    static const G4int kTotalBin     = DetectorLayout::kNumberOfCounters;
+    static const G4int kNumberOfBins = kTotalBin + 1;
+
+    static PerturbationTally* Instance();
+    static PerturbationTally* Master();
+    static void CollectWorkers();
+
+    static G4bool IsEnabled() { return fEnabled; }
+
+    // Perturbations from the master settings, at the start of each run
+    // (ScoringRunAction), so that every event of the run is counted
+    void BeginOfRun();
+    // Called for every step by ScoringSteppingAction
+    void Step(const G4Step* step);
+    // Derivatives inherited by a new track, from StackingAction
+    void NewTrack(const G4Track* track);
+    // Capture in a counter, from the sensitive detector
+    void Score(G4int counter, const G4Step* step);
+    void EndOfEvent();
+
+    void Reset();
+    void Merge(const PerturbationTally& other);
+
+    void Print();
+    void WriteFile(const G4String& fileName);
+
+  private:
+    PerturbationTally(G4bool master);
+    ~PerturbationTally();
+
+    // Perturbation as given by the commands
+    struct Definition {
+      G4String name;
+      G4String region;
+      G4String element;   // empty for the whole material
+    };
+
+    // Perturbation acting in a logical volume
+    struct Entry {
+      G4int index;        // perturbation
+      G4int element;      // index in the material, -1 for all
+      G4int Z;
+    };
+
+    void Configure();
+    void Accumulate(const G4Step* step, const std::vector<Entry>& entries,
+                    std::vector<G4double>& derivatives) const;
+    std::vector<G4double>* Current(G4int trackID, G4bool create);
+    G4double CrossSection(const G4Material* material, const Entry& entry,
+                          G4double energy) const;
+
+    G4double GetSensitivity(G4int p, G4int bin, G4double& error) const;
+
+    void DefineCommands();
+    void Add(const G4String& arguments);
+    void Clear();
+    void CollectAndWrite(const G4String& fileName);
+
+    // Regions of this instance, and the configuration they were built from
+    G4int fConfigVersion;
+    G4int fPerturbations;
+    std::unordered_map<const G4LogicalVolume*, std::vector<Entry> > fRegions;
+
+    // Derivatives of the tracks of the current event
+    std::unordered_map<G4int, std::vector<G4double> > fTracks;
+    std::vector<G4double>* fCurrent;
+    G4int fCurrentID;
+    G4int fScoredID;       // step already accumulated by Score()
+    G4int fScoredStep;
+
+    // Per history: rate (bins) and derivative ([p][bin]) sums
+    std::vector<G4double> fEventRate;
+    std::vector<G4double> fEventDerivative;
+    G4bool                fScored;
+    std::vector<G4double> fRateSum;
+    std::vector<G4double> fRateSum2;
+    std::vector<G4double> fSum;
+    std::vector<G4double> fSum2;
+    std::vector<G4double> fCross;     // sum of rate x derivative
+    G4long                fNofEvents;
+
+    G4GenericMessenger* fMessenger;
+
+    static G4bool fEnabled;
+    static std::vector<Definition> fDefinitions;
+    static G4int  fVersion;
+};
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+#endif
@@ -0,0 +1,189 @@
+#include "PrimaryFilter.hh"
+#include "DetectorLayout.hh"
+
+#include "G4AutoLock.hh"
+#include "G4GenericMessenger.hh"
+#include "G4SystemOfUnits.hh"
+#include "Randomize.hh"
+#include "G4ios.hh"
+
+#include <cmath>
+#include <limits>
+
+namespace
+{
+  G4Mutex filterMutex = G4MUTEX_INITIALIZER;
+  std::vector<PrimaryFilter*>* workers = nullptr;
+}
+
+G4bool   PrimaryFilter::fEnabled  = false;
+G4double PrimaryFilter::fSurvival = 0.1;
+G4double PrimaryFilter::fMargin   = 5.*cm;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+PrimaryFilter* PrimaryFilter::Instance()
+{
+  static G4ThreadLocal PrimaryFilter* instance = nullptr;
+  if (!instance) {
+    instance = new PrimaryFilter(false);
+    G4AutoLock lock(&filterMutex);
+    if (!workers) workers = new std::vector<PrimaryFilter*>;
+    workers->push_back(instance);
+  }
+  return instance;
+}
+
+PrimaryFilter* PrimaryFilter::Master()
+{
+  static PrimaryFilter master(true);
+  return &master;
+}
+
+void PrimaryFilter::CollectWorkers()
+{
+  G4AutoLock lock(&filterMutex);
+  if (!workers) return;
+  PrimaryFilter* master = Master();
+  for (auto worker : *workers) {
+    master->fTested    += worker->fTested;
+    master->fHits      += worker->fHits;
+    master->fKilled    += worker->fKilled;
+    master->fSurvived  += worker->fSurvived;
+    master->fWeightIn  += worker->fWeightIn;
+    master->fWeightOut += worker->fWeightOut;
+    worker->Reset();
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+PrimaryFilter::PrimaryFilter(G4bool master)
+ : fTested(0),
+   fHits(0),
+   fKilled(0),
+   fSurvived(0),
+   fWeightIn(0.),
+   fWeightOut(0.),
+   fMessenger(nullptr)
+{
+  if (master) DefineCommands();
+}
+
+PrimaryFilter::~PrimaryFilter()
+{
+  delete fMessenger;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4bool PrimaryFilter::HitsBox(const G4ThreeVector& position,
+                              const G4ThreeVector& direction,
+                              const G4ThreeVector& center, G4double half)
+{
+  // Slab method: intersect the parameter ranges inside each pair of planes
+  G4double tmin = 0.;
+  G4double tmax = std::numeric_limits<G4double>::max();
+  for (G4int i = 0; i < 3; ++i) {
+    G4double p = position[i] - center[i];
+    G4double d = direction[i];
+    if (d == 0.) {
+      if (std::fabs(p) > half) return false;
+      continue;
+    }
+    G4double t0 = (-half - p)/d;
+    G4double t1 = ( half - p)/d;
+    if (t0 > t1) std::swap(t0, t1);
+    tmin = std::max(tmin, t0);
+    tmax = std::min(tmax, t1);
+    if (tmin > tmax) return false;
+  }
+  return true;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4double PrimaryFilter::Test(const G4ThreeVector& position,
+                             const G4ThreeVector& direction, G4double weight)
+{
+  auto layout = DetectorLayout::Instance();
+  ++fTested;
+  fWeightIn += weight;
+
+  if (HitsBox(position, direction, layout->GetBoxCenter(),
+              layout->GetBoxHalf() + fMargin)) {
+    ++fHits;
+    fWeightOut += weight;
+    return 1.;
+  }
+
+  if (fSurvival <= 0. || G4UniformRand() >= fSurvival) {
+    ++fKilled;
+    return 0.;
+  }
+  ++fSurvived;
+  fWeightOut += weight/fSurvival;
+  return 1./fSurvival;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void PrimaryFilter::Reset()
+{
+  fTested = fHits = fKilled = fSurvived = 0;
+  fWeightIn = fWeightOut = 0.;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void PrimaryFilter::Print() const
+{
+  G4double tested = std::max<G4double>(fTested, 1.);
+  G4cout << G4endl
+         << "------------------------- Primary filter -------------------------"
+         << G4endl
+         << "  tested   " << fTested << G4endl
+         << "  hit box  " << fHits << " (" << 100.*fHits/tested << " %)"
+         << G4endl
+         << "  killed   " << fKilled << " (" << 100.*fKilled/tested << " %)"
+         << G4endl
+         << "  survived " << fSurvived;
+  if (fSurvival > 0.) G4cout << " with weight x" << 1./fSurvival;
+  else G4cout << " (survival 0: every miss killed)";
+  G4cout << G4endl
+         << "  weight in " << fWeightIn << ", out " << fWeightOut
+         << (fSurvival > 0. ? " (equal on average)" : " (biased: survival 0)")
+         << G4endl
+         << "-----------------------------------------------------------------"
+         << G4endl;
+}
+
+void PrimaryFilter::CollectAndPrint()
+{
+  CollectWorkers();
+  Print();
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void PrimaryFilter::DefineCommands()
+{
+  fMessenger = new G4GenericMessenger(this, "/nmds/filter/",
+                                      "Roulette of primaries missing the box");
+
+  fMessenger->DeclareProperty("enable", fEnabled,
+                              "Test every primary against the moderator box.");
+
+  auto& survivalCmd = fMessenger->DeclareProperty("survival", fSurvival,
+                      "Survival probability of primaries missing the box.");
+  survivalCmd.SetParameterName("survival", false);
+  survivalCmd.SetRange("survival>=0. && survival<=1.");
+
+  fMessenger->DeclarePropertyWithUnit("margin", "cm", fMargin,
+                                      "Margin added around the box.");
+
+  fMessenger->DeclareMethod("print", &PrimaryFilter::CollectAndPrint,
+                            "Merge the thread counts and print them.");
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
@@ -0,0 +1,76 @@
+#ifndef PrimaryFilter_h
+#define PrimaryFilter_h 1
+
+#include "globals.hh"
+#include "G4ThreeVector.hh"
+
+class G4GenericMessenger;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+/// Russian roulette of primaries whose straight line misses the moderator
+/// box, before any transport.
+///
+/// The ray from the primary vertex along its direction is tested against
+/// the box of DetectorLayout, enlarged by a margin, with the slab method.
+/// A primary that misses it survives with the given probability and its
+/// weight is divided by that probability, so that every tally keeps its
+/// expectation; a survival probability of zero discards such primaries
+/// outright, which is biased (scattering in the rock brings some back).
+/// Threads count the primaries tested, hitting, killed and surviving,
+/// merged like the other tallies.
+///
+/// Only the box is tested, not the room: the box lies inside the room, so
+/// a ray that hits the box also crosses the room, and a room test cannot
+/// change which primaries hit. Whether a miss comes back by scattering in
+/// the room or the rock is what the survival probability stands for.
+///
+///   /nmds/filter/enable true
+///   /nmds/filter/survival 0.1
+///   /nmds/filter/margin 5 cm
+///   /nmds/filter/print
+
+class PrimaryFilter
+{
+  public:
+    static PrimaryFilter* Instance();
+    static PrimaryFilter* Master();
+    static void CollectWorkers();
+
+    static G4bool IsEnabled() { return fEnabled; }
+
+    // Weight factor of a primary: 0 to kill it, 1 when it is kept as is
+    G4double Test(const G4ThreeVector& position, const G4ThreeVector& direction,
+                  G4double weight);
+
+    static G4bool HitsBox(const G4ThreeVector& position,
+                          const G4ThreeVector& direction,
+                          const G4ThreeVector& center, G4double half);
+
+    void Reset();
+    void Print() const;
+
+  private:
+    PrimaryFilter(G4bool master);
+    ~PrimaryFilter();
+
+    void DefineCommands();
+    void CollectAndPrint();
+
+    G4long   fTested;
+    G4long   fHits;
+    G4long   fKilled;
+    G4long   fSurvived;
+    G4double fWeightIn;
+    G4double fWeightOut;
+
+    G4GenericMessenger* fMessenger;
+
+    static G4bool   fEnabled;
+    static G4double fSurvival;
+    static G4double fMargin;
+};
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+#endif
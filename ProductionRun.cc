@@ -0,0 +1,310 @@
+#include "ProductionRun.hh"
+#include "RunTally.hh"
+#include "DieAwayHistogram.hh"
+#include "VolumeProfiler.hh"
+#include "FluenceMesh.hh"
+#include "DetectorLayout.hh"
+#include "EventRandom.hh"
+#include "CounterElectronics.hh"
+#include "RunTermination.hh"
+#include "ParallelRun.hh"
+
+#include "G4RunManager.hh"
+#include "G4Run.hh"
+#include "G4GenericMessenger.hh"
+#include "Randomize.hh"
+#include "G4ios.hh"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+namespace
+{
+  const char* kMagic = "NMDS-CHECKPOINT";
+  const G4int kVersion = 7;
+
+  void WriteBlock(std::ostream& os, const G4String& key, const std::string& text)
+  {
+    os << key << ' ' << text.size() << '\n' << text << '\n';
+  }
+
+  G4bool ReadBlock(std::istream& is, const G4String& key, std::string& text)
+  {
+    std::string name;
+    std::size_t size = 0;
+    is >> name >> size;
+    if (!is || name != key) return false;
+    is.get();
+    text.resize(size);
+    is.read(&text[0], size);
+    return (bool)is;
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+ProductionRun* ProductionRun::Instance()
+{
+  static ProductionRun instance;
+  return &instance;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+ProductionRun::ProductionRun()
+ : fMessenger(nullptr),
+   fCheckpointFile("nmds.chk"),
+   fChunk(10000),
+   fEventsRequested(0),
+   fEventsCompleted(0),
+   fFirstEvent(0),
+   fElapsed(0.)
+{
+  DefineCommands();
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+ProductionRun::~ProductionRun()
+{
+  delete fMessenger;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ProductionRun::BeamOn(G4int nofEvents)
+{
+  // Start from empty tallies
+  RunTally::CollectWorkers();
+  RunTally::Master()->Reset();
+  DieAwayHistogram::CollectWorkers();
+  DieAwayHistogram::Master()->Reset();
+  FluenceMesh::CollectWorkers();
+  FluenceMesh::Master()->Reset();
+  CounterElectronics::CollectWorkers();
+  CounterElectronics::Master()->Reset();
+
+  // Share of this process; the others run the rest of the events
+  fEventsRequested = ParallelRun::GetNumberOfEvents(nofEvents);
+  fFirstEvent = ParallelRun::GetFirstEvent(nofEvents);
+  fEventsCompleted = 0;
+  if (ParallelRun::GetSize() > 1 && !EventRandom::IsPerEvent()) {
+    EventRandom::SeedStream(ParallelRun::GetRank());
+  }
+  RunTermination::Instance()->Start();
+  RunChunks();
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ProductionRun::Resume(const G4String& fileName)
+{
+  if (!DetectorLayout::Instance()->IsClosed()) {
+    G4RunManager::GetRunManager()->Initialize();
+  }
+
+  RunTally::CollectWorkers();
+  DieAwayHistogram::CollectWorkers();
+  FluenceMesh::CollectWorkers();
+  CounterElectronics::CollectWorkers();
+  if (!ReadCheckpoint(ParallelRun::GetFileName(fileName))) return;
+
+  G4cout << "### Resuming production from " << fileName << ": "
+         << fEventsCompleted << " of " << fEventsRequested
+         << " events done." << G4endl;
+
+  // The clock goes on from the sessions before, as the tallies do
+  fCheckpointFile = fileName;
+  RunTermination::Instance()->Start(fElapsed);
+  RunChunks();
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ProductionRun::RunChunks()
+{
+  auto runManager = G4RunManager::GetRunManager();
+
+  while (true) {
+    // Rank 0 decides on the tallies of all processes, the others follow
+    G4long remaining = ParallelRun::Sum(fEventsRequested - fEventsCompleted);
+    if (remaining == 0) break;
+    G4int nofEvents = 0;
+    auto local = ParallelRun::ReduceTallies();
+    if (ParallelRun::GetRank() == 0) {
+      nofEvents = RunTermination::Instance()->NextChunk(*RunTally::Master(),
+                                                        fChunk, remaining);
+    }
+    ParallelRun::RestoreTallies(local);
+    nofEvents = (G4int)ParallelRun::Broadcast(nofEvents);
+    if (nofEvents <= 0) break;
+
+    nofEvents = (G4int)std::min<G4long>(nofEvents,
+                                        fEventsRequested - fEventsCompleted);
+    if (nofEvents > 0) {
+      EventRandom::SetEventOffset(fFirstEvent + fEventsCompleted);
+      runManager->BeamOn(nofEvents);
+    }
+
+    const G4Run* run = runManager->GetCurrentRun();
+    G4int done = (nofEvents > 0 && run) ? run->GetNumberOfEvent() : 0;
+
+    RunTally::CollectWorkers();
+    DieAwayHistogram::CollectWorkers();
+    FluenceMesh::CollectWorkers();
+    CounterElectronics::CollectWorkers();
+    fEventsCompleted += done;
+    WriteCheckpoint();
+
+    if (ParallelRun::Sum(done < nofEvents ? 1 : 0) > 0) {
+      G4cout << "### Production stopped after " << fEventsCompleted
+             << " events, resume from " << fCheckpointFile << G4endl;
+      break;
+    }
+  }
+
+  // Totals of all processes, printed once
+  ParallelRun::ReduceTallies();
+  if (ParallelRun::GetRank() != 0) return;
+
+  RunTally::Master()->Print();
+  DieAwayHistogram::Master()->WriteFile();
+  if (CounterElectronics::IsEnabled()) CounterElectronics::Master()->Print();
+  if (VolumeProfiler::IsEnabled()) {
+    VolumeProfiler::CollectWorkers();
+    VolumeProfiler::Master()->Print();
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ProductionRun::WriteCheckpoint() const
+{
+  // Write aside and rename, so that a crash never leaves a truncated file
+  G4String fileName = ParallelRun::GetFileName(fCheckpointFile);
+  G4String tmpName = fileName + ".tmp";
+  std::ofstream out(tmpName, std::ios::out | std::ios::trunc);
+  if (!out) {
+    G4ExceptionDescription msg;
+    msg << "Cannot open checkpoint file " << tmpName;
+    G4Exception("ProductionRun::WriteCheckpoint()", "NMDS001",
+                JustWarning, msg);
+    return;
+  }
+
+  out << kMagic << ' ' << kVersion << '\n'
+      << "fingerprint " << std::hex
+      << DetectorLayout::Instance()->GetFingerprint() << std::dec << '\n'
+      << "events " << fEventsRequested << ' ' << fEventsCompleted
+      << ' ' << fChunk << ' ' << fFirstEvent << '\n'
+      << "elapsed " << RunTermination::Instance()->GetElapsed() << '\n';
+
+  std::ostringstream master;
+  G4Random::getTheEngine()->put(master);
+  WriteBlock(out, "master", master.str());
+
+  RunTally::Master()->Write(out);
+  DieAwayHistogram::Master()->Write(out);
+  FluenceMesh::Master()->Write(out);
+  CounterElectronics::Master()->Write(out);
+  out.close();
+
+  if (std::rename(tmpName.c_str(), fileName.c_str()) != 0) {
+    G4ExceptionDescription msg;
+    msg << "Cannot rename " << tmpName << " to " << fileName;
+    G4Exception("ProductionRun::WriteCheckpoint()", "NMDS002",
+                JustWarning, msg);
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4bool ProductionRun::ReadCheckpoint(const G4String& fileName)
+{
+  std::ifstream in(fileName);
+  std::string magic, key;
+  G4int version = 0;
+  in >> magic >> version;
+  if (!in || magic != kMagic || version != kVersion) {
+    G4ExceptionDescription msg;
+    msg << fileName << " is not a version " << kVersion << " checkpoint";
+    G4Exception("ProductionRun::ReadCheckpoint()", "NMDS003",
+                JustWarning, msg);
+    return false;
+  }
+
+  unsigned long long fingerprint = 0;
+  in >> key >> std::hex >> fingerprint >> std::dec;
+  if (fingerprint != DetectorLayout::Instance()->GetFingerprint()) {
+    G4ExceptionDescription msg;
+    msg << "Checkpoint " << fileName << " was written for another geometry "
+        << "(fingerprint " << std::hex << fingerprint << " instead of "
+        << DetectorLayout::Instance()->GetFingerprint() << std::dec << ")";
+    G4Exception("ProductionRun::ReadCheckpoint()", "NMDS004",
+                FatalException, msg);
+    return false;
+  }
+
+  G4long requested = 0, completed = 0, first = 0;
+  G4int chunk = 0;
+  in >> key >> requested >> completed >> chunk >> first;
+  G4double elapsed = 0.;
+  in >> key >> elapsed;
+
+  // The master engine seeds all events: restoring it continues the
+  // sequence. Thread engines are reseeded per event and not saved.
+  std::string state;
+  if (!ReadBlock(in, "master", state)) {
+    G4Exception("ProductionRun::ReadCheckpoint()", "NMDS005",
+                JustWarning, "Corrupted engine state");
+    return false;
+  }
+  std::istringstream masterState(state);
+  G4Random::getTheEngine()->get(masterState);
+
+  if (!RunTally::Master()->Read(in) ||
+      !DieAwayHistogram::Master()->Read(in) ||
+      !FluenceMesh::Master()->Read(in) ||
+      !CounterElectronics::Master()->Read(in)) {
+    G4Exception("ProductionRun::ReadCheckpoint()", "NMDS005",
+                JustWarning, "Corrupted tallies");
+    return false;
+  }
+
+  fEventsRequested = requested;
+  fEventsCompleted = completed;
+  fFirstEvent = first;
+  fChunk = chunk;
+  fElapsed = elapsed;
+  return true;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ProductionRun::DefineCommands()
+{
+  fMessenger = new G4GenericMessenger(this, "/nmds/production/",
+                                      "Checkpointed production runs");
+
+  auto& beamOnCmd = fMessenger->DeclareMethod("beamOn",
+                                              &ProductionRun::BeamOn,
+                                              "Run events in checkpointed chunks.");
+  beamOnCmd.SetParameterName("nEvents", false);
+  beamOnCmd.SetRange("nEvents>0");
+
+  fMessenger->DeclareMethod("resume", &ProductionRun::Resume,
+                            "Resume a production from a checkpoint file.")
+    .SetParameterName("file", false);
+
+  fMessenger->DeclareProperty("checkpointFile", fCheckpointFile,
+                              "Checkpoint file name.");
+
+  auto& chunkCmd = fMessenger->DeclareProperty("chunk", fChunk,
+                                               "Events between checkpoints.");
+  chunkCmd.SetParameterName("chunk", false);
+  chunkCmd.SetRange("chunk>0");
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
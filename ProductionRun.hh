@@ -0,0 +1,72 @@
+#ifndef ProductionRun_h
+#define ProductionRun_h 1
+
+#include "globals.hh"
+
+class G4GenericMessenger;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+/// Long production runs split into chunks of events, with a checkpoint
+/// written after every chunk and resume from the last checkpoint.
+///
+/// A checkpoint holds the geometry fingerprint of DetectorLayout, the
+/// number of events requested and completed, the wall time spent so far
+/// (for RunTermination), the state of the master
+/// random engine (which seeds every event), the accumulated RunTally,
+/// DieAwayHistogram, FluenceMesh and CounterElectronics. The thread
+/// engines are reseeded from the master for every event and not saved.
+/// Resuming in a new process with the same geometry, scorer settings and
+/// chunk size continues the random sequence where it stopped, and the
+/// final tallies are statistically equivalent to those of the
+/// uninterrupted run. They are not the same numbers in general: with
+/// several threads, which thread runs which event and the merge order
+/// depend on scheduling, so the thread engines cannot be put back onto
+/// the same events. With /nmds/random/perEvent true every event is
+/// seeded from its number alone; the tallies over the same events are
+/// then equal to those of the uninterrupted run within the rounding of the
+/// sums. RunTermination sizes the chunks and may end the run early on
+/// precision or wall time, so the number of events itself may differ.
+///
+///   /nmds/production/checkpointFile nmds.chk
+///   /nmds/production/chunk 10000
+///   /nmds/production/beamOn 1000000
+///   /nmds/production/resume nmds.chk
+
+class ProductionRun
+{
+  public:
+    static ProductionRun* Instance();
+    ~ProductionRun();
+
+    void BeamOn(G4int nofEvents);
+    void Resume(const G4String& fileName);
+
+    void WriteCheckpoint() const;
+    G4bool ReadCheckpoint(const G4String& fileName);
+
+    void SetCheckpointFile(const G4String& name) { fCheckpointFile = name; }
+    void SetChunk(G4int chunk) { fChunk = chunk; }
+
+    G4long GetEventsRequested() const { return fEventsRequested; }
+    G4long GetEventsCompleted() const { return fEventsCompleted; }
+
+  private:
+    ProductionRun();
+
+    void DefineCommands();
+    void RunChunks();
+
+    G4GenericMessenger* fMessenger;
+
+    G4String fCheckpointFile;
+    G4int    fChunk;
+    G4long   fEventsRequested;
+    G4long   fEventsCompleted;
+    G4long   fFirstEvent;      // of this process, see ParallelRun
+    G4double fElapsed;         // wall time of earlier sessions [s]
+};
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+#endif
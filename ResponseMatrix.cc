@@ -0,0 +1,470 @@
+#include "ResponseMatrix.hh"
+#include "RunTally.hh"
+#include "DetectorLayout.hh"
+
+#include "G4RunManager.hh"
+#include "G4GenericMessenger.hh"
+#include "G4PhysicalConstants.hh"
+#include "G4SystemOfUnits.hh"
+#include "G4ios.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+namespace
+{
+  const G4int kVersion = 1;
+
+  template <typename T>
+  void WriteRaw(std::ostream& os, const T& value)
+  {
+    os.write(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+
+  template <typename T>
+  G4bool ReadRaw(std::istream& is, T& value)
+  {
+    return (G4bool)is.read(reinterpret_cast<char*>(&value), sizeof(T));
+  }
+
+  // Lines of numbers, without blank lines and '#' comments
+  std::vector<std::vector<G4double> > ReadColumns(const G4String& fileName)
+  {
+    std::vector<std::vector<G4double> > lines;
+    std::ifstream in(fileName);
+    std::string line;
+    while (std::getline(in, line)) {
+      std::size_t hash = line.find('#');
+      if (hash != std::string::npos) line.erase(hash);
+      std::istringstream is(line);
+      std::vector<G4double> values;
+      G4double value;
+      while (is >> value) values.push_back(value);
+      if (!values.empty()) lines.push_back(values);
+    }
+    return lines;
+  }
+
+  G4double Overlap(G4double a0, G4double a1, G4double b0, G4double b1)
+  {
+    return std::max(0., std::min(a1, b1) - std::max(a0, b0));
+  }
+}
+
+ResponseMatrix::Source ResponseMatrix::fSource =
+  { 1.*MeV, -1., 1., G4ThreeVector(), 1.*m };
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+ResponseMatrix* ResponseMatrix::Instance()
+{
+  static ResponseMatrix instance;
+  return &instance;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+ResponseMatrix::ResponseMatrix()
+ : fNofEnergies(0),
+   fNofAngles(0),
+   fEmin(0.),
+   fEmax(0.),
+   fRadius(0.),
+   fHistories(0),
+   fFingerprint(0),
+   fBuildEnergies(60),
+   fBuildAngles(1),
+   fBuildEmin(1.e-9*MeV),
+   fBuildEmax(20.*MeV),
+   fFileName(""),
+   fIterations(200),
+   fMessenger(nullptr)
+{
+  DefineCommands();
+}
+
+ResponseMatrix::~ResponseMatrix()
+{
+  delete fMessenger;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4double ResponseMatrix::EnergyEdge(G4int i) const
+{
+  return fEmin*std::pow(fEmax/fEmin, G4double(i)/fNofEnergies);
+}
+
+G4String ResponseMatrix::DefaultFileName() const
+{
+  std::ostringstream name;
+  name << "response_" << std::hex << std::setw(16) << std::setfill('0')
+       << DetectorLayout::Instance()->GetFingerprint() << ".bin";
+  return name.str();
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ResponseMatrix::Build(G4int historiesPerBin)
+{
+  auto runManager = G4RunManager::GetRunManager();
+  auto layout = DetectorLayout::Instance();
+  if (!layout->IsClosed()) runManager->Initialize();
+
+  fNofEnergies = fBuildEnergies;
+  fNofAngles   = fBuildAngles;
+  fEmin        = fBuildEmin;
+  fEmax        = fBuildEmax;
+  fRadius      = std::sqrt(3.)*layout->GetBoxHalf();
+  fHistories   = historiesPerBin;
+  fFingerprint = layout->GetFingerprint();
+  fResponse.assign((std::size_t)RunTally::kNumberOfBins*fNofEnergies*fNofAngles,
+                   0.);
+  fError.assign(fResponse.size(), 1.);
+
+  // The beam starts up to sqrt(2) radii from the box center
+  const G4ThreeVector& center = layout->GetBoxCenter();
+  for (G4int i = 0; i < 3; ++i) {
+    if (std::fabs(center[i]) + std::sqrt(2.)*fRadius > layout->GetRoomHalf()[i]) {
+      G4Exception("ResponseMatrix::Build()", "NMDS012", JustWarning,
+                  "The response beam starts partly outside the room.");
+      break;
+    }
+  }
+
+  G4double area = pi*fRadius*fRadius;
+  for (G4int e = 0; e < fNofEnergies; ++e) {
+    for (G4int a = 0; a < fNofAngles; ++a) {
+      fSource.energy = std::sqrt(EnergyEdge(e)*EnergyEdge(e + 1));
+      fSource.cosMin = -1. + 2.*a/fNofAngles;
+      fSource.cosMax = -1. + 2.*(a + 1)/fNofAngles;
+      fSource.center = center;
+      fSource.radius = fRadius;
+
+      RunTally::CollectWorkers();
+      RunTally::Master()->Reset();
+      runManager->BeamOn(historiesPerBin);
+      RunTally::CollectWorkers();
+
+      const RunTally* tally = RunTally::Master();
+      for (G4int bin = 0; bin < RunTally::kNumberOfBins; ++bin) {
+        fResponse[Index(bin, e, a)] = tally->GetMean(bin)*area;
+        fError[Index(bin, e, a)]    = tally->GetRelativeError(bin);
+      }
+    }
+    G4cout << "### Response: " << fSource.energy/MeV << " MeV done" << G4endl;
+  }
+  RunTally::Master()->Reset();
+
+  Save(fFileName.empty() ? DefaultFileName() : fFileName);
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ResponseMatrix::Save(const G4String& fileName) const
+{
+  std::ofstream out(fileName, std::ios::binary);
+  if (!out) {
+    G4ExceptionDescription msg;
+    msg << "Cannot write the response matrix to " << fileName;
+    G4Exception("ResponseMatrix::Save()", "NMDS012", JustWarning, msg);
+    return;
+  }
+
+  // Header, then response [cm2] and relative error, bin slowest,
+  // angle fastest
+  out.write("NMDSRESP", 8);
+  WriteRaw(out, kVersion);
+  WriteRaw(out, fFingerprint);
+  WriteRaw(out, (G4int)RunTally::kNumberOfBins);
+  WriteRaw(out, fNofEnergies);
+  WriteRaw(out, fNofAngles);
+  WriteRaw(out, fEmin/MeV);
+  WriteRaw(out, fEmax/MeV);
+  WriteRaw(out, fRadius/cm);
+  WriteRaw(out, (long long)fHistories);
+  for (auto response : fResponse) WriteRaw(out, response/cm2);
+  for (auto error : fError) WriteRaw(out, error);
+
+  G4cout << "### Response matrix " << fNofEnergies << " energies x "
+         << fNofAngles << " angles written to " << fileName << G4endl;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4bool ResponseMatrix::Load(const G4String& fileName)
+{
+  std::ifstream in(fileName, std::ios::binary);
+  char magic[8];
+  G4int version = 0, nbins = 0, nenergies = 0, nangles = 0;
+  unsigned long long fingerprint = 0;
+  G4double emin = 0., emax = 0., radius = 0.;
+  long long histories = 0;
+  if (!in || !in.read(magic, 8) || std::string(magic, 8) != "NMDSRESP" ||
+      !ReadRaw(in, version) || version != kVersion ||
+      !ReadRaw(in, fingerprint) || !ReadRaw(in, nbins) ||
+      nbins != RunTally::kNumberOfBins ||
+      !ReadRaw(in, nenergies) || !ReadRaw(in, nangles) ||
+      nenergies <= 0 || nangles <= 0 ||
+      !ReadRaw(in, emin) || !ReadRaw(in, emax) || !ReadRaw(in, radius) ||
+      !ReadRaw(in, histories)) {
+    G4ExceptionDescription msg;
+    msg << "Cannot read a response matrix from " << fileName;
+    G4Exception("ResponseMatrix::Load()", "NMDS012", JustWarning, msg);
+    return false;
+  }
+
+  auto layout = DetectorLayout::Instance();
+  if (layout->IsClosed() && fingerprint != layout->GetFingerprint()) {
+    G4ExceptionDescription msg;
+    msg << "Response matrix " << fileName << " belongs to geometry "
+        << std::hex << fingerprint << ", not to this one ("
+        << layout->GetFingerprint() << std::dec << ")";
+    G4Exception("ResponseMatrix::Load()", "NMDS012", JustWarning, msg);
+    return false;
+  }
+
+  std::size_t size = (std::size_t)nbins*nenergies*nangles;
+  std::vector<G4double> response(size), error(size);
+  for (auto& value : response) { ReadRaw(in, value); value *= cm2; }
+  for (auto& value : error) ReadRaw(in, value);
+  if (!in) {
+    G4ExceptionDescription msg;
+    msg << "Response matrix " << fileName << " is truncated";
+    G4Exception("ResponseMatrix::Load()", "NMDS012", JustWarning, msg);
+    return false;
+  }
+
+  fNofEnergies = nenergies;
+  fNofAngles   = nangles;
+  fEmin        = emin*MeV;
+  fEmax        = emax*MeV;
+  fRadius      = radius*cm;
+  fHistories   = histories;
+  fFingerprint = fingerprint;
+  fResponse.swap(response);
+  fError.swap(error);
+  return true;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ResponseMatrix::Fold(const std::vector<G4double>& phi,
+                          std::vector<G4double>& rates,
+                          std::vector<G4double>& errors) const
+{
+  rates.assign(RunTally::kNumberOfBins, 0.);
+  errors.assign(RunTally::kNumberOfBins, 0.);
+  std::size_t ncells = (std::size_t)fNofEnergies*fNofAngles;
+  for (G4int bin = 0; bin < RunTally::kNumberOfBins; ++bin) {
+    const G4double* response = &fResponse[Index(bin, 0, 0)];
+    const G4double* error = &fError[Index(bin, 0, 0)];
+    G4double rate = 0., variance = 0.;
+    for (std::size_t k = 0; k < ncells; ++k) {
+      G4double contribution = response[k]*phi[k];
+      rate += contribution;
+      variance += contribution*contribution*error[k]*error[k];
+    }
+    rates[bin] = rate;
+    errors[bin] = std::sqrt(variance);
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+std::vector<G4double>
+ResponseMatrix::Unfold(const std::vector<G4double>& rates,
+                       G4int iterations) const
+{
+  // Angle-integrated response to an isotropic fluence
+  const G4int ncounters = DetectorLayout::kNumberOfCounters;
+  std::vector<G4double> iso((std::size_t)ncounters*fNofEnergies, 0.);
+  for (G4int c = 0; c < ncounters; ++c) {
+    for (G4int e = 0; e < fNofEnergies; ++e) {
+      G4double sum = 0.;
+      for (G4int a = 0; a < fNofAngles; ++a) {
+        sum += fResponse[Index(RunTally::kCounterOffset + c, e, a)];
+      }
+      iso[c*fNofEnergies + e] = sum/fNofAngles;
+    }
+  }
+
+  std::vector<G4double> sensitivity(fNofEnergies, 0.);
+  G4double measured = 0., response = 0.;
+  for (G4int c = 0; c < ncounters; ++c) {
+    if (rates[c] < 0.) continue;
+    measured += rates[c];
+    for (G4int e = 0; e < fNofEnergies; ++e) {
+      sensitivity[e] += iso[c*fNofEnergies + e];
+      response += iso[c*fNofEnergies + e];
+    }
+  }
+
+  // MLEM from a flat start, which keeps the fluences positive
+  std::vector<G4double> phi(fNofEnergies, 0.);
+  if (response <= 0.) return phi;
+  for (G4int e = 0; e < fNofEnergies; ++e) {
+    if (sensitivity[e] > 0.) phi[e] = measured/response;
+  }
+  std::vector<G4double> predicted(ncounters), update(fNofEnergies);
+  for (G4int it = 0; it < iterations; ++it) {
+    for (G4int c = 0; c < ncounters; ++c) {
+      G4double sum = 0.;
+      for (G4int e = 0; e < fNofEnergies; ++e) {
+        sum += iso[c*fNofEnergies + e]*phi[e];
+      }
+      predicted[c] = sum;
+    }
+    std::fill(update.begin(), update.end(), 0.);
+    for (G4int c = 0; c < ncounters; ++c) {
+      if (rates[c] < 0. || predicted[c] <= 0.) continue;
+      G4double ratio = rates[c]/predicted[c];
+      for (G4int e = 0; e < fNofEnergies; ++e) {
+        update[e] += iso[c*fNofEnergies + e]*ratio;
+      }
+    }
+    for (G4int e = 0; e < fNofEnergies; ++e) {
+      if (sensitivity[e] > 0.) phi[e] *= update[e]/sensitivity[e];
+    }
+  }
+  return phi;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ResponseMatrix::LoadCommand(const G4String& fileName)
+{
+  if (Load(fileName.empty() ? DefaultFileName() : fileName)) {
+    G4cout << "### Response matrix " << fNofEnergies << " energies x "
+           << fNofAngles << " angles, " << fHistories
+           << " histories per bin" << G4endl;
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ResponseMatrix::FoldCommand(const G4String& fileName)
+{
+  if (fResponse.empty() && !Load(fFileName.empty() ? DefaultFileName()
+                                                   : fFileName)) return;
+
+  // Spread each group over the matrix bins, flat in lethargy and cosine
+  std::vector<G4double> phi((std::size_t)fNofEnergies*fNofAngles, 0.);
+  for (const auto& group : ReadColumns(fileName)) {
+    if (group.size() != 3 && group.size() != 5) continue;
+    G4double emin = group[0]*MeV, emax = group[1]*MeV;
+    G4double cosMin = (group.size() == 5) ? group[2] : -1.;
+    G4double cosMax = (group.size() == 5) ? group[3] : 1.;
+    G4double fluence = group.back()/cm2;
+    if (emin <= 0. || emax <= emin || cosMax <= cosMin) continue;
+    G4double lethargy = std::log(emax/emin);
+    for (G4int e = 0; e < fNofEnergies; ++e) {
+      G4double fe = Overlap(std::log(emin), std::log(emax),
+                            std::log(EnergyEdge(e)),
+                            std::log(EnergyEdge(e + 1)))/lethargy;
+      if (fe <= 0.) continue;
+      for (G4int a = 0; a < fNofAngles; ++a) {
+        G4double fa = Overlap(cosMin, cosMax, -1. + 2.*a/fNofAngles,
+                              -1. + 2.*(a + 1)/fNofAngles)/(cosMax - cosMin);
+        phi[(std::size_t)e*fNofAngles + a] += fluence*fe*fa;
+      }
+    }
+  }
+
+  std::vector<G4double> rates, errors;
+  Fold(phi, rates, errors);
+
+  G4cout << G4endl
+         << "----------------------- Folded rates [1/s] -----------------------"
+         << G4endl;
+  for (G4int bin = 0; bin < RunTally::kNumberOfBins; ++bin) {
+    G4cout << "  " << std::setw(14) << RunTally::GetBinName(bin)
+           << "  " << std::setw(12) << rates[bin]
+           << "  +- " << std::setw(12) << errors[bin] << G4endl;
+  }
+  G4cout << "-----------------------------------------------------------------"
+         << G4endl;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ResponseMatrix::UnfoldCommand(const G4String& fileName)
+{
+  if (fResponse.empty() && !Load(fFileName.empty() ? DefaultFileName()
+                                                   : fFileName)) return;
+
+  // Counters without a rate take no part
+  std::vector<G4double> rates(DetectorLayout::kNumberOfCounters, -1.);
+  for (const auto& line : ReadColumns(fileName)) {
+    if (line.size() < 2) continue;
+    G4int counter = G4int(line[0]);
+    if (counter >= 0 && counter < DetectorLayout::kNumberOfCounters) {
+      rates[counter] = line[1];
+    }
+  }
+
+  std::vector<G4double> phi = Unfold(rates, fIterations);
+
+  G4cout << G4endl
+         << "------------------ Unfolded fluence [1/(cm2 s)] ------------------"
+         << G4endl
+         << "      emin [MeV]      emax [MeV]       fluence" << G4endl;
+  for (G4int e = 0; e < fNofEnergies; ++e) {
+    G4cout << "  " << std::setw(14) << EnergyEdge(e)/MeV
+           << "  " << std::setw(14) << EnergyEdge(e + 1)/MeV
+           << "  " << std::setw(12) << phi[e]*cm2 << G4endl;
+  }
+  G4cout << "-----------------------------------------------------------------"
+         << G4endl;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ResponseMatrix::DefineCommands()
+{
+  fMessenger = new G4GenericMessenger(this, "/nmds/response/",
+                                      "Detector response matrix");
+
+  auto& energiesCmd = fMessenger->DeclareProperty("energyBins", fBuildEnergies,
+                      "Number of log-spaced energy bins of the next build.");
+  energiesCmd.SetParameterName("bins", false);
+  energiesCmd.SetRange("bins>0");
+
+  auto& anglesCmd = fMessenger->DeclareProperty("angleBins", fBuildAngles,
+                    "Number of polar-angle (cosine) bins of the next build.");
+  anglesCmd.SetParameterName("bins", false);
+  anglesCmd.SetRange("bins>0");
+
+  fMessenger->DeclarePropertyWithUnit("emin", "MeV", fBuildEmin,
+                                      "Lower edge of the energy bins.");
+  fMessenger->DeclarePropertyWithUnit("emax", "MeV", fBuildEmax,
+                                      "Upper edge of the energy bins.");
+
+  fMessenger->DeclareProperty("file", fFileName,
+                              "Matrix file; by default named after the geometry.");
+
+  auto& iterationsCmd = fMessenger->DeclareProperty("iterations", fIterations,
+                        "MLEM iterations of the unfolding.");
+  iterationsCmd.SetParameterName("iterations", false);
+  iterationsCmd.SetRange("iterations>0");
+
+  auto& buildCmd = fMessenger->DeclareMethod("build", &ResponseMatrix::Build,
+                   "Run every energy and angle bin and save the matrix.");
+  buildCmd.SetParameterName("histories", false);
+  buildCmd.SetRange("histories>0");
+
+  fMessenger->DeclareMethod("load", &ResponseMatrix::LoadCommand,
+                            "Load a matrix; by default the one of the geometry.")
+    .SetParameterName("file", true);
+  fMessenger->DeclareMethod("fold", &ResponseMatrix::FoldCommand,
+                            "Print the rates for a spectrum file.")
+    .SetParameterName("file", false);
+  fMessenger->DeclareMethod("unfold", &ResponseMatrix::UnfoldCommand,
+                            "Unfold a file of counter rates.")
+    .SetParameterName("file", false);
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
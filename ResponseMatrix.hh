@@ -0,0 +1,112 @@
+#ifndef ResponseMatrix_h
+#define ResponseMatrix_h 1
+
+#include "globals.hh"
+#include "G4ThreeVector.hh"
+
+#include <vector>
+
+class G4GenericMessenger;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+/// Response of every RunTally bin (counters, VD planes, counter total) to
+/// a unit fluence of neutrons, per energy bin and bin of the polar angle
+/// of incidence, with folding and unfolding of spectra.
+///
+/// Build() runs one monoenergetic parallel beam per bin through
+/// ResponseSource, which must then be the primary generator of the
+/// workers. The beam covers the disk of the sphere around the moderator
+/// box, so that the response is the tally per history times the disk
+/// area [cm2]. The matrix is saved with the geometry fingerprint of
+/// DetectorLayout and by default named after it, so that a directory of
+/// matrices is a library indexed by geometry; loading checks it.
+///
+/// Folding takes a spectrum file, one group per line, in MeV and
+/// 1/(cm2 s): "emin emax phi" (isotropic) or "emin emax cosmin cosmax phi",
+/// assumed flat in lethargy and cosine inside a group, and prints the
+/// rates. Unfolding takes "counter rate" lines and returns the isotropic
+/// group fluences by MLEM iterations.
+///
+///   /nmds/response/energyBins 60
+///   /nmds/response/emin 1e-9 MeV
+///   /nmds/response/emax 20 MeV
+///   /nmds/response/angleBins 1
+///   /nmds/response/build 100000
+///   /nmds/response/load response.bin
+///   /nmds/response/fold spectrum.txt
+///   /nmds/response/unfold rates.txt
+
+class ResponseMatrix
+{
+  public:
+    // Beam of the bin being built, read by ResponseSource
+    struct Source {
+      G4double energy;
+      G4double cosMin;
+      G4double cosMax;
+      G4ThreeVector center;
+      G4double radius;
+    };
+
+    static ResponseMatrix* Instance();
+
+    static const Source& GetSource() { return fSource; }
+
+    void Build(G4int historiesPerBin);
+    G4bool Load(const G4String& fileName);
+    void Save(const G4String& fileName) const;
+
+    // Rates of all tally bins for group fluences phi[energy][angle]
+    void Fold(const std::vector<G4double>& phi,
+              std::vector<G4double>& rates,
+              std::vector<G4double>& errors) const;
+
+    // Isotropic group fluences reproducing the counter rates
+    std::vector<G4double> Unfold(const std::vector<G4double>& rates,
+                                 G4int iterations) const;
+
+    G4double GetResponse(G4int bin, G4int energy, G4int angle) const
+      { return fResponse[Index(bin, energy, angle)]; }
+
+  private:
+    ResponseMatrix();
+    ~ResponseMatrix();
+
+    std::size_t Index(G4int bin, G4int energy, G4int angle) const
+      { return ((std::size_t)bin*fNofEnergies + energy)*fNofAngles + angle; }
+    G4double EnergyEdge(G4int i) const;
+    G4String DefaultFileName() const;
+
+    void DefineCommands();
+    void LoadCommand(const G4String& fileName);
+    void FoldCommand(const G4String& fileName);
+    void UnfoldCommand(const G4String& fileName);
+
+    G4int    fNofEnergies;
+    G4int    fNofAngles;
+    G4double fEmin;
+    G4double fEmax;
+    G4double fRadius;
+    G4long   fHistories;
+    unsigned long long fFingerprint;
+
+    std::vector<G4double> fResponse;   // [bin][energy][angle], area
+    std::vector<G4double> fError;      // relative
+
+    // Settings of the next build
+    G4int    fBuildEnergies;
+    G4int    fBuildAngles;
+    G4double fBuildEmin;
+    G4double fBuildEmax;
+    G4String fFileName;
+    G4int    fIterations;
+
+    G4GenericMessenger* fMessenger;
+
+    static Source fSource;
+};
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+#endif
@@ -0,0 +1,58 @@
+#include "ResponseSource.hh"
+#include "ResponseMatrix.hh"
+#include "EventRandom.hh"
+
+#include "G4ParticleGun.hh"
+#include "G4Neutron.hh"
+#include "G4Event.hh"
+#include "G4PhysicalConstants.hh"
+#include "Randomize.hh"
+
+#include <algorithm>
+#include <cmath>
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+ResponseSource::ResponseSource()
+ : G4VUserPrimaryGeneratorAction(),
+   fParticleGun(nullptr)
+{
+  fParticleGun = new G4ParticleGun(1);
+  fParticleGun->SetParticleDefinition(G4Neutron::Definition());
+}
+
+ResponseSource::~ResponseSource()
+{
+  delete fParticleGun;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ResponseSource::GeneratePrimaries(G4Event* event)
+{
+  EventRandom::Reseed(event);
+
+  const ResponseMatrix::Source& source = ResponseMatrix::GetSource();
+
+  G4double cosTheta = source.cosMin
+                    + (source.cosMax - source.cosMin)*G4UniformRand();
+  G4double sinTheta = std::sqrt(std::max(0., 1. - cosTheta*cosTheta));
+  G4double phi = twopi*G4UniformRand();
+  G4ThreeVector direction(sinTheta*std::cos(phi), sinTheta*std::sin(phi),
+                          cosTheta);
+
+  // Uniform on the disk facing the beam, one radius upstream
+  G4ThreeVector u = direction.orthogonal().unit();
+  G4ThreeVector v = direction.cross(u);
+  G4double r = source.radius*std::sqrt(G4UniformRand());
+  G4double psi = twopi*G4UniformRand();
+  G4ThreeVector position = source.center - source.radius*direction
+                         + r*(std::cos(psi)*u + std::sin(psi)*v);
+
+  fParticleGun->SetParticleEnergy(source.energy);
+  fParticleGun->SetParticleMomentumDirection(direction);
+  fParticleGun->SetParticlePosition(position);
+  fParticleGun->GeneratePrimaryVertex(event);
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
@@ -0,0 +1,32 @@
+#ifndef ResponseSource_h
+#define ResponseSource_h 1
+
+#include "G4VUserPrimaryGeneratorAction.hh"
+
+class G4ParticleGun;
+class G4Event;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+/// Primary generator of ResponseMatrix::Build(): one neutron per event,
+/// at the energy of the current bin, in a parallel beam with its polar
+/// angle drawn uniformly in cosine inside the current angular bin and a
+/// uniform azimuth, starting on a disk that covers the sphere around the
+/// moderator box. Register it on the workers in place of the application
+/// generator for response runs.
+
+class ResponseSource : public G4VUserPrimaryGeneratorAction
+{
+  public:
+    ResponseSource();
+    virtual ~ResponseSource();
+
+    virtual void GeneratePrimaries(G4Event* event);
+
+  private:
+    G4ParticleGun* fParticleGun;
+};
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+#endif
@@ -0,0 +1,678 @@
+#include "RockAlbedo.hh"
+#include "DetectorLayout.hh"
+#include "RunTally.hh"
+
+#include "G4RunManager.hh"
+#include "G4Step.hh"
+#include "G4Track.hh"
+#include "G4Neutron.hh"
+#include "G4VPhysicalVolume.hh"
+#include "G4LogicalVolume.hh"
+#include "G4LogicalVolumeStore.hh"
+#include "G4Material.hh"
+#include "G4Element.hh"
+#include "G4AutoLock.hh"
+#include "G4GenericMessenger.hh"
+#include "G4PhysicalConstants.hh"
+#include "G4SystemOfUnits.hh"
+#include "Randomize.hh"
+#include "G4ios.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+namespace
+{
+  G4Mutex albedoMutex = G4MUTEX_INITIALIZER;
+  std::vector<RockAlbedo*>* workers = nullptr;
+
+  const G4int    kVersion  = 1;
+  const G4double kDelayMin = 1.*ns;
+  const G4double kDelayMax = 10.*ms;
+  const G4double kTolerance = 1.*um;
+
+  template <typename T>
+  void WriteRaw(std::ostream& os, const T& value)
+  {
+    os.write(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+
+  template <typename T>
+  G4bool ReadRaw(std::istream& is, T& value)
+  {
+    return (G4bool)is.read(reinterpret_cast<char*>(&value), sizeof(T));
+  }
+
+  G4bool IsRock(const G4VPhysicalVolume* pv)
+  {
+    return pv && DetectorLayout::Instance()->GetRole(pv->GetLogicalVolume())
+                 == DetectorLayout::kRock;
+  }
+
+  // Wall of the room nearest to a point inside it (within tolerance),
+  // -1 outside the room
+  G4int RoomWall(const G4ThreeVector& point)
+  {
+    const G4ThreeVector& half = DetectorLayout::Instance()->GetRoomHalf();
+    G4int axis = -1;
+    G4double nearest = DBL_MAX;
+    for (G4int i = 0; i < 3; ++i) {
+      G4double distance = half[i] - std::fabs(point[i]);
+      if (distance < -kTolerance) return -1;
+      if (distance < nearest) {
+        nearest = distance;
+        axis = i;
+      }
+    }
+    return axis;
+  }
+
+  // Unit vector at cosine cosTheta to normal, uniform azimuth
+  G4ThreeVector AboutNormal(const G4ThreeVector& normal, G4double cosTheta)
+  {
+    G4double sinTheta = std::sqrt(std::max(0., 1. - cosTheta*cosTheta));
+    G4double phi = twopi*G4UniformRand();
+    G4ThreeVector u = normal.orthogonal().unit();
+    G4ThreeVector v = normal.cross(u);
+    return cosTheta*normal + sinTheta*(std::cos(phi)*u + std::sin(phi)*v);
+  }
+}
+
+G4int    RockAlbedo::fBuildGroups  = 30;
+G4int    RockAlbedo::fBuildCosines = 5;
+G4int    RockAlbedo::fBuildTimes   = 12;
+G4double RockAlbedo::fBuildEmin    = 1.e-5*eV;
+G4double RockAlbedo::fBuildEmax    = 20.*MeV;
+G4String RockAlbedo::fFileName     = "";
+G4bool   RockAlbedo::fEnabled      = false;
+G4bool   RockAlbedo::fBuilding     = false;
+RockAlbedo::Source RockAlbedo::fSource = { 1.*MeV, 2.*MeV, 0., 1. };
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+RockAlbedo* RockAlbedo::Instance()
+{
+  static G4ThreadLocal RockAlbedo* instance = nullptr;
+  if (!instance) {
+    instance = new RockAlbedo(false);
+    G4AutoLock lock(&albedoMutex);
+    if (!workers) workers = new std::vector<RockAlbedo*>;
+    workers->push_back(instance);
+  }
+  return instance;
+}
+
+RockAlbedo* RockAlbedo::Master()
+{
+  static RockAlbedo master(true);
+  return &master;
+}
+
+void RockAlbedo::CollectWorkers()
+{
+  G4AutoLock lock(&albedoMutex);
+  if (!workers) return;
+  RockAlbedo* master = Master();
+  for (auto worker : *workers) {
+    master->Merge(*worker);
+    worker->Reset();
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+RockAlbedo::RockAlbedo(G4bool master)
+ : fGroups(0),
+   fCosines(0),
+   fTimes(0),
+   fEmin(0.),
+   fEmax(0.),
+   fHistories(0),
+   fKey(0),
+   fEventWeight(0.),
+   fSum(0.),
+   fSum2(0.),
+   fNofEvents(0),
+   fReemitted(0),
+   fMessenger(nullptr)
+{
+  if (master) DefineCommands();
+}
+
+RockAlbedo::~RockAlbedo()
+{
+  delete fMessenger;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4int RockAlbedo::EnergyGroup(G4double energy) const
+{
+  if (energy <= fEmin) return 0;
+  G4int group = (G4int)(fGroups*std::log(energy/fEmin)/std::log(fEmax/fEmin));
+  return std::min(group, fGroups - 1);
+}
+
+G4double RockAlbedo::EnergyEdge(G4int i) const
+{
+  return fEmin*std::pow(fEmax/fEmin, G4double(i)/fGroups);
+}
+
+// Bin 0 holds delays below kDelayMin, the others are logarithmic
+G4int RockAlbedo::TimeBin(G4double delay) const
+{
+  if (fTimes == 1 || delay < kDelayMin) return 0;
+  G4int bin = 1 + (G4int)((fTimes - 1)*std::log(delay/kDelayMin)
+                          /std::log(kDelayMax/kDelayMin));
+  return std::min(bin, fTimes - 1);
+}
+
+G4double RockAlbedo::SampleDelay(G4int bin) const
+{
+  if (bin == 0) return kDelayMin*G4UniformRand();
+  G4double ratio = std::log(kDelayMax/kDelayMin)/(fTimes - 1);
+  return kDelayMin*std::exp(ratio*(bin - 1 + G4UniformRand()));
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+unsigned long long RockAlbedo::Key() const
+{
+  auto layout = DetectorLayout::Instance();
+  const G4Material* rock = nullptr;
+  for (auto lv : *G4LogicalVolumeStore::GetInstance()) {
+    if (layout->GetRole(lv) == DetectorLayout::kRock) rock = lv->GetMaterial();
+  }
+  if (!rock) return 0;
+
+  std::ostringstream os;
+  os << std::setprecision(17) << rock->GetName() << ' '
+     << rock->GetDensity()/(g/cm3);
+  for (std::size_t i = 0; i < rock->GetNumberOfElements(); ++i) {
+    const G4Element* element = rock->GetElement(i);
+    os << ' ' << element->GetZ() << ' ' << element->GetN()
+       << ' ' << rock->GetFractionVector()[i];
+  }
+  os << ' ' << layout->GetRockHalf() - layout->GetRoomHalf();
+
+  // FNV-1a, as the geometry fingerprint
+  unsigned long long hash = 14695981039346656037ULL;
+  for (char c : os.str()) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+G4String RockAlbedo::DefaultFileName() const
+{
+  std::ostringstream name;
+  name << "albedo_" << std::hex << std::setw(16) << std::setfill('0')
+       << Key() << ".bin";
+  return name.str();
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void RockAlbedo::Step(const G4Step* step)
+{
+  const G4Track* track = step->GetTrack();
+  G4StepPoint* post = step->GetPostStepPoint();
+
+  if (fBuilding) {
+    // Only neutrons matter for the tables
+    if (track->GetDefinition() != G4Neutron::Definition()) {
+      step->GetTrack()->SetTrackStatus(fStopAndKill);
+      return;
+    }
+    if (post->GetStepStatus() != fGeomBoundary) return;
+    if (!IsRock(step->GetPreStepPoint()->GetPhysicalVolume())) return;
+    if (!post->GetPhysicalVolume() || IsRock(post->GetPhysicalVolume())) return;
+    G4int axis = RoomWall(post->GetPosition());
+    if (axis >= 0) Score(step, axis);
+    return;
+  }
+
+  if (track->GetDefinition() != G4Neutron::Definition()) return;
+  if (post->GetStepStatus() != fGeomBoundary) return;
+  if (!IsRock(post->GetPhysicalVolume())) return;
+  if (IsRock(step->GetPreStepPoint()->GetPhysicalVolume())) return;
+  G4int axis = RoomWall(post->GetPosition());
+  if (axis >= 0) Reemit(step, axis);
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void RockAlbedo::Score(const G4Step* step, G4int axis)
+{
+  // Binning of the build in progress
+  const RockAlbedo* master = Master();
+  if (fGroups != master->fGroups || fCosines != master->fCosines ||
+      fTimes != master->fTimes || fEmin != master->fEmin ||
+      fEmax != master->fEmax) {
+    fGroups  = master->fGroups;
+    fCosines = master->fCosines;
+    fTimes   = master->fTimes;
+    fEmin    = master->fEmin;
+    fEmax    = master->fEmax;
+    fScore.assign(NumberOfCells(), 0.);
+  }
+
+  G4StepPoint* post = step->GetPostStepPoint();
+  G4ThreeVector normal;
+  normal[axis] = (post->GetPosition()[axis] > 0.) ? -1. : 1.;   // into the room
+  G4double cosine = post->GetMomentumDirection().dot(normal);
+  if (cosine <= 0.) return;
+
+  G4int group = EnergyGroup(post->GetKineticEnergy());
+  G4int bin = std::min((G4int)(cosine*fCosines), fCosines - 1);
+  G4int time = TimeBin(post->GetGlobalTime());
+  G4double weight = post->GetWeight();
+
+  fScore[(group*fCosines + bin)*fTimes + time] += weight;
+  fEventWeight += weight;
+  step->GetTrack()->SetTrackStatus(fStopAndKill);
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void RockAlbedo::Reemit(const G4Step* step, G4int axis)
+{
+  const RockAlbedo* tables = Master();
+  G4StepPoint* post = step->GetPostStepPoint();
+  G4Track* track = step->GetTrack();
+
+  G4double energy = post->GetKineticEnergy();
+  if (energy >= tables->fEmax) return;
+
+  G4ThreeVector normal;
+  normal[axis] = (post->GetPosition()[axis] > 0.) ? 1. : -1.;   // into the rock
+  G4double cosine = post->GetMomentumDirection().dot(normal);
+  if (cosine <= 0.) return;
+
+  G4int incident = tables->EnergyGroup(energy)*tables->fCosines
+                 + std::min((G4int)(cosine*tables->fCosines),
+                            tables->fCosines - 1);
+  G4double probability = tables->fReturn[incident];
+  if (probability <= 0.) {
+    track->SetTrackStatus(fStopAndKill);
+    return;
+  }
+
+  G4int cell = tables->fSampler[incident].Sample();
+  G4int time  = cell % tables->fTimes;
+  G4int bin   = (cell/tables->fTimes) % tables->fCosines;
+  G4int group = cell/(tables->fTimes*tables->fCosines);
+
+  G4double low = tables->EnergyEdge(group);
+  G4double newEnergy = low*std::pow(tables->EnergyEdge(group + 1)/low,
+                                    G4UniformRand());
+  G4double newCosine = (bin + G4UniformRand())/tables->fCosines;
+  G4ThreeVector direction = AboutNormal(-normal, newCosine);
+  G4double delay = tables->SampleDelay(time);
+  G4double weight = post->GetWeight()*probability;
+
+  // The next step starts from the post-step point
+  track->SetKineticEnergy(newEnergy);
+  track->SetMomentumDirection(direction);
+  track->SetWeight(weight);
+  track->SetGlobalTime(track->GetGlobalTime() + delay);
+  track->SetLocalTime(track->GetLocalTime() + delay);
+  post->SetKineticEnergy(newEnergy);
+  post->SetMomentumDirection(direction);
+  post->SetWeight(weight);
+  post->SetGlobalTime(post->GetGlobalTime() + delay);
+  post->SetLocalTime(post->GetLocalTime() + delay);
+  post->SetVelocity(track->CalculateVelocity());
+  ++fReemitted;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void RockAlbedo::EndOfEvent()
+{
+  fSum  += fEventWeight;
+  fSum2 += fEventWeight*fEventWeight;
+  fEventWeight = 0.;
+  ++fNofEvents;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void RockAlbedo::Reset()
+{
+  std::fill(fScore.begin(), fScore.end(), 0.);
+  fEventWeight = 0.;
+  fSum = 0.;
+  fSum2 = 0.;
+  fNofEvents = 0;
+  fReemitted = 0;
+}
+
+void RockAlbedo::Merge(const RockAlbedo& other)
+{
+  if (fScore.size() < other.fScore.size()) fScore.resize(other.fScore.size(), 0.);
+  for (std::size_t i = 0; i < other.fScore.size(); ++i) fScore[i] += other.fScore[i];
+  fSum  += other.fSum;
+  fSum2 += other.fSum2;
+  fNofEvents += other.fNofEvents;
+  fReemitted += other.fReemitted;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void RockAlbedo::Build(G4int historiesPerBin)
+{
+  auto runManager = G4RunManager::GetRunManager();
+  if (!DetectorLayout::Instance()->IsClosed()) runManager->Initialize();
+
+  fKey = Key();
+  if (fKey == 0) {
+    G4Exception("RockAlbedo::Build()", "NMDS020", JustWarning,
+                "No rock volume in the geometry.");
+    return;
+  }
+
+  fGroups    = fBuildGroups;
+  fCosines   = fBuildCosines;
+  fTimes     = fBuildTimes;
+  fEmin      = fBuildEmin;
+  fEmax      = fBuildEmax;
+  fHistories = historiesPerBin;
+  G4int nincident = fGroups*fCosines;
+  fReturn.assign(nincident, 0.);
+  fError.assign(nincident, 1.);
+  fCells.assign((std::size_t)nincident*NumberOfCells(), 0.);
+  fSampler.assign(nincident, RockSource::AliasTable());
+
+  // Full transport while the tables are measured
+  G4bool enabled = fEnabled;
+  fEnabled = false;
+  fBuilding = true;
+
+  for (G4int e = 0; e < fGroups; ++e) {
+    for (G4int a = 0; a < fCosines; ++a) {
+      fSource.emin   = EnergyEdge(e);
+      fSource.emax   = EnergyEdge(e + 1);
+      fSource.cosMin = G4double(a)/fCosines;
+      fSource.cosMax = G4double(a + 1)/fCosines;
+
+      CollectWorkers();
+      Reset();
+      fScore.assign(NumberOfCells(), 0.);
+      runManager->BeamOn(historiesPerBin);
+      CollectWorkers();
+
+      G4int incident = e*fCosines + a;
+      if (fNofEvents > 0) {
+        fReturn[incident] = fSum/fNofEvents;
+        G4double variance = fSum2/fNofEvents - fReturn[incident]*fReturn[incident];
+        if (fSum > 0.) {
+          fError[incident] = std::sqrt(std::max(0., variance)/fNofEvents)
+                           /fReturn[incident];
+        }
+        for (G4int cell = 0; cell < NumberOfCells(); ++cell) {
+          fCells[(std::size_t)incident*NumberOfCells() + cell] =
+            fScore[cell]/fNofEvents;
+        }
+      }
+      if (fSum > 0.) fSampler[incident].Build(fScore);
+    }
+    G4cout << "### Albedo: " << EnergyEdge(e)/MeV << " - "
+           << EnergyEdge(e + 1)/MeV << " MeV, return "
+           << fReturn[e*fCosines + fCosines - 1] << " at normal incidence"
+           << G4endl;
+  }
+
+  fBuilding = false;
+  fEnabled = enabled;
+  Reset();
+
+  Save(fFileName.empty() ? DefaultFileName() : fFileName);
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void RockAlbedo::Save(const G4String& fileName) const
+{
+  std::ofstream out(fileName, std::ios::binary);
+  if (!out) {
+    G4ExceptionDescription msg;
+    msg << "Cannot write the albedo tables to " << fileName;
+    G4Exception("RockAlbedo::Save()", "NMDS020", JustWarning, msg);
+    return;
+  }
+
+  // Header, then return probability and its relative error per incident
+  // bin (energy slowest), then the returned weight per incident neutron
+  // per incident bin and cell (energy, cosine, delay; delay fastest)
+  out.write("NMDSALBD", 8);
+  WriteRaw(out, kVersion);
+  WriteRaw(out, fKey);
+  WriteRaw(out, fGroups);
+  WriteRaw(out, fCosines);
+  WriteRaw(out, fTimes);
+  WriteRaw(out, fEmin/MeV);
+  WriteRaw(out, fEmax/MeV);
+  WriteRaw(out, kDelayMin/ns);
+  WriteRaw(out, kDelayMax/ns);
+  WriteRaw(out, (long long)fHistories);
+  for (auto value : fReturn) WriteRaw(out, value);
+  for (auto value : fError) WriteRaw(out, value);
+  for (auto value : fCells) WriteRaw(out, value);
+
+  G4cout << "### Albedo tables " << fGroups << " groups x " << fCosines
+         << " cosines written to " << fileName << G4endl;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4bool RockAlbedo::Load(const G4String& fileName)
+{
+  std::ifstream in(fileName, std::ios::binary);
+  char magic[8];
+  G4int version = 0, groups = 0, cosines = 0, times = 0;
+  unsigned long long key = 0;
+  G4double emin = 0., emax = 0., tmin = 0., tmax = 0.;
+  long long histories = 0;
+  if (!in || !in.read(magic, 8) || std::string(magic, 8) != "NMDSALBD" ||
+      !ReadRaw(in, version) || version != kVersion ||
+      !ReadRaw(in, key) || !ReadRaw(in, groups) || !ReadRaw(in, cosines) ||
+      !ReadRaw(in, times) || groups <= 0 || cosines <= 0 || times <= 0 ||
+      !ReadRaw(in, emin) || !ReadRaw(in, emax) ||
+      !ReadRaw(in, tmin) || !ReadRaw(in, tmax) ||
+      tmin != kDelayMin/ns || tmax != kDelayMax/ns ||
+      !ReadRaw(in, histories)) {
+    G4ExceptionDescription msg;
+    msg << "Cannot read albedo tables from " << fileName;
+    G4Exception("RockAlbedo::Load()", "NMDS020", JustWarning, msg);
+    return false;
+  }
+
+  if (DetectorLayout::Instance()->IsClosed() && key != Key()) {
+    G4ExceptionDescription msg;
+    msg << "Albedo tables " << fileName << " belong to another rock ("
+        << std::hex << key << " instead of " << Key() << std::dec << ")";
+    G4Exception("RockAlbedo::Load()", "NMDS020", JustWarning, msg);
+    return false;
+  }
+
+  G4int nincident = groups*cosines;
+  G4int ncells = groups*cosines*times;
+  std::vector<G4double> returned(nincident), error(nincident);
+  std::vector<G4double> cells((std::size_t)nincident*ncells);
+  for (auto& value : returned) ReadRaw(in, value);
+  for (auto& value : error) ReadRaw(in, value);
+  for (auto& value : cells) ReadRaw(in, value);
+  if (!in) {
+    G4ExceptionDescription msg;
+    msg << "Albedo tables " << fileName << " are truncated";
+    G4Exception("RockAlbedo::Load()", "NMDS020", JustWarning, msg);
+    return false;
+  }
+
+  fGroups    = groups;
+  fCosines   = cosines;
+  fTimes     = times;
+  fEmin      = emin*MeV;
+  fEmax      = emax*MeV;
+  fHistories = histories;
+  fKey       = key;
+  fReturn.swap(returned);
+  fError.swap(error);
+  fCells.swap(cells);
+  fSampler.assign(nincident, RockSource::AliasTable());
+  for (G4int i = 0; i < nincident; ++i) {
+    if (fReturn[i] <= 0.) continue;
+    std::vector<G4double> weights(fCells.begin() + (std::size_t)i*ncells,
+                                  fCells.begin() + (std::size_t)(i + 1)*ncells);
+    fSampler[i].Build(weights);
+  }
+  return true;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void RockAlbedo::Validate(G4int nofEvents)
+{
+  auto runManager = G4RunManager::GetRunManager();
+  if (!DetectorLayout::Instance()->IsClosed()) runManager->Initialize();
+  if (fReturn.empty() &&
+      !Load(fFileName.empty() ? DefaultFileName() : fFileName)) return;
+
+  std::vector<G4double> mean[2], error[2];
+  G4double seconds[2] = { 0., 0. };
+  G4long reemitted = 0;
+  G4bool enabled = fEnabled;
+
+  for (G4int pass = 0; pass < 2; ++pass) {
+    fEnabled = (pass == 1);
+    RunTally::CollectWorkers();
+    RunTally::Master()->Reset();
+    CollectWorkers();
+    Reset();
+
+    auto start = std::chrono::steady_clock::now();
+    runManager->BeamOn(nofEvents);
+    std::chrono::duration<G4double> elapsed =
+      std::chrono::steady_clock::now() - start;
+    seconds[pass] = elapsed.count();
+
+    RunTally::CollectWorkers();
+    CollectWorkers();
+    if (pass == 1) reemitted = fReemitted;
+    const RunTally* tally = RunTally::Master();
+    for (G4int bin = 0; bin < RunTally::kNumberOfBins; ++bin) {
+      mean[pass].push_back(tally->GetMean(bin));
+      error[pass].push_back(tally->GetRelativeError(bin)*tally->GetMean(bin));
+    }
+  }
+  fEnabled = enabled;
+  RunTally::Master()->Reset();
+  Reset();
+
+  G4cout << "### Albedo validation, " << nofEvents << " events: full transport "
+         << seconds[0] << " s, albedo " << seconds[1] << " s (speed-up "
+         << (seconds[1] > 0. ? seconds[0]/seconds[1] : 0.) << "), "
+         << reemitted << " neutrons returned by the walls" << G4endl;
+  G4cout << std::setw(14) << "bin" << std::setw(14) << "full"
+         << std::setw(12) << "+-" << std::setw(14) << "albedo"
+         << std::setw(12) << "+-" << std::setw(10) << "ratio"
+         << std::setw(10) << "z" << G4endl;
+
+  G4double chi2 = 0.;
+  G4int ndf = 0;
+  for (G4int bin = 0; bin < RunTally::kNumberOfBins; ++bin) {
+    if (bin >= RunTally::kVDOffset && bin != RunTally::kTotalBin) continue;
+    if (mean[0][bin] <= 0. && mean[1][bin] <= 0.) continue;
+    G4double sigma = std::sqrt(error[0][bin]*error[0][bin]
+                               + error[1][bin]*error[1][bin]);
+    G4double z = (sigma > 0.) ? (mean[1][bin] - mean[0][bin])/sigma : 0.;
+    if (bin != RunTally::kTotalBin && sigma > 0.) {
+      chi2 += z*z;
+      ++ndf;
+    }
+    G4cout << std::setw(14) << RunTally::GetBinName(bin)
+           << std::setw(14) << mean[0][bin] << std::setw(12) << error[0][bin]
+           << std::setw(14) << mean[1][bin] << std::setw(12) << error[1][bin]
+           << std::setw(10)
+           << (mean[0][bin] > 0. ? mean[1][bin]/mean[0][bin] : 0.)
+           << std::setw(10) << z << G4endl;
+  }
+  if (ndf > 0) {
+    G4cout << "### Counters: chi2/ndf " << chi2/ndf << " (" << ndf
+           << " counters)" << G4endl;
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void RockAlbedo::SetEnabled(G4bool enabled)
+{
+  if (enabled && fReturn.empty()) {
+    if (!DetectorLayout::Instance()->IsClosed()) {
+      G4Exception("RockAlbedo::SetEnabled()", "NMDS020", JustWarning,
+                  "Enable the albedo after /run/initialize.");
+      return;
+    }
+    if (!Load(fFileName.empty() ? DefaultFileName() : fFileName)) return;
+  }
+  fEnabled = enabled;
+}
+
+void RockAlbedo::LoadCommand(const G4String& fileName)
+{
+  fFileName = fileName;
+  Load(fileName);
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void RockAlbedo::DefineCommands()
+{
+  fMessenger = new G4GenericMessenger(this, "/nmds/albedo/",
+                                      "Albedo of the rock walls");
+
+  auto& groupsCmd = fMessenger->DeclareProperty("energyGroups", fBuildGroups,
+                    "Logarithmic energy groups of the next build.");
+  groupsCmd.SetParameterName("groups", false);
+  groupsCmd.SetRange("groups>0");
+
+  fMessenger->DeclarePropertyWithUnit("emin", "eV", fBuildEmin,
+                                      "Lower energy of the next build.");
+  fMessenger->DeclarePropertyWithUnit("emax", "MeV", fBuildEmax,
+                                      "Upper energy of the next build.");
+
+  auto& cosinesCmd = fMessenger->DeclareProperty("cosineBins", fBuildCosines,
+                     "Bins of the cosine to the wall normal.");
+  cosinesCmd.SetParameterName("bins", false);
+  cosinesCmd.SetRange("bins>0");
+
+  auto& timesCmd = fMessenger->DeclareProperty("timeBins", fBuildTimes,
+                   "Bins of the return delay, 1 ns to 10 ms.");
+  timesCmd.SetParameterName("bins", false);
+  timesCmd.SetRange("bins>0");
+
+  auto& buildCmd = fMessenger->DeclareMethod("build", &RockAlbedo::Build,
+                   "Measure the tables, histories per incident bin.");
+  buildCmd.SetParameterName("histories", false);
+  buildCmd.SetRange("histories>0");
+
+  fMessenger->DeclareMethod("load", &RockAlbedo::LoadCommand,
+                            "Table file to load and save to.")
+    .SetParameterName("file", false);
+  fMessenger->DeclareMethod("enable", &RockAlbedo::SetEnabled,
+                            "Replace neutron transport in the rock by albedo.");
+
+  auto& validateCmd = fMessenger->DeclareMethod("validate",
+                      &RockAlbedo::Validate,
+                      "Compare counters with full transport and albedo.");
+  validateCmd.SetParameterName("events", false);
+  validateCmd.SetRange("events>0");
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
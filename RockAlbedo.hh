@@ -0,0 +1,137 @@
+#ifndef RockAlbedo_h
+#define RockAlbedo_h 1
+
+#include "globals.hh"
+#include "RockSource.hh"
+
+#include <vector>
+
+class G4Step;
+class G4GenericMessenger;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+/// Albedo of the rock walls for neutrons, replacing their transport in
+/// the rock when the rock only serves as a reflector around the room.
+///
+/// Tables: per incident energy group and bin of the incident cosine to
+/// the wall normal, the weight returned into the room per incident
+/// neutron and the joint distribution of the returned energy group,
+/// cosine to the wall normal and delay. Build() measures them with full
+/// transport, shooting neutrons from the room walls into the rock through
+/// AlbedoSource, which must then be the primary generator of the workers,
+/// and scoring the neutrons coming back through the walls. Tables are
+/// saved by default under a name keyed by the rock material composition
+/// and the wall thicknesses, and loaded from it when enabled.
+///
+/// Enabled, a neutron entering the rock from the room is sent back at the
+/// same point: its weight is multiplied by the return probability of its
+/// incident bin, and its energy (uniform in lethargy within the group),
+/// direction (uniform azimuth about the normal) and arrival time are
+/// drawn from the tables. The lateral displacement of the return and the
+/// azimuthal correlation are neglected; neutrons above the table range
+/// and other particles are transported in the rock as before.
+///
+/// Validate() runs the application source with full transport and with
+/// albedo and compares the counter tallies and the run times.
+///
+///   /nmds/albedo/energyGroups 30
+///   /nmds/albedo/emin 1e-5 eV
+///   /nmds/albedo/emax 20 MeV
+///   /nmds/albedo/cosineBins 5
+///   /nmds/albedo/timeBins 12
+///   /nmds/albedo/build 100000
+///   /nmds/albedo/load albedo.bin
+///   /nmds/albedo/enable true
+///   /nmds/albedo/validate 10000
+
+class RockAlbedo
+{
+  public:
+    // Incident bin being built, read by AlbedoSource
+    struct Source {
+      G4double emin;
+      G4double emax;
+      G4double cosMin;
+      G4double cosMax;
+    };
+
+    static RockAlbedo* Instance();
+    static RockAlbedo* Master();
+    static void CollectWorkers();
+
+    static G4bool IsEnabled()  { return fEnabled; }
+    static G4bool IsBuilding() { return fBuilding; }
+    static const Source& GetSource() { return fSource; }
+
+    // Called for every step by ScoringSteppingAction, last
+    void Step(const G4Step* step);
+    // From ScoringEventAction while building
+    void EndOfEvent();
+
+    void Reset();
+    void Merge(const RockAlbedo& other);
+
+    void Build(G4int historiesPerBin);
+    G4bool Load(const G4String& fileName);
+    void Save(const G4String& fileName) const;
+    void Validate(G4int nofEvents);
+
+  private:
+    RockAlbedo(G4bool master);
+    ~RockAlbedo();
+
+    G4int NumberOfCells() const { return fGroups*fCosines*fTimes; }
+    G4int EnergyGroup(G4double energy) const;
+    G4double EnergyEdge(G4int i) const;
+    G4int TimeBin(G4double delay) const;
+    G4double SampleDelay(G4int bin) const;
+    unsigned long long Key() const;
+    G4String DefaultFileName() const;
+
+    void Reemit(const G4Step* step, G4int axis);
+    void Score(const G4Step* step, G4int axis);
+
+    void DefineCommands();
+    void SetEnabled(G4bool enabled);
+    void LoadCommand(const G4String& fileName);
+
+    // Tables (master), with their binning
+    G4int    fGroups;
+    G4int    fCosines;
+    G4int    fTimes;
+    G4double fEmin;
+    G4double fEmax;
+    G4long   fHistories;
+    unsigned long long fKey;
+    std::vector<G4double> fReturn;                  // [group][cosine]
+    std::vector<G4double> fError;                   // relative
+    std::vector<G4double> fCells;                   // [incident][cell]
+    std::vector<RockSource::AliasTable> fSampler;   // [incident]
+
+    // Tally of the bin being built (threads)
+    std::vector<G4double> fScore;                   // [cell]
+    G4double fEventWeight;
+    G4double fSum;
+    G4double fSum2;
+    G4long   fNofEvents;
+    G4long   fReemitted;
+
+    G4GenericMessenger* fMessenger;
+
+    // Binning of the next build and table file, set on the master
+    static G4int    fBuildGroups;
+    static G4int    fBuildCosines;
+    static G4int    fBuildTimes;
+    static G4double fBuildEmin;
+    static G4double fBuildEmax;
+    static G4String fFileName;
+
+    static G4bool   fEnabled;
+    static G4bool   fBuilding;
+    static Source   fSource;
+};
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+#endif
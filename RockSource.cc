@@ -0,0 +1,451 @@
+#include "RockSource.hh"
+#include "DetectorLayout.hh"
+#include "EventRandom.hh"
+
+#include "G4AutoLock.hh"
+#include "G4GenericMessenger.hh"
+#include "G4Event.hh"
+#include "G4PrimaryVertex.hh"
+#include "G4PrimaryParticle.hh"
+#include "G4Neutron.hh"
+#include "G4SystemOfUnits.hh"
+#include "G4PhysicalConstants.hh"
+#include "Randomize.hh"
+#include "G4ios.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+
+namespace
+{
+  G4Mutex rockSourceMutex = G4MUTEX_INITIALIZER;
+}
+
+G4String RockSource::fEnergyFile  = "";
+G4String RockSource::fAngleFile   = "";
+G4int    RockSource::fCells       = 20;
+G4double RockSource::fSpatialBias = 0.9;
+G4double RockSource::fRelaxation  = 50.*cm;
+G4double RockSource::fAngularBias = 0.5;
+G4int    RockSource::fVersion     = 0;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void RockSource::AliasTable::Build(const std::vector<G4double>& weights)
+{
+  G4int n = weights.size();
+  G4double sum = 0.;
+  for (auto w : weights) sum += w;
+
+  probability.assign(n, 1.);
+  alias.resize(n);
+  std::vector<G4double> scaled(n);
+  std::vector<G4int> small, large;
+  for (G4int i = 0; i < n; ++i) {
+    alias[i] = i;
+    scaled[i] = weights[i]*n/sum;
+    if (scaled[i] < 1.) small.push_back(i);
+    else                large.push_back(i);
+  }
+
+  // Pair each underfull entry with an overfull one
+  while (!small.empty() && !large.empty()) {
+    G4int s = small.back(); small.pop_back();
+    G4int l = large.back();
+    probability[s] = scaled[s];
+    alias[s] = l;
+    scaled[l] -= 1. - scaled[s];
+    if (scaled[l] < 1.) {
+      large.pop_back();
+      small.push_back(l);
+    }
+  }
+}
+
+G4int RockSource::AliasTable::Sample() const
+{
+  G4int n = probability.size();
+  G4double u = n*G4UniformRand();
+  G4int i = std::min((G4int)u, n - 1);
+  return (u - i < probability[i]) ? i : alias[i];
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+RockSource::RockSource()
+ : G4VUserPrimaryGeneratorAction(),
+   fTablesVersion(-1),
+   fMessenger(nullptr)
+{
+}
+
+RockSource::~RockSource()
+{
+  delete fMessenger;
+}
+
+RockSource* RockSource::Master()
+{
+  static RockSource* master = nullptr;
+  if (!master) {
+    master = new RockSource();
+    master->DefineCommands();
+  }
+  return master;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+std::shared_ptr<const RockSource::Tables> RockSource::GetTables()
+{
+  // One set of tables per settings, whichever thread asks first
+  static std::shared_ptr<const Tables> cache;
+  static G4int cacheVersion = -1;
+
+  G4AutoLock lock(&rockSourceMutex);
+  if (!cache || cacheVersion != fVersion) {
+    cache = Build();
+    cacheVersion = fVersion;
+  }
+  return cache;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4bool RockSource::ReadGroups(const G4String& fileName,
+                              std::vector<G4double>& low,
+                              std::vector<G4double>& high,
+                              std::vector<G4double>& value, G4double unit)
+{
+  std::ifstream in(fileName);
+  if (!in) return false;
+  std::string line;
+  while (std::getline(in, line)) {
+    std::size_t hash = line.find('#');
+    if (hash != std::string::npos) line.erase(hash);
+    std::istringstream is(line);
+    G4double a, b, v;
+    if (!(is >> a)) continue;
+    if (!(is >> b >> v) || !(b > a) || v < 0.) return false;
+    low.push_back(a*unit);
+    high.push_back(b*unit);
+    value.push_back(v);
+  }
+  G4double sum = 0.;
+  for (auto v : value) sum += v;
+  return sum > 0.;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+std::shared_ptr<const RockSource::Tables> RockSource::Build()
+{
+  auto layout = DetectorLayout::Instance();
+  if (!layout->IsClosed()) {
+    G4Exception("RockSource::Build()", "NMDS014", FatalException,
+                "The rock source needs the geometry; use it after "
+                "/run/initialize.");
+    return nullptr;
+  }
+
+  auto tables = std::make_shared<Tables>();
+  Tables& t = *tables;
+  t.rockHalf = layout->GetRockHalf();
+  t.roomHalf = layout->GetRoomHalf();
+  t.cells = fCells;
+
+  // Cells of the six faces: natural and room-attenuated weights
+  G4int n = fCells;
+  G4int nofCells = 6*n*n;
+  std::vector<G4double> area(nofCells), distance(nofCells);
+  G4double minDistance = DBL_MAX;
+  for (G4int c = 0; c < nofCells; ++c) {
+    G4int face = c/(n*n);
+    G4int axis = face/2;
+    G4int u = (axis + 1)%3, v = (axis + 2)%3;
+    G4ThreeVector center;
+    center[axis] = (face%2 ? 1. : -1.)*t.rockHalf[axis];
+    center[u] = t.rockHalf[u]*(2.*((c/n)%n + 0.5)/n - 1.);
+    center[v] = t.rockHalf[v]*(2.*(c%n + 0.5)/n - 1.);
+    area[c] = 4.*t.rockHalf[u]*t.rockHalf[v]/(n*n);
+
+    G4ThreeVector outside;
+    for (G4int i = 0; i < 3; ++i) {
+      outside[i] = std::max(0., std::fabs(center[i]) - t.roomHalf[i]);
+    }
+    distance[c] = outside.mag();
+    minDistance = std::min(minDistance, distance[c]);
+  }
+
+  G4double totalArea = 0., totalImportance = 0.;
+  std::vector<G4double> importance(nofCells);
+  for (G4int c = 0; c < nofCells; ++c) {
+    importance[c] = area[c]*std::exp(-(distance[c] - minDistance)/fRelaxation);
+    totalArea += area[c];
+    totalImportance += importance[c];
+  }
+  t.area = totalArea;
+
+  std::vector<G4double> biased(nofCells);
+  t.cellWeight.resize(nofCells);
+  for (G4int c = 0; c < nofCells; ++c) {
+    G4double natural = area[c]/totalArea;
+    biased[c] = (1. - fSpatialBias)*natural
+              + fSpatialBias*importance[c]/totalImportance;
+    t.cellWeight[c] = natural/biased[c];
+  }
+  t.cell.Build(biased);
+
+  // Energy groups, 1/E over the whole range by default
+  std::vector<G4double> value;
+  if (fEnergyFile.empty()) {
+    t.energyLow.push_back(1.e-9*MeV);
+    t.energyHigh.push_back(20.*MeV);
+    value.push_back(1.);
+  }
+  else if (!ReadGroups(fEnergyFile, t.energyLow, t.energyHigh, value, MeV)) {
+    G4ExceptionDescription msg;
+    msg << "Cannot read the energy spectrum " << fEnergyFile;
+    G4Exception("RockSource::Build()", "NMDS014", FatalException, msg);
+    return nullptr;
+  }
+  t.energy.Build(value);
+
+  // Cosine to the inward normal, cosine law by default
+  std::vector<G4double> low, high;
+  value.clear();
+  if (fAngleFile.empty()) {
+    const G4int bins = 20;
+    for (G4int i = 0; i < bins; ++i) {
+      low.push_back(G4double(i)/bins);
+      high.push_back(G4double(i + 1)/bins);
+      value.push_back(high.back()*high.back() - low.back()*low.back());
+    }
+  }
+  else if (!ReadGroups(fAngleFile, low, high, value, 1.)) {
+    G4ExceptionDescription msg;
+    msg << "Cannot read the angular distribution " << fAngleFile;
+    G4Exception("RockSource::Build()", "NMDS014", FatalException, msg);
+    return nullptr;
+  }
+  for (std::size_t i = 0; i < low.size(); ++i) {
+    if (low[i] < 0. || high[i] > 1. || (i > 0 && low[i] != high[i-1])) {
+      G4ExceptionDescription msg;
+      msg << "Cosine bins of " << fAngleFile
+          << " must be contiguous and inside [0, 1]";
+      G4Exception("RockSource::Build()", "NMDS014", FatalException, msg);
+      return nullptr;
+    }
+  }
+  G4double sum = 0.;
+  for (auto v : value) sum += v;
+  t.cosEdges = low;
+  t.cosEdges.push_back(high.back());
+  for (std::size_t i = 0; i < value.size(); ++i) {
+    t.cosDensity.push_back(value[i]/(sum*(high[i] - low[i])));
+  }
+  t.angle.Build(value);
+
+  return tables;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4double RockSource::NaturalDensity(const Tables& tables,
+                                    G4double cosine) const
+{
+  const std::vector<G4double>& edges = tables.cosEdges;
+  if (cosine < edges.front() || cosine > edges.back()) return 0.;
+  std::size_t bin = std::upper_bound(edges.begin(), edges.end(), cosine)
+                  - edges.begin();
+  bin = std::min(std::max<std::size_t>(bin, 1), tables.cosDensity.size());
+  return tables.cosDensity[bin - 1];
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void RockSource::GeneratePrimaries(G4Event* event)
+{
+  EventRandom::Reseed(event);
+
+  G4int version = fVersion;
+  if (!fTables || fTablesVersion != version) {
+    fTables = GetTables();
+    fTablesVersion = version;
+  }
+  const Tables& t = *fTables;
+
+  // Vertex, uniform inside the drawn cell
+  G4int n = t.cells;
+  G4int c = t.cell.Sample();
+  G4int face = c/(n*n);
+  G4int axis = face/2;
+  G4int u = (axis + 1)%3, v = (axis + 2)%3;
+  G4double sign = face%2 ? 1. : -1.;
+  G4ThreeVector position;
+  position[axis] = sign*t.rockHalf[axis];
+  position[u] = t.rockHalf[u]*(2.*((c/n)%n + G4UniformRand())/n - 1.);
+  position[v] = t.rockHalf[v]*(2.*(c%n + G4UniformRand())/n - 1.);
+
+  G4ThreeVector normal;
+  normal[axis] = -sign;
+
+  // Cone around the room, kept inside the inward hemisphere
+  G4ThreeVector toRoom = (-position).unit();
+  G4double sinAlpha = std::min(1., t.roomHalf.mag()/position.mag());
+  G4double cosAlpha = std::sqrt(1. - sinAlpha*sinAlpha);
+  G4double cosBeta = toRoom.dot(normal);
+  cosAlpha = std::max(cosAlpha, std::sqrt(std::max(0., 1. - cosBeta*cosBeta)));
+
+  G4ThreeVector direction;
+  G4double phi = twopi*G4UniformRand();
+  if (G4UniformRand() < fAngularBias) {
+    G4double cosTheta = 1. - G4UniformRand()*(1. - cosAlpha);
+    G4double sinTheta = std::sqrt(std::max(0., 1. - cosTheta*cosTheta));
+    G4ThreeVector e1 = toRoom.orthogonal().unit();
+    G4ThreeVector e2 = toRoom.cross(e1);
+    direction = cosTheta*toRoom
+              + sinTheta*(std::cos(phi)*e1 + std::sin(phi)*e2);
+  }
+  else {
+    G4int bin = t.angle.Sample();
+    G4double cosTheta = t.cosEdges[bin]
+                      + G4UniformRand()*(t.cosEdges[bin+1] - t.cosEdges[bin]);
+    G4double sinTheta = std::sqrt(std::max(0., 1. - cosTheta*cosTheta));
+    G4ThreeVector e1 = normal.orthogonal().unit();
+    G4ThreeVector e2 = normal.cross(e1);
+    direction = cosTheta*normal
+              + sinTheta*(std::cos(phi)*e1 + std::sin(phi)*e2);
+  }
+
+  // Natural over biased density of the direction
+  G4double natural = NaturalDensity(t, direction.dot(normal))/twopi;
+  G4double cone = (direction.dot(toRoom) >= cosAlpha && cosAlpha < 1.)
+                ? 1./(twopi*(1. - cosAlpha)) : 0.;
+  G4double biased = (1. - fAngularBias)*natural + fAngularBias*cone;
+  G4double weight = t.cellWeight[c]*(biased > 0. ? natural/biased : 0.);
+
+  G4int group = t.energy.Sample();
+  G4double energy = t.energyLow[group]
+                  *std::pow(t.energyHigh[group]/t.energyLow[group],
+                            G4UniformRand());
+
+  auto particle = new G4PrimaryParticle(G4Neutron::Definition());
+  particle->SetKineticEnergy(energy);
+  particle->SetMomentumDirection(direction);
+  particle->SetWeight(weight);
+  auto vertex = new G4PrimaryVertex(position, 0.);
+  vertex->SetPrimary(particle);
+  event->AddPrimaryVertex(vertex);
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void RockSource::Print()
+{
+  auto tables = GetTables();
+  const Tables& t = *tables;
+  G4double minWeight = DBL_MAX, maxWeight = 0.;
+  for (auto w : t.cellWeight) {
+    minWeight = std::min(minWeight, w);
+    maxWeight = std::max(maxWeight, w);
+  }
+
+  G4cout << G4endl
+         << "--------------------------- Rock source ---------------------------"
+         << G4endl
+         << "  surface        " << t.area/m2 << " m2 (rates = tally per history"
+         << " x surface x current)" << G4endl
+         << "  cells          6 x " << t.cells << " x " << t.cells
+         << ", spatial bias " << fSpatialBias << ", relaxation "
+         << fRelaxation/cm << " cm" << G4endl
+         << "  cell weights   " << minWeight << " to " << maxWeight << G4endl
+         << "  angular bias   " << fAngularBias << " (weights below "
+         << 1./(1. - fAngularBias) << ")" << G4endl
+         << "  energy groups  " << t.energyLow.size() << " from "
+         << (fEnergyFile.empty() ? G4String("1/E") : fEnergyFile) << G4endl
+         << "  cosine bins    " << t.cosDensity.size() << " from "
+         << (fAngleFile.empty() ? G4String("cosine law") : fAngleFile) << G4endl
+         << "-------------------------------------------------------------------"
+         << G4endl;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void RockSource::SetEnergyFile(const G4String& fileName)
+{
+  fEnergyFile = fileName;
+  ++fVersion;
+}
+
+void RockSource::SetAngleFile(const G4String& fileName)
+{
+  fAngleFile = fileName;
+  ++fVersion;
+}
+
+void RockSource::SetCells(G4int cells)
+{
+  fCells = cells;
+  ++fVersion;
+}
+
+void RockSource::SetSpatialBias(G4double bias)
+{
+  fSpatialBias = bias;
+  ++fVersion;
+}
+
+void RockSource::SetRelaxation(G4double length)
+{
+  fRelaxation = length;
+  ++fVersion;
+}
+
+void RockSource::SetAngularBias(G4double bias)
+{
+  fAngularBias = bias;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void RockSource::DefineCommands()
+{
+  fMessenger = new G4GenericMessenger(this, "/nmds/source/",
+                                      "Biased neutron source on the rock");
+
+  fMessenger->DeclareMethod("energyFile", &RockSource::SetEnergyFile,
+                            "Groups \"emin emax current\" in MeV.");
+  fMessenger->DeclareMethod("angleFile", &RockSource::SetAngleFile,
+                            "Bins \"cosmin cosmax current\" to the normal.");
+
+  auto& cellsCmd = fMessenger->DeclareMethod("cells", &RockSource::SetCells,
+                   "Cells per side of each face of the rock block.");
+  cellsCmd.SetParameterName("cells", false);
+  cellsCmd.SetRange("cells>0");
+
+  auto& spatialCmd = fMessenger->DeclareMethod("spatialBias",
+                     &RockSource::SetSpatialBias,
+                     "Share of vertices drawn by distance to the room.");
+  spatialCmd.SetParameterName("bias", false);
+  spatialCmd.SetRange("bias>=0. && bias<1.");
+
+  auto& relaxationCmd = fMessenger->DeclareMethodWithUnit("relaxation", "cm",
+                        &RockSource::SetRelaxation,
+                        "Attenuation length of the vertex bias.");
+  relaxationCmd.SetParameterName("relaxation", false);
+  relaxationCmd.SetRange("relaxation>0.");
+
+  auto& angularCmd = fMessenger->DeclareMethod("angularBias",
+                     &RockSource::SetAngularBias,
+                     "Share of directions drawn in the cone to the room.");
+  angularCmd.SetParameterName("bias", false);
+  angularCmd.SetRange("bias>=0. && bias<1.");
+
+  fMessenger->DeclareMethod("print", &RockSource::Print,
+                            "Print the source tables.");
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
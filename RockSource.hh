@@ -0,0 +1,121 @@
+#ifndef RockSource_h
+#define RockSource_h 1
+
+#include "G4VUserPrimaryGeneratorAction.hh"
+#include "globals.hh"
+#include "G4ThreeVector.hh"
+
+#include <memory>
+#include <vector>
+
+class G4Event;
+class G4GenericMessenger;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+/// Ambient neutrons entering the rock block through its outer surfaces,
+/// biased towards the room and carrying weights.
+///
+/// The natural source is a current uniform over the six faces of the rock
+/// block, with the tabulated energy spectrum and distribution of the
+/// cosine to the inward normal (cosine law by default), isotropic in
+/// azimuth. Each face is cut into cells x cells; a cell is drawn with
+/// probability (1-s) area + s area exp(-d/lambda), normalised, where d is
+/// the distance of its center to the room, and a direction from the
+/// mixture (1-b) natural + b uniform in the cone around the room seen from
+/// the vertex. The weight is the ratio of natural to biased densities of
+/// position and direction, so the expectation of every tally is that of
+/// the natural source and weights stay below 1/((1-s)(1-b)). Cells,
+/// energy groups and cosine bins are drawn from alias tables, at a fixed
+/// cost per primary; the tables are built by the first thread after any
+/// change and shared. A history stands for a unit current over the block
+/// surface: rates are tallies per history times the area printed and the
+/// current [1/(cm2 s)].
+///
+/// Spectrum files hold groups "emin emax current" in MeV, sampled flat in
+/// lethargy inside a group; angle files "cosmin cosmax current". Register
+/// RockSource on the workers as the primary generator.
+///
+///   /nmds/source/energyFile spectrum.txt
+///   /nmds/source/angleFile angles.txt
+///   /nmds/source/cells 20
+///   /nmds/source/spatialBias 0.9
+///   /nmds/source/relaxation 50 cm
+///   /nmds/source/angularBias 0.5
+///   /nmds/source/print
+
+class RockSource : public G4VUserPrimaryGeneratorAction
+{
+  public:
+    // Walker alias table: one uniform number per draw
+    struct AliasTable {
+      std::vector<G4double> probability;
+      std::vector<G4int>    alias;
+
+      void Build(const std::vector<G4double>& weights);
+      G4int Sample() const;
+    };
+
+    struct Tables {
+      G4ThreeVector rockHalf;
+      G4ThreeVector roomHalf;
+      G4int cells;
+      G4double area;                      // of the block surface
+
+      AliasTable            cell;
+      std::vector<G4double> cellWeight;   // natural / biased probability
+
+      AliasTable            energy;
+      std::vector<G4double> energyLow;
+      std::vector<G4double> energyHigh;
+
+      AliasTable            angle;
+      std::vector<G4double> cosEdges;
+      std::vector<G4double> cosDensity;   // natural density in cosine
+    };
+
+    RockSource();
+    virtual ~RockSource();
+
+    // Holds the commands
+    static RockSource* Master();
+
+    virtual void GeneratePrimaries(G4Event* event);
+
+    void Print();
+
+  private:
+    static std::shared_ptr<const Tables> GetTables();
+    static std::shared_ptr<const Tables> Build();
+    static G4bool ReadGroups(const G4String& fileName,
+                             std::vector<G4double>& low,
+                             std::vector<G4double>& high,
+                             std::vector<G4double>& value, G4double unit);
+
+    G4double NaturalDensity(const Tables& tables, G4double cosine) const;
+
+    void DefineCommands();
+    void SetEnergyFile(const G4String& fileName);
+    void SetAngleFile(const G4String& fileName);
+    void SetCells(G4int cells);
+    void SetSpatialBias(G4double bias);
+    void SetRelaxation(G4double length);
+    void SetAngularBias(G4double bias);
+
+    std::shared_ptr<const Tables> fTables;
+    G4int fTablesVersion;
+
+    G4GenericMessenger* fMessenger;
+
+    static G4String fEnergyFile;
+    static G4String fAngleFile;
+    static G4int    fCells;
+    static G4double fSpatialBias;
+    static G4double fRelaxation;
+    static G4double fAngularBias;
+    static G4int    fVersion;
+};
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+#endif
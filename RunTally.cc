@@ -0,0 +1,246 @@
+#include "RunTally.hh"
+#include "ParallelRun.hh"
+
+#include "G4AutoLock.hh"
+#include "G4ios.hh"
+
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <sstream>
+
+namespace
+{
+  G4Mutex tallyMutex = G4MUTEX_INITIALIZER;
+  std::vector<RunTally*>* workers = nullptr;
+}
+
+std::vector<std::vector<G4int> > RunTally::fOrbits;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+RunTally* RunTally::Instance()
+{
+  static G4ThreadLocal RunTally* instance = nullptr;
+  if (!instance) {
+    instance = new RunTally();
+    G4AutoLock lock(&tallyMutex);
+    if (!workers) workers = new std::vector<RunTally*>;
+    workers->push_back(instance);
+  }
+  return instance;
+}
+
+RunTally* RunTally::Master()
+{
+  static RunTally master;
+  return &master;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+RunTally::RunTally()
+ : fEvent(kNumberOfBins, 0.),
+   fSum(kNumberOfBins, 0.),
+   fSum2(kNumberOfBins, 0.),
+   fNofEvents(0),
+   fFolded(kNumberOfBins, 0)
+{
+  fTouched.reserve(kNumberOfBins);
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void RunTally::CollectWorkers()
+{
+  G4AutoLock lock(&tallyMutex);
+  if (!workers) return;
+  RunTally* master = Master();
+  for (auto worker : *workers) {
+    if (worker == master) continue;
+    master->Merge(*worker);
+    worker->Reset();
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void RunTally::AddCapture(G4int counter, G4double weight)
+{
+  G4int bin = kCounterOffset + counter;
+  if (fEvent[bin] == 0.) fTouched.push_back(bin);
+  fEvent[bin] += weight;
+  if (fEvent[kTotalBin] == 0.) fTouched.push_back(kTotalBin);
+  fEvent[kTotalBin] += weight;
+}
+
+void RunTally::AddCrossing(G4int vd, G4double weight)
+{
+  G4int bin = kVDOffset + vd;
+  if (fEvent[bin] == 0.) fTouched.push_back(bin);
+  fEvent[bin] += weight;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void RunTally::SetOrbits(const std::vector<std::vector<G4int> >& orbits)
+{
+  fOrbits = orbits;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void RunTally::Fold()
+{
+  std::size_t ntouched = fTouched.size();
+  for (std::size_t i = 0; i < ntouched; ++i) {
+    const std::vector<G4int>& orbit = fOrbits[fTouched[i]];
+    if (orbit.size() < 2 || fFolded[orbit[0]]) continue;
+
+    G4double sum = 0.;
+    for (auto bin : orbit) sum += fEvent[bin];
+    G4double mean = sum/orbit.size();
+    for (auto bin : orbit) {
+      if (fEvent[bin] == 0.) fTouched.push_back(bin);
+      fEvent[bin]  = mean;
+      fFolded[bin] = 1;
+    }
+  }
+  for (auto bin : fTouched) fFolded[bin] = 0;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void RunTally::EndOfEvent()
+{
+  if (!fOrbits.empty()) Fold();
+
+  for (auto bin : fTouched) {
+    G4double x = fEvent[bin];
+    fSum[bin]  += x;
+    fSum2[bin] += x*x;
+    fEvent[bin] = 0.;
+  }
+  fTouched.clear();
+  ++fNofEvents;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void RunTally::Reset()
+{
+  fEvent.assign(kNumberOfBins, 0.);
+  fTouched.clear();
+  fSum.assign(kNumberOfBins, 0.);
+  fSum2.assign(kNumberOfBins, 0.);
+  fNofEvents = 0;
+}
+
+void RunTally::Merge(const RunTally& other)
+{
+  for (G4int i = 0; i < kNumberOfBins; ++i) {
+    fSum[i]  += other.fSum[i];
+    fSum2[i] += other.fSum2[i];
+  }
+  fNofEvents += other.fNofEvents;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4double RunTally::GetMean(G4int bin) const
+{
+  return (fNofEvents > 0) ? fSum[bin]/fNofEvents : 0.;
+}
+
+G4double RunTally::GetRelativeError(G4int bin) const
+{
+  if (fNofEvents < 2 || fSum[bin] <= 0.) return 1.;
+  G4double n = fNofEvents;
+  G4double var = (fSum2[bin]/n - (fSum[bin]/n)*(fSum[bin]/n))/(n - 1.);
+  return (var > 0.) ? std::sqrt(var)/(fSum[bin]/n) : 0.;
+}
+
+G4String RunTally::GetBinName(G4int bin)
+{
+  std::ostringstream name;
+  if (bin == kTotalBin)       name << "CounterTotal";
+  else if (bin >= kVDOffset)  name << "VD" << bin - kVDOffset;
+  else                        name << "HeCounter" << bin - kCounterOffset;
+  return name.str();
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void RunTally::Write(std::ostream& os) const
+{
+  os << "tally " << kNumberOfBins << ' ' << fNofEvents << '\n'
+     << std::hexfloat;
+  for (G4int i = 0; i < kNumberOfBins; ++i) {
+    os << fSum[i] << ' ' << fSum2[i] << '\n';
+  }
+  os << std::defaultfloat;
+}
+
+G4bool RunTally::Read(std::istream& is)
+{
+  std::string key;
+  G4int nbins = 0;
+  G4long nevents = 0;
+  is >> key >> nbins >> nevents;
+  if (!is || key != "tally" || nbins != kNumberOfBins) return false;
+
+  std::vector<G4double> sum(nbins), sum2(nbins);
+  for (G4int i = 0; i < nbins; ++i) {
+    // operator>> does not parse hexfloat portably, go through strtod
+    std::string s1, s2;
+    is >> s1 >> s2;
+    if (!is) return false;
+    sum[i]  = std::strtod(s1.c_str(), nullptr);
+    sum2[i] = std::strtod(s2.c_str(), nullptr);
+  }
+  Reset();
+  fSum  = sum;
+  fSum2 = sum2;
+  fNofEvents = nevents;
+  return true;
+}
+
+void RunTally::Pack(std::vector<G4double>& buffer) const
+{
+  buffer.push_back(fNofEvents);
+  ParallelRun::PackVector(buffer, fSum);
+  ParallelRun::PackVector(buffer, fSum2);
+}
+
+G4bool RunTally::Unpack(const std::vector<G4double>& buffer,
+                        std::size_t& offset)
+{
+  if (offset >= buffer.size()) return false;
+  G4long nevents = (G4long)buffer[offset++];
+  if (!ParallelRun::UnpackVector(buffer, offset, fSum) ||
+      !ParallelRun::UnpackVector(buffer, offset, fSum2)) return false;
+  fNofEvents = nevents;
+  return true;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void RunTally::Print() const
+{
+  G4cout << G4endl
+         << "--------------------- Tallies per history -----------------------"
+         << G4endl
+         << " events: " << fNofEvents << G4endl;
+  for (G4int i = 0; i < kNumberOfBins; ++i) {
+    if (fSum[i] == 0.) continue;
+    G4cout << "  " << std::setw(14) << GetBinName(i)
+           << "  " << std::setw(12) << GetMean(i)
+           << "  +- " << std::setw(6) << std::setprecision(3)
+           << 100.*GetRelativeError(i) << " %" << std::setprecision(6)
+           << G4endl;
+  }
+  G4cout << "-----------------------------------------------------------------"
+         << G4endl;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
@@ -0,0 +1,86 @@
+#ifndef RunTally_h
+#define RunTally_h 1
+
+#include "globals.hh"
+#include "DetectorLayout.hh"
+
+#include <iosfwd>
+#include <vector>
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+/// Accumulated counter and VD tallies.
+///
+/// Each thread fills its own instance (Instance()); contributions are
+/// buffered during the event and added to per-history sums and sums of
+/// squares by EndOfEvent(), so that mean and relative error are available
+/// for every bin. The master copy (Master()) is obtained with
+/// CollectWorkers() once the worker threads are idle, i.e. after BeamOn().
+/// With folding on, equivalent bins are averaged before squaring, so that
+/// the errors include their correlation within a history.
+///
+/// Bins: 0..59 counter captures, 60..81 VD crossings (VD index 0..21),
+/// 82 total of all counters.
+
+class RunTally
+{
+  public:
+    static const G4int kCounterOffset = 0;
+    static const G4int kVDOffset      = DetectorLayout::kNumberOfCounters;
+    static const G4int kTotalBin      = kVDOffset + DetectorLayout::kNumberOfVD;
+    static const G4int kNumberOfBins  = kTotalBin + 1;
+
+    static RunTally* Instance();
+    static RunTally* Master();
+
+    // Merge all thread instances into the master copy and reset them
+    static void CollectWorkers();
+
+    // Filling, from the sensitive detector
+    void AddCapture(G4int counter, G4double weight);
+    void AddCrossing(G4int vd, G4double weight);
+    void EndOfEvent();
+
+    void Reset();
+    void Merge(const RunTally& other);
+
+    // Bins averaged together event by event (see DetectorSymmetry);
+    // orbits[bin] lists the bins equivalent to bin, empty for no folding
+    static void SetOrbits(const std::vector<std::vector<G4int> >& orbits);
+
+    G4long   GetNumberOfEvents() const { return fNofEvents; }
+    G4double GetSum(G4int bin)  const { return fSum[bin]; }
+    G4double GetSum2(G4int bin) const { return fSum2[bin]; }
+    G4double GetMean(G4int bin) const;
+    G4double GetRelativeError(G4int bin) const;
+
+    static G4String GetBinName(G4int bin);
+
+    // Exact (hexfloat) text representation used by checkpoints
+    void Write(std::ostream& os) const;
+    G4bool Read(std::istream& is);
+
+    // Sums as a flat buffer, for the reduction over processes (ParallelRun)
+    void Pack(std::vector<G4double>& buffer) const;
+    G4bool Unpack(const std::vector<G4double>& buffer, std::size_t& offset);
+
+    void Print() const;
+
+  private:
+    RunTally();
+
+    void Fold();
+
+    std::vector<G4double> fEvent;
+    std::vector<G4int>    fTouched;
+    std::vector<G4double> fSum;
+    std::vector<G4double> fSum2;
+    G4long                fNofEvents;
+    std::vector<char>     fFolded;
+
+    static std::vector<std::vector<G4int> > fOrbits;
+};
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+#endif
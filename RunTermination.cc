@@ -0,0 +1,157 @@
+#include "RunTermination.hh"
+#include "RunTally.hh"
+#include "ParallelRun.hh"
+
+#include "G4GenericMessenger.hh"
+#include "G4SystemOfUnits.hh"
+#include "G4ios.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+RunTermination* RunTermination::Instance()
+{
+  static RunTermination instance;
+  return &instance;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+RunTermination::RunTermination()
+ : fBins(1, RunTally::kTotalBin),
+   fStart(std::chrono::steady_clock::now()),
+   fPrevious(0.),
+   fMessenger(nullptr),
+   fPrecision(0.),
+   fWallTime(0.),
+   fMinEvents(10000)
+{
+  DefineCommands();
+}
+
+RunTermination::~RunTermination()
+{
+  delete fMessenger;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void RunTermination::Start(G4double previous)
+{
+  fStart = std::chrono::steady_clock::now();
+  fPrevious = previous;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4double RunTermination::GetElapsed() const
+{
+  std::chrono::duration<G4double> elapsed =
+    std::chrono::steady_clock::now() - fStart;
+  return fPrevious + elapsed.count();
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4int RunTermination::NextChunk(const RunTally& tally, G4int chunk,
+                                G4long remaining)
+{
+  G4long next = std::min<G4long>(chunk, remaining);
+  G4long events = tally.GetNumberOfEvents();
+  G4int processes = ParallelRun::GetSize();   // a chunk is per process
+  if (events == 0 || (fPrecision <= 0. && fWallTime <= 0.)) return next;
+
+  G4double seconds = GetElapsed();
+
+  // Worst watched bin
+  G4int worst = fBins.front();
+  for (auto bin : fBins) {
+    if (tally.GetRelativeError(bin) > tally.GetRelativeError(worst)) worst = bin;
+  }
+  G4double error = tally.GetRelativeError(worst);
+  G4double fom = (error > 0. && seconds > 0.) ? 1./(error*error*seconds) : 0.;
+  G4cout << "### " << events << " events, " << seconds << " s: worst "
+         << RunTally::GetBinName(worst) << " +- " << 100.*error
+         << " %, FOM " << fom << " /s" << G4endl;
+
+  if (fPrecision > 0. && events >= fMinEvents && error <= fPrecision) {
+    G4cout << "### Target precision " << 100.*fPrecision
+           << " % reached, production ends." << G4endl;
+    return 0;
+  }
+  if (fWallTime > 0.) {
+    G4double budget = fWallTime/s;
+    if (seconds >= budget) {
+      G4cout << "### Wall-time budget of " << budget
+             << " s spent, production ends." << G4endl;
+      return 0;
+    }
+    G4double perEvent = seconds/events;
+    if (perEvent > 0.) {
+      G4long fit = (G4long)((budget - seconds)/perEvent)/processes;
+      next = std::min(next, std::max<G4long>(fit, 1));
+    }
+  }
+  if (fPrecision > 0. && error < 1.) {
+    G4double needed = events*(error*error/(fPrecision*fPrecision) - 1.);
+    G4long wanted = std::max<G4long>((G4long)std::ceil(1.1*needed), 100);
+    wanted = std::max(wanted, fMinEvents - events)/processes + 1;
+    next = std::min(next, wanted);
+  }
+  return (G4int)next;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void RunTermination::SetTallies(const G4String& names)
+{
+  std::istringstream is(names);
+  std::string name;
+  std::vector<G4int> bins;
+  while (is >> name) {
+    G4bool found = false;
+    for (G4int bin = 0; bin < RunTally::kNumberOfBins; ++bin) {
+      G4bool counter = bin < RunTally::kVDOffset;
+      G4bool vd = bin >= RunTally::kVDOffset && bin < RunTally::kTotalBin;
+      if ((name == "counters" && counter) || (name == "vd" && vd) ||
+          name == RunTally::GetBinName(bin)) {
+        bins.push_back(bin);
+        found = true;
+      }
+    }
+    if (!found) {
+      G4ExceptionDescription msg;
+      msg << "Unknown tally " << name;
+      G4Exception("RunTermination::SetTallies()", "NMDS016", JustWarning, msg);
+      return;
+    }
+  }
+  if (!bins.empty()) fBins = bins;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void RunTermination::DefineCommands()
+{
+  fMessenger = new G4GenericMessenger(this, "/nmds/termination/",
+                                      "End of production runs on precision or time");
+
+  auto& precisionCmd = fMessenger->DeclareProperty("precision", fPrecision,
+                       "Target relative error of the watched tallies, 0 off.");
+  precisionCmd.SetParameterName("precision", false);
+  precisionCmd.SetRange("precision>=0.");
+
+  fMessenger->DeclareMethod("tallies", &RunTermination::SetTallies,
+                            "RunTally bins watched, or counters, vd.");
+
+  fMessenger->DeclarePropertyWithUnit("wallTime", "s", fWallTime,
+                                      "Wall-time budget of the run, 0 off.");
+
+  fMessenger->DeclareProperty("minEvents", fMinEvents,
+                              "Events before the precision may stop a run.");
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
@@ -0,0 +1,75 @@
+#ifndef RunTermination_h
+#define RunTermination_h 1
+
+#include "globals.hh"
+
+#include <chrono>
+#include <vector>
+
+class RunTally;
+class G4GenericMessenger;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+/// Early end of production runs, once chosen tallies reach a target
+/// relative error or the wall-time budget is spent.
+///
+/// ProductionRun asks for the size of every chunk. The chunks are the
+/// batches: after each one the thread tallies are merged, and the worst
+/// relative error of the watched bins and its figure of merit
+/// 1/(R^2 T), T the wall time of this process, are printed. A resumed
+/// production takes T and the budget on from the checkpoint, so that both
+/// cover the same events as the tallies. The run stops
+/// when the error is below the target (after a minimum number of events)
+/// or the budget is spent. Otherwise the next chunk is cut to the events
+/// the error predicts (R^2 falling as 1/N, plus 10 %) and to the events
+/// that fit in the remaining time, so that neither target overshoots by
+/// a whole chunk. The number of events of beamOn is the upper bound.
+///
+/// Only /nmds/production/beamOn and resume are watched: a plain
+/// /run/beamOn has no chunks and always runs all its events.
+///
+/// Tallies are RunTally bin names (HeCounter12, VD3, CounterTotal), or
+/// "counters" and "vd" for all bins of a kind.
+///
+///   /nmds/termination/precision 0.01
+///   /nmds/termination/tallies CounterTotal VD21
+///   /nmds/termination/wallTime 3600 s
+///   /nmds/termination/minEvents 10000
+
+class RunTermination
+{
+  public:
+    static RunTermination* Instance();
+    ~RunTermination();
+
+    // Start of the wall-time budget, after previous seconds spent by
+    // the earlier sessions of a resumed production
+    void Start(G4double previous = 0.);
+
+    // Wall time of the production so far [s]
+    G4double GetElapsed() const;
+
+    // Events of the next chunk, 0 to stop
+    G4int NextChunk(const RunTally& tally, G4int chunk, G4long remaining);
+
+  private:
+    RunTermination();
+
+    void DefineCommands();
+    void SetTallies(const G4String& names);
+
+    std::vector<G4int> fBins;
+    std::chrono::steady_clock::time_point fStart;
+    G4double fPrevious;
+
+    G4GenericMessenger* fMessenger;
+
+    G4double fPrecision;
+    G4double fWallTime;
+    G4long   fMinEvents;
+};
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+#endif
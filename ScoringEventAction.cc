@@ -0,0 +1,54 @@
+#include "ScoringEventAction.hh"
+#include "RunTally.hh"
+#include "DieAwayHistogram.hh"
+#include "FluenceMesh.hh"
+#include "ImportanceMap.hh"
+#include "PerturbationTally.hh"
+#include "RockAlbedo.hh"
+#include "CounterElectronics.hh"
+#include "StartupProfiler.hh"
+#include "EventRandom.hh"
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+ScoringEventAction::ScoringEventAction()
+ : G4UserEventAction()
+{
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+ScoringEventAction::~ScoringEventAction()
+{
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ScoringEventAction::BeginOfEventAction(const G4Event*)
+{
+  // First event of the thread ends its startup
+  StartupProfiler::Instance()->Stop();
+  EventRandom::BeginOfEvent();
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ScoringEventAction::EndOfEventAction(const G4Event*)
+{
+  RunTally::Instance()->EndOfEvent();
+  DieAwayHistogram::Instance()->EndOfEvent();
+
+  if (FluenceMesh::IsEnabled()) FluenceMesh::Instance()->EndOfEvent();
+  if (ImportanceMap::IsEnabled()) ImportanceMap::Instance()->EndOfEvent();
+  if (PerturbationTally::IsEnabled()) {
+    PerturbationTally::Instance()->EndOfEvent();
+  }
+  if (RockAlbedo::IsBuilding()) RockAlbedo::Instance()->EndOfEvent();
+  if (CounterElectronics::IsEnabled()) {
+    CounterElectronics::Instance()->EndOfEvent();
+  }
+
+  EventRandom::EndOfEvent();
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
@@ -0,0 +1,30 @@
+#ifndef ScoringEventAction_h
+#define ScoringEventAction_h 1
+
+#include "G4UserEventAction.hh"
+
+class G4Event;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+/// Event action of the scoring and run-control tools: it ends the startup
+/// profile of the thread at its first event, times the events for
+/// EventRandom, and closes the event of the per-history tallies (RunTally,
+/// DieAwayHistogram, FluenceMesh, ImportanceMap, PerturbationTally,
+/// CounterElectronics, and RockAlbedo while building). It keeps no state
+/// of its own; register it on each worker in the action initialization,
+/// next to ScoringRunAction and ScoringSteppingAction.
+
+class ScoringEventAction : public G4UserEventAction
+{
+  public:
+    ScoringEventAction();
+    virtual ~ScoringEventAction();
+
+    virtual void BeginOfEventAction(const G4Event* event);
+    virtual void EndOfEventAction(const G4Event* event);
+};
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+#endif
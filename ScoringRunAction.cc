@@ -0,0 +1,61 @@
+#include "ScoringRunAction.hh"
+#include "RunTally.hh"
+#include "DieAwayHistogram.hh"
+#include "NeutronXSCache.hh"
+#include "PerturbationTally.hh"
+#include "FluenceMesh.hh"
+#include "ImportanceMap.hh"
+#include "ThermalDiffusion.hh"
+
+#include "G4RunManager.hh"
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+ScoringRunAction::ScoringRunAction()
+ : G4UserRunAction()
+{
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+ScoringRunAction::~ScoringRunAction()
+{
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ScoringRunAction::BeginOfRunAction(const G4Run*)
+{
+  // The MT master has no events: it only builds the shared cross-section
+  // tables, before the workers start
+  G4bool useXS = NeutronXSCache::IsEnabled() || PerturbationTally::IsEnabled();
+  G4RunManager::RMType type = G4RunManager::GetRunManager()->GetRunManagerType();
+
+  // Merged tallies, set up like those of the threads
+  if (type != G4RunManager::workerRM) {
+    if (ThermalDiffusion::IsEnabled()) ThermalDiffusion::CheckScorers();
+    if (FluenceMesh::IsEnabled()) FluenceMesh::Master()->BeginOfRun();
+    if (ImportanceMap::IsEnabled()) ImportanceMap::Master()->BeginOfRun();
+    if (PerturbationTally::IsEnabled()) PerturbationTally::Master()->BeginOfRun();
+  }
+  if (type == G4RunManager::masterRM) {
+    if (useXS) NeutronXSCache::Instance()->Prepare();
+    return;
+  }
+
+  // Make sure the thread tallies exist, and are set up, before the first
+  // step, so that all events of the run are counted
+  RunTally::Instance();
+  DieAwayHistogram::Instance();
+  if (FluenceMesh::IsEnabled()) FluenceMesh::Instance()->BeginOfRun();
+  if (ImportanceMap::IsEnabled()) ImportanceMap::Instance()->BeginOfRun();
+  if (PerturbationTally::IsEnabled()) {
+    PerturbationTally::Instance()->BeginOfRun();
+  }
+
+  // Tabulated neutron cross sections, once per thread
+  if (NeutronXSCache::IsEnabled()) NeutronXSCache::Instance()->Attach();
+  else if (PerturbationTally::IsEnabled()) NeutronXSCache::Instance()->Prepare();
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
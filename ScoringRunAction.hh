@@ -0,0 +1,30 @@
+#ifndef ScoringRunAction_h
+#define ScoringRunAction_h 1
+
+#include "G4UserRunAction.hh"
+
+class G4Run;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+/// Run action of the scoring and run-control tools: at the start of each
+/// run, before any event, it creates and sets up the tallies of the
+/// thread (and the merged ones on the master), so that every event of the
+/// run is counted, and puts the tabulated neutron cross sections
+/// (NeutronXSCache) in front of the thread's data sets; on the MT master,
+/// it builds those tables before the workers start. Register it on each
+/// worker in the action initialization, next to ScoringEventAction, and
+/// on the master (BuildForMaster).
+
+class ScoringRunAction : public G4UserRunAction
+{
+  public:
+    ScoringRunAction();
+    virtual ~ScoringRunAction();
+
+    virtual void BeginOfRunAction(const G4Run* run);
+};
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+#endif
@@ -0,0 +1,46 @@
+#include "ScoringSteppingAction.hh"
+#include "VolumeProfiler.hh"
+#include "FluenceMesh.hh"
+#include "NavigationStats.hh"
+#include "ImportanceMap.hh"
+#include "PerturbationTally.hh"
+#include "Benchmark.hh"
+#include "RockAlbedo.hh"
+#include "ThermalDiffusion.hh"
+
+#include "G4Step.hh"
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+ScoringSteppingAction::ScoringSteppingAction()
+ : G4UserSteppingAction()
+{
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+ScoringSteppingAction::~ScoringSteppingAction()
+{
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ScoringSteppingAction::UserSteppingAction(const G4Step* step)
+{
+  if (VolumeProfiler::IsEnabled()) VolumeProfiler::Instance()->Step(step);
+  if (FluenceMesh::IsEnabled()) FluenceMesh::Instance()->Step(step);
+  if (NavigationStats::IsEnabled()) NavigationStats::Instance()->Step(step);
+  if (ImportanceMap::IsEnabled()) ImportanceMap::Instance()->Step(step);
+  if (PerturbationTally::IsEnabled()) PerturbationTally::Instance()->Step(step);
+  if (Benchmark::IsRunning()) Benchmark::CountStep();
+
+  // Last: they move the track (back into the room, across the moderator)
+  if (RockAlbedo::IsEnabled() || RockAlbedo::IsBuilding()) {
+    RockAlbedo::Instance()->Step(step);
+  }
+  if (ThermalDiffusion::IsEnabled() || ThermalDiffusion::IsCalibrating()) {
+    ThermalDiffusion::Instance()->Step(step);
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
@@ -0,0 +1,28 @@
+#ifndef ScoringSteppingAction_h
+#define ScoringSteppingAction_h 1
+
+#include "G4UserSteppingAction.hh"
+
+class G4Step;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+/// Stepping action forwarding every step to the enabled step-level tools
+/// (VolumeProfiler, FluenceMesh, NavigationStats, ImportanceMap,
+/// PerturbationTally, then RockAlbedo and ThermalDiffusion) and counting
+/// the steps of Benchmark runs. It keeps no state of its own; register it
+/// on each worker in the action initialization, next to the application
+/// stepping action if any (G4MultiSteppingAction).
+
+class ScoringSteppingAction : public G4UserSteppingAction
+{
+  public:
+    ScoringSteppingAction();
+    virtual ~ScoringSteppingAction();
+
+    virtual void UserSteppingAction(const G4Step* step);
+};
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+#endif
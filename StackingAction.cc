@@ -0,0 +1,184 @@
+#include "StackingAction.hh"
+#include "PrimaryFilter.hh"
+#include "ImportanceMap.hh"
+#include "PerturbationTally.hh"
+#include "DetectorLayout.hh"
+
+#include "G4Track.hh"
+#include "G4Neutron.hh"
+#include "G4VPhysicalVolume.hh"
+#include "G4LogicalVolume.hh"
+#include "G4Material.hh"
+#include "G4StackManager.hh"
+#include "G4GenericMessenger.hh"
+
+#include <algorithm>
+#include <cmath>
+
+G4bool              StackingAction::fGrouped   = false;
+G4GenericMessenger* StackingAction::fMessenger = nullptr;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+StackingAction::StackingAction()
+ : G4UserStackingAction(),
+   fStage(0),
+   fMaterials(0),
+   fReclassifying(false)
+{
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+StackingAction::~StackingAction()
+{
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4ClassificationOfNewTrack
+StackingAction::ClassifyNewTrack(const G4Track* track)
+{
+  // Waiting tracks made urgent by the kernel, already classified once
+  if (fReclassifying) return Stack(track);
+
+  if (track->GetParentID() == 0 && PrimaryFilter::IsEnabled()) {
+    G4double factor = PrimaryFilter::Instance()->Test(track->GetPosition(),
+                                                      track->GetMomentumDirection(),
+                                                      track->GetWeight());
+    if (factor == 0.) return fKill;
+
+    // The stack owns the track until it is tracked
+    if (factor != 1.) {
+      const_cast<G4Track*>(track)->SetWeight(track->GetWeight()*factor);
+    }
+  }
+
+  if (track->GetParentID() > 0 && ImportanceMap::IsEnabled()) {
+    ImportanceMap::Instance()->NewTrack(track);
+  }
+  if (track->GetParentID() > 0 && PerturbationTally::IsEnabled()) {
+    PerturbationTally::Instance()->NewTrack(track);
+  }
+
+  if (fGrouped && track->GetParentID() > 0) return Stack(track);
+  return fUrgent;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void StackingAction::NewStage()
+{
+  // The kernel has made all waiting tracks urgent: keep the first stage
+  // that has tracks, send the others back
+  G4int nofStages = (G4int)fPending.size();
+  for (;;) {
+    G4int next = kBox*fMaterials;
+    while (next < nofStages && fPending[next] == 0) ++next;
+
+    // Nothing counted: all the waiting tracks stay urgent
+    if (next == nofStages) return;
+
+    fStage = next;
+    G4int before = fPending[next];
+    fReclassifying = true;
+    stackManager->ReClassify();
+    fReclassifying = false;
+    if (fPending[next] < before) return;
+
+    // Count out of step with the stack (aborted tracks): never loop on it
+    fPending[next] = 0;
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void StackingAction::PrepareNewEvent()
+{
+  // The kernel ends an event when the urgent and waiting stacks are both
+  // empty; anything still waiting here was never tracked
+  G4int left = stackManager->GetNWaitingTrack();
+  if (left > 0) {
+    G4ExceptionDescription msg;
+    msg << left << " tracks were still waiting at the end of the previous"
+        << " event and were not tracked";
+    G4Exception("StackingAction::PrepareNewEvent()", "NMDS024",
+                JustWarning, msg);
+  }
+
+  // Materials may have been added since the last event (CounterGas)
+  fMaterials = (G4int)G4Material::GetNumberOfMaterials() + 1;
+  fStage = 0;
+  fPending.assign(kNumberOfGroups*fMaterials, 0);
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+StackingAction::Group StackingAction::GetGroup(const G4Track* track) const
+{
+  auto layout = DetectorLayout::Instance();
+
+  // Secondaries carry the touchable of their creation point
+  const G4VPhysicalVolume* pv = track->GetVolume();
+  DetectorLayout::VolumeRole role =
+    pv ? layout->GetRole(pv->GetLogicalVolume()) : DetectorLayout::kOther;
+
+  if (role == DetectorLayout::kRock) return kRock;
+  if (role == DetectorLayout::kTarget) return kTarget;
+
+  G4ThreeVector local = track->GetPosition() - layout->GetBoxCenter();
+  G4double half = layout->GetBoxHalf();
+  G4bool inBox = std::fabs(local.x()) <= half && std::fabs(local.y()) <= half &&
+                 std::fabs(local.z()) <= half;
+  if (inBox) {
+    return (track->GetDefinition() == G4Neutron::Definition())
+           ? kModeratorNeutrons : kBox;
+  }
+  return kElsewhere;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4int StackingAction::GetStage(const G4Track* track) const
+{
+  // The last index of a group is for volumes without a material
+  G4int material = fMaterials - 1;
+  const G4VPhysicalVolume* pv = track->GetVolume();
+  if (pv && pv->GetLogicalVolume()->GetMaterial()) {
+    const G4Material* m = pv->GetLogicalVolume()->GetMaterial();
+    if (m->GetBaseMaterial()) m = m->GetBaseMaterial();
+    material = std::min((G4int)m->GetIndex(), fMaterials - 1);
+  }
+  return GetGroup(track)*fMaterials + material;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4ClassificationOfNewTrack StackingAction::Stack(const G4Track* track)
+{
+  // Moderator neutrons are tracked now, the other stages wait. When
+  // NewStage() reclassifies the waiting tracks, those of the current stage
+  // become urgent and leave the count of their stage
+  G4int stage = GetStage(track);
+  if (fReclassifying) {
+    if (stage != fStage) return fWaiting;
+    --fPending[stage];
+    return fUrgent;
+  }
+  if (stage < kBox*fMaterials) return fUrgent;
+  ++fPending[stage];
+  return fWaiting;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void StackingAction::DefineCommands()
+{
+  if (fMessenger) return;
+  fMessenger = new G4GenericMessenger(nullptr, "/nmds/stacking/",
+                                      "Order of the secondary tracks");
+  fMessenger->DeclareProperty("group", fGrouped,
+                              "Stack secondaries by volume, moderator first.");
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
@@ -0,0 +1,74 @@
+#ifndef StackingAction_h
+#define StackingAction_h 1
+
+#include "G4UserStackingAction.hh"
+#include "globals.hh"
+
+#include <vector>
+
+class G4Track;
+class G4GenericMessenger;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+/// Stacking action of the run-control tools: primaries go through
+/// PrimaryFilter before they are tracked, and secondaries are linked to
+/// their parent for ImportanceMap and PerturbationTally. Register it on
+/// each worker in the action initialization.
+///
+/// With grouping on, secondaries are stacked by the role of the volume
+/// they start in (DetectorLayout) and by its material instead of one LIFO
+/// stack, so that consecutive tracks share their material data: neutrons
+/// inside the moderator box are tracked first (urgent), then, stage by
+/// stage, the other tracks in the box, in the lead target, in the rock,
+/// and elsewhere, each split by material (polyethylene apart from the
+/// counter gas, air apart from the walls). Derived materials go with
+/// their base material, since they share its tables (CounterGas fills).
+/// All later stages wait in the one waiting stack; at each new stage the
+/// kernel makes them urgent and NewStage() sends back all but the first
+/// stage that has tracks, so an empty stage never ends the event early. Tracks created during a stage are stacked
+/// the same way, so moderator neutrons always come next. A warning is
+/// given if an event ever ends with tracks still waiting. Results change
+/// within statistics only (the random sequence follows the track order);
+/// Benchmark records the mode for comparisons.
+///
+///   /nmds/stacking/group true
+
+class StackingAction : public G4UserStackingAction
+{
+  public:
+    StackingAction();
+    virtual ~StackingAction();
+
+    virtual G4ClassificationOfNewTrack ClassifyNewTrack(const G4Track* track);
+    virtual void NewStage();
+    virtual void PrepareNewEvent();
+
+    static G4bool IsGrouped() { return fGrouped; }
+
+    // Commands, created once on the master by DetectorConstruction
+    static void DefineCommands();
+
+  private:
+    // Stacking groups, in tracking order
+    enum Group { kModeratorNeutrons = 0, kBox, kTarget, kRock, kElsewhere,
+                 kNumberOfGroups };
+
+    Group GetGroup(const G4Track* track) const;
+
+    // Group and material of the starting volume, as one index
+    G4int GetStage(const G4Track* track) const;
+    G4ClassificationOfNewTrack Stack(const G4Track* track);
+
+    G4int              fStage;      // stage being tracked
+    std::vector<G4int> fPending;    // tracks waiting, per stage
+    G4int              fMaterials;  // materials per group
+    G4bool             fReclassifying;
+
+    static G4bool              fGrouped;
+    static G4GenericMessenger* fMessenger;
+};
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+#endif
@@ -0,0 +1,112 @@
+#include "StartupProfiler.hh"
+
+#include "G4Material.hh"
+#include "G4AutoLock.hh"
+#include "G4GenericMessenger.hh"
+#include "G4ios.hh"
+
+#include <iomanip>
+
+namespace
+{
+  G4Mutex startupMutex = G4MUTEX_INITIALIZER;
+
+  // Current phase of each thread
+  G4ThreadLocal G4String* current = nullptr;
+  G4ThreadLocal std::chrono::steady_clock::time_point* started = nullptr;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+StartupProfiler* StartupProfiler::Instance()
+{
+  static StartupProfiler instance;
+  return &instance;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+StartupProfiler::StartupProfiler()
+ : fCreated(std::chrono::steady_clock::now()),
+   fMessenger(nullptr)
+{
+  fMessenger = new G4GenericMessenger(this, "/nmds/startup/",
+                                      "Startup phases");
+  fMessenger->DeclareMethod("print", &StartupProfiler::Print,
+                            "Print the wall time of the startup phases.");
+  fMessenger->DeclareMethod("printMaterials", &StartupProfiler::PrintMaterials,
+                            "Print the material table.");
+}
+
+StartupProfiler::~StartupProfiler()
+{
+  delete fMessenger;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void StartupProfiler::Start(const G4String& phase)
+{
+  Stop();
+  if (!current) {
+    current = new G4String;
+    started = new std::chrono::steady_clock::time_point;
+  }
+  *current = phase;
+  *started = std::chrono::steady_clock::now();
+}
+
+void StartupProfiler::Stop()
+{
+  if (!current || current->empty()) return;
+  std::chrono::duration<G4double> elapsed =
+    std::chrono::steady_clock::now() - *started;
+
+  G4AutoLock lock(&startupMutex);
+  auto it = fPhases.find(*current);
+  if (it == fPhases.end()) {
+    fOrder.push_back(*current);
+    it = fPhases.insert(std::make_pair(*current, Phase())).first;
+  }
+  Phase& phase = it->second;
+  ++phase.calls;
+  phase.total += elapsed.count();
+  phase.max = std::max(phase.max, elapsed.count());
+  current->clear();
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void StartupProfiler::Print() const
+{
+  G4AutoLock lock(&startupMutex);
+  std::chrono::duration<G4double> sinceStart =
+    std::chrono::steady_clock::now() - fCreated;
+
+  G4cout << G4endl
+         << "------------------------- Startup phases -------------------------"
+         << G4endl
+         << "  phase                                  calls  total [s]    max [s]"
+         << G4endl;
+  for (const auto& name : fOrder) {
+    const Phase& phase = fPhases.at(name);
+    G4cout << "  " << std::left << std::setw(38) << name << std::right
+           << std::setw(6) << phase.calls
+           << std::setw(11) << std::setprecision(4) << phase.total
+           << std::setw(11) << phase.max
+           << std::setprecision(6) << G4endl;
+  }
+  G4cout << "  " << sinceStart.count() << " s since the detector construction"
+         << G4endl
+         << "-----------------------------------------------------------------"
+         << G4endl;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void StartupProfiler::PrintMaterials() const
+{
+  G4cout << *(G4Material::GetMaterialTable()) << G4endl;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
@@ -0,0 +1,59 @@
+#ifndef StartupProfiler_h
+#define StartupProfiler_h 1
+
+#include "globals.hh"
+
+#include <chrono>
+#include <map>
+#include <vector>
+
+class G4GenericMessenger;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+/// Wall time of the phases before the first event.
+///
+/// Each thread runs at most one phase at a time: Start() ends the current
+/// phase of the calling thread and begins the next one, Stop() ends it.
+/// DetectorConstruction marks material definition, the blocks of
+/// DefineVolumes() and the sensitive detector and field setup; the phase
+/// that follows, up to the first event of the thread, covers what the
+/// kernel does in between (physics tables, geometry closing and voxel
+/// optimisation). Phases of the same name on several threads are summed,
+/// with their maximum shown as well.
+///
+///   /nmds/startup/print
+///   /nmds/startup/printMaterials
+
+class StartupProfiler
+{
+  public:
+    static StartupProfiler* Instance();
+
+    void Start(const G4String& phase);
+    void Stop();
+
+    void Print() const;
+    void PrintMaterials() const;
+
+  private:
+    struct Phase {
+      Phase() : calls(0), total(0.), max(0.) {}
+      G4int    calls;
+      G4double total;
+      G4double max;
+    };
+
+    StartupProfiler();
+    ~StartupProfiler();
+
+    std::map<G4String, Phase> fPhases;
+    std::vector<G4String>     fOrder;
+    std::chrono::steady_clock::time_point fCreated;
+
+    G4GenericMessenger* fMessenger;
+};
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+#endif
@@ -0,0 +1,72 @@
+#include "TallySD.hh"
+#include "RunTally.hh"
+#include "DieAwayHistogram.hh"
+#include "DetectorLayout.hh"
+#include "ImportanceMap.hh"
+#include "PerturbationTally.hh"
+#include "CounterElectronics.hh"
+
+#include "G4Step.hh"
+#include "G4Track.hh"
+#include "G4VProcess.hh"
+#include "G4Neutron.hh"
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+TallySD::TallySD(const G4String& name)
+ : G4VSensitiveDetector(name)
+{
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+TallySD::~TallySD()
+{
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4bool TallySD::ProcessHits(G4Step* step, G4TouchableHistory*)
+{
+  const G4Track* track = step->GetTrack();
+  if (track->GetDefinition() != G4Neutron::Definition()) return false;
+
+  auto layout = DetectorLayout::Instance();
+  const G4StepPoint* prePoint = step->GetPreStepPoint();
+  const G4VPhysicalVolume* pv = prePoint->GetPhysicalVolume();
+
+  // Neutron entering a VD plane or the target
+  G4int vd = layout->GetVDIndex(pv);
+  if (vd >= 0) {
+    if (prePoint->GetStepStatus() != fGeomBoundary) return false;
+    RunTally::Instance()->AddCrossing(vd, track->GetWeight());
+    return true;
+  }
+
+  // Neutron absorbed in the counter gas
+  G4int counter = layout->GetCounterIndex(pv);
+  if (counter < 0) return false;
+  if (track->GetTrackStatus() != fStopAndKill) return false;
+  const G4VProcess* process = step->GetPostStepPoint()->GetProcessDefinedStep();
+  if (!process || process->GetProcessType() == fTransportation) return false;
+
+  RunTally::Instance()->AddCapture(counter, track->GetWeight());
+  DieAwayHistogram::Instance()->Fill(counter,
+                                     step->GetPostStepPoint()->GetGlobalTime(),
+                                     prePoint->GetKineticEnergy(),
+                                     track->GetWeight());
+  if (CounterElectronics::IsEnabled()) {
+    G4double time = step->GetPostStepPoint()->GetGlobalTime();
+    CounterElectronics::Instance()->Fill(counter, time, track->GetWeight());
+  }
+  if (ImportanceMap::IsEnabled()) {
+    ImportanceMap::Instance()->Score(counter, track->GetTrackID(),
+                                     track->GetWeight());
+  }
+  if (PerturbationTally::IsEnabled()) {
+    PerturbationTally::Instance()->Score(counter, step);
+  }
+  return true;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
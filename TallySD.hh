@@ -0,0 +1,30 @@
+#ifndef TallySD_h
+#define TallySD_h 1
+
+#include "G4VSensitiveDetector.hh"
+
+class G4Step;
+class G4TouchableHistory;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+/// Sensitive detector of the He-3 counters, the VD planes and the target.
+///
+/// Neutron captures in the counter gas and neutron entries into the VD
+/// volumes are scored, with the track weight, into the RunTally of the
+/// current thread; captures also feed the DieAwayHistogram and the
+/// capture-level tools. ScoringEventAction closes the events. No hits
+/// collection is produced.
+
+class TallySD : public G4VSensitiveDetector
+{
+  public:
+    TallySD(const G4String& name);
+    virtual ~TallySD();
+
+    virtual G4bool ProcessHits(G4Step* step, G4TouchableHistory* history);
+};
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+#endif
@@ -0,0 +1,557 @@
+#include "ThermalDiffusion.hh"
+#include "DetectorLayout.hh"
+#include "RunTally.hh"
+#include "DieAwayHistogram.hh"
+#include "FluenceMesh.hh"
+#include "ImportanceMap.hh"
+
+#include "G4RunManager.hh"
+#include "G4Step.hh"
+#include "G4Track.hh"
+#include "G4Neutron.hh"
+#include "G4VPhysicalVolume.hh"
+#include "G4LogicalVolume.hh"
+#include "G4Material.hh"
+#include "G4Navigator.hh"
+#include "G4TransportationManager.hh"
+#include "G4AutoLock.hh"
+#include "G4GenericMessenger.hh"
+#include "G4PhysicalConstants.hh"
+#include "G4SystemOfUnits.hh"
+#include "Randomize.hh"
+#include "G4ios.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+namespace
+{
+  G4Mutex diffusionMutex = G4MUTEX_INITIALIZER;
+  std::vector<ThermalDiffusion*>* workers = nullptr;
+
+  const G4double kDieAwayStart = 10.*us;
+
+  G4bool IsModerator(const G4VPhysicalVolume* pv)
+  {
+    return pv && DetectorLayout::Instance()->GetRole(pv->GetLogicalVolume())
+                 == DetectorLayout::kModerator;
+  }
+
+  G4ThreeVector Isotropic()
+  {
+    G4double cosTheta = 2.*G4UniformRand() - 1.;
+    G4double sinTheta = std::sqrt(1. - cosTheta*cosTheta);
+    G4double phi = twopi*G4UniformRand();
+    return G4ThreeVector(sinTheta*std::cos(phi), sinTheta*std::sin(phi),
+                         cosTheta);
+  }
+
+  // Mean capture time, and mean time after kDieAwayStart beyond it
+  void DieAway(G4double& mean, G4double& tail)
+  {
+    const DieAwayHistogram* histogram = DieAwayHistogram::Master();
+    G4double sum = 0., sumTime = 0., late = 0., lateTime = 0.;
+    for (G4int c = 0; c < DieAwayHistogram::kNofCounters; ++c) {
+      for (G4int i = 0; i < DieAwayHistogram::kTimeBins; ++i) {
+        G4double count = histogram->GetTimeCount(c, i);
+        G4double time = std::sqrt(DieAwayHistogram::GetTimeEdge(i)
+                                  *DieAwayHistogram::GetTimeEdge(i + 1));
+        sum += count;
+        sumTime += count*time;
+        if (time > kDieAwayStart) {
+          late += count;
+          lateTime += count*(time - kDieAwayStart);
+        }
+      }
+    }
+    mean = (sum > 0.) ? sumTime/sum : 0.;
+    tail = (late > 0.) ? lateTime/late : 0.;
+  }
+}
+
+G4bool   ThermalDiffusion::fEnabled     = false;
+G4bool   ThermalDiffusion::fCalibrating = false;
+G4double ThermalDiffusion::fThermal     = 0.1*eV;
+G4double ThermalDiffusion::fMargin      = 1.*cm;
+G4double ThermalDiffusion::fMinRadius   = 2.*cm;
+G4String ThermalDiffusion::fFileName    = "diffusion.txt";
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+ThermalDiffusion* ThermalDiffusion::Instance()
+{
+  static G4ThreadLocal ThermalDiffusion* instance = nullptr;
+  if (!instance) {
+    instance = new ThermalDiffusion(false);
+    G4AutoLock lock(&diffusionMutex);
+    if (!workers) workers = new std::vector<ThermalDiffusion*>;
+    workers->push_back(instance);
+  }
+  return instance;
+}
+
+ThermalDiffusion* ThermalDiffusion::Master()
+{
+  static ThermalDiffusion master(true);
+  return &master;
+}
+
+void ThermalDiffusion::CollectWorkers()
+{
+  G4AutoLock lock(&diffusionMutex);
+  if (!workers) return;
+  ThermalDiffusion* master = Master();
+  for (auto worker : *workers) {
+    master->Merge(*worker);
+    worker->Reset();
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+ThermalDiffusion::ThermalDiffusion(G4bool master)
+ : fLastTrack(-1),
+   fWalks(0),
+   fAbsorbed(0),
+   fDistance(0.),
+   fMessenger(nullptr)
+{
+  if (master) DefineCommands();
+}
+
+ThermalDiffusion::~ThermalDiffusion()
+{
+  delete fMessenger;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ThermalDiffusion::Step(const G4Step* step)
+{
+  const G4Track* track = step->GetTrack();
+  if (track->GetDefinition() != G4Neutron::Definition()) return;
+
+  if (fCalibrating) {
+    Calibrate(step);
+    return;
+  }
+
+  G4StepPoint* post = step->GetPostStepPoint();
+  if (track->GetTrackStatus() != fAlive) return;
+  if (post->GetStepStatus() == fGeomBoundary) return;
+  if (post->GetKineticEnergy() >= fThermal) return;
+  if (!IsModerator(post->GetPhysicalVolume())) return;
+
+  // Tables of the master, read only during runs
+  const ThermalDiffusion* master = Master();
+  auto found = master->fParameters.find(post->GetMaterial()->GetName());
+  if (found != master->fParameters.end()) Walk(step, found->second);
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ThermalDiffusion::Calibrate(const G4Step* step)
+{
+  G4StepPoint* pre = step->GetPreStepPoint();
+  G4StepPoint* post = step->GetPostStepPoint();
+  const G4Track* track = step->GetTrack();
+
+  if (pre->GetKineticEnergy() >= fThermal ||
+      !IsModerator(pre->GetPhysicalVolume())) {
+    fLastTrack = -1;
+    return;
+  }
+
+  Sums& sums = fSums[pre->GetMaterial()];
+  G4double weight = pre->GetWeight();
+  G4double duration = post->GetGlobalTime() - pre->GetGlobalTime();
+  sums.exposure += weight*duration;
+  if (track->GetTrackStatus() == fStopAndKill &&
+      post->GetStepStatus() != fGeomBoundary) sums.absorbed += weight;
+
+  // Free flights from one collision to the next
+  G4bool complete = pre->GetStepStatus() != fGeomBoundary &&
+                    post->GetStepStatus() != fGeomBoundary &&
+                    track->GetCurrentStepNumber() > 1;
+  if (!complete) {
+    fLastTrack = -1;
+    return;
+  }
+
+  G4double length = step->GetStepLength();
+  sums.weight  += weight;
+  sums.length  += weight*length;
+  sums.length2 += weight*length*length;
+  sums.time    += weight*duration;
+
+  const G4ThreeVector& direction = pre->GetMomentumDirection();
+  if (fLastTrack == track->GetTrackID()) {
+    sums.pairs  += weight;
+    sums.cosine += weight*direction.dot(fLastDirection);
+  }
+  fLastTrack = track->GetTrackID();
+  fLastDirection = direction;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ThermalDiffusion::Walk(const G4Step* step, const Parameters& parameters)
+{
+  G4StepPoint* post = step->GetPostStepPoint();
+  G4Track* track = step->GetTrack();
+
+  // The tracking navigator is located at the post-step point
+  G4Navigator* navigator = G4TransportationManager::GetTransportationManager()
+                             ->GetNavigatorForTracking();
+  G4ThreeVector position = post->GetPosition();
+  G4double radius = navigator->ComputeSafety(position, DBL_MAX, true) - fMargin;
+  if (radius < fMinRadius) return;
+
+  G4double time = SampleFirstPassage()*radius*radius/parameters.kappa;
+  if (G4UniformRand() >= std::exp(-parameters.absorption*time)) {
+    track->SetTrackStatus(fStopAndKill);
+    ++fAbsorbed;
+    return;
+  }
+
+  // Maxwellian density: kT times a Gamma(3/2) variate
+  G4double kT = k_Boltzmann*post->GetMaterial()->GetTemperature();
+  G4double gauss = G4RandGauss::shoot(0., 1.);
+  G4double energy = kT*(-std::log(G4UniformRand()) + 0.5*gauss*gauss);
+
+  G4ThreeVector newPosition = position + radius*Isotropic();
+  G4ThreeVector direction = Isotropic();
+
+  track->SetPosition(newPosition);
+  track->SetKineticEnergy(energy);
+  track->SetMomentumDirection(direction);
+  track->SetGlobalTime(track->GetGlobalTime() + time);
+  track->SetLocalTime(track->GetLocalTime() + time);
+  post->SetPosition(newPosition);
+  post->SetKineticEnergy(energy);
+  post->SetMomentumDirection(direction);
+  post->SetGlobalTime(post->GetGlobalTime() + time);
+  post->SetLocalTime(post->GetLocalTime() + time);
+  post->SetVelocity(track->CalculateVelocity());
+  navigator->LocateGlobalPointWithinVolume(newPosition);
+
+  ++fWalks;
+  fDistance += radius;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+// First-passage time of diffusion from the centre of a unit sphere at
+// unit diffusivity: survival S(tau) = 2 sum (-1)^(n+1) exp(-n2 pi2 tau)
+G4double ThermalDiffusion::SampleFirstPassage()
+{
+  static const G4int kPoints = 4000;
+  static const G4double kTauMax = 2.;
+  static const std::vector<G4double> cdf = [] {
+    std::vector<G4double> table(kPoints + 1, 0.);
+    for (G4int i = 1; i <= kPoints; ++i) {
+      G4double tau = kTauMax*i/kPoints;
+      if (tau < 2.e-3) continue;   // below 1e-50
+      G4double survival = 0.;
+      for (G4int n = 1; n <= 400; ++n) {
+        G4double term = 2.*std::exp(-n*n*pi*pi*tau);
+        survival += (n%2) ? term : -term;
+      }
+      table[i] = std::min(1., std::max(table[i - 1], 1. - survival));
+    }
+    return table;
+  }();
+
+  G4double u = G4UniformRand()*cdf.back();
+  G4int i = (G4int)(std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin());
+  if (i == 0) return 0.;
+  G4double width = cdf[i] - cdf[i - 1];
+  G4double fraction = (width > 0.) ? (u - cdf[i - 1])/width : 0.;
+  return kTauMax*(i - 1 + fraction)/kPoints;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ThermalDiffusion::Reset()
+{
+  fSums.clear();
+  fLastTrack = -1;
+  fWalks = 0;
+  fAbsorbed = 0;
+  fDistance = 0.;
+}
+
+void ThermalDiffusion::Merge(const ThermalDiffusion& other)
+{
+  for (auto& entry : other.fSums) {
+    Sums& sums = fSums[entry.first];
+    const Sums& add = entry.second;
+    sums.weight   += add.weight;
+    sums.length   += add.length;
+    sums.length2  += add.length2;
+    sums.time     += add.time;
+    sums.pairs    += add.pairs;
+    sums.cosine   += add.cosine;
+    sums.exposure += add.exposure;
+    sums.absorbed += add.absorbed;
+  }
+  fWalks    += other.fWalks;
+  fAbsorbed += other.fAbsorbed;
+  fDistance += other.fDistance;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ThermalDiffusion::Save(const G4String& fileName)
+{
+  // Parameters from the calibration sums collected so far
+  CollectWorkers();
+  for (auto& entry : fSums) {
+    const Sums& sums = entry.second;
+    if (sums.weight <= 0. || sums.exposure <= 0.) continue;
+    G4double length  = sums.length/sums.weight;
+    G4double length2 = sums.length2/sums.weight;
+    G4double time    = sums.time/sums.weight;
+    G4double mu = (sums.pairs > 0.) ? sums.cosine/sums.pairs : 0.;
+    Parameters& parameters = fParameters[entry.first->GetName()];
+    parameters.kappa = (length2 + 2.*length*length*mu/(1. - mu))/(6.*time);
+    parameters.absorption = sums.absorbed/sums.exposure;
+    parameters.flights = sums.weight;
+  }
+
+  std::ofstream out(fileName);
+  if (!out) {
+    G4ExceptionDescription msg;
+    msg << "Cannot write the diffusion parameters to " << fileName;
+    G4Exception("ThermalDiffusion::Save()", "NMDS021", JustWarning, msg);
+    return;
+  }
+  out << "# material  kappa[cm2/s]  absorption[1/s]  flights  thermal[eV]\n"
+      << std::setprecision(10);
+  for (auto& entry : fParameters) {
+    out << entry.first << ' ' << entry.second.kappa/(cm2/s) << ' '
+        << entry.second.absorption*s << ' ' << entry.second.flights << ' '
+        << fThermal/eV << '\n';
+  }
+  fFileName = fileName;
+  Print();
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4bool ThermalDiffusion::Load(const G4String& fileName)
+{
+  std::ifstream in(fileName);
+  if (!in) {
+    G4ExceptionDescription msg;
+    msg << "Cannot read diffusion parameters from " << fileName
+        << "; calibrate first (/nmds/diffusion/calibrate)";
+    G4Exception("ThermalDiffusion::Load()", "NMDS021", JustWarning, msg);
+    return false;
+  }
+
+  std::map<G4String, Parameters> loaded;
+  std::string line;
+  while (std::getline(in, line)) {
+    std::size_t hash = line.find('#');
+    if (hash != std::string::npos) line.erase(hash);
+    std::istringstream is(line);
+    std::string name;
+    G4double kappa = 0., absorption = 0., flights = 0., thermal = 0.;
+    if (!(is >> name >> kappa >> absorption >> flights >> thermal)) continue;
+    if (std::fabs(thermal*eV - fThermal) > 1.e-6*fThermal) {
+      G4ExceptionDescription msg;
+      msg << fileName << ": " << name << " was calibrated below "
+          << thermal << " eV, not " << fThermal/eV << " eV";
+      G4Exception("ThermalDiffusion::Load()", "NMDS021", JustWarning, msg);
+    }
+    Parameters& parameters = loaded[name];
+    parameters.kappa = kappa*cm2/s;
+    parameters.absorption = absorption/s;
+    parameters.flights = flights;
+  }
+  if (loaded.empty()) {
+    G4ExceptionDescription msg;
+    msg << "No diffusion parameters in " << fileName;
+    G4Exception("ThermalDiffusion::Load()", "NMDS021", JustWarning, msg);
+    return false;
+  }
+  fParameters.swap(loaded);
+  fFileName = fileName;
+  return true;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ThermalDiffusion::Validate(G4int nofEvents)
+{
+  auto runManager = G4RunManager::GetRunManager();
+  if (!DetectorLayout::Instance()->IsClosed()) runManager->Initialize();
+  if (fParameters.empty() && !Load(fFileName)) return;
+
+  std::vector<G4double> mean[2], error[2];
+  G4double seconds[2] = { 0., 0. };
+  G4double meanTime[2] = { 0., 0. }, dieAway[2] = { 0., 0. };
+  G4long walks = 0;
+  G4bool enabled = fEnabled, calibrating = fCalibrating;
+  fCalibrating = false;
+
+  for (G4int pass = 0; pass < 2; ++pass) {
+    fEnabled = (pass == 1);
+    RunTally::CollectWorkers();
+    RunTally::Master()->Reset();
+    DieAwayHistogram::CollectWorkers();
+    DieAwayHistogram::Master()->Reset();
+    CollectWorkers();
+    fWalks = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    runManager->BeamOn(nofEvents);
+    std::chrono::duration<G4double> elapsed =
+      std::chrono::steady_clock::now() - start;
+    seconds[pass] = elapsed.count();
+
+    RunTally::CollectWorkers();
+    DieAwayHistogram::CollectWorkers();
+    CollectWorkers();
+    if (pass == 1) walks = fWalks;
+    const RunTally* tally = RunTally::Master();
+    for (G4int bin = 0; bin < RunTally::kNumberOfBins; ++bin) {
+      mean[pass].push_back(tally->GetMean(bin));
+      error[pass].push_back(tally->GetRelativeError(bin)*tally->GetMean(bin));
+    }
+    DieAway(meanTime[pass], dieAway[pass]);
+  }
+  fEnabled = enabled;
+  fCalibrating = calibrating;
+  RunTally::Master()->Reset();
+  DieAwayHistogram::Master()->Reset();
+
+  G4cout << "### Diffusion validation, " << nofEvents << " events: analog "
+         << seconds[0] << " s, random walk " << seconds[1] << " s (speed-up "
+         << (seconds[1] > 0. ? seconds[0]/seconds[1] : 0.) << "), "
+         << walks << " walk steps" << G4endl;
+  G4cout << "    mean capture time " << meanTime[0]/us << " us analog, "
+         << meanTime[1]/us << " us walk; die-away after "
+         << kDieAwayStart/us << " us " << dieAway[0]/us << " us analog, "
+         << dieAway[1]/us << " us walk" << G4endl;
+  G4cout << std::setw(14) << "bin" << std::setw(14) << "analog"
+         << std::setw(12) << "+-" << std::setw(14) << "walk"
+         << std::setw(12) << "+-" << std::setw(10) << "ratio"
+         << std::setw(10) << "z" << G4endl;
+
+  G4double chi2 = 0.;
+  G4int ndf = 0;
+  for (G4int bin = 0; bin < RunTally::kNumberOfBins; ++bin) {
+    if (bin >= RunTally::kVDOffset && bin != RunTally::kTotalBin) continue;
+    if (mean[0][bin] <= 0. && mean[1][bin] <= 0.) continue;
+    G4double sigma = std::sqrt(error[0][bin]*error[0][bin]
+                               + error[1][bin]*error[1][bin]);
+    G4double z = (sigma > 0.) ? (mean[1][bin] - mean[0][bin])/sigma : 0.;
+    if (bin != RunTally::kTotalBin && sigma > 0.) {
+      chi2 += z*z;
+      ++ndf;
+    }
+    G4cout << std::setw(14) << RunTally::GetBinName(bin)
+           << std::setw(14) << mean[0][bin] << std::setw(12) << error[0][bin]
+           << std::setw(14) << mean[1][bin] << std::setw(12) << error[1][bin]
+           << std::setw(10)
+           << (mean[0][bin] > 0. ? mean[1][bin]/mean[0][bin] : 0.)
+           << std::setw(10) << z << G4endl;
+  }
+  if (ndf > 0) {
+    G4cout << "### Counters: chi2/ndf " << chi2/ndf << " (" << ndf
+           << " counters)" << G4endl;
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ThermalDiffusion::Print()
+{
+  CollectWorkers();
+  G4cout << "### Thermal diffusion below " << fThermal/eV << " eV:" << G4endl;
+  for (auto& entry : fParameters) {
+    const Parameters& parameters = entry.second;
+    G4double length = (parameters.absorption > 0.)
+      ? std::sqrt(parameters.kappa/parameters.absorption) : 0.;
+    G4cout << "  " << entry.first << ": kappa " << parameters.kappa/(cm2/s)
+           << " cm2/s, absorption " << parameters.absorption*s
+           << " /s (lifetime "
+           << (parameters.absorption > 0. ? 1./parameters.absorption/us : 0.)
+           << " us, diffusion length " << length/cm << " cm) from "
+           << parameters.flights << " flights" << G4endl;
+  }
+  if (fWalks > 0) {
+    G4cout << "  " << fWalks << " walk steps, mean radius "
+           << fDistance/fWalks/cm << " cm, " << fAbsorbed
+           << " absorbed during walks" << G4endl;
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ThermalDiffusion::SetEnabled(G4bool enabled)
+{
+  if (enabled && !CheckScorers()) return;
+  if (enabled && fParameters.empty() && !Load(fFileName)) return;
+  fEnabled = enabled;
+}
+
+G4bool ThermalDiffusion::CheckScorers()
+{
+  // The mesh scorers would only see the analog step before each jump
+  if (!FluenceMesh::IsEnabled() && !ImportanceMap::IsEnabled()) return true;
+  G4ExceptionDescription msg;
+  msg << "The thermal walk does not score the path of its jumps, which "
+      << (FluenceMesh::IsEnabled() ? "FluenceMesh" : "ImportanceMap")
+      << " would under-count; the walk is off.";
+  G4Exception("ThermalDiffusion::CheckScorers()", "NMDS026", JustWarning, msg);
+  fEnabled = false;
+  return false;
+}
+
+void ThermalDiffusion::LoadCommand(const G4String& fileName)
+{
+  Load(fileName);
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ThermalDiffusion::DefineCommands()
+{
+  fMessenger = new G4GenericMessenger(this, "/nmds/diffusion/",
+                                      "Random walk of thermal neutrons");
+
+  fMessenger->DeclarePropertyWithUnit("thermal", "eV", fThermal,
+                                      "Energy below which neutrons walk.");
+  fMessenger->DeclareProperty("calibrate", fCalibrating,
+                              "Measure the walk parameters in analog runs.");
+  fMessenger->DeclareMethod("save", &ThermalDiffusion::Save,
+                            "Write the calibrated parameters.")
+    .SetParameterName("file", false);
+  fMessenger->DeclareMethod("load", &ThermalDiffusion::LoadCommand,
+                            "Read the walk parameters.")
+    .SetParameterName("file", false);
+  fMessenger->DeclarePropertyWithUnit("margin", "cm", fMargin,
+                                      "Distance kept from any boundary.");
+  fMessenger->DeclarePropertyWithUnit("minRadius", "cm", fMinRadius,
+                                      "Smallest walk step.");
+  fMessenger->DeclareMethod("enable", &ThermalDiffusion::SetEnabled,
+                            "Random walk of thermal neutrons in the moderator.");
+
+  auto& validateCmd = fMessenger->DeclareMethod("validate",
+                      &ThermalDiffusion::Validate,
+                      "Compare counters and die-away, analog and walk.");
+  validateCmd.SetParameterName("events", false);
+  validateCmd.SetRange("events>0");
+
+  fMessenger->DeclareMethod("print", &ThermalDiffusion::Print,
+                            "Print the walk parameters and statistics.");
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
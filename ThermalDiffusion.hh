@@ -0,0 +1,133 @@
+#ifndef ThermalDiffusion_h
+#define ThermalDiffusion_h 1
+
+#include "globals.hh"
+#include "G4ThreeVector.hh"
+
+#include <map>
+#include <vector>
+
+class G4Step;
+class G4Material;
+class G4GenericMessenger;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+/// Condensed random walk of thermal neutrons inside the moderator.
+///
+/// Calibration: during analog runs, the thermal neutron steps inside the
+/// moderator volumes give, per material, the diffusivity
+///   kappa = (<l2> + 2 <l>2 mu/(1-mu)) / (6 <t>)
+/// from the free flights between collisions (length l, duration t, mean
+/// cosine mu between successive flights) and the absorption rate, the
+/// absorbed weight over the weight-time spent thermal. These depend on
+/// the physics list (thermal scattering); they are saved to a text file
+/// and loaded from it when enabled.
+///
+/// Walk: after a collision of a thermal neutron in the moderator, the
+/// distance to the nearest boundary (navigator safety, which covers the
+/// counter bores cut in the polyethylene) less a margin is the radius R of
+/// a sphere; when R is large enough, the neutron jumps to a uniform point
+/// on the sphere, after a time drawn from the first-passage distribution
+/// of diffusion from the centre (mean R2/(6 kappa)), with the absorption
+/// over that time played analogously, and leaves isotropically with a
+/// Maxwellian energy at the material temperature. Near boundaries and
+/// counters transport stays analog. Capture gammas of the walk are not
+/// produced.
+///
+/// The path covered by a jump is not scored, so the walk cannot run with
+/// FluenceMesh or ImportanceMap: enabling it with either on is refused,
+/// and a run started with both switches the walk off.
+///
+/// Validate() runs the application source analog and with the walk and
+/// compares the counter tallies, the die-away time and the run times.
+///
+///   /nmds/diffusion/thermal 0.1 eV
+///   /nmds/diffusion/calibrate true
+///   /nmds/diffusion/save diffusion.txt
+///   /nmds/diffusion/load diffusion.txt
+///   /nmds/diffusion/margin 1 cm
+///   /nmds/diffusion/minRadius 2 cm
+///   /nmds/diffusion/enable true
+///   /nmds/diffusion/validate 10000
+///   /nmds/diffusion/print
+
+class ThermalDiffusion
+{
+  public:
+    static ThermalDiffusion* Instance();
+    static ThermalDiffusion* Master();
+    static void CollectWorkers();
+
+    static G4bool IsEnabled()     { return fEnabled; }
+    static G4bool IsCalibrating() { return fCalibrating; }
+
+    // Off, with a warning, when a track-length scorer is on; from
+    // ScoringRunAction at the start of every run
+    static G4bool CheckScorers();
+
+    // Called for every step by ScoringSteppingAction, last
+    void Step(const G4Step* step);
+
+    void Reset();
+    void Merge(const ThermalDiffusion& other);
+
+    G4bool Load(const G4String& fileName);
+    void Save(const G4String& fileName);
+    void Validate(G4int nofEvents);
+    void Print();
+
+  private:
+    ThermalDiffusion(G4bool master);
+    ~ThermalDiffusion();
+
+    // Walk parameters of a material
+    struct Parameters {
+      G4double kappa;        // diffusivity, mm2/ns
+      G4double absorption;   // rate, 1/ns
+      G4double flights;      // weight of the flights measured
+    };
+
+    // Calibration sums of a material (zero when inserted)
+    struct Sums {
+      G4double weight;     // complete flights
+      G4double length;
+      G4double length2;
+      G4double time;
+      G4double pairs;      // successive complete flights
+      G4double cosine;
+      G4double exposure;   // weight x time spent thermal
+      G4double absorbed;
+    };
+
+    void Calibrate(const G4Step* step);
+    void Walk(const G4Step* step, const Parameters& parameters);
+    static G4double SampleFirstPassage();
+
+    void DefineCommands();
+    void SetEnabled(G4bool enabled);
+    void LoadCommand(const G4String& fileName);
+
+    std::map<const G4Material*, Sums> fSums;
+    G4int         fLastTrack;
+    G4ThreeVector fLastDirection;
+    G4long        fWalks;
+    G4long        fAbsorbed;
+    G4double      fDistance;
+
+    // Parameters by material name (master)
+    std::map<G4String, Parameters> fParameters;
+
+    G4GenericMessenger* fMessenger;
+
+    static G4bool   fEnabled;
+    static G4bool   fCalibrating;
+    static G4double fThermal;
+    static G4double fMargin;
+    static G4double fMinRadius;
+    static G4String fFileName;
+};
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+#endif
@@ -0,0 +1,347 @@
+#include "VolumeProfiler.hh"
+
+#include "G4Step.hh"
+#include "G4Track.hh"
+#include "G4VProcess.hh"
+#include "G4LogicalVolume.hh"
+#include "G4VPhysicalVolume.hh"
+#include "G4ParticleDefinition.hh"
+#include "G4AutoLock.hh"
+#include "G4GenericMessenger.hh"
+#include "G4ios.hh"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+
+namespace
+{
+  G4Mutex profilerMutex = G4MUTEX_INITIALIZER;
+  std::vector<VolumeProfiler*>* workers = nullptr;
+}
+
+G4bool VolumeProfiler::fEnabled  = false;
+G4int  VolumeProfiler::fSampling = 100;
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+VolumeProfiler* VolumeProfiler::Instance()
+{
+  static G4ThreadLocal VolumeProfiler* instance = nullptr;
+  if (!instance) {
+    instance = new VolumeProfiler(false);
+    G4AutoLock lock(&profilerMutex);
+    if (!workers) workers = new std::vector<VolumeProfiler*>;
+    workers->push_back(instance);
+  }
+  return instance;
+}
+
+VolumeProfiler* VolumeProfiler::Master()
+{
+  static VolumeProfiler master(true);
+  return &master;
+}
+
+void VolumeProfiler::CollectWorkers()
+{
+  G4AutoLock lock(&profilerMutex);
+  if (!workers) return;
+  VolumeProfiler* master = Master();
+  for (auto worker : *workers) {
+    worker->MergeInto(master->fMergedByParticle, master->fMergedByProcess);
+    worker->Reset();
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+VolumeProfiler::VolumeProfiler(G4bool master)
+ : fLastVolume(nullptr),
+   fLastParticle(nullptr),
+   fLastVolumeIndex(0),
+   fLastParticleIndex(0),
+   fStepCounter(0),
+   fTiming(false),
+   fMessenger(nullptr)
+{
+  if (master) {
+    DefineCommands();
+  }
+  else {
+    fByParticle.resize(kMaxKeys*kMaxKeys);
+    fByProcess.resize(kMaxKeys*kMaxKeys);
+  }
+}
+
+VolumeProfiler::~VolumeProfiler()
+{
+  delete fMessenger;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+G4int VolumeProfiler::Index(std::unordered_map<const void*, G4int>& indices,
+                            std::vector<G4String>& names,
+                            const void* key, const G4String& name)
+{
+  auto it = indices.find(key);
+  if (it != indices.end()) return it->second;
+
+  // Keys beyond the table share the last slot
+  G4int index = (G4int)names.size();
+  if (index >= kMaxKeys - 1) {
+    index = kMaxKeys - 1;
+    if ((G4int)names.size() < kMaxKeys) names.push_back("other");
+  }
+  else {
+    names.push_back(name);
+  }
+  indices[key] = index;
+  return index;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void VolumeProfiler::Step(const G4Step* step)
+{
+  const G4StepPoint* prePoint = step->GetPreStepPoint();
+  const G4LogicalVolume* lv = prePoint->GetPhysicalVolume()->GetLogicalVolume();
+  const G4ParticleDefinition* particle = step->GetTrack()->GetDefinition();
+  const G4VProcess* process = step->GetPostStepPoint()->GetProcessDefinedStep();
+
+  // The same volume and particle usually repeat from step to step
+  if (lv != fLastVolume) {
+    fLastVolume = lv;
+    fLastVolumeIndex = Index(fVolumeIndex, fVolumeNames, lv, lv->GetName());
+  }
+  if (particle != fLastParticle) {
+    fLastParticle = particle;
+    fLastParticleIndex = Index(fParticleIndex, fParticleNames, particle,
+                               particle->GetParticleName());
+  }
+  auto known = fProcessIndex.find(process);
+  G4int ir = (known != fProcessIndex.end()) ? known->second :
+    Index(fProcessIndex, fProcessNames, process,
+          process ? process->GetProcessName() : G4String("none"));
+
+  Entry& byParticle = fByParticle[fLastVolumeIndex*kMaxKeys + fLastParticleIndex];
+  Entry& byProcess  = fByProcess[fLastVolumeIndex*kMaxKeys + ir];
+  ++byParticle.steps;
+  ++byProcess.steps;
+
+  // Time the step following the start of each sampling period
+  G4long phase = fStepCounter++ % fSampling;
+  if (phase == 0 && fTiming) {
+    std::chrono::duration<G4double> elapsed =
+      std::chrono::steady_clock::now() - fStart;
+    G4double time = elapsed.count()*fSampling;
+    byParticle.time += time;
+    byProcess.time  += time;
+    fTiming = false;
+  }
+  if (phase == fSampling - 1) {
+    fStart  = std::chrono::steady_clock::now();
+    fTiming = true;
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void VolumeProfiler::Reset()
+{
+  std::fill(fByParticle.begin(), fByParticle.end(), Entry());
+  std::fill(fByProcess.begin(), fByProcess.end(), Entry());
+  fStepCounter = 0;
+  fTiming = false;
+  fMergedByParticle.clear();
+  fMergedByProcess.clear();
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void VolumeProfiler::MergeInto(std::map<std::string, EntryMap>& byParticle,
+                               std::map<std::string, EntryMap>& byProcess) const
+{
+  for (std::size_t iv = 0; iv < fVolumeNames.size(); ++iv) {
+    for (std::size_t ip = 0; ip < fParticleNames.size(); ++ip) {
+      const Entry& entry = fByParticle[iv*kMaxKeys + ip];
+      if (entry.steps == 0) continue;
+      Entry& merged = byParticle[fVolumeNames[iv]][fParticleNames[ip]];
+      merged.steps += entry.steps;
+      merged.time  += entry.time;
+    }
+    for (std::size_t ir = 0; ir < fProcessNames.size(); ++ir) {
+      const Entry& entry = fByProcess[iv*kMaxKeys + ir];
+      if (entry.steps == 0) continue;
+      Entry& merged = byProcess[fVolumeNames[iv]][fProcessNames[ir]];
+      merged.steps += entry.steps;
+      merged.time  += entry.time;
+    }
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void VolumeProfiler::Print() const
+{
+  // Volume totals, most expensive first
+  std::vector<std::pair<std::string, Entry> > volumes;
+  G4long totalSteps = 0;
+  G4double totalTime = 0.;
+  for (const auto& volume : fMergedByParticle) {
+    Entry sum;
+    for (const auto& particle : volume.second) {
+      sum.steps += particle.second.steps;
+      sum.time  += particle.second.time;
+    }
+    totalSteps += sum.steps;
+    totalTime  += sum.time;
+    volumes.push_back(std::make_pair(volume.first, sum));
+  }
+  std::sort(volumes.begin(), volumes.end(),
+            [](const std::pair<std::string, Entry>& a,
+               const std::pair<std::string, Entry>& b)
+            { return a.second.time > b.second.time; });
+
+  G4cout << G4endl
+         << "--------------------- Step profile per volume --------------------"
+         << G4endl
+         << "  volume            steps   steps %     time [s]   time %"
+         << G4endl;
+  for (const auto& volume : volumes) {
+    G4cout << "  " << std::left << std::setw(14) << volume.first << std::right
+           << std::setw(12) << volume.second.steps
+           << std::setw(9) << std::setprecision(3)
+           << (totalSteps ? 100.*volume.second.steps/totalSteps : 0.)
+           << std::setw(13) << volume.second.time
+           << std::setw(9)
+           << (totalTime > 0. ? 100.*volume.second.time/totalTime : 0.)
+           << std::setprecision(6) << G4endl;
+
+    // Most stepping particle and process in this volume
+    for (const auto* table : { &fMergedByParticle, &fMergedByProcess }) {
+      const EntryMap& entries = table->at(volume.first);
+      auto top = std::max_element(entries.begin(), entries.end(),
+        [](const EntryMap::value_type& a, const EntryMap::value_type& b)
+        { return a.second.steps < b.second.steps; });
+      if (top == entries.end()) continue;
+      G4cout << "      top " << (table == &fMergedByParticle ? "particle " :
+                                                               "process  ")
+             << std::left << std::setw(16) << top->first << std::right
+             << std::setw(12) << top->second.steps << G4endl;
+    }
+  }
+  G4cout << "  total " << totalSteps << " steps, " << totalTime
+         << " s sampled (1/" << fSampling << " steps timed)" << G4endl
+         << "-----------------------------------------------------------------"
+         << G4endl;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void VolumeProfiler::WriteCSV(const G4String& fileName) const
+{
+  std::ofstream out(fileName);
+  if (!out) {
+    G4ExceptionDescription msg;
+    msg << "Cannot open " << fileName;
+    G4Exception("VolumeProfiler::WriteCSV()", "NMDS007", JustWarning, msg);
+    return;
+  }
+  out << "volume,kind,name,steps,time_s\n";
+  for (const auto& volume : fMergedByParticle) {
+    for (const auto& entry : volume.second) {
+      out << volume.first << ",particle," << entry.first << ','
+          << entry.second.steps << ',' << entry.second.time << '\n';
+    }
+  }
+  for (const auto& volume : fMergedByProcess) {
+    for (const auto& entry : volume.second) {
+      out << volume.first << ",process," << entry.first << ','
+          << entry.second.steps << ',' << entry.second.time << '\n';
+    }
+  }
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void VolumeProfiler::WriteJSON(const G4String& fileName) const
+{
+  std::ofstream out(fileName);
+  if (!out) {
+    G4ExceptionDescription msg;
+    msg << "Cannot open " << fileName;
+    G4Exception("VolumeProfiler::WriteJSON()", "NMDS007", JustWarning, msg);
+    return;
+  }
+
+  auto writeEntries = [&out](const EntryMap& entries) {
+    G4bool first = true;
+    for (const auto& entry : entries) {
+      out << (first ? "" : ",") << "\n      \"" << entry.first
+          << "\": {\"steps\": " << entry.second.steps
+          << ", \"time_s\": " << entry.second.time << "}";
+      first = false;
+    }
+  };
+
+  out << "{\n  \"sampling\": " << fSampling << ",\n  \"volumes\": {";
+  G4bool first = true;
+  for (const auto& volume : fMergedByParticle) {
+    out << (first ? "" : ",") << "\n    \"" << volume.first << "\": {"
+        << "\n     \"particles\": {";
+    writeEntries(volume.second);
+    out << "},\n     \"processes\": {";
+    auto processes = fMergedByProcess.find(volume.first);
+    if (processes != fMergedByProcess.end()) writeEntries(processes->second);
+    out << "}}";
+    first = false;
+  }
+  out << "\n  }\n}\n";
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void VolumeProfiler::CollectAndPrint()
+{
+  CollectWorkers();
+  Print();
+}
+
+void VolumeProfiler::CollectAndWriteCSV(const G4String& fileName)
+{
+  CollectWorkers();
+  WriteCSV(fileName);
+}
+
+void VolumeProfiler::CollectAndWriteJSON(const G4String& fileName)
+{
+  CollectWorkers();
+  WriteJSON(fileName);
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void VolumeProfiler::DefineCommands()
+{
+  fMessenger = new G4GenericMessenger(this, "/nmds/profiler/",
+                                      "Step and time profile per volume");
+
+  fMessenger->DeclareProperty("enable", fEnabled,
+                              "Profile every step.");
+
+  auto& samplingCmd = fMessenger->DeclareProperty("sampling", fSampling,
+                                  "Time one step out of this many.");
+  samplingCmd.SetParameterName("sampling", false);
+  samplingCmd.SetRange("sampling>0");
+
+  fMessenger->DeclareMethod("print", &VolumeProfiler::CollectAndPrint,
+                            "Merge the thread profiles and print them.");
+  fMessenger->DeclareMethod("csv", &VolumeProfiler::CollectAndWriteCSV,
+                            "Merge the thread profiles and write CSV.");
+  fMessenger->DeclareMethod("json", &VolumeProfiler::CollectAndWriteJSON,
+                            "Merge the thread profiles and write JSON.");
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......